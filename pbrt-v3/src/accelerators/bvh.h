@@ -41,15 +41,22 @@
 // accelerators/bvh.h*
 #include "pbrt.h"
 #include "primitive.h"
+#include "bfptriangle.h"
 #include <atomic>
 
 namespace pbrt {
 struct BVHBuildNode;
+class MappedFile;
 
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 struct MortonPrimitive;
 struct LinearBVHNode;
+template <int N>
+struct WideBVHNode;
+template <typename T>
+struct QuantizedBVHNode;
+struct BatchRay;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
@@ -60,17 +67,25 @@ class BVHAccel : public Aggregate {
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH,
+             bool bfpLeaves = false, int width = 2, int quantizedBits = 0,
+             const std::string &cacheDir = "");
     Bounds3f WorldBound() const;
     ~BVHAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void Intersect(RayBatch &batch) const;
+    // The tree's cache file (empty without a cache directory) and whether
+    // the tree was loaded from it
+    const std::string &CacheFile() const { return cacheFile; }
+    bool LoadedFromCache() const { return loadedFromCache; }
 
   private:
     // BVHAccel Private Methods
     BVHBuildNode *recursiveBuild(
-        MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
-        int start, int end, int *totalNodes,
+        std::vector<MemoryArena> &threadArenas,
+        std::vector<BVHPrimitiveInfo> &primitiveInfo, int start, int end,
+        std::atomic<int> *totalNodes,
         std::vector<std::shared_ptr<Primitive>> &orderedPrims);
     BVHBuildNode *HLBVHBuild(
         MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
@@ -85,13 +100,67 @@ class BVHAccel : public Aggregate {
     BVHBuildNode *buildUpperSAH(MemoryArena &arena,
                                 std::vector<BVHBuildNode *> &treeletRoots,
                                 int start, int end, int *totalNodes) const;
-    int flattenBVHTree(BVHBuildNode *node, int *offset);
+    Float flattenBVHTree(BVHBuildNode *node, int offset);
+    // Tree cache files: the flattened nodes and the order of the
+    // primitives. loadCache() returns the number of nodes, 0 if the file
+    // does not exist or does not match _key_.
+    int loadCache(const std::string &filename, uint64_t key);
+    void writeCache(const std::string &filename, uint64_t key, int totalNodes,
+                    const std::vector<std::shared_ptr<Primitive>> &unordered)
+        const;
+    void buildBfpLeaves();
+    // Replaces _nodes_ with nodes whose bounds are quantized to _T_
+    template <typename T>
+    void quantizeNodes(int totalNodes,
+                       std::vector<QuantizedBVHNode<T>> *qNodes);
+    // Batched traversal of the binary tree: ranged packets when all rays
+    // share their direction signs, ray stream filtering otherwise
+    void intersectPacket(RayBatch &batch,
+                         const std::vector<BatchRay> &info) const;
+    void intersectStream(RayBatch &batch,
+                         const std::vector<BatchRay> &info) const;
+    void intersectLeaf(RayBatch &batch, int rayIndex, const BatchRay &info,
+                       int nodeIndex) const;
+    // Traversal of the 4- or 8-wide nodes; _isect_ nullptr for shadow rays
+    template <int N>
+    bool intersectWide(const std::vector<WideBVHNode<N>> &wide,
+                       const Ray &ray, SurfaceInteraction *isect) const;
+    // Traversal of the quantized nodes; _isect_ nullptr for shadow rays
+    template <typename T>
+    bool intersectQuantized(const std::vector<QuantizedBVHNode<T>> &qNodes,
+                            const Ray &ray, SurfaceInteraction *isect) const;
+    // bit i set: the ray certainly misses primitive i of leaf _nodeIndex_;
+    // _r_ is set up for _ray_ the first time a leaf has a block
+    uint32_t bfpMisses(int nodeIndex, const Ray &ray, BfpRay *r) const {
+        if (bfpLeafIndex.empty() || bfpLeafIndex[nodeIndex] < 0) return 0;
+        if (!r->Initialized()) r->Init(ray);
+        return bfpLeaves[bfpLeafIndex[nodeIndex]].Misses(ray, *r);
+    }
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<std::shared_ptr<Primitive>> primitives;
+    Bounds3f bounds;
     LinearBVHNode *nodes = nullptr;
+    // When loaded from the cache, _nodes_ points into this read-only mapping
+    std::unique_ptr<MappedFile> nodeFile;
+    std::string cacheFile;
+    bool loadedFromCache = false;
+    // per node: index into _bfpLeaves_, -1 for interior nodes and leaves
+    // that are not all triangles; empty when the BFP leaf test is off
+    std::vector<int> bfpLeafIndex;
+    std::vector<BfpTriangleBlock> bfpLeaves;
+    // Collapsed copies of the tree for _width_ 4 or 8; leaves stay in
+    // _nodes_
+    int width;
+    std::vector<WideBVHNode<4>> wideNodes4;
+    std::vector<WideBVHNode<8>> wideNodes8;
+    // With _quantizedBits_ 8 or 16, the tree is stored in one of these
+    // instead of _nodes_, which is freed
+    int quantizedBits;
+    std::vector<QuantizedBVHNode<uint8_t>> quantizedNodes8;
+    std::vector<QuantizedBVHNode<uint16_t>> quantizedNodes16;
 };
 
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
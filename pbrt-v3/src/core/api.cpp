@@ -34,6 +34,7 @@
 #include "api.h"
 #include "parallel.h"
 #include "paramset.h"
+#include "parser.h"
 #include "spectrum.h"
 #include "scene.h"
 #include "film.h"
@@ -59,6 +60,7 @@
 #include "integrators/path.h"
 #include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "integrators/whitted.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
@@ -116,6 +118,7 @@
 #include "media/homogeneous.h"
 
 #include <map>
+#include <set>
 #include <stdio.h>
 
 namespace pbrt {
@@ -371,12 +374,39 @@ static std::vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
 int catIndentCount = 0;
 
+// With --parallelparse, static shapes are recorded as they are parsed and
+// created together on worker threads once the scene needs them. Primitives
+// and lights that are ready earlier are queued behind them, so that the
+// scene receives everything in the same order as without the option.
+struct PendingShape {
+    // Shape creation parameters; _name_ is empty for queued results
+    std::string name;
+    ParamSet params;
+    Transform *ObjToWorld = nullptr, *WorldToObj = nullptr;
+    bool reverseOrientation = false;
+    std::shared_ptr<GraphicsState::FloatTextureMap> floatTextures;
+    std::shared_ptr<Material> mtl;
+    MediumInterface mi;
+    std::string areaLight;
+    ParamSet areaLightParams;
+
+    std::vector<std::shared_ptr<Primitive>> *destination = nullptr;
+    std::vector<std::shared_ptr<Shape>> shapes;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    std::vector<std::shared_ptr<Light>> lights;
+};
+
+static std::vector<PendingShape> pendingShapes;
+static std::set<const std::vector<std::shared_ptr<Primitive>> *>
+    pendingInstances;
+STAT_COUNTER("Scene/Shapes created in parallel", nDeferredShapes);
+static WorldEndCallback worldEndCallback;
+
 // API Forward Declarations
-std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
-                                               const Transform *ObjectToWorld,
-                                               const Transform *WorldToObject,
-                                               bool reverseOrientation,
-                                               const ParamSet &paramSet);
+std::vector<std::shared_ptr<Shape>> MakeShapes(
+    const std::string &name, const Transform *ObjectToWorld,
+    const Transform *WorldToObject, bool reverseOrientation,
+    const ParamSet &paramSet, GraphicsState::FloatTextureMap *floatTextures);
 
 // API Macros
 #define VERIFY_INITIALIZED(func)                           \
@@ -423,11 +453,10 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
     } while (false) /* swallow trailing semicolon */
 
 // Object Creation Function Definitions
-std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
-                                               const Transform *object2world,
-                                               const Transform *world2object,
-                                               bool reverseOrientation,
-                                               const ParamSet &paramSet) {
+std::vector<std::shared_ptr<Shape>> MakeShapes(
+    const std::string &name, const Transform *object2world,
+    const Transform *world2object, bool reverseOrientation,
+    const ParamSet &paramSet, GraphicsState::FloatTextureMap *floatTextures) {
     std::vector<std::shared_ptr<Shape>> shapes;
     std::shared_ptr<Shape> s;
     if (name == "sphere")
@@ -514,10 +543,10 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
         } else
             shapes = CreateTriangleMeshShape(object2world, world2object,
                                              reverseOrientation, paramSet,
-                                             &*graphicsState.floatTextures);
+                                             floatTextures);
     } else if (name == "plymesh")
         shapes = CreatePLYMesh(object2world, world2object, reverseOrientation,
-                               paramSet, &*graphicsState.floatTextures);
+                               paramSet, floatTextures);
     else if (name == "heightfield")
         shapes = CreateHeightfield(object2world, world2object,
                                    reverseOrientation, paramSet);
@@ -698,28 +727,57 @@ std::shared_ptr<Medium> MakeMedium(const std::string &name,
     if (name == "homogeneous") {
         m = new HomogeneousMedium(sig_a, sig_s, g);
     } else if (name == "heterogeneous") {
-        int nitems;
-        const Float *data = paramSet.FindFloat("density", &nitems);
-        if (!data) {
-            Error("No \"density\" values provided for heterogeneous medium?");
-            return NULL;
-        }
         int nx = paramSet.FindOneInt("nx", 1);
         int ny = paramSet.FindOneInt("ny", 1);
         int nz = paramSet.FindOneInt("nz", 1);
         Point3f p0 = paramSet.FindOnePoint3f("p0", Point3f(0.f, 0.f, 0.f));
         Point3f p1 = paramSet.FindOnePoint3f("p1", Point3f(1.f, 1.f, 1.f));
-        if (nitems != nx * ny * nz) {
-            Error(
-                "GridDensityMedium has %d density values; expected nx*ny*nz = "
-                "%d",
-                nitems, nx * ny * nz);
-            return NULL;
+        std::string encodingName = paramSet.FindOneString("encoding", "float");
+        BrickedDensity::Encoding encoding;
+        if (encodingName == "float")
+            encoding = BrickedDensity::Encoding::Float;
+        else if (encodingName == "fixed16")
+            encoding = BrickedDensity::Encoding::Fixed16;
+        else if (encodingName == "fixed8")
+            encoding = BrickedDensity::Encoding::Fixed8;
+        else if (encodingName == "bfp")
+            encoding = BrickedDensity::Encoding::Bfp;
+        else {
+            Warning("Density encoding \"%s\" unknown. Using \"float\".",
+                    encodingName.c_str());
+            encoding = BrickedDensity::Encoding::Float;
+        }
+        int bits = paramSet.FindOneInt("bfpmantissa", 8);
+        if (bits < 1 || bits > 16) {
+            Warning("\"bfpmantissa\" %d out of range [1, 16]. Clamping.", bits);
+            bits = Clamp(bits, 1, 16);
+        }
+        BrickedDensity density(nx, ny, nz, encoding, bits);
+
+        // Stream samples from "densityfile" or take them from "density"
+        std::string densityFile = paramSet.FindOneFilename("densityfile", "");
+        if (!densityFile.empty()) {
+            if (!ReadDensityFile(densityFile, &density)) return NULL;
+        } else {
+            int nitems;
+            const Float *data = paramSet.FindFloat("density", &nitems);
+            if (!data) {
+                Error("No \"density\" values provided for heterogeneous medium?");
+                return NULL;
+            }
+            if (nitems != nx * ny * nz) {
+                Error(
+                    "GridDensityMedium has %d density values; expected nx*ny*nz = "
+                    "%d",
+                    nitems, nx * ny * nz);
+                return NULL;
+            }
+            density.AddSlabs(data);
         }
         Transform data2Medium = Translate(Vector3f(p0)) *
                                 Scale(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
-        m = new GridDensityMedium(sig_a, sig_s, g, nx, ny, nz,
-                                  medium2world * data2Medium, data);
+        m = new GridDensityMedium(sig_a, sig_s, g, medium2world * data2Medium,
+                                  std::move(density));
     } else
         Warning("Medium \"%s\" unknown.", name.c_str());
     paramSet.ReportUnused();
@@ -867,6 +925,105 @@ Film *MakeFilm(const std::string &name, const ParamSet &paramSet,
     return film;
 }
 
+static void addPendingToScene(PendingShape &entry) {
+    std::vector<std::shared_ptr<Primitive>> &dest = *entry.destination;
+    dest.insert(dest.end(), entry.prims.begin(), entry.prims.end());
+    if (entry.lights.empty()) return;
+    if (entry.destination != &renderOptions->primitives)
+        Warning("Area lights not supported with object instancing");
+    else
+        renderOptions->lights.insert(renderOptions->lights.end(),
+                                     entry.lights.begin(), entry.lights.end());
+}
+
+// Creates the shapes recorded in _pendingShapes_ in parallel, then adds
+// their primitives and everything queued behind them to the scene in order
+static void createPendingShapes() {
+    if (pendingShapes.empty()) return;
+    // Creation no longer happens at the parser's location
+    Loc *loc = parserLoc;
+    parserLoc = nullptr;
+    ParallelFor([&](int64_t i) {
+        PendingShape &pending = pendingShapes[i];
+        if (pending.name.empty()) return;
+        pending.shapes =
+            MakeShapes(pending.name, pending.ObjToWorld, pending.WorldToObj,
+                       pending.reverseOrientation, pending.params,
+                       pending.floatTextures.get());
+        pending.params.ReportUnused();
+        ++nDeferredShapes;
+        if (pending.areaLight != "") return;
+        pending.prims.reserve(pending.shapes.size());
+        for (const auto &s : pending.shapes)
+            pending.prims.push_back(std::make_shared<GeometricPrimitive>(
+                s, pending.mtl, nullptr, pending.mi));
+    }, pendingShapes.size(), 1);
+    parserLoc = loc;
+
+    for (PendingShape &pending : pendingShapes) {
+        if (pending.areaLight != "") {
+            // Create area lights for shapes in order
+            pending.prims.reserve(pending.shapes.size());
+            for (const auto &s : pending.shapes) {
+                std::shared_ptr<AreaLight> area = MakeAreaLight(
+                    pending.areaLight, *pending.ObjToWorld, pending.mi,
+                    pending.areaLightParams, s);
+                if (area) pending.lights.push_back(area);
+                pending.prims.push_back(std::make_shared<GeometricPrimitive>(
+                    s, pending.mtl, area, pending.mi));
+            }
+        }
+        addPendingToScene(pending);
+    }
+    pendingShapes.clear();
+    pendingInstances.clear();
+}
+
+// Adds _prims_ and _lights_ to the scene or the current instance, after
+// anything still waiting in _pendingShapes_
+static void addToScene(std::vector<std::shared_ptr<Primitive>> prims,
+                       std::vector<std::shared_ptr<Light>> lights) {
+    PendingShape entry;
+    entry.destination = renderOptions->currentInstance
+                            ? renderOptions->currentInstance
+                            : &renderOptions->primitives;
+    entry.prims = std::move(prims);
+    entry.lights = std::move(lights);
+    if (pendingShapes.empty())
+        addPendingToScene(entry);
+    else
+        pendingShapes.push_back(std::move(entry));
+}
+
+static void deferShape(const std::string &name, const ParamSet &params,
+                       Transform *ObjToWorld, Transform *WorldToObj) {
+    PendingShape pending;
+    pending.name = name;
+    pending.params = params;
+    pending.ObjToWorld = ObjToWorld;
+    pending.WorldToObj = WorldToObj;
+    pending.reverseOrientation = graphicsState.reverseOrientation;
+    // Shapes only look up their alpha textures, so those are all that is
+    // kept of the current float textures
+    pending.floatTextures =
+        std::make_shared<GraphicsState::FloatTextureMap>();
+    for (const char *alpha : {"alpha", "shadowalpha"}) {
+        auto iter = graphicsState.floatTextures->find(params.FindTexture(alpha));
+        if (iter != graphicsState.floatTextures->end())
+            pending.floatTextures->insert(*iter);
+    }
+    pending.mtl = graphicsState.GetMaterialForShape(params);
+    pending.mi = graphicsState.CreateMediumInterface();
+    pending.areaLight = graphicsState.areaLight;
+    pending.areaLightParams = graphicsState.areaLightParams;
+    pending.destination = renderOptions->currentInstance
+                              ? renderOptions->currentInstance
+                              : &renderOptions->primitives;
+    if (renderOptions->currentInstance)
+        pendingInstances.insert(renderOptions->currentInstance);
+    pendingShapes.push_back(std::move(pending));
+}
+
 // API Function Definitions
 void pbrtInit(const Options &opt) {
     PbrtOptions = opt;
@@ -880,6 +1037,8 @@ void pbrtInit(const Options &opt) {
 
     // General \pbrt Initialization
     SampledSpectrum::Init();
+    textureCache.SetBudget(size_t(std::max(PbrtOptions.textureCacheMB, 1))
+                           << 20);
     ParallelInit();  // Threads must be launched before the profiler is
                      // initialized.
     InitProfiler();
@@ -1307,7 +1466,7 @@ void pbrtLightSource(const std::string &name, const ParamSet &params) {
     if (!lt)
         Error("LightSource: light type \"%s\" unknown.", name.c_str());
     else
-        renderOptions->lights.push_back(lt);
+        addToScene({}, {lt});
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sLightSource \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
@@ -1342,9 +1501,15 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         // Create shapes for shape _name_
         Transform *ObjToWorld = transformCache.Lookup(curTransform[0]);
         Transform *WorldToObj = transformCache.Lookup(Inverse(curTransform[0]));
+        if (PbrtOptions.parallelParse && !PbrtOptions.cat &&
+            !PbrtOptions.toPly) {
+            deferShape(name, params, ObjToWorld, WorldToObj);
+            return;
+        }
         std::vector<std::shared_ptr<Shape>> shapes =
             MakeShapes(name, ObjToWorld, WorldToObj,
-                       graphicsState.reverseOrientation, params);
+                       graphicsState.reverseOrientation, params,
+                       &*graphicsState.floatTextures);
         if (shapes.empty()) return;
         std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
         params.ReportUnused();
@@ -1371,7 +1536,8 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
                 "animated shape");
         Transform *identity = transformCache.Lookup(Transform());
         std::vector<std::shared_ptr<Shape>> shapes = MakeShapes(
-            name, identity, identity, graphicsState.reverseOrientation, params);
+            name, identity, identity, graphicsState.reverseOrientation, params,
+            &*graphicsState.floatTextures);
         if (shapes.empty()) return;
 
         // Create _GeometricPrimitive_(s) for animated shape
@@ -1404,18 +1570,8 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
             prims[0], animatedObjectToWorld);
     }
     // Add _prims_ and _areaLights_ to scene or current instance
-    if (renderOptions->currentInstance) {
-        if (areaLights.size())
-            Warning("Area lights not supported with object instancing");
-        renderOptions->currentInstance->insert(
-            renderOptions->currentInstance->end(), prims.begin(), prims.end());
-    } else {
-        renderOptions->primitives.insert(renderOptions->primitives.end(),
-                                         prims.begin(), prims.end());
-        if (areaLights.size())
-            renderOptions->lights.insert(renderOptions->lights.end(),
-                                         areaLights.begin(), areaLights.end());
-    }
+    addToScene(std::move(prims), std::vector<std::shared_ptr<Light>>(
+                                     areaLights.begin(), areaLights.end()));
 }
 
 // Attempt to determine if the ParamSet for a shape may provide a value for
@@ -1561,6 +1717,7 @@ void pbrtObjectInstance(const std::string &name) {
     }
     std::vector<std::shared_ptr<Primitive>> &in =
         renderOptions->instances[name];
+    if (pendingInstances.count(&in)) createPendingShapes();
     if (in.empty()) return;
     ++nObjectInstancesUsed;
     if (in.size() > 1) {
@@ -1584,7 +1741,11 @@ void pbrtObjectInstance(const std::string &name) {
         InstanceToWorld[1], renderOptions->transformEndTime);
     std::shared_ptr<Primitive> prim(
         std::make_shared<TransformedPrimitive>(in[0], animatedInstanceToWorld));
-    renderOptions->primitives.push_back(prim);
+    addToScene({prim}, {});
+}
+
+void pbrtSetWorldEndCallback(WorldEndCallback callback) {
+    worldEndCallback = std::move(callback);
 }
 
 void pbrtWorldEnd() {
@@ -1603,7 +1764,11 @@ void pbrtWorldEnd() {
     // Create scene and render
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
+    } else if (worldEndCallback) {
+        createPendingShapes();
+        worldEndCallback(renderOptions->primitives, renderOptions->lights);
     } else {
+        createPendingShapes();
         std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
         std::unique_ptr<Scene> scene(renderOptions->MakeScene());
 
@@ -1681,6 +1846,9 @@ Integrator *RenderOptions::MakeIntegrator() const {
             CreateDirectLightingIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "path")
         integrator = CreatePathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "wavefront")
+        integrator =
+            CreateWavefrontIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "volpath")
         integrator = CreateVolPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "bdpt") {
@@ -1696,6 +1864,13 @@ Integrator *RenderOptions::MakeIntegrator() const {
         return nullptr;
     }
 
+    SamplerIntegrator *samplerIntegrator =
+        dynamic_cast<SamplerIntegrator *>(integrator);
+    if (samplerIntegrator)
+        samplerIntegrator->SetAdaptiveSampling(
+            IntegratorParams.FindOneFloat("adaptivethreshold", 0),
+            IntegratorParams.FindOneFloat("timebudget", 0));
+
     if (renderOptions->haveScatteringMedia && IntegratorName != "volpath" &&
         IntegratorName != "bdpt" && IntegratorName != "mlt") {
         Warning(
@@ -40,6 +40,7 @@
 
 // core/api.h*
 #include "pbrt.h"
+#include <functional>
 
 namespace pbrt {
 
@@ -91,6 +92,14 @@ void pbrtWorldEnd();
 void pbrtParseFile(std::string filename);
 void pbrtParseString(std::string str);
 
+// While a callback is set, pbrtWorldEnd() hands it the scene's primitives
+// and lights, in the order the scene description created them, instead of
+// rendering; tests use this to inspect what the parser built.
+typedef std::function<void(const std::vector<std::shared_ptr<Primitive>> &,
+                           const std::vector<std::shared_ptr<Light>> &)>
+    WorldEndCallback;
+void pbrtSetWorldEndCallback(WorldEndCallback callback);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_API_H
@@ -1,55 +1,514 @@
 #ifndef PBRT_BFP_BFPBLOCK_H
 #define PBRT_BFP_BFPBLOCK_H
 
+#include <algorithm>
+#include <type_traits>
+
 #include "bfpnum.h"
 
 namespace pbrt {
+/* kernels */
+// Format-independent building blocks shared by every BfpBlock
+// instantiation; bfpblock.cpp dispatches them to the widest kernel set
+// (bfpkernels.h) the CPU supports. Mantissas are widened to 64-bit "wide"
+// magnitudes, and the kernels may process up to the next multiple of 4
+// elements, so callers pad their arrays.
+
+// wide[i] = |(+-a[i] << tempShift >> shiftA) + (+-b[i] << tempShift >>
+// shiftB)|, returns the signs of the sums as a bitmask
+uint64_t BfpAlignedSum(const uint16_t *a, uint64_t signA, int shiftA,
+                       const uint16_t *b, uint64_t signB, int shiftB,
+                       int tempShift, uint32_t n, uint64_t *wide);
+uint64_t BfpAlignedSum(const uint32_t *a, uint64_t signA, int shiftA,
+                       const uint32_t *b, uint64_t signB, int shiftB,
+                       int tempShift, uint32_t n, uint64_t *wide);
+// wide[i] = a[i] * b[i]
+void BfpMultiply(const uint16_t *a, const uint16_t *b, uint32_t n,
+                 uint64_t *wide);
+void BfpMultiply(const uint32_t *a, const uint32_t *b, uint32_t n,
+                 uint64_t *wide);
+uint64_t BfpOrReduce(const uint64_t *wide, uint32_t n);
+// mant[i] = wide[i] >> point rounded to nearest even (wide[i] << -point for
+// point <= 0), returns the OR of the unpacked results
+uint64_t BfpRoundToMant(const uint64_t *wide, uint32_t n, int point,
+                        uint16_t *mant);
+uint64_t BfpRoundToMant(const uint64_t *wide, uint32_t n, int point,
+                        uint32_t *mant);
+
+// MantBits: stored mantissa bits (implicit 1 excluded), ExpBits: shared
+// exponent bits, BlockSize: element capacity. Blocks are fixed-capacity so
+// no arithmetic function allocates.
+template <int MantBits, int ExpBits, int BlockSize>
 class BfpBlock {
   public:
-    BfpBlock() : commonExp(0), blockSize(0){};
-    BfpBlock(std::vector<double> x);
+    // wide intermediate results (products, aligned sums) have to fit in 62
+    // bits, and the signs in one 64-bit mask
+    static_assert(MantBits >= 1 && MantBits <= 30,
+                  "MantBits is too long for the 32-bit mantissa word!");
+    static_assert(ExpBits >= 2 && ExpBits <= 11,
+                  "ExpBits is too long for double!");
+    static_assert(BlockSize >= 1 && BlockSize <= 64,
+                  "BlockSize does not fit the sign mask!");
+
+    // mantissa word: implicit 1 + MantBits bits
+    typedef typename std::conditional<MantBits <= 15, uint16_t, uint32_t>::type
+        Mant;
+    static constexpr int MantLength = MantBits, ExpLength = ExpBits;
+    static constexpr int Bias = (1 << (ExpBits - 1)) - 1;
+    static constexpr int MaxExp = (1 << ExpBits) - 1;
+    // sign + carry + implicit1 + mantissa + TempShift = 64
+    static constexpr int TempShift = 61 - MantBits;
+    // storage is padded to the widest SIMD kernel (4 x 64-bit lanes)
+    static constexpr int Capacity = (BlockSize + 3) & ~3;
+
+    BfpBlock() : commonExp(0), blockSize(0), signBits(0) { Clear(); };
+    BfpBlock(const double *x, uint32_t n);
+    BfpBlock(const std::vector<double> &x) : BfpBlock(x.data(), x.size()){};
 
     /*element-wise matrix arithmetic functions*/
-    BfpBlock Add1D(BfpBlock b);
-    BfpBlock Sub1D(BfpBlock b);
-    BfpBlock Mult1D(BfpBlock b);
-    BfpBlock Div1D(BfpBlock b);
-    BfpBlock Add2D(BfpBlock b);
-    BfpBlock Sub2D(BfpBlock b);
-    BfpBlock Mult2D(BfpBlock b);
-    BfpBlock Div2D(BfpBlock b);
+    BfpBlock Add1D(const BfpBlock &b) const;
+    BfpBlock Sub1D(const BfpBlock &b) const;
+    BfpBlock Mult1D(const BfpBlock &b) const;
+    BfpBlock Div1D(const BfpBlock &b) const;
 
     /* scalar-matrix arithmetic functions*/
-    BfpBlock AddScalar1D(double scalar);
-    BfpBlock SubScalar1D(double scalar, bool isScalarFirst);
-    BfpBlock MultScalar1D(double scalar);
-    BfpBlock DivScalar1D(double scalar, bool isScalarFirst);
-    BfpBlock AddScalar2D(double scalar);
-    BfpBlock SubScalar2D(double scalar);
-    BfpBlock MultScalar2D(double scalar);
-    BfpBlock DivScalar2D(double scalar);
+    BfpBlock AddScalar1D(double scalar) const;
+    BfpBlock SubScalar1D(double scalar, bool isScalarFirst) const;
+    BfpBlock MultScalar1D(double scalar) const;
+    BfpBlock DivScalar1D(double scalar, bool isScalarFirst) const;
 
     /* Matrix Multiplication */
-    BfpBlock MatrixMult(BfpBlock b);
+    // this block is a row-major (blockSize / n) x n matrix, b is n x
+    // (b.blockSize / n)
+    BfpBlock MatrixMult(const BfpBlock &b, uint32_t n) const;
 
     /* compare functions */
-    BfpNum Max();
-    BfpNum Min();
+    BfpNum Max() const;
+    BfpNum Min() const;
     void Swap(BfpBlock *b);
 
+    /* exponent alignment */
+    // truncates the mantissas so the block uses the (not smaller) exponent
+    // exp, e.g. to share one exponent between several blocks
+    void Align(uint16_t exp);
+
+    /* element access */
+    uint16_t Sign(int i) const { return (uint16_t)((signBits >> i) & 1); }
+    void SetSign(int i, uint16_t s) {
+        signBits = (signBits & ~((uint64_t)1 << i)) | ((uint64_t)s << i);
+    }
+    double Get(int i) const {
+        double v = std::ldexp((double)mant[i],
+                              (int)commonExp - Bias - MantBits);
+        return Sign(i) ? -v : v;
+    }
+
     /* print functions */
-    void PrintBitwise();
+    void PrintBitwise() const;
 
-    std::vector<double> ToFloatingPoint();
+    void ToFloatingPoint(double *x) const;
+    std::vector<double> ToFloatingPoint() const;
+
+  private:
+    static uint64_t LowMask(uint32_t n) {
+        return n >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+    }
+    // w >> point (w << -point for point <= 0) rounded to nearest even
+    // like BfpRoundToMant(); results too long for a mantissa come back as
+    // MaxMant() + 1
+    static uint64_t MaxMant() { return LowMask(MantBits + 1); }
+    static uint64_t RoundWide(uint64_t w, int point) {
+        if (point <= 0)
+            return -point < 64 && w <= (MaxMant() >> -point) ? w << -point
+                                                              : MaxMant() + 1;
+        if (point >= 64) return 0;
+        uint64_t half = ((uint64_t)1 << (point - 1)) - 1;
+        uint64_t r = (w + half + ((w >> point) & 1)) >> point;
+        return std::min(r, MaxMant() + 1);
+    }
+    static BfpBlock Broadcast(double scalar, uint32_t n);
+    void Clear() { std::fill(mant, mant + Capacity, (Mant)0); }
+    void Normalize(const uint64_t *wide, uint64_t wideSign, int wideExp);
 
   public:
     uint16_t commonExp;
-    std::vector<uint16_t> sign;
-    std::vector<uint64_t>
-        mant;  // unsigned fixed point Q 1.23 or Q. 1.52 or custom
-
     uint32_t blockSize;
+    uint64_t signBits;  // bit i set: element i is negative
+
+    // unsigned fixed point Q 1.MantBits; elements past blockSize are always
+    // zero so kernels can run on whole SIMD vectors
+#ifdef PBRT_HAVE_ALIGNAS
+    alignas(32)
+#endif  // PBRT_HAVE_ALIGNAS
+        Mant mant[Capacity];
 };
 
+// formats benchmarked against each other; all share float's exponent range
+typedef BfpBlock<8, 8, 64> BfpBlock8;
+typedef BfpBlock<12, 8, 64> BfpBlock12;
+typedef BfpBlock<16, 8, 64> BfpBlock16;
+typedef BfpBlock<23, 8, 64> BfpBlock23;
+
+/* block formatting */
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::BfpBlock(const double *x, uint32_t n)
+    : commonExp(0), blockSize(n), signBits(0) {
+    // check block fits the fixed capacity
+    if (n > BlockSize)
+        throw std::invalid_argument("error: block is larger than BlockSize!");
+    Clear();
+
+    // block formatting
+    int exps[Capacity];
+    uint64_t mants[Capacity];
+    int maxExp = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t bits;
+        std::memcpy(&bits, &x[i], sizeof(double));
+        signBits |= ((bits & DOUBLE_SIGN_EXTRACT_BITS) >> 63) << i;
+
+        // zeros and denormals are flushed to zero
+        int exp = (int)((bits & DOUBLE_EXPONENT_EXTRACT_BITS) >>
+                        DOUBLE_MANTISSA_LENGTH);
+        if (!exp) {
+            exps[i] = 0;
+            mants[i] = 0;
+            continue;
+        }
+
+        // customize exponent length, add implicit 1
+        exps[i] = exp - DOUBLE_BIAS + Bias;
+        mants[i] = (bits & DOUBLE_MANT_EXTRACT_BITS) | DOUBLE_IMPLICIT_1;
+        maxExp = std::max(maxExp, exps[i]);
+    }
+
+    // customize mantissa length and align mantissas to the common exponent,
+    // rounding to nearest even as Normalize() does; if the largest mantissa
+    // rounds up to the next power of two, round again one position further.
+    // Elements too large for MaxExp saturate.
+    auto align = [&](int exp) {
+        bool carry = false;
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t r = RoundWide(
+                mants[i], DOUBLE_MANTISSA_LENGTH - MantBits + exp - exps[i]);
+            carry |= r > MaxMant();
+            mant[i] = (Mant)std::min(r, MaxMant());
+        }
+        return carry;
+    };
+    int exp = std::min(maxExp, (int)MaxExp);
+    if (align(exp) && exp < MaxExp) align(++exp);
+    commonExp = (uint16_t)exp;
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::Broadcast(double scalar, uint32_t n) {
+    double x[BlockSize];
+    std::fill(x, x + n, scalar);
+    return BfpBlock(x, n);
+}
+
+// carry/renormalize: pick the common exponent so that the largest of the
+// wide magnitudes (value = wide[i] * 2^wideExp) keeps its implicit 1 at
+// bit MantBits, then round every element to that position
+template <int MantBits, int ExpBits, int BlockSize>
+void BfpBlock<MantBits, ExpBits, BlockSize>::Normalize(const uint64_t *wide,
+                                                       uint64_t wideSign,
+                                                       int wideExp) {
+    signBits = wideSign & LowMask(blockSize);
+    uint64_t bits = BfpOrReduce(wide, blockSize);
+    int point = BitLength(bits) - (MantBits + 1);
+    int exp = wideExp + point + Bias + MantBits;
+    if (!bits || point - exp > 62) {
+        // zero block, or every element underflows
+        commonExp = 0;
+        Clear();
+        return;
+    }
+    if (exp < 0) {
+        point -= exp;
+        exp = 0;
+    }
+
+    // rounding may carry out of the largest mantissa; round once more
+    // from the wide values at the next position
+    if (exp <= MaxExp &&
+        BfpRoundToMant(wide, blockSize, point, mant) >> (MantBits + 1)) {
+        point++;
+        exp++;
+        if (exp <= MaxExp) BfpRoundToMant(wide, blockSize, point, mant);
+    }
+    if (exp > MaxExp) {
+        // the block overflows the exponent range: keep the largest
+        // exponent and saturate the mantissas that don't fit it
+        point -= exp - MaxExp;
+        exp = MaxExp;
+        for (uint32_t i = 0; i < blockSize; i++)
+            mant[i] = (Mant)std::min(RoundWide(wide[i], point), MaxMant());
+    }
+    commonExp = (uint16_t)exp;
+}
+
+/* matrix element-wise arithmetic functions */
+// this block: a, other block: b
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::Add1D(const BfpBlock &b) const {
+    // check if both blocks have same size
+    if (blockSize != b.blockSize)
+        throw std::invalid_argument(
+            "error[Add1D]: two blocks are not the same size");
+
+    // decide common exponent and align mantissas to it
+    int exp = std::max(commonExp, b.commonExp);
+    uint64_t wide[Capacity];
+    uint64_t sign = BfpAlignedSum(mant, signBits, exp - commonExp, b.mant,
+                                  b.signBits, exp - b.commonExp, TempShift,
+                                  blockSize, wide);
+
+    BfpBlock res;
+    res.blockSize = blockSize;
+    res.Normalize(wide, sign, exp - Bias - MantBits - TempShift);
+    return res;
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::Sub1D(const BfpBlock &b) const {
+    BfpBlock negB = b;
+    negB.signBits ^= LowMask(blockSize);
+    return Add1D(negB);
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::Mult1D(const BfpBlock &b) const {
+    // check if both blocks have same size
+    if (blockSize != b.blockSize)
+        throw std::invalid_argument(
+            "error[Mult1D]: two blocks are not the same size");
+
+    uint64_t wide[Capacity];
+    BfpMultiply(mant, b.mant, blockSize, wide);
+
+    BfpBlock res;
+    res.blockSize = blockSize;
+    res.Normalize(wide, signBits ^ b.signBits,
+                  commonExp + b.commonExp - 2 * Bias - 2 * MantBits);
+    return res;
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::Div1D(const BfpBlock &b) const {
+    // check if both blocks have same size
+    if (blockSize != b.blockSize)
+        throw std::invalid_argument(
+            "error[Div1D]: two blocks are not the same size");
+
+    // no SIMD integer division; the quotient keeps a sticky bit so that
+    // rounding to nearest even sees the inexact remainder
+    uint64_t wide[Capacity] = {0};
+    for (uint32_t i = 0; i < blockSize; i++) {
+        if (!b.mant[i])
+            throw std::invalid_argument("error[Div1D]: division by zero");
+        uint64_t tempA = (uint64_t)mant[i] << TempShift;
+        wide[i] = tempA / b.mant[i];
+        if (tempA % b.mant[i]) wide[i] |= 1;
+    }
+
+    BfpBlock res;
+    res.blockSize = blockSize;
+    res.Normalize(wide, signBits ^ b.signBits,
+                  commonExp - b.commonExp - TempShift);
+    return res;
+}
+
+/* scalar-matrix arithmetic functions*/
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::AddScalar1D(double scalar) const {
+    return Add1D(Broadcast(scalar, blockSize));
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::SubScalar1D(double scalar,
+                                                    bool isScalarFirst) const {
+    if (isScalarFirst)  // scalar - bfp
+        return Broadcast(scalar, blockSize).Sub1D(*this);
+    else  // bfp - scalar
+        return AddScalar1D(-scalar);
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::MultScalar1D(double scalar) const {
+    return Mult1D(Broadcast(scalar, blockSize));
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::DivScalar1D(double scalar,
+                                                    bool isScalarFirst) const {
+    if (isScalarFirst)  // scalar / bfp
+        return Broadcast(scalar, blockSize).Div1D(*this);
+    else  // bfp / scalar
+        return Div1D(Broadcast(scalar, blockSize));
+}
+
+/* Matrix Multiplication */
+template <int MantBits, int ExpBits, int BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>
+BfpBlock<MantBits, ExpBits, BlockSize>::MatrixMult(const BfpBlock &b,
+                                                   uint32_t n) const {
+    // check if matrix multiplication is possible
+    if (n == 0 || blockSize % n || b.blockSize % n)
+        throw std::invalid_argument(
+            "error[MatrixMult]: blocks' size is unfit for Matrix "
+            "Multiplication");
+    uint32_t rows = blockSize / n, cols = b.blockSize / n;
+    if (rows * cols > BlockSize)
+        throw std::invalid_argument(
+            "error[MatrixMult]: result is larger than BlockSize");
+
+    // products have 2 * (MantBits + 1) bits; drop low bits when the dot
+    // product could overflow the signed accumulator
+    int preShift = std::max(0, 2 * (MantBits + 1) + BitLength(n) - 62);
+
+    uint64_t wide[Capacity] = {0};
+    uint64_t sign = 0;
+    for (uint32_t i = 0; i < rows; i++) {
+        for (uint32_t j = 0; j < cols; j++) {
+            int64_t sum = 0;
+            for (uint32_t k = 0; k < n; k++) {
+                int64_t p = (int64_t)(((uint64_t)mant[i * n + k] *
+                                       (uint64_t)b.mant[k * cols + j]) >>
+                                      preShift);
+                sum += (Sign(i * n + k) ^ b.Sign(k * cols + j)) ? -p : p;
+            }
+            if (sum < 0) {
+                sign |= (uint64_t)1 << (i * cols + j);
+                sum = -sum;
+            }
+            wide[i * cols + j] = (uint64_t)sum;
+        }
+    }
+
+    BfpBlock res;
+    res.blockSize = rows * cols;
+    res.Normalize(wide, sign,
+                  commonExp + b.commonExp - 2 * Bias - 2 * MantBits +
+                      preShift);
+    return res;
+}
+
+/* compare functions */
+template <int MantBits, int ExpBits, int BlockSize>
+BfpNum BfpBlock<MantBits, ExpBits, BlockSize>::Max() const {
+    int64_t maxMant = INT64_MIN;
+    for (uint32_t i = 0; i < blockSize; i++) {
+        int64_t signedMant = Sign(i) ? -(int64_t)mant[i] : (int64_t)mant[i];
+        maxMant = std::max(maxMant, signedMant);
+    }
+
+    if (maxMant < 0)
+        return BfpNum((uint16_t)1, commonExp, (uint64_t)-maxMant, MantBits,
+                      ExpBits);
+    else
+        return BfpNum((uint16_t)0, commonExp, (uint64_t)maxMant, MantBits,
+                      ExpBits);
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+BfpNum BfpBlock<MantBits, ExpBits, BlockSize>::Min() const {
+    int64_t minMant = INT64_MAX;
+    for (uint32_t i = 0; i < blockSize; i++) {
+        int64_t signedMant = Sign(i) ? -(int64_t)mant[i] : (int64_t)mant[i];
+        minMant = std::min(minMant, signedMant);
+    }
+
+    if (minMant < 0)
+        return BfpNum((uint16_t)1, commonExp, (uint64_t)-minMant, MantBits,
+                      ExpBits);
+    else
+        return BfpNum((uint16_t)0, commonExp, (uint64_t)minMant, MantBits,
+                      ExpBits);
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+void BfpBlock<MantBits, ExpBits, BlockSize>::Swap(BfpBlock *b) {
+    // check if both blocks have same size
+    if (blockSize != b->blockSize)
+        throw std::invalid_argument(
+            "error[Swap]: two blocks are not the same size");
+
+    // align mantissas so that mantissas corresponds to the bigger common
+    // exponent, then set smaller commonExp to the bigger commonExp
+    if (commonExp > b->commonExp)
+        b->Align(commonExp);
+    else
+        Align(b->commonExp);
+
+    // compare and swap (a: max block, b: min block)
+    for (uint32_t i = 0; i < blockSize; i++) {
+        int64_t signedAMant = Sign(i) ? -(int64_t)mant[i] : (int64_t)mant[i];
+        int64_t signedBMant =
+            b->Sign(i) ? -(int64_t)b->mant[i] : (int64_t)b->mant[i];
+
+        if (signedBMant > signedAMant) {
+            std::swap(mant[i], b->mant[i]);
+            uint16_t signTemp = b->Sign(i);
+            b->SetSign(i, Sign(i));
+            SetSign(i, signTemp);
+        }
+    }
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+void BfpBlock<MantBits, ExpBits, BlockSize>::Align(uint16_t exp) {
+    if (exp < commonExp)
+        throw std::invalid_argument(
+            "error[Align]: exponent is smaller than the common exponent");
+    int shift = exp - commonExp;
+    for (uint32_t i = 0; i < blockSize; i++)
+        mant[i] = shift < 32 ? mant[i] >> shift : 0;
+    commonExp = exp;
+}
+
+/* print functions */
+template <int MantBits, int ExpBits, int BlockSize>
+void BfpBlock<MantBits, ExpBits, BlockSize>::PrintBitwise() const {
+    std::cout << "--------------BFP block-------------" << std::endl;
+    std::cout << "N: " << blockSize << std::endl;
+    std::cout << "commonExp: " << BitString(commonExp, ExpBits) << std::endl;
+    for (uint32_t i = 0; i < blockSize; i++) {
+        std::cout << i << ": " << Sign(i) << "\t"
+                  << BitStringWithSpace(mant[i], MantBits + 1);
+        std::cout << "\t(" << Get(i) << ")" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+void BfpBlock<MantBits, ExpBits, BlockSize>::ToFloatingPoint(double *x) const {
+    for (uint32_t i = 0; i < blockSize; i++) x[i] = Get(i);
+}
+
+template <int MantBits, int ExpBits, int BlockSize>
+std::vector<double> BfpBlock<MantBits, ExpBits, BlockSize>::ToFloatingPoint()
+    const {
+    std::vector<double> res(blockSize);
+    ToFloatingPoint(res.data());
+    return res;
+}
+
+// the benchmarked formats are instantiated once in bfpblock.cpp
+extern template class BfpBlock<8, 8, 64>;
+extern template class BfpBlock<12, 8, 64>;
+extern template class BfpBlock<16, 8, 64>;
+extern template class BfpBlock<23, 8, 64>;
+
 }  // namespace pbrt
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,233 @@
+#ifndef PBRT_BFP_BFPERROR_H
+#define PBRT_BFP_BFPERROR_H
+
+#include "pbrt.h"
+#include "rng.h"
+#include "bfpblock.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace pbrt {
+// Distribution of errors measured in ulps, for the BFP accuracy tests and
+// bfpbench.
+class BfpErrorStats {
+  public:
+    void Add(double ulps) {
+        values.push_back(ulps);
+        sorted = false;
+    }
+    size_t Count() const { return values.size(); }
+    double Mean() const {
+        double sum = 0;
+        for (double v : values) sum += v;
+        return values.empty() ? 0 : sum / values.size();
+    }
+    // p in [0, 1]; Percentile(1) is the maximum
+    double Percentile(double p) const {
+        if (values.empty()) return 0;
+        if (!sorted) {
+            std::sort(values.begin(), values.end());
+            sorted = true;
+        }
+        size_t i = std::min(values.size() - 1, (size_t)(p * values.size()));
+        return values[i];
+    }
+    double Max() const { return Percentile(1); }
+
+  private:
+    mutable std::vector<double> values;
+    mutable bool sorted = false;
+};
+
+// ulp of a float with the magnitude of _x_ (denormals count as FLT_MIN)
+inline double FloatUlp(double x) {
+    int exp;
+    std::frexp(std::max(std::abs(x), (double)FLT_MIN), &exp);
+    return std::ldexp(1., exp - 24);
+}
+
+// ulp of the block's shared exponent
+template <typename Block>
+double BlockUlp(const Block &b) {
+    return std::ldexp(1., (int)b.commonExp - Block::Bias - Block::MantLength);
+}
+
+// Records the error of every element of _r_ against _ref_ both in ulps of
+// the block exponent and in float ulps of the reference value.
+template <typename Block>
+void AddBlockErrors(const Block &r, const double *ref,
+                    BfpErrorStats *blockUlps, BfpErrorStats *floatUlps) {
+    const double ulp = BlockUlp(r);
+    for (uint32_t i = 0; i < r.blockSize; ++i) {
+        double err = std::abs(r.Get(i) - ref[i]);
+        if (blockUlps) blockUlps->Add(err / ulp);
+        if (floatUlps) floatUlps->Add(err / FloatUlp(ref[i]));
+    }
+}
+
+// _n_ nonzero values of random sign with magnitudes spread log-uniformly
+// over _decades_ orders of magnitude around 1
+inline std::vector<double> BfpRandomValues(RNG &rng, int n, Float decades) {
+    std::vector<double> v(n);
+    for (int i = 0; i < n; ++i) {
+        double mag = std::pow(10., decades * (rng.UniformFloat() - .5f)) *
+                     (1 + rng.UniformFloat());
+        v[i] = rng.UniformFloat() < .5f ? -mag : mag;
+    }
+    return v;
+}
+
+/* operations shared by the accuracy tests and bfpbench */
+enum class BfpOp {
+    Convert, Add, Sub, Mult, Div, AddScalar, SubScalar, ScalarSub,
+    MultScalar, DivScalar, ScalarDiv, MatrixMult, Max, Min, Swap
+};
+
+struct BfpOpName {
+    BfpOp op;
+    const char *name;
+};
+
+static const BfpOpName bfpOpNames[] = {
+    {BfpOp::Convert, "convert"},       {BfpOp::Add, "add"},
+    {BfpOp::Sub, "sub"},               {BfpOp::Mult, "mult"},
+    {BfpOp::Div, "div"},               {BfpOp::AddScalar, "addscalar"},
+    {BfpOp::SubScalar, "subscalar"},   {BfpOp::ScalarSub, "scalarsub"},
+    {BfpOp::MultScalar, "multscalar"}, {BfpOp::DivScalar, "divscalar"},
+    {BfpOp::ScalarDiv, "scalardiv"},   {BfpOp::MatrixMult, "matrixmult"},
+    {BfpOp::Max, "max"},               {BfpOp::Min, "min"},
+    {BfpOp::Swap, "swap"}};
+
+inline const char *BfpOpString(BfpOp op) {
+    for (const BfpOpName &o : bfpOpNames)
+        if (o.op == op) return o.name;
+    return "";
+}
+
+// side of the square matrices _n_ elements hold, or 0
+inline int BfpMatrixSide(int n) {
+    int m = (int)std::sqrt((double)n);
+    return m * m == n ? m : 0;
+}
+
+// Number of result values of _op_ on _n_-element inputs.
+inline int BfpResultSize(BfpOp op, int n) {
+    if (op == BfpOp::Max || op == BfpOp::Min) return 1;
+    if (op == BfpOp::Swap) return 2 * n;
+    return n;
+}
+
+// The operation on plain arrays; the double instantiation is the reference
+// and both are timed as baselines.
+template <typename T>
+void BfpReference(BfpOp op, const T *x, const T *y, T s, int n, T *out) {
+    switch (op) {
+    case BfpOp::Convert:
+        for (int i = 0; i < n; ++i) out[i] = x[i];
+        break;
+    case BfpOp::Add:
+        for (int i = 0; i < n; ++i) out[i] = x[i] + y[i];
+        break;
+    case BfpOp::Sub:
+        for (int i = 0; i < n; ++i) out[i] = x[i] - y[i];
+        break;
+    case BfpOp::Mult:
+        for (int i = 0; i < n; ++i) out[i] = x[i] * y[i];
+        break;
+    case BfpOp::Div:
+        for (int i = 0; i < n; ++i) out[i] = x[i] / y[i];
+        break;
+    case BfpOp::AddScalar:
+        for (int i = 0; i < n; ++i) out[i] = x[i] + s;
+        break;
+    case BfpOp::SubScalar:
+        for (int i = 0; i < n; ++i) out[i] = x[i] - s;
+        break;
+    case BfpOp::ScalarSub:
+        for (int i = 0; i < n; ++i) out[i] = s - x[i];
+        break;
+    case BfpOp::MultScalar:
+        for (int i = 0; i < n; ++i) out[i] = x[i] * s;
+        break;
+    case BfpOp::DivScalar:
+        for (int i = 0; i < n; ++i) out[i] = x[i] / s;
+        break;
+    case BfpOp::ScalarDiv:
+        for (int i = 0; i < n; ++i) out[i] = s / x[i];
+        break;
+    case BfpOp::MatrixMult: {
+        int m = BfpMatrixSide(n);
+        for (int i = 0; i < m; ++i)
+            for (int j = 0; j < m; ++j) {
+                T sum = 0;
+                for (int k = 0; k < m; ++k) sum += x[i * m + k] * y[k * m + j];
+                out[i * m + j] = sum;
+            }
+        break;
+    }
+    case BfpOp::Max:
+        out[0] = *std::max_element(x, x + n);
+        break;
+    case BfpOp::Min:
+        out[0] = *std::min_element(x, x + n);
+        break;
+    case BfpOp::Swap:
+        for (int i = 0; i < n; ++i) {
+            out[i] = std::max(x[i], y[i]);
+            out[n + i] = std::min(x[i], y[i]);
+        }
+        break;
+    }
+}
+
+// Runs _op_ on blocks; the results and the ulp of the block(s) holding
+// them go to _out_ and _ulp_ unless they are nullptr (when timing).
+// Returns a value depending on the result so the work is not optimized
+// away.
+template <typename Block>
+uint64_t BfpApply(BfpOp op, const Block &a, const Block &b, double s,
+                  double *out, double *ulp) {
+    Block r;
+    switch (op) {
+    case BfpOp::Convert: {
+        double x[Block::Capacity];
+        a.ToFloatingPoint(x);
+        r = Block(x, a.blockSize);
+        break;
+    }
+    case BfpOp::Add: r = a.Add1D(b); break;
+    case BfpOp::Sub: r = a.Sub1D(b); break;
+    case BfpOp::Mult: r = a.Mult1D(b); break;
+    case BfpOp::Div: r = a.Div1D(b); break;
+    case BfpOp::AddScalar: r = a.AddScalar1D(s); break;
+    case BfpOp::SubScalar: r = a.SubScalar1D(s, false); break;
+    case BfpOp::ScalarSub: r = a.SubScalar1D(s, true); break;
+    case BfpOp::MultScalar: r = a.MultScalar1D(s); break;
+    case BfpOp::DivScalar: r = a.DivScalar1D(s, false); break;
+    case BfpOp::ScalarDiv: r = a.DivScalar1D(s, true); break;
+    case BfpOp::MatrixMult: r = a.MatrixMult(b, BfpMatrixSide(a.blockSize)); break;
+    case BfpOp::Max:
+    case BfpOp::Min: {
+        BfpNum v = op == BfpOp::Max ? a.Max() : a.Min();
+        if (out) out[0] = v.ToFloatingPoint();
+        if (ulp) *ulp = BlockUlp(a);
+        return v.mant;
+    }
+    case BfpOp::Swap: {
+        Block hi = a, lo = b;
+        hi.Swap(&lo);
+        if (out) {
+            hi.ToFloatingPoint(out);
+            lo.ToFloatingPoint(out + a.blockSize);
+        }
+        if (ulp) *ulp = BlockUlp(hi);
+        return hi.mant[0] + lo.mant[0];
+    }
+    }
+    if (out) r.ToFloatingPoint(out);
+    if (ulp) *ulp = BlockUlp(r);
+    return r.commonExp + r.mant[0];
+}
+
+}  // namespace pbrt
+#endif
@@ -0,0 +1,54 @@
+#define BFP_KERNEL_SET BfpScalarKernels
+#include "bfpkernels_impl.h"
+
+#if defined(PBRT_BFP_HAVE_SSE42) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace pbrt {
+/* CPU detection */
+#if defined(PBRT_BFP_HAVE_SSE42)
+#if defined(_MSC_VER)
+static bool CpuHasSSE42() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+}
+
+static bool CpuHasAVX2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    // the OS has to save the YMM registers too
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+#else
+static bool CpuHasSSE42() { return __builtin_cpu_supports("sse4.2"); }
+static bool CpuHasAVX2() { return __builtin_cpu_supports("avx2"); }
+#endif
+#endif  // PBRT_BFP_HAVE_SSE42
+
+int BfpSupportedKernels(const BfpKernelSet *sets[3]) {
+    int n = 0;
+    sets[n++] = &BfpScalarKernels;
+#if defined(PBRT_BFP_HAVE_SSE42)
+    if (CpuHasSSE42()) sets[n++] = &BfpSSE42Kernels;
+#endif
+#if defined(PBRT_BFP_HAVE_AVX2)
+    if (CpuHasAVX2()) sets[n++] = &BfpAVX2Kernels;
+#endif
+    return n;
+}
+
+const BfpKernelSet &BfpKernels() {
+    static const BfpKernelSet *kernels = [] {
+        const BfpKernelSet *sets[3];
+        return sets[BfpSupportedKernels(sets) - 1];
+    }();
+    return *kernels;
+}
+
+}  // namespace pbrt
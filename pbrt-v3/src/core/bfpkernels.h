@@ -0,0 +1,59 @@
+#ifndef PBRT_BFP_BFPKERNELS_H
+#define PBRT_BFP_BFPKERNELS_H
+
+#include <stdint.h>
+
+namespace pbrt {
+// A ray in the integer frame of a BfpTriangleBlock (bfptriangle.h), its axes
+// permuted as in the watertight triangle test
+struct BfpTriangleRay {
+    static const int ShearBits = 30;
+    // v[a][8 * j + i]: signed mantissa of coordinate a of vertex j of
+    // triangle i
+    const int16_t *v[3];
+    // origin on the mantissa grid, |o| <= 2^27
+    int64_t o[3];
+    // shear factors with _ShearBits_ fraction bits
+    int64_t sx, sy;
+    // tMax along the z axis, on the mantissa grid
+    int64_t tz;
+    bool flipZ;
+};
+
+/* kernel sets */
+// The kernels behind BfpAlignedSum() and friends in bfpblock.h, once per
+// instruction set. Each set is built in its own file, the only one compiled
+// for its instruction set, so pbrt runs on CPUs without it; BfpKernels()
+// picks the widest set that was built and that the CPU supports.
+struct BfpKernelSet {
+    uint64_t (*alignedSum16)(const uint16_t *a, uint64_t signA, int shiftA,
+                             const uint16_t *b, uint64_t signB, int shiftB,
+                             int tempShift, uint32_t n, uint64_t *wide);
+    uint64_t (*alignedSum32)(const uint32_t *a, uint64_t signA, int shiftA,
+                             const uint32_t *b, uint64_t signB, int shiftB,
+                             int tempShift, uint32_t n, uint64_t *wide);
+    void (*multiply16)(const uint16_t *a, const uint16_t *b, uint32_t n,
+                       uint64_t *wide);
+    void (*multiply32)(const uint32_t *a, const uint32_t *b, uint32_t n,
+                       uint64_t *wide);
+    uint64_t (*orReduce)(const uint64_t *wide, uint32_t n);
+    uint64_t (*roundToMant16)(const uint64_t *wide, uint32_t n, int point,
+                              uint16_t *mant);
+    uint64_t (*roundToMant32)(const uint64_t *wide, uint32_t n, int point,
+                              uint32_t *mant);
+    // bit i set: _r_ certainly misses triangle i of _n_
+    uint32_t (*triangleMisses)(const BfpTriangleRay &r, int n);
+};
+
+extern const BfpKernelSet BfpScalarKernels;
+// only defined when built with PBRT_BFP_SIMD on x86
+extern const BfpKernelSet BfpSSE42Kernels, BfpAVX2Kernels;
+
+const BfpKernelSet &BfpKernels();
+// Stores the sets usable on this CPU in _sets_, from the scalar one to the
+// one BfpKernels() returns, and returns their count
+int BfpSupportedKernels(const BfpKernelSet *sets[3]);
+
+}  // namespace pbrt
+
+#endif  // PBRT_BFP_BFPKERNELS_H
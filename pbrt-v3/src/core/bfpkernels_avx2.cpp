@@ -0,0 +1,4 @@
+// Compiled with AVX2 enabled; see bfpkernels.h
+#define BFP_KERNELS_AVX2
+#define BFP_KERNEL_SET BfpAVX2Kernels
+#include "bfpkernels_impl.h"
@@ -0,0 +1,436 @@
+#ifndef PBRT_BFP_BFPKERNELS_IMPL_H
+#define PBRT_BFP_BFPKERNELS_IMPL_H
+
+// The body of each BFP kernel set: the file including it defines
+// BFP_KERNEL_SET, the name of the set, and BFP_KERNELS_AVX2 or
+// BFP_KERNELS_SSE42 to pick the instruction set. Nothing here may use
+// inline functions from other headers, since the copy compiled for a wider
+// instruction set could be the one the linker keeps.
+
+#include <string.h>
+#include "bfpkernels.h"
+#if defined(BFP_KERNELS_AVX2)
+#include <immintrin.h>
+#elif defined(BFP_KERNELS_SSE42)
+#include <nmmintrin.h>
+#endif
+
+namespace pbrt {
+/* SIMD helpers: mantissa words are widened to one 64-bit lane each */
+#if defined(BFP_KERNELS_AVX2)
+static inline __m256i LoadMant(const uint32_t *m) {
+    return _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *)m));
+}
+
+static inline __m256i LoadMant(const uint16_t *m) {
+    return _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *)m));
+}
+
+static inline void StoreMant(uint32_t *m, __m256i v) {
+    __m256i packed =
+        _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0));
+    _mm_storeu_si128((__m128i *)m, _mm256_castsi256_si128(packed));
+}
+
+static inline void StoreMant(uint16_t *m, __m256i v) {
+    __m256i packed =
+        _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0));
+    __m128i lo = _mm256_castsi256_si128(packed);
+    _mm_storel_epi64((__m128i *)m, _mm_packus_epi32(lo, lo));
+}
+
+// all-ones lane i if bit i of signs is set
+static inline __m256i SignMask(uint64_t signs) {
+    const __m256i lane = _mm256_setr_epi64x(1, 2, 4, 8);
+    __m256i bits = _mm256_set1_epi64x((int64_t)(signs & 0xF));
+    return _mm256_cmpeq_epi64(_mm256_and_si256(bits, lane), lane);
+}
+
+// Triangle coordinates are sign extended to one 64-bit lane each; lanes
+// hold values that fit in 32 bits, so the 32-bit min/max and signed
+// multiply instructions apply.
+static inline __m256i LoadCoord(const int16_t *v) {
+    return _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i *)v));
+}
+
+static inline __m256i AbsLanes(__m256i x) {
+    __m256i neg = _mm256_cmpgt_epi64(_mm256_setzero_si256(), x);
+    return _mm256_sub_epi64(_mm256_xor_si256(x, neg), neg);
+}
+
+// floor(s * z / 2^ShearBits); there is no 64-bit arithmetic shift
+static inline __m256i Shear(__m256i s, __m256i z) {
+    const int b = BfpTriangleRay::ShearBits;
+    __m256i p = _mm256_add_epi64(_mm256_mul_epi32(s, z),
+                                 _mm256_set1_epi64x((int64_t)1 << 62));
+    return _mm256_sub_epi64(_mm256_srli_epi64(p, b),
+                            _mm256_set1_epi64x((int64_t)1 << (62 - b)));
+}
+#elif defined(BFP_KERNELS_SSE42)
+static inline __m128i LoadMant(const uint32_t *m) {
+    return _mm_cvtepu32_epi64(_mm_loadl_epi64((const __m128i *)m));
+}
+
+static inline __m128i LoadMant(const uint16_t *m) {
+    int32_t two;
+    memcpy(&two, m, sizeof(two));
+    return _mm_cvtepu16_epi64(_mm_cvtsi32_si128(two));
+}
+
+static inline void StoreMant(uint32_t *m, __m128i v) {
+    _mm_storel_epi64((__m128i *)m,
+                     _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline void StoreMant(uint16_t *m, __m128i v) {
+    __m128i lo = _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 0, 2, 0));
+    int32_t two = _mm_cvtsi128_si32(_mm_packus_epi32(lo, lo));
+    memcpy(m, &two, sizeof(two));
+}
+
+static inline __m128i SignMask(uint64_t signs) {
+    const __m128i lane = _mm_set_epi64x(2, 1);
+    __m128i bits = _mm_set1_epi64x((int64_t)(signs & 0x3));
+    return _mm_cmpeq_epi64(_mm_and_si128(bits, lane), lane);
+}
+
+static inline __m128i LoadCoord(const int16_t *v) {
+    int32_t two;
+    memcpy(&two, v, sizeof(two));
+    return _mm_cvtepi16_epi64(_mm_cvtsi32_si128(two));
+}
+
+static inline __m128i AbsLanes(__m128i x) {
+    __m128i neg = _mm_cmpgt_epi64(_mm_setzero_si128(), x);
+    return _mm_sub_epi64(_mm_xor_si128(x, neg), neg);
+}
+
+static inline __m128i Shear(__m128i s, __m128i z) {
+    const int b = BfpTriangleRay::ShearBits;
+    __m128i p = _mm_add_epi64(_mm_mul_epi32(s, z),
+                              _mm_set1_epi64x((int64_t)1 << 62));
+    return _mm_sub_epi64(_mm_srli_epi64(p, b),
+                         _mm_set1_epi64x((int64_t)1 << (62 - b)));
+}
+#endif
+
+/* kernels */
+template <typename Mant>
+static uint64_t AlignedSum(const Mant *a, uint64_t signA, int shiftA,
+                           const Mant *b, uint64_t signB, int shiftB,
+                           int tempShift, uint32_t n, uint64_t *wide) {
+    uint64_t sign = 0;
+    shiftA = shiftA < 64 ? shiftA : 64;
+    shiftB = shiftB < 64 ? shiftB : 64;
+#if defined(BFP_KERNELS_AVX2)
+    const __m128i countS = _mm_cvtsi32_si128(tempShift);
+    const __m128i countA = _mm_cvtsi32_si128(shiftA);
+    const __m128i countB = _mm_cvtsi32_si128(shiftB);
+    const __m256i zero = _mm256_setzero_si256();
+    for (uint32_t i = 0; i < n; i += 4) {
+        __m256i tempA =
+            _mm256_srl_epi64(_mm256_sll_epi64(LoadMant(a + i), countS), countA);
+        __m256i tempB =
+            _mm256_srl_epi64(_mm256_sll_epi64(LoadMant(b + i), countS), countB);
+
+        // 1. conversion to 2's complement
+        __m256i maskA = SignMask(signA >> i), maskB = SignMask(signB >> i);
+        tempA = _mm256_sub_epi64(_mm256_xor_si256(tempA, maskA), maskA);
+        tempB = _mm256_sub_epi64(_mm256_xor_si256(tempB, maskB), maskB);
+
+        // 2. add mantissas
+        __m256i tempRes = _mm256_add_epi64(tempA, tempB);
+
+        // 3. convert to signed magnitude
+        __m256i neg = _mm256_cmpgt_epi64(zero, tempRes);
+        tempRes = _mm256_sub_epi64(_mm256_xor_si256(tempRes, neg), neg);
+        _mm256_storeu_si256((__m256i *)(wide + i), tempRes);
+        sign |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(neg)) << i;
+    }
+#elif defined(BFP_KERNELS_SSE42)
+    const __m128i countS = _mm_cvtsi32_si128(tempShift);
+    const __m128i countA = _mm_cvtsi32_si128(shiftA);
+    const __m128i countB = _mm_cvtsi32_si128(shiftB);
+    const __m128i zero = _mm_setzero_si128();
+    for (uint32_t i = 0; i < n; i += 2) {
+        __m128i tempA =
+            _mm_srl_epi64(_mm_sll_epi64(LoadMant(a + i), countS), countA);
+        __m128i tempB =
+            _mm_srl_epi64(_mm_sll_epi64(LoadMant(b + i), countS), countB);
+
+        __m128i maskA = SignMask(signA >> i), maskB = SignMask(signB >> i);
+        tempA = _mm_sub_epi64(_mm_xor_si128(tempA, maskA), maskA);
+        tempB = _mm_sub_epi64(_mm_xor_si128(tempB, maskB), maskB);
+
+        __m128i tempRes = _mm_add_epi64(tempA, tempB);
+
+        __m128i neg = _mm_cmpgt_epi64(zero, tempRes);
+        tempRes = _mm_sub_epi64(_mm_xor_si128(tempRes, neg), neg);
+        _mm_storeu_si128((__m128i *)(wide + i), tempRes);
+        sign |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(neg)) << i;
+    }
+#else
+    for (uint32_t i = 0; i < n; i++) {
+        int64_t tempA = shiftA < 64 ? (int64_t)(((uint64_t)a[i] << tempShift) >>
+                                                shiftA)
+                                    : 0;
+        int64_t tempB = shiftB < 64 ? (int64_t)(((uint64_t)b[i] << tempShift) >>
+                                                shiftB)
+                                    : 0;
+        if ((signA >> i) & 1) tempA = -tempA;
+        if ((signB >> i) & 1) tempB = -tempB;
+
+        int64_t tempRes = tempA + tempB;
+        if (tempRes < 0) {
+            tempRes = -tempRes;
+            sign |= (uint64_t)1 << i;
+        }
+        wide[i] = (uint64_t)tempRes;
+    }
+#endif
+    return sign;
+}
+
+template <typename Mant>
+static void Multiply(const Mant *a, const Mant *b, uint32_t n,
+                     uint64_t *wide) {
+#if defined(BFP_KERNELS_AVX2)
+    for (uint32_t i = 0; i < n; i += 4)
+        _mm256_storeu_si256((__m256i *)(wide + i),
+                            _mm256_mul_epu32(LoadMant(a + i), LoadMant(b + i)));
+#elif defined(BFP_KERNELS_SSE42)
+    for (uint32_t i = 0; i < n; i += 2)
+        _mm_storeu_si128((__m128i *)(wide + i),
+                         _mm_mul_epu32(LoadMant(a + i), LoadMant(b + i)));
+#else
+    for (uint32_t i = 0; i < n; i++) wide[i] = (uint64_t)a[i] * (uint64_t)b[i];
+#endif
+}
+
+static uint64_t OrReduce(const uint64_t *wide, uint32_t n) {
+#if defined(BFP_KERNELS_AVX2)
+    __m256i acc = _mm256_setzero_si256();
+    for (uint32_t i = 0; i < n; i += 4)
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(wide + i)));
+    __m128i acc2 = _mm_or_si128(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+    return (uint64_t)_mm_cvtsi128_si64(acc2) |
+           (uint64_t)_mm_extract_epi64(acc2, 1);
+#elif defined(BFP_KERNELS_SSE42)
+    __m128i acc = _mm_setzero_si128();
+    for (uint32_t i = 0; i < n; i += 2)
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(wide + i)));
+    return (uint64_t)_mm_cvtsi128_si64(acc) |
+           (uint64_t)_mm_extract_epi64(acc, 1);
+#else
+    uint64_t acc = 0;
+    for (uint32_t i = 0; i < n; i++) acc |= wide[i];
+    return acc;
+#endif
+}
+
+template <typename Mant>
+static uint64_t RoundToMant(const uint64_t *wide, uint32_t n, int point,
+                            Mant *mant) {
+    uint64_t bits = 0;
+    if (point <= 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t r = wide[i] << -point;
+            bits |= r;
+            mant[i] = (Mant)r;
+        }
+        return bits;
+    }
+    // ground bit set and (round/sticky bits set or last bit odd) -> round up
+    const uint64_t half = ((uint64_t)1 << (point - 1)) - 1;
+#if defined(BFP_KERNELS_AVX2)
+    const __m128i count = _mm_cvtsi32_si128(point);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i halfv = _mm256_set1_epi64x((int64_t)half);
+    __m256i acc = _mm256_setzero_si256();
+    for (uint32_t i = 0; i < n; i += 4) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(wide + i));
+        __m256i lastBit = _mm256_and_si256(_mm256_srl_epi64(w, count), one);
+        __m256i r = _mm256_srl_epi64(
+            _mm256_add_epi64(_mm256_add_epi64(w, halfv), lastBit), count);
+        acc = _mm256_or_si256(acc, r);
+        StoreMant(mant + i, r);
+    }
+    __m128i acc2 = _mm_or_si128(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+    bits = (uint64_t)_mm_cvtsi128_si64(acc2) |
+           (uint64_t)_mm_extract_epi64(acc2, 1);
+#elif defined(BFP_KERNELS_SSE42)
+    const __m128i count = _mm_cvtsi32_si128(point);
+    const __m128i one = _mm_set1_epi64x(1);
+    const __m128i halfv = _mm_set1_epi64x((int64_t)half);
+    __m128i acc = _mm_setzero_si128();
+    for (uint32_t i = 0; i < n; i += 2) {
+        __m128i w = _mm_loadu_si128((const __m128i *)(wide + i));
+        __m128i lastBit = _mm_and_si128(_mm_srl_epi64(w, count), one);
+        __m128i r = _mm_srl_epi64(
+            _mm_add_epi64(_mm_add_epi64(w, halfv), lastBit), count);
+        acc = _mm_or_si128(acc, r);
+        StoreMant(mant + i, r);
+    }
+    bits = (uint64_t)_mm_cvtsi128_si64(acc) |
+           (uint64_t)_mm_extract_epi64(acc, 1);
+#else
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t r = (wide[i] + half + ((wide[i] >> point) & 1)) >> point;
+        bits |= r;
+        mant[i] = (Mant)r;
+    }
+#endif
+    return bits;
+}
+
+// The watertight test's edge functions on the translated and sheared integer
+// vertices, for all triangles of a block at once. All error bounds are per
+// triangle, from the largest coordinates m (x and y) and mz (z) of its
+// vertices: a sheared coordinate is off by at most eps ulps (block
+// quantization, rounded origin and shear factor, floor of the shift, and
+// the float test's own rounding), so an edge function is off by at most
+// 4 eps m + 2 eps^2 plus the float test's 2^-22 relative error on its two
+// products.
+static uint32_t TriangleMisses(const BfpTriangleRay &r, int n) {
+    uint32_t misses = 0;
+#if defined(BFP_KERNELS_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ox = _mm256_set1_epi64x(r.o[0]);
+    const __m256i oy = _mm256_set1_epi64x(r.o[1]);
+    const __m256i oz = _mm256_set1_epi64x(r.o[2]);
+    const __m256i sx = _mm256_set1_epi64x(r.sx), sy = _mm256_set1_epi64x(r.sy);
+    const __m256i tz = _mm256_set1_epi64x(r.tz);
+    const __m256i flip = _mm256_set1_epi64x(r.flipZ ? -1 : 0);
+    for (int i = 0; i < n; i += 4) {
+        __m256i x[3], y[3], m = zero, mz = zero, zMin = zero, zMax = zero;
+        for (int j = 0; j < 3; ++j) {
+            __m256i z = _mm256_sub_epi64(LoadCoord(r.v[2] + 8 * j + i), oz);
+            x[j] = _mm256_add_epi64(
+                _mm256_sub_epi64(LoadCoord(r.v[0] + 8 * j + i), ox),
+                Shear(sx, z));
+            y[j] = _mm256_add_epi64(
+                _mm256_sub_epi64(LoadCoord(r.v[1] + 8 * j + i), oy),
+                Shear(sy, z));
+            m = _mm256_max_epi32(
+                m, _mm256_max_epi32(AbsLanes(x[j]), AbsLanes(y[j])));
+            mz = _mm256_max_epi32(mz, AbsLanes(z));
+            // distance along the ray direction
+            z = _mm256_sub_epi64(_mm256_xor_si256(z, flip), flip);
+            zMin = j ? _mm256_min_epi32(zMin, z) : z;
+            zMax = j ? _mm256_max_epi32(zMax, z) : z;
+        }
+        __m256i eps = _mm256_add_epi64(
+            _mm256_set1_epi64x(8),
+            _mm256_srli_epi64(_mm256_add_epi64(m, _mm256_add_epi64(mz, mz)),
+                              21));
+        __m256i epsZ =
+            _mm256_add_epi64(_mm256_set1_epi64x(4), _mm256_srli_epi64(mz, 21));
+        __m256i bound = _mm256_add_epi64(
+            _mm256_add_epi64(_mm256_slli_epi64(_mm256_mul_epi32(eps, m), 2),
+                             _mm256_slli_epi64(_mm256_mul_epi32(eps, eps), 1)),
+            _mm256_add_epi64(_mm256_srli_epi64(_mm256_mul_epi32(m, m), 21),
+                             _mm256_set1_epi64x(2)));
+        __m256i negBound = _mm256_sub_epi64(zero, bound);
+        __m256i neg = zero, pos = zero;
+        for (int k = 0; k < 3; ++k) {
+            int j0 = k == 2 ? 0 : k + 1, j1 = k == 0 ? 2 : k - 1;
+            __m256i e = _mm256_sub_epi64(_mm256_mul_epi32(x[j0], y[j1]),
+                                         _mm256_mul_epi32(y[j0], x[j1]));
+            neg = _mm256_or_si256(neg, _mm256_cmpgt_epi64(negBound, e));
+            pos = _mm256_or_si256(pos, _mm256_cmpgt_epi64(e, bound));
+        }
+        __m256i miss = _mm256_or_si256(
+            _mm256_and_si256(neg, pos),
+            _mm256_or_si256(
+                _mm256_cmpgt_epi64(_mm256_sub_epi64(zero, epsZ), zMax),
+                _mm256_cmpgt_epi64(zMin, _mm256_add_epi64(tz, epsZ))));
+        misses |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(miss)) << i;
+    }
+#elif defined(BFP_KERNELS_SSE42)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ox = _mm_set1_epi64x(r.o[0]), oy = _mm_set1_epi64x(r.o[1]);
+    const __m128i oz = _mm_set1_epi64x(r.o[2]);
+    const __m128i sx = _mm_set1_epi64x(r.sx), sy = _mm_set1_epi64x(r.sy);
+    const __m128i tz = _mm_set1_epi64x(r.tz);
+    const __m128i flip = _mm_set1_epi64x(r.flipZ ? -1 : 0);
+    for (int i = 0; i < n; i += 2) {
+        __m128i x[3], y[3], m = zero, mz = zero, zMin = zero, zMax = zero;
+        for (int j = 0; j < 3; ++j) {
+            __m128i z = _mm_sub_epi64(LoadCoord(r.v[2] + 8 * j + i), oz);
+            x[j] = _mm_add_epi64(
+                _mm_sub_epi64(LoadCoord(r.v[0] + 8 * j + i), ox), Shear(sx, z));
+            y[j] = _mm_add_epi64(
+                _mm_sub_epi64(LoadCoord(r.v[1] + 8 * j + i), oy), Shear(sy, z));
+            m = _mm_max_epi32(m, _mm_max_epi32(AbsLanes(x[j]), AbsLanes(y[j])));
+            mz = _mm_max_epi32(mz, AbsLanes(z));
+            z = _mm_sub_epi64(_mm_xor_si128(z, flip), flip);
+            zMin = j ? _mm_min_epi32(zMin, z) : z;
+            zMax = j ? _mm_max_epi32(zMax, z) : z;
+        }
+        __m128i eps = _mm_add_epi64(
+            _mm_set1_epi64x(8),
+            _mm_srli_epi64(_mm_add_epi64(m, _mm_add_epi64(mz, mz)), 21));
+        __m128i epsZ = _mm_add_epi64(_mm_set1_epi64x(4), _mm_srli_epi64(mz, 21));
+        __m128i bound = _mm_add_epi64(
+            _mm_add_epi64(_mm_slli_epi64(_mm_mul_epi32(eps, m), 2),
+                          _mm_slli_epi64(_mm_mul_epi32(eps, eps), 1)),
+            _mm_add_epi64(_mm_srli_epi64(_mm_mul_epi32(m, m), 21),
+                          _mm_set1_epi64x(2)));
+        __m128i negBound = _mm_sub_epi64(zero, bound);
+        __m128i neg = zero, pos = zero;
+        for (int k = 0; k < 3; ++k) {
+            int j0 = k == 2 ? 0 : k + 1, j1 = k == 0 ? 2 : k - 1;
+            __m128i e = _mm_sub_epi64(_mm_mul_epi32(x[j0], y[j1]),
+                                      _mm_mul_epi32(y[j0], x[j1]));
+            neg = _mm_or_si128(neg, _mm_cmpgt_epi64(negBound, e));
+            pos = _mm_or_si128(pos, _mm_cmpgt_epi64(e, bound));
+        }
+        __m128i miss = _mm_or_si128(
+            _mm_and_si128(neg, pos),
+            _mm_or_si128(_mm_cmpgt_epi64(_mm_sub_epi64(zero, epsZ), zMax),
+                         _mm_cmpgt_epi64(zMin, _mm_add_epi64(tz, epsZ))));
+        misses |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(miss)) << i;
+    }
+#else
+    const int b = BfpTriangleRay::ShearBits;
+    for (int i = 0; i < n; ++i) {
+        int64_t x[3], y[3], m = 0, mz = 0, zMin = 0, zMax = 0;
+        for (int j = 0; j < 3; ++j) {
+            int64_t z = r.v[2][8 * j + i] - r.o[2];
+            x[j] = r.v[0][8 * j + i] - r.o[0] + ((r.sx * z) >> b);
+            y[j] = r.v[1][8 * j + i] - r.o[1] + ((r.sy * z) >> b);
+            int64_t ax = x[j] < 0 ? -x[j] : x[j], ay = y[j] < 0 ? -y[j] : y[j];
+            m = ax > m ? ax : m;
+            m = ay > m ? ay : m;
+            int64_t az = z < 0 ? -z : z;
+            mz = az > mz ? az : mz;
+            if (r.flipZ) z = -z;
+            zMin = (j && zMin < z) ? zMin : z;
+            zMax = (j && zMax > z) ? zMax : z;
+        }
+        int64_t eps = 8 + ((m + 2 * mz) >> 21), epsZ = 4 + (mz >> 21);
+        int64_t bound = 4 * eps * m + 2 * eps * eps + ((m * m) >> 21) + 2;
+        bool neg = false, pos = false;
+        for (int k = 0; k < 3; ++k) {
+            int j0 = k == 2 ? 0 : k + 1, j1 = k == 0 ? 2 : k - 1;
+            int64_t e = x[j0] * y[j1] - y[j0] * x[j1];
+            neg |= e < -bound;
+            pos |= e > bound;
+        }
+        if ((neg && pos) || zMax < -epsZ || zMin > r.tz + epsZ)
+            misses |= 1u << i;
+    }
+#endif
+    return misses & ((1u << n) - 1);
+}
+
+const BfpKernelSet BFP_KERNEL_SET = {
+    AlignedSum<uint16_t>, AlignedSum<uint32_t>,  Multiply<uint16_t>,
+    Multiply<uint32_t>,   OrReduce,              RoundToMant<uint16_t>,
+    RoundToMant<uint32_t>, TriangleMisses};
+
+}  // namespace pbrt
+
+#endif  // PBRT_BFP_BFPKERNELS_IMPL_H
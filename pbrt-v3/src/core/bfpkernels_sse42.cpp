@@ -0,0 +1,4 @@
+// Compiled with SSE4.2 enabled; see bfpkernels.h
+#define BFP_KERNELS_SSE42
+#define BFP_KERNEL_SET BfpSSE42Kernels
+#include "bfpkernels_impl.h"
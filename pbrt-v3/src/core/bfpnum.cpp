@@ -14,11 +14,12 @@ BfpNum::BfpNum(double f) {
     if (exp) mant ^= DOUBLE_IMPLICIT_1;
 }
 
-BfpNum::BfpNum(uint16_t s, uint16_t e, uint64_t m) {
+BfpNum::BfpNum(uint16_t s, uint16_t e, uint64_t m, int mantLength,
+               int expLength) {
     sign = s;
-    exp = e - BFP_BIAS + DOUBLE_BIAS;
+    exp = e - ((1 << (expLength - 1)) - 1) + DOUBLE_BIAS;
     mant = m << (DOUBLE_MANTISSA_LENGTH -
-                 BFP_MANTISSA_LENGTH);  // implicit 1 included!
+                 mantLength);  // implicit 1 included!
     if (exp && mant) {
         while (!(mant & DOUBLE_IMPLICIT_1)) {
             mant <<= 1;
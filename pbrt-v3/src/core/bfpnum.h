@@ -7,7 +7,9 @@ namespace pbrt {
 class BfpNum {
   public:
     BfpNum(double f);
-    BfpNum(uint16_t sign, uint16_t exp, uint64_t mant);
+    // block element with the given mantissa/exponent lengths
+    BfpNum(uint16_t sign, uint16_t exp, uint64_t mant, int mantLength,
+           int expLength);
     double ToFloatingPoint();
     void PrintBitwise();
     void PrintValue();
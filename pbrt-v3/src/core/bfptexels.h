@@ -0,0 +1,133 @@
+#ifndef PBRT_BFP_BFPTEXELS_H
+#define PBRT_BFP_BFPTEXELS_H
+
+#include "pbrt.h"
+#include "memory.h"
+
+namespace pbrt {
+// channel access for the texel types MIPMap is instantiated with
+template <typename T>
+struct BfpTexelChannels {
+    static constexpr int N = T::nSamples;
+    static Float Get(const T &t, int c) { return t[c]; }
+    static void Set(T *t, int c, Float v) { (*t)[c] = v; }
+};
+
+template <>
+struct BfpTexelChannels<Float> {
+    static constexpr int N = 1;
+    static Float Get(Float t, int c) { return t; }
+    static void Set(Float *t, int c, Float v) { *t = v; }
+};
+
+// Read-only BlockedArray whose 4x4 texel blocks are stored as one shared
+// exponent per channel plus sign-magnitude mantissa words: 8-bit words for
+// up to 7 mantissa bits, 16-bit words for up to 15.
+template <typename T>
+class BfpBlockedArray {
+  public:
+    static constexpr int LogBlockSize = 2;
+    static constexpr int BlockSize = 1 << LogBlockSize;
+    static constexpr int BlockArea = BlockSize * BlockSize;
+    static constexpr int NChannels = BfpTexelChannels<T>::N;
+
+    BfpBlockedArray(const BlockedArray<T, LogBlockSize> &a, int mantBits);
+    int uSize() const { return uRes; }
+    int vSize() const { return vRes; }
+    T operator()(int u, int v) const;
+    size_t BytesUsed() const {
+        return exps.size() + words8.size() + 2 * words16.size();
+    }
+
+  private:
+    // word index of channel _c_ of texel (u, v); exponents are stored per
+    // (block, channel)
+    int Word(int u, int v, int c) const {
+        int block = (v >> LogBlockSize) * uBlocks + (u >> LogBlockSize);
+        int offset = ((v & (BlockSize - 1)) << LogBlockSize) +
+                     (u & (BlockSize - 1));
+        return (block * NChannels + c) * BlockArea + offset;
+    }
+
+    const int uRes, vRes, uBlocks, mantBits;
+    // exponent of one mantissa ulp, in [-126, 127]
+    std::vector<int8_t> exps;
+    std::vector<uint8_t> words8;
+    std::vector<uint16_t> words16;
+};
+
+template <typename T>
+BfpBlockedArray<T>::BfpBlockedArray(const BlockedArray<T, LogBlockSize> &a,
+                                    int mantBits)
+    : uRes(a.uSize()),
+      vRes(a.vSize()),
+      uBlocks((a.uSize() + BlockSize - 1) >> LogBlockSize),
+      mantBits(mantBits) {
+    CHECK(mantBits >= 1 && mantBits <= 15);
+    int vBlocks = (vRes + BlockSize - 1) >> LogBlockSize;
+    int nBlocks = uBlocks * vBlocks;
+    exps.resize(nBlocks * NChannels);
+    if (mantBits <= 7)
+        words8.resize(nBlocks * NChannels * BlockArea);
+    else
+        words16.resize(nBlocks * NChannels * BlockArea);
+
+    const uint32_t maxMant = (1u << mantBits) - 1;
+    for (int b = 0; b < nBlocks; ++b) {
+        int u0 = (b % uBlocks) << LogBlockSize;
+        int v0 = (b / uBlocks) << LogBlockSize;
+        for (int c = 0; c < NChannels; ++c) {
+            // shared exponent from the largest magnitude in the block
+            Float maxAbs = 0;
+            for (int v = v0; v < std::min(v0 + BlockSize, vRes); ++v)
+                for (int u = u0; u < std::min(u0 + BlockSize, uRes); ++u)
+                    maxAbs = std::max(
+                        maxAbs, std::abs(BfpTexelChannels<T>::Get(a(u, v), c)));
+            int maxExp;
+            std::frexp(maxAbs, &maxExp);
+            int exp = Clamp(maxExp - mantBits, -126, 127);
+            exps[b * NChannels + c] = (int8_t)exp;
+
+            // round to nearest; the top value may round up into the next
+            // binade, which saturates instead
+            for (int v = v0; v < std::min(v0 + BlockSize, vRes); ++v)
+                for (int u = u0; u < std::min(u0 + BlockSize, uRes); ++u) {
+                    Float x = BfpTexelChannels<T>::Get(a(u, v), c);
+                    uint32_t m = std::min(
+                        (uint32_t)std::lround(std::ldexp(std::abs(x), -exp)),
+                        maxMant);
+                    uint32_t sign = x < 0 ? 1 : 0;
+                    if (mantBits <= 7)
+                        words8[Word(u, v, c)] = (uint8_t)((sign << 7) | m);
+                    else
+                        words16[Word(u, v, c)] = (uint16_t)((sign << 15) | m);
+                }
+        }
+    }
+}
+
+template <typename T>
+T BfpBlockedArray<T>::operator()(int u, int v) const {
+    T r;
+    int w = Word(u, v, 0);
+    int e = w / BlockArea;
+    for (int c = 0; c < NChannels; ++c, w += BlockArea, ++e) {
+        // power-of-two scale straight from the float exponent bits
+        Float scale = BitsToFloat((uint32_t)(exps[e] + 127) << 23);
+        Float x;
+        if (mantBits <= 7) {
+            uint8_t m = words8[w];
+            x = (Float)(m & 0x7f) * scale;
+            if (m & 0x80) x = -x;
+        } else {
+            uint16_t m = words16[w];
+            x = (Float)(m & 0x7fff) * scale;
+            if (m & 0x8000) x = -x;
+        }
+        BfpTexelChannels<T>::Set(&r, c, x);
+    }
+    return r;
+}
+
+}  // namespace pbrt
+#endif
@@ -0,0 +1,106 @@
+#include "bfptransform.h"
+
+#include "stats.h"
+
+namespace pbrt {
+STAT_COUNTER("BFP/Transformed points, vectors and normals", nBfpTransformed);
+STAT_FLOAT_DISTRIBUTION("BFP/Transform error (ulps of batch maximum)",
+                        bfpTransformError);
+
+static BfpTransform::Block ToBlock(const Matrix4x4 &m) {
+    double x[16];
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j) x[4 * i + j] = m.m[i][j];
+    return BfpTransform::Block(x, 16);
+}
+
+static Matrix4x4 FromBlock(const BfpTransform::Block &b) {
+    double x[16];
+    b.ToFloatingPoint(x);
+    Matrix4x4 r;
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j) r.m[i][j] = (Float)x[4 * i + j];
+    return r;
+}
+
+template <typename T>
+static Float MaxAbsComponent(const T &v) {
+    return std::max(std::abs(v.x), std::max(std::abs(v.y), std::abs(v.z)));
+}
+
+// Transforms _n_ elements of _in_ by the block matrix _m_, using _w_ as the
+// homogeneous coordinate. Returns per-batch maxima of the inputs' transformed
+// magnitudes through _batchMax_ when non-null, for the error report.
+template <typename T>
+static void ApplyBlock(const BfpTransform::Block &m, const T *in, int n,
+                       Float w, T *out, Float *batchMax) {
+    const int batchSize = BfpTransform::BatchSize;
+    double x[4 * batchSize];
+    for (int start = 0; start < n; start += batchSize) {
+        int count = std::min(batchSize, n - start);
+        for (int i = 0; i < count; ++i) {
+            x[i] = in[start + i].x;
+            x[count + i] = in[start + i].y;
+            x[2 * count + i] = in[start + i].z;
+            x[3 * count + i] = w;
+        }
+        BfpTransform::Block r = m.MatrixMult(BfpTransform::Block(x, 4 * count), 4);
+        r.ToFloatingPoint(x);
+
+        Float maxAbs = 0;
+        for (int i = 0; i < count; ++i) {
+            T v((Float)x[i], (Float)x[count + i], (Float)x[2 * count + i]);
+            double wp = x[3 * count + i];
+            if (w != 0 && wp != 1) v /= (Float)wp;
+            out[start + i] = v;
+            maxAbs = std::max(maxAbs, MaxAbsComponent(v));
+        }
+        if (batchMax) batchMax[start / batchSize] = maxAbs;
+    }
+    nBfpTransformed += n;
+}
+
+// Difference to the float path in units of the last place of the largest
+// magnitude in each batch, which is what the shared exponent guarantees.
+template <typename T>
+static void ReportError(const Transform &t, const T *in, int n, const T *out,
+                        const Float *batchMax) {
+    const int batchSize = BfpTransform::BatchSize;
+    for (int i = 0; i < n; ++i) {
+        Float ulp = std::ldexp(batchMax[i / batchSize],
+                               -BfpTransform::Block::MantLength);
+        T ref = t(in[i]);
+        Float err = MaxAbsComponent(Vector3f(ref.x - out[i].x, ref.y - out[i].y,
+                                             ref.z - out[i].z));
+        ReportValue(bfpTransformError, ulp > 0 ? err / ulp : err);
+    }
+}
+
+// BfpTransform Method Definitions
+BfpTransform::BfpTransform(const Transform &t, bool reportError)
+    : t(t),
+      m(ToBlock(t.GetMatrix())),
+      mInvT(ToBlock(Transpose(t.GetInverseMatrix()))),
+      reportError(reportError) {}
+
+void BfpTransform::operator()(const Point3f *p, int n, Point3f *out) const {
+    std::vector<Float> batchMax(reportError ? (n + BatchSize - 1) / BatchSize : 0);
+    ApplyBlock(m, p, n, 1, out, reportError ? batchMax.data() : nullptr);
+    if (reportError) ReportError(t, p, n, out, batchMax.data());
+}
+
+void BfpTransform::operator()(const Vector3f *v, int n, Vector3f *out) const {
+    std::vector<Float> batchMax(reportError ? (n + BatchSize - 1) / BatchSize : 0);
+    ApplyBlock(m, v, n, 0, out, reportError ? batchMax.data() : nullptr);
+    if (reportError) ReportError(t, v, n, out, batchMax.data());
+}
+
+void BfpTransform::operator()(const Normal3f *nrm, int n, Normal3f *out) const {
+    std::vector<Float> batchMax(reportError ? (n + BatchSize - 1) / BatchSize : 0);
+    ApplyBlock(mInvT, nrm, n, 0, out, reportError ? batchMax.data() : nullptr);
+    if (reportError) ReportError(t, nrm, n, out, batchMax.data());
+}
+
+Matrix4x4 BfpTransform::GetMatrix() const { return FromBlock(m); }
+
+}  // namespace pbrt
@@ -0,0 +1,40 @@
+#ifndef PBRT_BFP_BFPTRANSFORM_H
+#define PBRT_BFP_BFPTRANSFORM_H
+
+#include "pbrt.h"
+#include "transform.h"
+#include "bfpblock.h"
+
+namespace pbrt {
+// Transform application with the matrix held as one shared-exponent block.
+// Points, vectors and normals are batched as row-major 4 x BatchSize blocks
+// (one row per homogeneous coordinate), so each batch costs a single block
+// matrix multiplication. Only triangle mesh vertices are transformed this
+// way; single points, vectors and rays, matrix products and instance
+// transforms stay in floating point, since converting one element to a
+// block costs more than the float arithmetic it replaces.
+class BfpTransform {
+  public:
+    typedef BfpBlock23 Block;
+    static constexpr int BatchSize = 16;
+
+    // reportError: also run the float path and record the difference in
+    // the "BFP/" statistics
+    BfpTransform(const Transform &t, bool reportError = false);
+
+    /* batch application; _out_ may be the input unless the error is
+       reported */
+    void operator()(const Point3f *p, int n, Point3f *out) const;
+    void operator()(const Vector3f *v, int n, Vector3f *out) const;
+    void operator()(const Normal3f *nrm, int n, Normal3f *out) const;
+
+    Matrix4x4 GetMatrix() const;
+
+  private:
+    Transform t;
+    Block m, mInvT;  // normals use the transposed inverse
+    bool reportError;
+};
+
+}  // namespace pbrt
+#endif
@@ -0,0 +1,97 @@
+#include "bfptriangle.h"
+
+#include "bfpkernels.h"
+#include "stats.h"
+
+namespace pbrt {
+STAT_PERCENT("BFP/Leaf triangles culled by the block test", nBfpCulled,
+             nBfpTested);
+STAT_PERCENT("BFP/Leaf block tests out of exponent range", nBfpOutOfRange,
+             nBfpBlockTests);
+
+/* fixed point layout */
+// ray origins may lie up to 2^RangeBits block maxima away from the block
+// center; with 15-bit vertices the sheared coordinates stay below 2^29, so
+// the edge function products are exact in 64 bits
+static constexpr int RangeBits = 12;
+
+void BfpRay::Init(const Ray &ray) {
+    kz = MaxDimension(Abs(ray.d));
+    kx = kz + 1;
+    if (kx == 3) kx = 0;
+    ky = kx + 1;
+    if (ky == 3) ky = 0;
+    Vector3f d = Permute(ray.d, kx, ky, kz);
+    Sx = -d.x / d.z;
+    Sy = -d.y / d.z;
+}
+
+BfpTriangleBlock::BfpTriangleBlock(const Point3f *pv, int nTriangles)
+    : nTriangles(nTriangles) {
+    CHECK(nTriangles > 0 && nTriangles <= MaxTriangles);
+    const int n = 3 * nTriangles;
+    Bounds3f bounds(pv[0]);
+    for (int i = 1; i < n; ++i) bounds = Union(bounds, pv[i]);
+    center = .5f * bounds.pMin + .5f * bounds.pMax;
+
+    double x[3][3 * MaxTriangles];
+    for (int a = 0; a < 3; ++a)
+        for (int i = 0; i < n; ++i) x[a][i] = (double)pv[i][a] - center[a];
+
+    // one exponent for all three coordinates
+    Block p[3];
+    uint16_t exp = 0;
+    for (int a = 0; a < 3; ++a) {
+        p[a] = Block(x[a], n);
+        exp = std::max(exp, p[a].commonExp);
+    }
+    for (int a = 0; a < 3; ++a) p[a].Align(exp);
+    invUlp = exp ? std::ldexp(1., Block::Bias + Block::MantLength - exp) : 0;
+
+    for (int a = 0; a < 3; ++a)
+        for (int j = 0; j < 3; ++j)
+            for (int i = 0; i < MaxTriangles; ++i) {
+                int e = 3 * i + j;
+                int m = i < nTriangles ? p[a].mant[e] : 0;
+                v[a][j][i] = (i < nTriangles && p[a].Sign(e)) ? -m : m;
+            }
+}
+
+uint32_t BfpTriangleBlock::Misses(const Ray &ray, const BfpRay &r) const {
+    ++nBfpBlockTests;
+    if (invUlp == 0) {
+        // degenerate leaf, everything flushed to zero
+        ++nBfpOutOfRange;
+        return 0;
+    }
+
+    // Put the permuted ray on the block's grid, in units of one mantissa ulp
+    const double maxOrigin = (double)(1 << (Block::MantLength + 1 + RangeBits));
+    const int axis[3] = {r.kx, r.ky, r.kz};
+    BfpTriangleRay tr;
+    for (int a = 0; a < 3; ++a) {
+        double q = ((double)ray.o[axis[a]] - center[axis[a]]) * invUlp;
+        if (!(std::abs(q) <= maxOrigin)) {
+            // too few mantissa bits would be left for the edge functions
+            ++nBfpOutOfRange;
+            return 0;
+        }
+        tr.o[a] = std::llround(q);
+        tr.v[a] = &v[axis[a]][0][0];
+    }
+    const double shearScale = (double)(1 << BfpTriangleRay::ShearBits);
+    tr.sx = std::llround(r.Sx * shearScale);
+    tr.sy = std::llround(r.Sy * shearScale);
+    // vertex z values stay far below 2^40, so that is as good as infinity
+    const int64_t maxTz = (int64_t)1 << 40;
+    double tz = ray.tMax * std::abs(ray.d[r.kz]) * invUlp * (1 + 1e-6);
+    tr.tz = tz < (double)maxTz ? (int64_t)std::ceil(tz) : maxTz;
+    tr.flipZ = ray.d[r.kz] < 0;
+
+    uint32_t misses = BfpKernels().triangleMisses(tr, nTriangles);
+    for (uint32_t m = misses; m; m &= m - 1) ++nBfpCulled;
+    nBfpTested += nTriangles;
+    return misses;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,58 @@
+#ifndef PBRT_BFP_BFPTRIANGLE_H
+#define PBRT_BFP_BFPTRIANGLE_H
+
+#include "pbrt.h"
+#include "geometry.h"
+#include "bfpblock.h"
+
+namespace pbrt {
+// Per-ray setup shared by all triangle blocks: the axis permutation and
+// shear of the watertight test in Triangle::Intersect(). Default
+// constructed, it is set up by Init() when the first block is tested.
+struct BfpRay {
+    BfpRay() = default;
+    BfpRay(const Ray &ray) { Init(ray); }
+    void Init(const Ray &ray);
+    bool Initialized() const { return kz >= 0; }
+    int kx, ky, kz = -1;
+    Float Sx, Sy;
+};
+
+// The vertices of up to MaxTriangles triangles (a BVH leaf) as three
+// coordinate blocks sharing one exponent, relative to the center of their
+// bounds. The signed mantissas are kept one row per coordinate and vertex,
+// so the kernels of bfpkernels.h test a ray against four (AVX2) or two
+// (SSE4.2) triangles at a time with the watertight edge functions evaluated
+// on the integers.
+//
+// The test only culls: a triangle is reported as missed when the error
+// bound of the fixed-point edge functions (and of the float test itself)
+// still proves the miss. Everything else, including rays whose origin is
+// too far away for the block's exponent range, is left to the float
+// Triangle::Intersect(), so results match the float path exactly.
+class BfpTriangleBlock {
+  public:
+    static constexpr int MaxTriangles = 8;
+    // element 3 * i + j holds vertex j of triangle i; mantissas with the
+    // implicit bit fit in 15 bits, so signed ones fit in an int16_t
+    typedef BfpBlock<14, 8, 3 * MaxTriangles> Block;
+
+    // p[3 * i + j]: vertex j of triangle i
+    BfpTriangleBlock(const Point3f *p, int nTriangles);
+
+    // bit i set: _ray_ certainly misses triangle i within [0, ray.tMax]
+    uint32_t Misses(const Ray &ray, const BfpRay &r) const;
+
+  private:
+    Point3f center;
+    // one over the grid spacing of the mantissas; 0 if all vertices were
+    // flushed to zero
+    double invUlp;
+    int nTriangles;
+    // v[a][j][i]: coordinate a of vertex j of triangle i, 0 past
+    // _nTriangles_
+    int16_t v[3][3][MaxTriangles];
+};
+
+}  // namespace pbrt
+#endif
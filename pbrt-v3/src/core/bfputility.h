@@ -4,16 +4,12 @@
 #include <stdint.h>
 
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
-#define BFP_MANTISSA_LENGTH 23
-#define FIXED_POINT_LENGTH 24
-#define BFP_EXPONENT_LENGTH 8
-#define BFP_BIAS ((1 << (BFP_EXPONENT_LENGTH - 1)) - 1)
-
 #define DOUBLE_BIAS 1023
 #define DOUBLE_MANTISSA_LENGTH 52
 #define DOUBLE_EXPONENT_LENGTH 11
@@ -35,6 +31,19 @@ std::string BitString(uint16_t num, uint32_t len);
 std::string BitStringWithSpace(uint64_t num, uint32_t len);
 /* rounding */
 int64_t RoundToNearestEven(int64_t num, int point);
+/* number of significant bits, 0 for 0 */
+inline int BitLength(uint64_t num) {
+#if defined(__GNUC__) || defined(__clang__)
+    return num ? 64 - __builtin_clzll(num) : 0;
+#else
+    int len = 0;
+    while (num) {
+        num >>= 1;
+        len++;
+    }
+    return len;
+#endif
+}
 }  // namespace pbrt
 
 #endif
\ No newline at end of file
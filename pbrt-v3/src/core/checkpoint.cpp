@@ -0,0 +1,169 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/checkpoint.cpp*
+#include "checkpoint.h"
+#include "film.h"
+#include "stats.h"
+#include <cstdio>
+#include <fstream>
+
+namespace pbrt {
+
+STAT_COUNTER("Checkpoint/Checkpoints written", nCheckpointsWritten);
+STAT_COUNTER("Checkpoint/Tiles restored", nTilesRestored);
+
+static const char checkpointMagic[8] = {'P', 'B', 'R', 'T', 'C', 'K', 'P', 'T'};
+static PBRT_CONSTEXPR int32_t checkpointVersion = 1;
+
+// RenderCheckpoint Method Definitions
+RenderCheckpoint::RenderCheckpoint(Film *film, const std::string &description,
+                                   int nTiles)
+    : film(film),
+      description(description),
+      filename(film->filename + ".ckpt"),
+      tileSamples(nTiles, 0),
+      interval(PbrtOptions.checkpointInterval),
+      lastWrite(std::chrono::steady_clock::now()) {}
+
+bool RenderCheckpoint::Restore() {
+    if (!PbrtOptions.resume) return false;
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        Warning("No checkpoint \"%s\" to resume from; starting over.",
+                filename.c_str());
+        return false;
+    }
+    char magic[8];
+    int32_t version, descriptionLength, nTiles;
+    in.read(magic, sizeof(magic));
+    in.read((char *)&version, sizeof(version));
+    in.read((char *)&descriptionLength, sizeof(descriptionLength));
+    std::string desc(std::max(descriptionLength, 0), ' ');
+    if (in && descriptionLength > 0) in.read(&desc[0], descriptionLength);
+    in.read((char *)&nTiles, sizeof(nTiles));
+    if (!in || memcmp(magic, checkpointMagic, sizeof(magic)) != 0 ||
+        version != checkpointVersion || desc != description ||
+        nTiles != (int)tileSamples.size()) {
+        Warning("Checkpoint \"%s\" is not for this render; starting over.",
+                filename.c_str());
+        return false;
+    }
+    std::vector<int64_t> samples(nTiles);
+    in.read((char *)samples.data(), nTiles * sizeof(int64_t));
+    uint64_t stateSize = 0;
+    in.read((char *)&stateSize, sizeof(stateSize));
+    std::vector<double> savedState;
+    if (in && stateSize < (1ull << 40)) {
+        savedState.resize(stateSize);
+        in.read((char *)savedState.data(), stateSize * sizeof(double));
+    }
+    if (!in || savedState.size() != stateSize || !film->ReadPixelState(in)) {
+        Warning("Unable to read checkpoint \"%s\"; starting over.",
+                filename.c_str());
+        return false;
+    }
+
+    tileSamples = std::move(samples);
+    state = std::move(savedState);
+    for (int64_t s : tileSamples)
+        if (s > 0) ++nTilesRestored;
+    LOG(INFO) << "Resumed from checkpoint " << filename;
+    return true;
+}
+
+void RenderCheckpoint::CommitTile(int tileIndex, int64_t samplesDone,
+                                  const std::function<void()> &commit) {
+    if (!Enabled()) {
+        commit();
+        tileSamples[tileIndex] = samplesDone;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    commit();
+    tileSamples[tileIndex] = samplesDone;
+    std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (std::chrono::duration<Float>(now - lastWrite).count() >= interval) {
+        Write();
+        // Measure the interval from the end of the write, so that slow
+        // writes of large films do not take up all of the render time
+        lastWrite = std::chrono::steady_clock::now();
+    }
+}
+
+void RenderCheckpoint::Write() {
+    ProfilePhase _(Prof::WriteCheckpoint);
+    if (saveState) saveState(&state);
+    // Write to a temporary file and rename it over the old checkpoint so
+    // that an interrupted write leaves the previous checkpoint intact
+    std::string tempFilename = filename + ".tmp";
+    {
+        std::ofstream out(tempFilename, std::ios::binary | std::ios::trunc);
+        int32_t descriptionLength = description.size();
+        int32_t nTiles = tileSamples.size();
+        uint64_t stateSize = state.size();
+        out.write(checkpointMagic, sizeof(checkpointMagic));
+        out.write((const char *)&checkpointVersion, sizeof(checkpointVersion));
+        out.write((const char *)&descriptionLength, sizeof(descriptionLength));
+        out.write(description.data(), descriptionLength);
+        out.write((const char *)&nTiles, sizeof(nTiles));
+        out.write((const char *)tileSamples.data(),
+                  nTiles * sizeof(int64_t));
+        out.write((const char *)&stateSize, sizeof(stateSize));
+        out.write((const char *)state.data(), stateSize * sizeof(double));
+        film->WritePixelState(out);
+        out.flush();
+        if (!out) {
+            Warning("Error writing checkpoint \"%s\".", tempFilename.c_str());
+            return;
+        }
+    }
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        // Windows does not replace existing files with rename()
+        std::remove(filename.c_str());
+        if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            Warning("Unable to rename checkpoint to \"%s\".",
+                    filename.c_str());
+            return;
+        }
+    }
+    ++nCheckpointsWritten;
+    LOG(INFO) << "Wrote checkpoint " << filename;
+}
+
+void RenderCheckpoint::Finish() {
+    if (Enabled() || PbrtOptions.resume) std::remove(filename.c_str());
+}
+
+}  // namespace pbrt
@@ -0,0 +1,99 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_CHECKPOINT_H
+#define PBRT_CORE_CHECKPOINT_H
+
+// core/checkpoint.h*
+#include "pbrt.h"
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+namespace pbrt {
+
+// RenderCheckpoint Declarations
+// Periodically saves the progress of a tiled render to
+// "<image file>.ckpt": the film's accumulated pixel sums, the number of
+// samples each tile has taken and any extra integrator state, so that a
+// render interrupted by --checkpoint can be continued with --resume. Tile
+// sampler seeds are a function of the tile and pass, so they need not be
+// stored. Tile results must be handed to the film through CommitTile(), so
+// that a checkpoint never includes the samples of a tile in flight.
+class RenderCheckpoint {
+  public:
+    // RenderCheckpoint Public Methods
+    // _description_ identifies the integrator and its settings; checkpoints
+    // written with another description or film are not resumed
+    RenderCheckpoint(Film *film, const std::string &description, int nTiles);
+    // Whether periodic checkpoints are being written
+    bool Enabled() const { return interval > 0; }
+    // Loads the checkpoint when --resume was given; returns false and
+    // leaves the film untouched if there is none or it does not match
+    bool Restore();
+    int64_t TileSamples(int tileIndex) const { return tileSamples[tileIndex]; }
+    // Records that the tile has taken its first _samplesDone_ samples after
+    // running _commit_, which adds them to the film (and to any state that
+    // _saveState_ writes); writes a checkpoint once the interval has passed
+    void CommitTile(int tileIndex, int64_t samplesDone,
+                    const std::function<void()> &commit);
+    // Removes the checkpoint file once the final image has been written
+    void Finish();
+
+    // RenderCheckpoint Public Data
+    // Integrator state: filled by Restore() and, for writing, by
+    // _saveState_, which is called with no tile commit in progress
+    std::vector<double> state;
+    std::function<void(std::vector<double> *)> saveState;
+
+  private:
+    // RenderCheckpoint Private Methods
+    void Write();
+
+    // RenderCheckpoint Private Data
+    Film *film;
+    const std::string description, filename;
+    std::vector<int64_t> tileSamples;
+    const Float interval;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point lastWrite;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_CHECKPOINT_H
@@ -33,10 +33,21 @@
 
 // core/fileutil.cpp*
 #include "fileutil.h"
+#include "stringprint.h"
 #include <cstdlib>
 #include <climits>
+#include <atomic>
+#include <cstdio>
 #ifndef PBRT_IS_WINDOWS
 #include <libgen.h>
+#include <unistd.h>
+#else
+#include <windows.h>  // Windows file mapping and renaming API
+#endif
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 namespace pbrt {
@@ -126,4 +137,85 @@ void SetSearchDirectory(const std::string &dirname) {
     searchDirectory = dirname;
 }
 
+std::string TemporaryFilename(const std::string &filename) {
+    static std::atomic<int> counter{0};
+#ifdef PBRT_IS_WINDOWS
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = getpid();
+#endif
+    return StringPrintf("%s.%lu.%d.tmp", filename.c_str(), pid, counter++);
+}
+
+bool ReplaceFileWith(const std::string &filename, const std::string &from) {
+#ifdef PBRT_IS_WINDOWS
+    return MoveFileExA(from.c_str(), filename.c_str(),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(from.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string &filename) {
+    std::unique_ptr<MappedFile> file(new MappedFile);
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat stat;
+    if (fstat(fd, &stat) != 0) {
+        close(fd);
+        return nullptr;
+    }
+    file->size = stat.st_size;
+    if (file->size > 0) {
+        void *ptr = mmap(0, file->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr != MAP_FAILED) {
+            file->data = (const char *)ptr;
+            file->mapped = true;
+        }
+    }
+    close(fd);
+    if (file->mapped || file->size == 0) return file;
+#elif defined(PBRT_IS_WINDOWS)
+    HANDLE fileHandle =
+        CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (fileHandle == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER liLen;
+    if (GetFileSizeEx(fileHandle, &liLen) && liLen.QuadPart > 0) {
+        file->size = liLen.QuadPart;
+        HANDLE mapping =
+            CreateFileMapping(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping) {
+            file->data =
+                (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            file->mapped = file->data != nullptr;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(fileHandle);
+    if (file->mapped) return file;
+#endif
+    // Read the file instead
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return nullptr;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        file->contents.insert(file->contents.end(), buf, buf + n);
+    fclose(f);
+    file->data = file->contents.data();
+    file->size = file->contents.size();
+    return file;
+}
+
+MappedFile::~MappedFile() {
+    if (!mapped) return;
+#ifdef PBRT_HAVE_MMAP
+    munmap((void *)data, size);
+#elif defined(PBRT_IS_WINDOWS)
+    UnmapViewOfFile(data);
+#endif
+}
+
 }  // namespace pbrt
@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include <string>
 #include <cctype>
+#include <memory>
 #include <string.h>
 
 namespace pbrt {
@@ -52,6 +53,12 @@ std::string AbsolutePath(const std::string &filename);
 std::string ResolveFilename(const std::string &filename);
 std::string DirectoryContaining(const std::string &filename);
 void SetSearchDirectory(const std::string &dirname);
+// Returns a name for a temporary file next to _filename_ that no other
+// thread or process uses
+std::string TemporaryFilename(const std::string &filename);
+// Replaces _filename_ with the file _from_; other processes see either the
+// old file or the new one, never neither
+bool ReplaceFileWith(const std::string &filename, const std::string &from);
 
 inline bool HasExtension(const std::string &value, const std::string &ending) {
     if (ending.size() > value.size()) return false;
@@ -60,6 +67,24 @@ inline bool HasExtension(const std::string &value, const std::string &ending) {
         [](char a, char b) { return std::tolower(a) == std::tolower(b); });
 }
 
+// Read-only memory mapping of a whole file; on systems without file
+// mapping, a copy of its contents
+class MappedFile {
+  public:
+    // Returns nullptr if the file cannot be opened
+    static std::unique_ptr<MappedFile> Open(const std::string &filename);
+    ~MappedFile();
+    const char *Data() const { return data; }
+    size_t Size() const { return size; }
+
+  private:
+    MappedFile() = default;
+    const char *data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::vector<char> contents;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_FILEUTIL_H
@@ -40,17 +40,26 @@
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
+STAT_PERCENT("Film/Tile merges that waited for the lock", contendedMerges,
+             lockedMerges);
+STAT_RATIO("Film/CAS retries per lock-free tile merge", mergeRetries,
+           lockFreeMerges);
+STAT_PERCENT("Film/Atomic splats that retried", retriedSplats, atomicSplats);
+STAT_COUNTER("Film/Per-thread splats", threadSplats);
 
 // Film Method Definitions
 Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
            std::unique_ptr<Filter> filt, Float diagonal,
-           const std::string &filename, Float scale, Float maxSampleLuminance)
+           const std::string &filename, Float scale, Float maxSampleLuminance,
+           bool bfpPixels, bool lockFree)
     : fullResolution(resolution),
       diagonal(diagonal * .001),
       filter(std::move(filt)),
       filename(filename),
       scale(scale),
-      maxSampleLuminance(maxSampleLuminance) {
+      maxSampleLuminance(maxSampleLuminance),
+      bfpPixels(bfpPixels),
+      lockFree(lockFree) {
     // Compute film image bounds
     croppedPixelBounds =
         Bounds2i(Point2i(std::ceil(fullResolution.x * cropWindow.pMin.x),
@@ -62,8 +71,31 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
         croppedPixelBounds;
 
     // Allocate film image storage
-    pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
-    filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    if (bfpPixels) {
+        Vector2i res = croppedPixelBounds.Diagonal();
+        nBfpBlocksX = (res.x + bfpBlockWidth - 1) / bfpBlockWidth;
+        nBfpBlocks =
+            nBfpBlocksX * ((res.y + bfpBlockWidth - 1) / bfpBlockWidth);
+        bfpBlocks.reset(new BfpPixels[nBfpBlocks]);
+        filmPixelMemory += nBfpBlocks * sizeof(BfpPixels);
+        Clear();
+    } else {
+        pixels =
+            std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
+        filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+        if (lockFree) {
+            lockFreePixels.reset(new LockFreePixel[croppedPixelBounds.Area()]);
+            filmPixelMemory +=
+                croppedPixelBounds.Area() * sizeof(LockFreePixel);
+        }
+    }
+
+    if (lockFree) {
+        int nBands = (croppedPixelBounds.Diagonal().y + splatBandRows - 1) /
+                     splatBandRows;
+        threadSplatXYZ.resize(MaxThreadIndex());
+        for (auto &bands : threadSplatXYZ) bands.resize(nBands);
+    }
 
     // Precompute filter weight table
     int offset = 0;
@@ -92,7 +124,8 @@ Bounds2f Film::GetPhysicalExtent() const {
     return Bounds2f(Point2f(-x / 2, -y / 2), Point2f(x / 2, y / 2));
 }
 
-std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds) {
+std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds,
+                                            bool recordMoments) {
     // Bound image pixels that samples in _sampleBounds_ contribute to
     Vector2f halfPixel = Vector2f(0.5f, 0.5f);
     Bounds2f floatBounds = (Bounds2f)sampleBounds;
@@ -102,10 +135,23 @@ std::unique_ptr<FilmTile> Film::GetFilmTile(const Bounds2i &sampleBounds) {
     Bounds2i tilePixelBounds = Intersect(Bounds2i(p0, p1), croppedPixelBounds);
     return std::unique_ptr<FilmTile>(new FilmTile(
         tilePixelBounds, filter->radius, filterTable, filterTableWidth,
-        maxSampleLuminance));
+        maxSampleLuminance, recordMoments));
 }
 
 void Film::Clear() {
+    ClearLockFreeSums();
+    if (bfpPixels) {
+        const double zeros[PixelBlock::Capacity] = {};
+        const PixelBlock zero(zeros, bfpBlockWidth * bfpBlockWidth);
+        for (int b = 0; b < nBfpBlocks; ++b) {
+            for (int c = 0; c < 3; ++c) bfpBlocks[b].xyz[c] = zero;
+            bfpBlocks[b].filterWeightSum = zero;
+        }
+        if (bfpSplatXYZ)
+            for (int i = 0; i < 3 * croppedPixelBounds.Area(); ++i)
+                bfpSplatXYZ[i] = 0;
+        return;
+    }
     for (Point2i p : croppedPixelBounds) {
         Pixel &pixel = GetPixel(p);
         for (int c = 0; c < 3; ++c)
@@ -114,10 +160,69 @@ void Film::Clear() {
     }
 }
 
+void Film::ClearLockFreeSums() {
+    if (lockFreePixels)
+        for (int i = 0; i < croppedPixelBounds.Area(); ++i) {
+            for (int c = 0; c < 3; ++c) lockFreePixels[i].xyz[c] = 0;
+            lockFreePixels[i].filterWeightSum = 0;
+        }
+    int bandValues = 3 * splatBandRows * croppedPixelBounds.Diagonal().x;
+    for (const auto &bands : threadSplatXYZ)
+        for (const auto &band : bands)
+            if (band) std::fill(band.get(), band.get() + bandValues, Float(0));
+}
+
+void Film::AddLockFreeSums(int offset, Float xyz[3], Float *filterWeightSum,
+                           Float splatXYZ[3]) const {
+    if (lockFreePixels) {
+        const LockFreePixel &pixel = lockFreePixels[offset];
+        for (int i = 0; i < 3; ++i) xyz[i] += pixel.xyz[i];
+        *filterWeightSum += pixel.filterWeightSum;
+    }
+    int bandPixels = splatBandRows * croppedPixelBounds.Diagonal().x;
+    int band = offset / bandPixels, bandOffset = offset % bandPixels;
+    for (const auto &bands : threadSplatXYZ)
+        if (bands[band])
+            for (int i = 0; i < 3; ++i)
+                splatXYZ[i] += bands[band][3 * bandOffset + i];
+}
+
+std::unique_lock<std::mutex> Film::LockForMerge() {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    ++lockedMerges;
+    if (!lock.owns_lock()) {
+        ++contendedMerges;
+        lock.lock();
+    }
+    return lock;
+}
+
 void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile) {
     ProfilePhase p(Prof::MergeFilmTile);
     VLOG(1) << "Merging film tile " << tile->pixelBounds;
-    std::lock_guard<std::mutex> lock(mutex);
+    if (bfpPixels) {
+        MergeBfpFilmTile(*tile);
+        return;
+    }
+    if (lockFree) {
+        // Tiles only overlap along the filter radius, so the atomic adds
+        // rarely have to retry
+        int64_t retries = 0;
+        for (Point2i pixel : tile->GetPixelBounds()) {
+            const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
+            LockFreePixel &mergePixel = lockFreePixels[PixelOffset(pixel)];
+            Float xyz[3];
+            tilePixel.contribSum.ToXYZ(xyz);
+            for (int i = 0; i < 3; ++i)
+                retries += mergePixel.xyz[i].Add(xyz[i]);
+            retries +=
+                mergePixel.filterWeightSum.Add(tilePixel.filterWeightSum);
+        }
+        mergeRetries += retries;
+        ++lockFreeMerges;
+        return;
+    }
+    std::unique_lock<std::mutex> lock = LockForMerge();
     for (Point2i pixel : tile->GetPixelBounds()) {
         // Merge _pixel_ into _Film::pixels_
         const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
@@ -129,11 +234,97 @@ void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile) {
     }
 }
 
-void Film::SetImage(const Spectrum *img) const {
+void Film::MergeBfpFilmTile(const FilmTile &tile) {
+    // Convert the tile to blocks on the film's block grid outside the lock
+    Bounds2i tileBounds = tile.GetPixelBounds();
+    if (tileBounds.pMin.x >= tileBounds.pMax.x ||
+        tileBounds.pMin.y >= tileBounds.pMax.y)
+        return;
+    Point2i b0(
+        (tileBounds.pMin.x - croppedPixelBounds.pMin.x) / bfpBlockWidth,
+        (tileBounds.pMin.y - croppedPixelBounds.pMin.y) / bfpBlockWidth);
+    Point2i b1(
+        (tileBounds.pMax.x - 1 - croppedPixelBounds.pMin.x) / bfpBlockWidth,
+        (tileBounds.pMax.y - 1 - croppedPixelBounds.pMin.y) / bfpBlockWidth);
+    std::vector<int> blockIndices;
+    std::vector<BfpPixels> tileBlocks;
+    const int blockArea = bfpBlockWidth * bfpBlockWidth;
+    for (int by = b0.y; by <= b1.y; ++by)
+        for (int bx = b0.x; bx <= b1.x; ++bx) {
+            double v[4][PixelBlock::Capacity] = {};
+            Point2i pMin = croppedPixelBounds.pMin +
+                           Vector2i(bx, by) * bfpBlockWidth;
+            Bounds2i blockBounds =
+                Intersect(Bounds2i(pMin, pMin + Vector2i(bfpBlockWidth,
+                                                         bfpBlockWidth)),
+                          tileBounds);
+            for (Point2i pixel : blockBounds) {
+                const FilmTilePixel &tilePixel = tile.GetPixel(pixel);
+                Float xyz[3];
+                tilePixel.contribSum.ToXYZ(xyz);
+                int e = (pixel.y - pMin.y) * bfpBlockWidth + pixel.x - pMin.x;
+                for (int c = 0; c < 3; ++c) v[c][e] = xyz[c];
+                v[3][e] = tilePixel.filterWeightSum;
+            }
+            BfpPixels blocks;
+            for (int c = 0; c < 3; ++c)
+                blocks.xyz[c] = PixelBlock(v[c], blockArea);
+            blocks.filterWeightSum = PixelBlock(v[3], blockArea);
+            blockIndices.push_back(by * nBfpBlocksX + bx);
+            tileBlocks.push_back(blocks);
+        }
+
+    std::unique_lock<std::mutex> lock = LockForMerge();
+    for (size_t i = 0; i < tileBlocks.size(); ++i) {
+        BfpPixels &merge = bfpBlocks[blockIndices[i]];
+        for (int c = 0; c < 3; ++c)
+            merge.xyz[c] = merge.xyz[c].Add1D(tileBlocks[i].xyz[c]);
+        merge.filterWeightSum =
+            merge.filterWeightSum.Add1D(tileBlocks[i].filterWeightSum);
+    }
+}
+
+void Film::GetBfpPixel(const Point2i &p, Float xyz[3],
+                       Float *filterWeightSum) const {
+    int block, element;
+    BfpPixelOffset(p, &block, &element);
+    const BfpPixels &blocks = bfpBlocks[block];
+    for (int c = 0; c < 3; ++c) xyz[c] = (Float)blocks.xyz[c].Get(element);
+    *filterWeightSum = (Float)blocks.filterWeightSum.Get(element);
+}
+
+void Film::SetImage(const Spectrum *img) {
     int nPixels = croppedPixelBounds.Area();
+    ClearLockFreeSums();
+    if (bfpPixels) {
+        // Gather each block's pixels and replace its contents
+        const int blockArea = bfpBlockWidth * bfpBlockWidth;
+        int width = croppedPixelBounds.Diagonal().x;
+        for (int b = 0; b < nBfpBlocks; ++b) {
+            double v[4][PixelBlock::Capacity] = {};
+            int x0 = (b % nBfpBlocksX) * bfpBlockWidth;
+            int y0 = (b / nBfpBlocksX) * bfpBlockWidth;
+            for (int e = 0; e < blockArea; ++e) {
+                int x = x0 + e % bfpBlockWidth, y = y0 + e / bfpBlockWidth;
+                if (x >= width || y * width + x >= nPixels) continue;
+                Float xyz[3];
+                img[y * width + x].ToXYZ(xyz);
+                for (int c = 0; c < 3; ++c) v[c][e] = xyz[c];
+                v[3][e] = 1;
+            }
+            for (int c = 0; c < 3; ++c)
+                bfpBlocks[b].xyz[c] = PixelBlock(v[c], blockArea);
+            bfpBlocks[b].filterWeightSum = PixelBlock(v[3], blockArea);
+        }
+        if (bfpSplatXYZ)
+            for (int i = 0; i < 3 * nPixels; ++i) bfpSplatXYZ[i] = 0;
+        return;
+    }
     for (int i = 0; i < nPixels; ++i) {
         Pixel &p = pixels[i];
-        img[i].ToXYZ(p.xyz);
+        Float xyz[3];
+        img[i].ToXYZ(xyz);
+        for (int c = 0; c < 3; ++c) p.xyz[c] = xyz[c];
         p.filterWeightSum = 1;
         p.splatXYZ[0] = p.splatXYZ[1] = p.splatXYZ[2] = 0;
     }
@@ -162,8 +353,37 @@ void Film::AddSplat(const Point2f &p, Spectrum v) {
         v *= maxSampleLuminance / v.y();
     Float xyz[3];
     v.ToXYZ(xyz);
-    Pixel &pixel = GetPixel(pi);
-    for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+    Vector2i d = pi - croppedPixelBounds.pMin;
+    int offset = d.y * croppedPixelBounds.Diagonal().x + d.x;
+    if (lockFree && ThreadIndex < (int)threadSplatXYZ.size()) {
+        int width = croppedPixelBounds.Diagonal().x, band = d.y / splatBandRows;
+        std::unique_ptr<Float[]> &buffer = threadSplatXYZ[ThreadIndex][band];
+        if (!buffer) {
+            int nValues = 3 * splatBandRows * width;
+            buffer.reset(new Float[nValues]());
+            filmPixelMemory += nValues * sizeof(Float);
+        }
+        int bandOffset = (d.y - band * splatBandRows) * width + d.x;
+        for (int i = 0; i < 3; ++i) buffer[3 * bandOffset + i] += xyz[i];
+        ++threadSplats;
+        return;
+    }
+
+    int retries = 0;
+    if (bfpPixels) {
+        int nPixels = croppedPixelBounds.Area();
+        std::call_once(bfpSplatsAllocated, [&]() {
+            bfpSplatXYZ.reset(new AtomicFloat[3 * nPixels]);
+            filmPixelMemory += 3 * nPixels * sizeof(AtomicFloat);
+        });
+        for (int i = 0; i < 3; ++i)
+            retries += bfpSplatXYZ[3 * offset + i].Add(xyz[i]);
+    } else {
+        Pixel &pixel = GetPixel(pi);
+        for (int i = 0; i < 3; ++i) retries += pixel.splatXYZ[i].Add(xyz[i]);
+    }
+    ++atomicSplats;
+    if (retries > 0) ++retriedSplats;
 }
 
 void Film::WriteImage(Float splatScale) {
@@ -171,14 +391,54 @@ void Film::WriteImage(Float splatScale) {
     LOG(INFO) <<
         "Converting image to RGB and computing final weighted pixel values";
     std::unique_ptr<Float[]> rgb(new Float[3 * croppedPixelBounds.Area()]);
+
+    // Sum the per-thread splat buffers, a band of rows per task
+    bool anyThreadSplats = false;
+    for (const auto &bands : threadSplatXYZ)
+        for (const auto &band : bands) anyThreadSplats |= band != nullptr;
+    std::unique_ptr<Float[]> threadSplatSum;
+    if (anyThreadSplats) {
+        Vector2i res = croppedPixelBounds.Diagonal();
+        int bandValues = 3 * splatBandRows * res.x;
+        threadSplatSum.reset(new Float[3 * res.x * res.y]());
+        ParallelFor([&](int64_t band) {
+            Float *sum = &threadSplatSum[band * bandValues];
+            int n = std::min(bandValues, 3 * res.x * res.y -
+                                             (int)band * bandValues);
+            for (const auto &bands : threadSplatXYZ)
+                if (bands[band])
+                    for (int i = 0; i < n; ++i) sum[i] += bands[band][i];
+        }, threadSplatXYZ[0].size());
+    }
+
     int offset = 0;
     for (Point2i p : croppedPixelBounds) {
         // Convert pixel XYZ color to RGB
-        Pixel &pixel = GetPixel(p);
-        XYZToRGB(pixel.xyz, &rgb[3 * offset]);
+        Float xyz[3], filterWeightSum, splatXYZ[3] = {0, 0, 0};
+        if (bfpPixels) {
+            GetBfpPixel(p, xyz, &filterWeightSum);
+            if (bfpSplatXYZ)
+                for (int i = 0; i < 3; ++i)
+                    splatXYZ[i] = bfpSplatXYZ[3 * offset + i];
+        } else {
+            Pixel &pixel = GetPixel(p);
+            for (int i = 0; i < 3; ++i) {
+                xyz[i] = pixel.xyz[i];
+                splatXYZ[i] = pixel.splatXYZ[i];
+            }
+            filterWeightSum = pixel.filterWeightSum;
+            if (lockFreePixels) {
+                const LockFreePixel &lockFreePixel = lockFreePixels[offset];
+                for (int i = 0; i < 3; ++i) xyz[i] += lockFreePixel.xyz[i];
+                filterWeightSum += lockFreePixel.filterWeightSum;
+            }
+        }
+        if (threadSplatSum)
+            for (int i = 0; i < 3; ++i)
+                splatXYZ[i] += threadSplatSum[3 * offset + i];
+        XYZToRGB(xyz, &rgb[3 * offset]);
 
         // Normalize pixel with weight sum
-        Float filterWeightSum = pixel.filterWeightSum;
         if (filterWeightSum != 0) {
             Float invWt = (Float)1 / filterWeightSum;
             rgb[3 * offset] = std::max((Float)0, rgb[3 * offset] * invWt);
@@ -190,8 +450,6 @@ void Film::WriteImage(Float splatScale) {
 
         // Add splat value at pixel
         Float splatRGB[3];
-        Float splatXYZ[3] = {pixel.splatXYZ[0], pixel.splatXYZ[1],
-                             pixel.splatXYZ[2]};
         XYZToRGB(splatXYZ, splatRGB);
         rgb[3 * offset] += splatScale * splatRGB[0];
         rgb[3 * offset + 1] += splatScale * splatRGB[1];
@@ -210,6 +468,89 @@ void Film::WriteImage(Float splatScale) {
     pbrt::WriteImage(filename, &rgb[0], croppedPixelBounds, fullResolution);
 }
 
+// Per pixel: XYZ sums, filter weight sum and splatted XYZ
+static PBRT_CONSTEXPR int pixelStateValues = 7;
+
+void Film::WritePixelState(std::ostream &out) const {
+    int32_t header[5] = {croppedPixelBounds.pMin.x, croppedPixelBounds.pMin.y,
+                         croppedPixelBounds.pMax.x, croppedPixelBounds.pMax.y,
+                         (int32_t)sizeof(Float)};
+    out.write((const char *)header, sizeof(header));
+    std::vector<Float> values(pixelStateValues * croppedPixelBounds.Area());
+    int offset = 0;
+    for (Point2i p : croppedPixelBounds) {
+        Float *v = &values[pixelStateValues * offset];
+        if (bfpPixels) {
+            GetBfpPixel(p, v, &v[3]);
+            if (bfpSplatXYZ)
+                for (int i = 0; i < 3; ++i)
+                    v[4 + i] = bfpSplatXYZ[3 * offset + i];
+        } else {
+            const Pixel &pixel = pixels[offset];
+            for (int i = 0; i < 3; ++i) {
+                v[i] = pixel.xyz[i];
+                v[4 + i] = pixel.splatXYZ[i];
+            }
+            v[3] = pixel.filterWeightSum;
+        }
+        AddLockFreeSums(offset, v, &v[3], &v[4]);
+        ++offset;
+    }
+    out.write((const char *)values.data(), values.size() * sizeof(Float));
+}
+
+bool Film::ReadPixelState(std::istream &in) {
+    int32_t header[5];
+    in.read((char *)header, sizeof(header));
+    if (!in || header[0] != croppedPixelBounds.pMin.x ||
+        header[1] != croppedPixelBounds.pMin.y ||
+        header[2] != croppedPixelBounds.pMax.x ||
+        header[3] != croppedPixelBounds.pMax.y || header[4] != sizeof(Float))
+        return false;
+    const int nPixels = croppedPixelBounds.Area();
+    std::vector<Float> values(pixelStateValues * nPixels);
+    in.read((char *)values.data(), values.size() * sizeof(Float));
+    if (!in) return false;
+
+    ClearLockFreeSums();
+    if (bfpPixels) {
+        // Requantize the sums block by block, as SetImage() does
+        const int blockArea = bfpBlockWidth * bfpBlockWidth;
+        int width = croppedPixelBounds.Diagonal().x;
+        for (int b = 0; b < nBfpBlocks; ++b) {
+            double v[4][PixelBlock::Capacity] = {};
+            int x0 = (b % nBfpBlocksX) * bfpBlockWidth;
+            int y0 = (b / nBfpBlocksX) * bfpBlockWidth;
+            for (int e = 0; e < blockArea; ++e) {
+                int x = x0 + e % bfpBlockWidth, y = y0 + e / bfpBlockWidth;
+                if (x >= width || y * width + x >= nPixels) continue;
+                for (int c = 0; c < 4; ++c)
+                    v[c][e] = values[pixelStateValues * (y * width + x) + c];
+            }
+            for (int c = 0; c < 3; ++c)
+                bfpBlocks[b].xyz[c] = PixelBlock(v[c], blockArea);
+            bfpBlocks[b].filterWeightSum = PixelBlock(v[3], blockArea);
+        }
+        std::call_once(bfpSplatsAllocated, [&]() {
+            bfpSplatXYZ.reset(new AtomicFloat[3 * nPixels]);
+            filmPixelMemory += 3 * nPixels * sizeof(AtomicFloat);
+        });
+        for (int i = 0; i < nPixels; ++i)
+            for (int c = 0; c < 3; ++c)
+                bfpSplatXYZ[3 * i + c] = values[pixelStateValues * i + 4 + c];
+        return true;
+    }
+    for (int i = 0; i < nPixels; ++i) {
+        const Float *v = &values[pixelStateValues * i];
+        for (int c = 0; c < 3; ++c) {
+            pixels[i].xyz[c] = v[c];
+            pixels[i].splatXYZ[c] = v[4 + c];
+        }
+        pixels[i].filterWeightSum = v[3];
+    }
+    return true;
+}
+
 Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
     std::string filename;
     if (PbrtOptions.imageFile != "") {
@@ -247,8 +588,16 @@ Film *CreateFilm(const ParamSet &params, std::unique_ptr<Filter> filter) {
     Float diagonal = params.FindOneFloat("diagonal", 35.);
     Float maxSampleLuminance = params.FindOneFloat("maxsampleluminance",
                                                    Infinity);
+    bool bfpPixels = params.FindOneBool("bfppixels", false);
+    // Lock-free films take 16 more bytes per pixel for the atomic sums and,
+    // with integrators that splat (BDPT, MLT), up to 12 bytes per pixel and
+    // thread for the splat buffers
+    bool lockFree = params.FindOneBool("lockfree", false);
+    if (lockFree && bfpPixels)
+        Warning("BFP pixels are always merged under a lock; \"lockfree\" "
+                "only applies to splats.");
     return new Film(Point2i(xres, yres), crop, std::move(filter), diagonal,
-                    filename, scale, maxSampleLuminance);
+                    filename, scale, maxSampleLuminance, bfpPixels, lockFree);
 }
 
 }  // namespace pbrt
@@ -45,6 +45,8 @@
 #include "filter.h"
 #include "stats.h"
 #include "parallel.h"
+#include "bfpblock.h"
+#include <mutex>
 
 namespace pbrt {
 
@@ -54,6 +56,12 @@ struct FilmTilePixel {
     Float filterWeightSum = 0.f;
 };
 
+// Luminance moments of the samples inside a pixel, for adaptive sampling
+struct FilmTilePixelMoments {
+    Float lumSum = 0.f, lumSqSum = 0.f;
+    int nSamples = 0;
+};
+
 // Film Declarations
 class Film {
   public:
@@ -61,15 +69,24 @@ class Film {
     Film(const Point2i &resolution, const Bounds2f &cropWindow,
          std::unique_ptr<Filter> filter, Float diagonal,
          const std::string &filename, Float scale,
-         Float maxSampleLuminance = Infinity);
+         Float maxSampleLuminance = Infinity, bool bfpPixels = false,
+         bool lockFree = false);
     Bounds2i GetSampleBounds() const;
     Bounds2f GetPhysicalExtent() const;
-    std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
+    // With _recordMoments_, the tile also records the luminance moments of
+    // each pixel's samples
+    std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds,
+                                          bool recordMoments = false);
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
-    void SetImage(const Spectrum *img) const;
+    void SetImage(const Spectrum *img);
     void AddSplat(const Point2f &p, Spectrum v);
     void WriteImage(Float splatScale = 1);
     void Clear();
+    // The accumulated sums of every pixel, for render checkpoints;
+    // ReadPixelState() returns false if the state is for other pixel
+    // bounds or could not be read
+    void WritePixelState(std::ostream &out) const;
+    bool ReadPixelState(std::istream &in);
 
     // Film Public Data
     const Point2i fullResolution;
@@ -88,19 +105,66 @@ class Film {
         Float pad;
     };
     std::unique_ptr<Pixel[]> pixels;
+    // BFP pixel storage: 8x8 pixel blocks per channel, each with a shared
+    // exponent; tiles are merged with block (integer) adds
+    typedef BfpBlock<15, 8, 64> PixelBlock;
+    static PBRT_CONSTEXPR int bfpBlockWidth = 8;
+    struct BfpPixels {
+        PixelBlock xyz[3], filterWeightSum;
+    };
+    const bool bfpPixels;
+    std::unique_ptr<BfpPixels[]> bfpBlocks;
+    int nBfpBlocksX, nBfpBlocks;
+    // splats are rare, so they are only allocated by the first AddSplat()
+    std::once_flag bfpSplatsAllocated;
+    std::unique_ptr<AtomicFloat[]> bfpSplatXYZ;
     static PBRT_CONSTEXPR int filterTableWidth = 16;
     Float filterTable[filterTableWidth * filterTableWidth];
     std::mutex mutex;
+    // Lock-free accumulation: tiles are merged with atomic adds into
+    // _lockFreePixels_, which are added to _pixels_ wherever the sums are
+    // read. Splats go to per-thread XYZ buffers, _threadSplatXYZ_[thread]
+    // [band], indexed by _ThreadIndex_ and allocated in bands of
+    // _splatBandRows_ rows as a thread first splats into them.
+    const bool lockFree;
+    struct LockFreePixel {
+        AtomicFloat xyz[3], filterWeightSum;
+    };
+    std::unique_ptr<LockFreePixel[]> lockFreePixels;
+    static PBRT_CONSTEXPR int splatBandRows = 16;
+    std::vector<std::vector<std::unique_ptr<Float[]>>> threadSplatXYZ;
     const Float scale;
     const Float maxSampleLuminance;
 
     // Film Private Methods
-    Pixel &GetPixel(const Point2i &p) {
+    int PixelOffset(const Point2i &p) const {
         CHECK(InsideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
-        int offset = (p.x - croppedPixelBounds.pMin.x) +
-                     (p.y - croppedPixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return (p.x - croppedPixelBounds.pMin.x) +
+               (p.y - croppedPixelBounds.pMin.y) * width;
+    }
+    Pixel &GetPixel(const Point2i &p) { return pixels[PixelOffset(p)]; }
+    std::unique_lock<std::mutex> LockForMerge();
+    // The lock-free sums are read and cleared with plain loads and stores,
+    // including other threads' splat buffers, so the two methods below may
+    // only run while no thread merges tiles or adds splats. Their callers
+    // run before or after rendering, except for WritePixelState(), which
+    // the render checkpoint calls under the lock that all tile merges and
+    // splats take while it is enabled.
+    void ClearLockFreeSums();
+    // Adds the sums of the lock-free storage for pixel _offset_ (an index
+    // into _pixels_) to _xyz_, _filterWeightSum_ and _splatXYZ_
+    void AddLockFreeSums(int offset, Float xyz[3], Float *filterWeightSum,
+                         Float splatXYZ[3]) const;
+    void MergeBfpFilmTile(const FilmTile &tile);
+    void GetBfpPixel(const Point2i &p, Float xyz[3],
+                     Float *filterWeightSum) const;
+    // block and element index of pixel _p_ in _bfpBlocks_
+    void BfpPixelOffset(const Point2i &p, int *block, int *element) const {
+        CHECK(InsideExclusive(p, croppedPixelBounds));
+        Vector2i d = p - croppedPixelBounds.pMin;
+        *block = (d.y / bfpBlockWidth) * nBfpBlocksX + d.x / bfpBlockWidth;
+        *element = (d.y % bfpBlockWidth) * bfpBlockWidth + d.x % bfpBlockWidth;
     }
 };
 
@@ -109,7 +173,7 @@ class FilmTile {
     // FilmTile Public Methods
     FilmTile(const Bounds2i &pixelBounds, const Vector2f &filterRadius,
              const Float *filterTable, int filterTableSize,
-             Float maxSampleLuminance)
+             Float maxSampleLuminance, bool recordMoments = false)
         : pixelBounds(pixelBounds),
           filterRadius(filterRadius),
           invFilterRadius(1 / filterRadius.x, 1 / filterRadius.y),
@@ -117,12 +181,24 @@ class FilmTile {
           filterTableSize(filterTableSize),
           maxSampleLuminance(maxSampleLuminance) {
         pixels = std::vector<FilmTilePixel>(std::max(0, pixelBounds.Area()));
+        if (recordMoments)
+            moments = std::vector<FilmTilePixelMoments>(pixels.size());
     }
     void AddSample(const Point2f &pFilm, Spectrum L,
                    Float sampleWeight = 1.) {
         ProfilePhase _(Prof::AddFilmSample);
         if (L.y() > maxSampleLuminance)
             L *= maxSampleLuminance / L.y();
+        if (!moments.empty()) {
+            Point2i pSample = (Point2i)Floor(pFilm);
+            if (InsideExclusive(pSample, pixelBounds)) {
+                FilmTilePixelMoments &m = moments[PixelOffset(pSample)];
+                Float y = L.y() * sampleWeight;
+                m.lumSum += y;
+                m.lumSqSum += y * y;
+                ++m.nSamples;
+            }
+        }
         // Compute sample's raster bounds
         Point2f pFilmDiscrete = pFilm - Vector2f(0.5f, 0.5f);
         Point2i p0 = (Point2i)Ceil(pFilmDiscrete - filterRadius);
@@ -173,15 +249,28 @@ class FilmTile {
             (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
         return pixels[offset];
     }
+    // Only for tiles created with _recordMoments_
+    const FilmTilePixelMoments &GetMoments(const Point2i &p) const {
+        CHECK(!moments.empty());
+        return moments[PixelOffset(p)];
+    }
     Bounds2i GetPixelBounds() const { return pixelBounds; }
 
   private:
+    int PixelOffset(const Point2i &p) const {
+        CHECK(InsideExclusive(p, pixelBounds));
+        int width = pixelBounds.pMax.x - pixelBounds.pMin.x;
+        return (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * width;
+    }
+
     // FilmTile Private Data
     const Bounds2i pixelBounds;
     const Vector2f filterRadius, invFilterRadius;
     const Float *filterTable;
     const int filterTableSize;
     std::vector<FilmTilePixel> pixels;
+    // empty unless the tile records luminance moments
+    std::vector<FilmTilePixelMoments> moments;
     const Float maxSampleLuminance;
     friend class Film;
 };
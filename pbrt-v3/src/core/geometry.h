@@ -1474,6 +1474,22 @@ inline Float SphericalPhi(const Vector3f &v) {
     return (p < 0) ? (p + 2 * Pi) : p;
 }
 
+// DirectionCone Declarations
+// The directions within the angle whose cosine is _cosTheta_ of the unit
+// vector _w_; a default-constructed cone is empty
+struct DirectionCone {
+    DirectionCone() {}
+    DirectionCone(const Vector3f &w, Float cosTheta)
+        : w(Normalize(w)), cosTheta(cosTheta) {}
+    static DirectionCone EntireSphere() {
+        return DirectionCone(Vector3f(0, 0, 1), -1);
+    }
+    bool IsEmpty() const { return cosTheta == Infinity; }
+
+    Vector3f w;
+    Float cosTheta = Infinity;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_GEOMETRY_H
@@ -39,6 +39,9 @@
 
 #include <ImfRgba.h>
 #include <ImfRgbaFile.h>
+#include <ImfTestFile.h>
+#include <ImfTiledRgbaFile.h>
+#include <mutex>
 
 namespace pbrt {
 
@@ -188,6 +191,121 @@ static void WriteImageEXR(const std::string &name, const Float *pixels,
     delete[] hrgba;
 }
 
+bool WriteTiledImageEXR(const std::string &name, const Float *rgb,
+                        const Point2i &resolution, int tileSize) {
+    using namespace Imf;
+    // Filter the MIP levels in full precision; like MIPMap, the last row
+    // or column of a level that is one texel high or wide is repeated
+    std::vector<Float> level(rgb, rgb + 3 * resolution.x * resolution.y);
+    Point2i res = resolution;
+    try {
+        Header header(resolution.x, resolution.y);
+        TiledRgbaOutputFile file(name.c_str(), header, WRITE_RGB, tileSize,
+                                 tileSize, MIPMAP_LEVELS, ROUND_DOWN);
+        for (int l = 0; l < file.numLevels(); ++l) {
+            if (l > 0) {
+                Point2i fineRes = res;
+                res = Point2i(std::max(1, res.x / 2), std::max(1, res.y / 2));
+                std::vector<Float> fine = std::move(level);
+                level.resize(3 * res.x * res.y);
+                auto fineTexel = [&](int s, int t, int c) {
+                    s = std::min(s, fineRes.x - 1);
+                    t = std::min(t, fineRes.y - 1);
+                    return fine[3 * (t * fineRes.x + s) + c];
+                };
+                for (int t = 0; t < res.y; ++t)
+                    for (int s = 0; s < res.x; ++s)
+                        for (int c = 0; c < 3; ++c)
+                            level[3 * (t * res.x + s) + c] =
+                                .25f * (fineTexel(2 * s, 2 * t, c) +
+                                        fineTexel(2 * s + 1, 2 * t, c) +
+                                        fineTexel(2 * s, 2 * t + 1, c) +
+                                        fineTexel(2 * s + 1, 2 * t + 1, c));
+            }
+            std::vector<Rgba> pixels(res.x * res.y);
+            for (size_t i = 0; i < pixels.size(); ++i)
+                pixels[i] =
+                    Rgba(level[3 * i], level[3 * i + 1], level[3 * i + 2]);
+            file.setFrameBuffer(&pixels[0], 1, res.x);
+            file.writeTiles(0, file.numXTiles(l) - 1, 0,
+                            file.numYTiles(l) - 1, l);
+        }
+    } catch (const std::exception &exc) {
+        Error("Error writing \"%s\": %s", name.c_str(), exc.what());
+        return false;
+    }
+    return true;
+}
+
+// TiledImageReader Method Definitions
+struct TiledImageReader::File {
+    File(const std::string &name) : file(name.c_str()) {}
+    Imf::TiledRgbaInputFile file;
+    // Setting the frame buffer and reading tiles must happen together
+    std::mutex mutex;
+};
+
+std::unique_ptr<TiledImageReader> TiledImageReader::Open(
+    const std::string &name) {
+    if (!HasExtension(name, ".exr") || !Imf::isTiledOpenExrFile(name.c_str()))
+        return nullptr;
+    std::unique_ptr<TiledImageReader> reader(new TiledImageReader);
+    try {
+        reader->file.reset(new File(name));
+    } catch (const std::exception &e) {
+        Error("Unable to read image file \"%s\": %s", name.c_str(), e.what());
+        return nullptr;
+    }
+    Imf::TiledRgbaInputFile &exr = reader->file->file;
+    Imath::Box2i dw = exr.dataWindow();
+    reader->resolution =
+        Point2i(dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+    // Only MIP levels that are rounded down match the ones MIPMap uses
+    if (exr.levelMode() == Imf::MIPMAP_LEVELS &&
+        exr.levelRoundingMode() == Imf::ROUND_DOWN)
+        reader->nLevels = exr.numLevels();
+    LOG(INFO) << StringPrintf("Opened tiled EXR image %s (%d x %d)",
+                              name.c_str(), reader->resolution.x,
+                              reader->resolution.y);
+    return reader;
+}
+
+TiledImageReader::~TiledImageReader() {}
+
+bool TiledImageReader::Read(const Bounds2i &bounds, RGBSpectrum *rgb,
+                            int level) {
+    CHECK_LT(level, nLevels);
+    Imf::TiledRgbaInputFile &exr = file->file;
+    // Find the tiles that overlap _bounds_ and the region they cover
+    int tw = exr.tileXSize(), th = exr.tileYSize();
+    int tx0 = bounds.pMin.x / tw, tx1 = (bounds.pMax.x - 1) / tw;
+    int ty0 = bounds.pMin.y / th, ty1 = (bounds.pMax.y - 1) / th;
+    int x0 = tx0 * tw, y0 = ty0 * th;
+    int width = std::min((tx1 + 1) * tw, exr.levelWidth(level)) - x0;
+    int height = std::min((ty1 + 1) * th, exr.levelHeight(level)) - y0;
+
+    std::vector<Imf::Rgba> pixels(width * height);
+    Imath::Box2i dw = exr.dataWindow();
+    try {
+        std::lock_guard<std::mutex> lock(file->mutex);
+        exr.setFrameBuffer(&pixels[0] - (dw.min.x + x0) -
+                               (dw.min.y + y0) * width,
+                           1, width);
+        exr.readTiles(tx0, tx1, ty0, ty1, level);
+    } catch (const std::exception &e) {
+        Error("Unable to read tiles of image file: %s", e.what());
+        return false;
+    }
+
+    for (int y = bounds.pMin.y; y < bounds.pMax.y; ++y)
+        for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x) {
+            const Imf::Rgba &p = pixels[(y - y0) * width + (x - x0)];
+            Float frgb[3] = {p.r, p.g, p.b};
+            *rgb++ = RGBSpectrum::FromRGB(frgb);
+        }
+    return true;
+}
+
 // TGA Function Definitions
 void WriteImageTGA(const std::string &name, const uint8_t *pixels, int xRes,
                    int yRes, int totalXRes, int totalYRes, int xOffset,
@@ -54,6 +54,36 @@ RGBSpectrum *ReadImageEXR(const std::string &name, int *width,
 
 void WriteImage(const std::string &name, const Float *rgb,
                 const Bounds2i &outputBounds, const Point2i &totalResolution);
+// Writes an RGB image as an EXR file stored in _tileSize_ square tiles,
+// which TiledImageReader can read piece by piece, along with its MIP
+// levels; each level averages 2x2 texels of the one before it
+bool WriteTiledImageEXR(const std::string &name, const Float *rgb,
+                        const Point2i &resolution, int tileSize = 64);
+
+// TiledImageReader Declarations
+// Reads arbitrary regions of tiled EXR files, decoding only the tiles that
+// overlap them, so that large textures needn't be held in memory in full
+class TiledImageReader {
+  public:
+    // Returns nullptr if _name_ isn't a tiled EXR file
+    static std::unique_ptr<TiledImageReader> Open(const std::string &name);
+    ~TiledImageReader();
+    Point2i Resolution() const { return resolution; }
+    // The number of MIP levels stored in the file, each half the size of
+    // the one before it, rounded down; one if it has none
+    int Levels() const { return nLevels; }
+    // Reads the pixels in _bounds_ of MIP level _level_, relative to the
+    // image's upper left corner, into _rgb_ in scanline order; safe to
+    // call from multiple threads
+    bool Read(const Bounds2i &bounds, RGBSpectrum *rgb, int level = 0);
+
+  private:
+    TiledImageReader() = default;
+    struct File;
+    std::unique_ptr<File> file;
+    Point2i resolution;
+    int nLevels = 1;
+};
 
 }  // namespace pbrt
 
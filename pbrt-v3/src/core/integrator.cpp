@@ -41,11 +41,19 @@
 #include "integrator.h"
 #include "progressreporter.h"
 #include "camera.h"
+#include "checkpoint.h"
+#include "lightdistrib.h"
 #include "stats.h"
+#include <typeinfo>
 
 namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Integrator/Adaptive sampling passes", adaptivePasses);
+STAT_PERCENT("Integrator/Tile passes skipped by adaptive sampling",
+             skippedTilePasses, tilePasses);
+STAT_INT_DISTRIBUTION("Integrator/Adaptive samples per pixel",
+                      adaptiveSamples);
 
 // Integrator Method Definitions
 Integrator::~Integrator() {}
@@ -105,6 +113,23 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                           scene, sampler, arena, handleMedia) / lightPdf;
 }
 
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia,
+                               const LightDistribution &lightDistrib) {
+    ProfilePhase p(Prof::DirectLighting);
+    // Choose a single light to sample at _it_ using _lightDistrib_
+    if (scene.lights.empty()) return Spectrum(0.f);
+    Float lightPdf;
+    int lightNum = lightDistrib.Sample(it.p, it.n, sampler.Get1D(), &lightPdf);
+    if (lightPdf == 0) return Spectrum(0.f);
+    const std::shared_ptr<Light> &light = scene.lights[lightNum];
+    Point2f uLight = sampler.Get2D();
+    Point2f uScattering = sampler.Get2D();
+    return EstimateDirect(it, uScattering, *light, uLight,
+                          scene, sampler, arena, handleMedia) / lightPdf;
+}
+
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
@@ -224,6 +249,52 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
         new Distribution1D(&lightPower[0], lightPower.size()));
 }
 
+Spectrum CheckRadiance(const Spectrum &L, const Point2i &pixel,
+                              int64_t sampleNum) {
+    // Issue warning if unexpected radiance value returned
+    if (L.HasNaNs()) {
+        LOG(ERROR) << StringPrintf(
+            "Not-a-number radiance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNum);
+        return Spectrum(0.f);
+    } else if (L.y() < -1e-5) {
+        LOG(ERROR) << StringPrintf(
+            "Negative luminance value, %f, returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            L.y(), pixel.x, pixel.y, (int)sampleNum);
+        return Spectrum(0.f);
+    } else if (std::isinf(L.y())) {
+        LOG(ERROR) << StringPrintf(
+            "Infinite luminance value returned "
+            "for pixel (%d, %d), sample %d. Setting to black.",
+            pixel.x, pixel.y, (int)sampleNum);
+        return Spectrum(0.f);
+    }
+    return L;
+}
+
+// Luminance moments of a pixel's samples over all adaptive passes
+struct PixelMoments {
+    double lumSum = 0, lumSqSum = 0;
+    int64_t nSamples = 0;
+};
+
+// Relative standard error of the pixel's mean luminance
+static Float RelativeError(const PixelMoments &m) {
+    if (m.nSamples < 2) return Infinity;
+    double mean = m.lumSum / m.nSamples;
+    double variance = std::max(
+        0., (m.lumSqSum - m.nSamples * mean * mean) / (m.nSamples - 1));
+    return std::sqrt(variance / m.nSamples) / std::max(std::abs(mean), 1e-3);
+}
+
+// Starts _sampler_'s next sample if it is before _endSample_
+static bool NextSample(Sampler &sampler, int64_t endSample) {
+    return sampler.StartNextSample() &&
+           sampler.CurrentSampleNumber() < endSample;
+}
+
 // SamplerIntegrator Method Definitions
 void SamplerIntegrator::Render(const Scene &scene) {
     Preprocess(scene, *sampler);
@@ -235,17 +306,81 @@ void SamplerIntegrator::Render(const Scene &scene) {
     const int tileSize = 16;
     Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
                    (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
-    {
+
+    // Split the samples into passes for adaptive sampling
+    const bool adaptive = adaptiveThreshold > 0 || adaptiveTimeBudget > 0;
+    const int64_t spp = sampler->samplesPerPixel;
+    const int64_t passSamples =
+        adaptive ? std::min(spp, std::max<int64_t>(4, spp / 16)) : spp;
+    const int nPasses = (spp + passSamples - 1) / passSamples;
+    const int nTileCount = nTiles.x * nTiles.y;
+    std::vector<uint8_t> tileConverged(nTileCount, 0);
+    std::vector<PixelMoments> moments(adaptive ? sampleBounds.Area() : 0);
+
+    // Resume from a checkpoint; the adaptive sampling state is saved as the
+    // pixels' moments followed by the tiles' convergence flags
+    RenderCheckpoint checkpoint(
+        camera->film,
+        StringPrintf("%s spp %d pass %d threshold %f budget %f",
+                     typeid(*this).name(), (int)spp, (int)passSamples,
+                     adaptiveThreshold, adaptiveTimeBudget),
+        nTileCount);
+    if (adaptive) {
+        checkpoint.saveState = [&](std::vector<double> *state) {
+            state->clear();
+            for (const PixelMoments &m : moments) {
+                state->push_back(m.lumSum);
+                state->push_back(m.lumSqSum);
+                state->push_back(m.nSamples);
+            }
+            state->insert(state->end(), tileConverged.begin(),
+                          tileConverged.end());
+        };
+    }
+    if (checkpoint.Restore() && adaptive) {
+        const std::vector<double> &state = checkpoint.state;
+        if (state.size() == 3 * moments.size() + nTileCount) {
+            for (size_t i = 0; i < moments.size(); ++i) {
+                moments[i].lumSum = state[3 * i];
+                moments[i].lumSqSum = state[3 * i + 1];
+                moments[i].nSamples = (int64_t)state[3 * i + 2];
+            }
+            for (int i = 0; i < nTileCount; ++i)
+                tileConverged[i] = state[3 * moments.size() + i] != 0;
+        } else
+            Warning("Checkpoint has no adaptive sampling state.");
+    }
+
+    ProgressReporter reporter(nPasses * nTileCount, "Rendering");
+    for (int pass = 0; pass < nPasses; ++pass) {
+        const int64_t firstSample = pass * passSamples;
+        const int64_t endSample = std::min(firstSample + passSamples, spp);
+        std::atomic<int> nTilesRendered(0);
         ParallelFor2D([&](Point2i tile) {
             // Render section of image corresponding to _tile_
+            int tileIndex = tile.y * nTiles.x + tile.x;
+            if (checkpoint.TileSamples(tileIndex) >= endSample) {
+                // Rendered before the checkpoint we resumed from
+                reporter.Update();
+                ++nTilesRendered;
+                return;
+            }
+            if (adaptive) ++tilePasses;
+            if (tileConverged[tileIndex] ||
+                (pass > 0 && adaptiveTimeBudget > 0 &&
+                 reporter.ElapsedMS() > 1000 * adaptiveTimeBudget)) {
+                ++skippedTilePasses;
+                reporter.Update();
+                return;
+            }
 
             // Allocate _MemoryArena_ for tile
             MemoryArena arena;
 
-            // Get sampler instance for tile
-            int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+            // Get sampler instance for tile; every pass uses the tile's seed
+            // so that pixels continue their sample sequences where the
+            // previous pass stopped
+            std::unique_ptr<Sampler> tileSampler = sampler->Clone(tileIndex);
 
             // Compute sample bounds for tile
             int x0 = sampleBounds.pMin.x + tile.x * tileSize;
@@ -257,85 +392,192 @@ void SamplerIntegrator::Render(const Scene &scene) {
 
             // Get _FilmTile_ for tile
             std::unique_ptr<FilmTile> filmTile =
-                camera->film->GetFilmTile(tileBounds);
+                camera->film->GetFilmTile(tileBounds, adaptive);
 
             // Loop over pixels in tile to render them
-            for (Point2i pixel : tileBounds) {
-                {
-                    ProfilePhase pp(Prof::StartPixel);
-                    tileSampler->StartPixel(pixel);
-                }
+            if (batchCameraRays)
+                RenderTileBatched(scene, *tileSampler, tileBounds,
+                                  filmTile.get(), arena, firstSample,
+                                  endSample);
+            else
+                RenderTile(scene, *tileSampler, tileBounds, filmTile.get(),
+                           arena, firstSample, endSample);
+            LOG(INFO) << "Finished image tile " << tileBounds;
 
-                // Do this check after the StartPixel() call; this keeps
-                // the usage of RNG values from (most) Samplers that use
-                // RNGs consistent, which improves reproducability /
-                // debugging.
-                if (!InsideExclusive(pixel, pixelBounds))
-                    continue;
-
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    Float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-                    Spectrum L(0.f);
-                    if (rayWeight > 0) L = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (L.HasNaNs()) {
-                        LOG(ERROR) << StringPrintf(
-                            "Not-a-number radiance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (L.y() < -1e-5) {
-                        LOG(ERROR) << StringPrintf(
-                            "Negative luminance value, %f, returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            L.y(), pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
-                    } else if (std::isinf(L.y())) {
-                          LOG(ERROR) << StringPrintf(
-                            "Infinite luminance value returned "
-                            "for pixel (%d, %d), sample %d. Setting to black.",
-                            pixel.x, pixel.y,
-                            (int)tileSampler->CurrentSampleNumber());
-                        L = Spectrum(0.f);
+            checkpoint.CommitTile(tileIndex, endSample, [&]() {
+                // Accumulate the pixels' luminance moments and check
+                // whether all have converged
+                if (adaptive) {
+                    Float maxError = 0;
+                    for (Point2i pixel : tileBounds) {
+                        if (!InsideExclusive(pixel, pixelBounds)) continue;
+                        const FilmTilePixelMoments &p =
+                            filmTile->GetMoments(pixel);
+                        Vector2i d = pixel - sampleBounds.pMin;
+                        PixelMoments &m = moments[d.y * sampleExtent.x + d.x];
+                        m.lumSum += p.lumSum;
+                        m.lumSqSum += p.lumSqSum;
+                        m.nSamples += p.nSamples;
+                        maxError = std::max(maxError, RelativeError(m));
                     }
-                    VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
-                        ray << " -> L = " << L;
-
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
-
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
-            }
-            LOG(INFO) << "Finished image tile " << tileBounds;
+                    tileConverged[tileIndex] =
+                        adaptiveThreshold > 0 && maxError < adaptiveThreshold;
+                }
 
-            // Merge image tile into _Film_
-            camera->film->MergeFilmTile(std::move(filmTile));
+                // Merge image tile into _Film_
+                camera->film->MergeFilmTile(std::move(filmTile));
+            });
             reporter.Update();
+            ++nTilesRendered;
         }, nTiles);
-        reporter.Done();
+        if (adaptive) ++adaptivePasses;
+        if (nTilesRendered == 0) break;
     }
+    reporter.Done();
+    for (const PixelMoments &m : moments)
+        if (m.nSamples > 0) ReportValue(adaptiveSamples, m.nSamples);
     LOG(INFO) << "Rendering finished";
 
     // Save final image after rendering
     camera->film->WriteImage();
+    checkpoint.Finish();
+}
+
+void SamplerIntegrator::RenderTile(const Scene &scene, Sampler &tileSampler,
+                                   const Bounds2i &tileBounds,
+                                   FilmTile *filmTile, MemoryArena &arena,
+                                   int64_t firstSample,
+                                   int64_t endSample) const {
+    for (Point2i pixel : tileBounds) {
+        {
+            ProfilePhase pp(Prof::StartPixel);
+            tileSampler.StartPixel(pixel);
+        }
+
+        // Do this check after the StartPixel() call; this keeps
+        // the usage of RNG values from (most) Samplers that use
+        // RNGs consistent, which improves reproducability /
+        // debugging.
+        if (!InsideExclusive(pixel, pixelBounds))
+            continue;
+        if (firstSample > 0 && !tileSampler.SetSampleNumber(firstSample))
+            continue;
+
+        do {
+            // Initialize _CameraSample_ for current sample
+            CameraSample cameraSample = tileSampler.GetCameraSample(pixel);
+
+            // Generate camera ray for current sample
+            RayDifferential ray;
+            Float rayWeight =
+                camera->GenerateRayDifferential(cameraSample, &ray);
+            ray.ScaleDifferentials(
+                1 / std::sqrt((Float)tileSampler.samplesPerPixel));
+            ++nCameraRays;
+
+            // Evaluate radiance along camera ray
+            Spectrum L(0.f);
+            if (rayWeight > 0) L = Li(ray, scene, tileSampler, arena);
+            L = CheckRadiance(L, pixel, tileSampler.CurrentSampleNumber());
+            VLOG(1) << "Camera sample: " << cameraSample << " -> ray: " <<
+                ray << " -> L = " << L;
+
+            // Add camera ray's contribution to image
+            filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
+
+            // Free _MemoryArena_ memory from computing image sample
+            // value
+            arena.Reset();
+        } while (NextSample(tileSampler, endSample));
+    }
+}
+
+void SamplerIntegrator::RenderTileBatched(const Scene &scene,
+                                          Sampler &tileSampler,
+                                          const Bounds2i &tileBounds,
+                                          FilmTile *filmTile,
+                                          MemoryArena &arena,
+                                          int64_t firstSample,
+                                          int64_t endSample) const {
+    // Trace the camera rays of as many pixels as fit in one batch together,
+    // then shade them one sample at a time. The second pass restarts each
+    // pixel so that the sampler's later dimensions are consumed in the usual
+    // order; the camera samples it returns again are only used to advance it.
+    const int maxBatchRays = 1024;
+    const int pixelsPerBatch =
+        std::max<int64_t>(1, maxBatchRays / (endSample - firstSample));
+    std::vector<Point2i> pixels;
+    for (Point2i pixel : tileBounds) pixels.push_back(pixel);
+
+    RayBatch batch;
+    std::vector<CameraSample> cameraSamples;
+    std::vector<RayDifferential> rays;
+    std::vector<Float> rayWeights;
+    std::vector<int> batchIndex;
+    for (size_t first = 0; first < pixels.size(); first += pixelsPerBatch) {
+        size_t last = std::min(first + pixelsPerBatch, pixels.size());
+        batch.Clear();
+        cameraSamples.clear();
+        rays.clear();
+        rayWeights.clear();
+        batchIndex.clear();
+
+        // Generate camera rays for all samples of the pixels
+        for (size_t p = first; p < last; ++p) {
+            {
+                ProfilePhase pp(Prof::StartPixel);
+                tileSampler.StartPixel(pixels[p]);
+            }
+            if (!InsideExclusive(pixels[p], pixelBounds) ||
+                (firstSample > 0 && !tileSampler.SetSampleNumber(firstSample)))
+                continue;
+            do {
+                CameraSample cameraSample =
+                    tileSampler.GetCameraSample(pixels[p]);
+                RayDifferential ray;
+                Float rayWeight =
+                    camera->GenerateRayDifferential(cameraSample, &ray);
+                ray.ScaleDifferentials(
+                    1 / std::sqrt((Float)tileSampler.samplesPerPixel));
+                ++nCameraRays;
+                cameraSamples.push_back(cameraSample);
+                rays.push_back(ray);
+                rayWeights.push_back(rayWeight);
+                batchIndex.push_back(rayWeight > 0 ? batch.Add(ray) : -1);
+            } while (NextSample(tileSampler, endSample));
+        }
+        scene.Intersect(batch);
+
+        // Evaluate radiance along the traced rays
+        size_t s = 0;
+        for (size_t p = first; p < last; ++p) {
+            const Point2i &pixel = pixels[p];
+            {
+                ProfilePhase pp(Prof::StartPixel);
+                tileSampler.StartPixel(pixel);
+            }
+            if (!InsideExclusive(pixel, pixelBounds) ||
+                (firstSample > 0 && !tileSampler.SetSampleNumber(firstSample)))
+                continue;
+            do {
+                tileSampler.GetCameraSample(pixel);
+                Spectrum L(0.f);
+                int i = batchIndex[s];
+                if (i >= 0) {
+                    rays[s].tMax = batch.rays[i].tMax;
+                    L = LiFromHit(rays[s],
+                                  batch.hit[i] ? &batch.isects[i] : nullptr,
+                                  scene, tileSampler, arena);
+                }
+                L = CheckRadiance(L, pixel, tileSampler.CurrentSampleNumber());
+                VLOG(1) << "Camera sample: " << cameraSamples[s]
+                        << " -> ray: " << rays[s] << " -> L = " << L;
+                filmTile->AddSample(cameraSamples[s].pFilm, L, rayWeights[s]);
+                arena.Reset();
+                ++s;
+            } while (NextSample(tileSampler, endSample));
+        }
+    }
 }
 
 Spectrum SamplerIntegrator::SpecularReflect(
@@ -65,6 +65,10 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia = false,
                                const Distribution1D *lightDistrib = nullptr);
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia,
+                               const LightDistribution &lightDistrib);
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
@@ -72,6 +76,10 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         bool specular = false);
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene);
+// Returns _L_, or black with an error message if it is not-a-number,
+// negative or infinite.
+Spectrum CheckRadiance(const Spectrum &L, const Point2i &pixel,
+                       int64_t sampleNum);
 
 // SamplerIntegrator Declarations
 class SamplerIntegrator : public Integrator {
@@ -79,13 +87,34 @@ class SamplerIntegrator : public Integrator {
     // SamplerIntegrator Public Methods
     SamplerIntegrator(std::shared_ptr<const Camera> camera,
                       std::shared_ptr<Sampler> sampler,
-                      const Bounds2i &pixelBounds)
-        : camera(camera), sampler(sampler), pixelBounds(pixelBounds) {}
+                      const Bounds2i &pixelBounds,
+                      bool batchCameraRays = false)
+        : camera(camera),
+          sampler(sampler),
+          pixelBounds(pixelBounds),
+          batchCameraRays(batchCameraRays) {}
     virtual void Preprocess(const Scene &scene, Sampler &sampler) {}
     void Render(const Scene &scene);
+    // Renders in passes that only revisit tiles with a pixel whose mean
+    // luminance has a relative standard error above _threshold_, until the
+    // sampler's sample count is reached or _timeBudget_ seconds have
+    // passed; zero disables either criterion.
+    void SetAdaptiveSampling(Float threshold, Float timeBudget) {
+        adaptiveThreshold = threshold;
+        adaptiveTimeBudget = timeBudget;
+    }
     virtual Spectrum Li(const RayDifferential &ray, const Scene &scene,
                         Sampler &sampler, MemoryArena &arena,
                         int depth = 0) const = 0;
+    // Radiance along a camera ray whose first intersection has already been
+    // found by a batched trace; _isect_ is nullptr if the ray escaped. The
+    // default ignores the hit and calls Li().
+    virtual Spectrum LiFromHit(const RayDifferential &ray,
+                               const SurfaceInteraction *isect,
+                               const Scene &scene, Sampler &sampler,
+                               MemoryArena &arena) const {
+        return Li(ray, scene, sampler, arena);
+    }
     Spectrum SpecularReflect(const RayDifferential &ray,
                              const SurfaceInteraction &isect,
                              const Scene &scene, Sampler &sampler,
@@ -100,9 +129,22 @@ class SamplerIntegrator : public Integrator {
     std::shared_ptr<const Camera> camera;
 
   private:
+    // SamplerIntegrator Private Methods
+    // Both render samples [_firstSample_, _endSample_) of every pixel
+    void RenderTile(const Scene &scene, Sampler &tileSampler,
+                    const Bounds2i &tileBounds, FilmTile *filmTile,
+                    MemoryArena &arena, int64_t firstSample,
+                    int64_t endSample) const;
+    void RenderTileBatched(const Scene &scene, Sampler &tileSampler,
+                           const Bounds2i &tileBounds, FilmTile *filmTile,
+                           MemoryArena &arena, int64_t firstSample,
+                           int64_t endSample) const;
+
     // SamplerIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
     const Bounds2i pixelBounds;
+    const bool batchCameraRays;
+    Float adaptiveThreshold = 0, adaptiveTimeBudget = 0;
 };
 
 }  // namespace pbrt
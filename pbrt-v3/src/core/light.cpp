@@ -56,6 +56,66 @@ Light::Light(int flags, const Transform &LightToWorld,
 
 Light::~Light() {}
 
+// LightBounds Method Definitions
+Float LightBounds::Importance(const Point3f &p, const Normal3f &n) const {
+    // Compute clamped squared distance to the center of _bounds_
+    Point3f pc = (bounds.pMin + bounds.pMax) / 2;
+    Float d2 = DistanceSquared(p, pc);
+    d2 = std::max(d2, bounds.Diagonal().Length() / 2);
+
+    // Angles are combined through their sines and cosines; subtractions
+    // clamp at zero
+    auto sinFromCos = [](Float cosTheta) {
+        return std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
+    };
+    auto cosSubClamped = [](Float sinTheta_a, Float cosTheta_a,
+                            Float sinTheta_b, Float cosTheta_b) -> Float {
+        if (cosTheta_a > cosTheta_b) return 1;
+        return cosTheta_a * cosTheta_b + sinTheta_a * sinTheta_b;
+    };
+    auto sinSubClamped = [](Float sinTheta_a, Float cosTheta_a,
+                            Float sinTheta_b, Float cosTheta_b) -> Float {
+        if (cosTheta_a > cosTheta_b) return 0;
+        return sinTheta_a * cosTheta_b - cosTheta_a * sinTheta_b;
+    };
+
+    // Compute the angle $\theta_w$ between _w_ and the direction to _p_
+    Vector3f wi = p == pc ? w : Normalize(p - pc);
+    Float cosTheta_w = Dot(w, wi);
+    if (twoSided) cosTheta_w = std::abs(cosTheta_w);
+    Float sinTheta_w = sinFromCos(cosTheta_w);
+
+    // Compute the angle $\theta_b$ that _bounds_ subtends from _p_
+    Point3f center;
+    Float radius;
+    bounds.BoundingSphere(&center, &radius);
+    Float cosTheta_b = -1;
+    if (DistanceSquared(p, center) > radius * radius)
+        cosTheta_b = sinFromCos(radius / Distance(p, center));
+    Float sinTheta_b = sinFromCos(cosTheta_b);
+
+    // Find the smallest angle $\theta'$ between an emission direction
+    // and _p_, and test it against the emission falloff
+    Float sinTheta_o = sinFromCos(cosTheta_o);
+    Float cosTheta_x =
+        cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    Float sinTheta_x =
+        sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    Float cosThetap =
+        cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap < cosTheta_e) return 0;
+    Float importance = phi * cosThetap / d2;
+
+    // Account for the cosine at _p_ for points on surfaces
+    if (n != Normal3f(0, 0, 0)) {
+        Float cosTheta_i = AbsDot(wi, n);
+        Float sinTheta_i = sinFromCos(cosTheta_i);
+        importance *=
+            cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+    }
+    return std::max(importance, (Float)0);
+}
+
 bool VisibilityTester::Unoccluded(const Scene &scene) const {
     return !scene.IntersectP(p0.SpawnRayTo(p1));
 }
@@ -58,6 +58,29 @@ inline bool IsDeltaLight(int flags) {
            flags & (int)LightFlags::DeltaDirection;
 }
 
+// LightBounds Declarations
+// A conservative description of where a light is and how it emits, for
+// choosing lights by their likely contribution: the light lies within
+// _bounds_, emits power _phi_, and emits from each point only within
+// _cosTheta_e_ of the directions within _cosTheta_o_ of _w_ (or their
+// reverse if _twoSided_)
+struct LightBounds {
+    LightBounds() {}
+    LightBounds(const Bounds3f &bounds, const Vector3f &w, Float phi,
+                Float cosTheta_o, Float cosTheta_e, bool twoSided)
+        : bounds(bounds), w(Normalize(w)), phi(phi), cosTheta_o(cosTheta_o),
+          cosTheta_e(cosTheta_e), twoSided(twoSided) {}
+    // Returns an estimate of the light's contribution at _p_; _n_ is the
+    // surface normal there, or zero in participating media
+    Float Importance(const Point3f &p, const Normal3f &n) const;
+
+    Bounds3f bounds;
+    Vector3f w;
+    Float phi = 0;
+    Float cosTheta_o = 1, cosTheta_e = 1;
+    bool twoSided = false;
+};
+
 // Light Declarations
 class Light {
   public:
@@ -77,6 +100,8 @@ class Light {
                                Float *pdfDir) const = 0;
     virtual void Pdf_Le(const Ray &ray, const Normal3f &nLight, Float *pdfPos,
                         Float *pdfDir) const = 0;
+    // Returns false if the light can't be bounded, as for infinite lights
+    virtual bool Bounds(LightBounds *lb) const { return false; }
 
     // Light Public Data
     const int flags;
@@ -45,6 +45,16 @@ namespace pbrt {
 
 LightDistribution::~LightDistribution() {}
 
+int LightDistribution::Sample(const Point3f &p, const Normal3f &n, Float u,
+                              Float *pmf) const {
+    return Lookup(p)->SampleDiscrete(u, pmf);
+}
+
+Float LightDistribution::PMF(const Point3f &p, const Normal3f &n,
+                             int lightIndex) const {
+    return Lookup(p)->DiscretePDF(lightIndex);
+}
+
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
     const std::string &name, const Scene &scene) {
     if (name == "uniform" || scene.lights.size() == 1)
@@ -56,6 +66,9 @@ std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
     else if (name == "spatial")
         return std::unique_ptr<LightDistribution>{
             new SpatialLightDistribution(scene)};
+    else if (name == "bvh")
+        return std::unique_ptr<LightDistribution>{
+            new LightBVHDistribution(scene)};
     else {
         Error(
             "Light sample distribution type \"%s\" unknown. Using \"spatial\".",
@@ -299,4 +312,235 @@ SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
     return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// LightBVHDistribution
+
+STAT_MEMORY_COUNTER("Memory/Light BVH", lightBVHBytes);
+STAT_COUNTER("Scene/Lights in light BVH", nBVHLights);
+
+static Float SafeACos(Float x) { return std::acos(Clamp(x, -1, 1)); }
+
+static DirectionCone Union(const DirectionCone &a, const DirectionCone &b) {
+    if (a.IsEmpty()) return b;
+    if (b.IsEmpty()) return a;
+    // Return one cone if it holds the other
+    Float theta_a = SafeACos(a.cosTheta), theta_b = SafeACos(b.cosTheta);
+    Float theta_d = SafeACos(Dot(a.w, b.w));
+    if (std::min(theta_d + theta_b, Pi) <= theta_a) return a;
+    if (std::min(theta_d + theta_a, Pi) <= theta_b) return b;
+
+    // Otherwise rotate _a_'s axis toward _b_'s to the middle of both spans
+    Float theta_o = (theta_a + theta_d + theta_b) / 2;
+    if (theta_o >= Pi) return DirectionCone::EntireSphere();
+    Vector3f wr = Cross(a.w, b.w);
+    if (wr.LengthSquared() == 0) return DirectionCone::EntireSphere();
+    Vector3f w = Rotate(Degrees(theta_o - theta_a), wr)(a.w);
+    return DirectionCone(w, std::cos(theta_o));
+}
+
+static LightBounds Union(const LightBounds &a, const LightBounds &b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+    DirectionCone cone = Union(DirectionCone(a.w, a.cosTheta_o),
+                               DirectionCone(b.w, b.cosTheta_o));
+    return LightBounds(Union(a.bounds, b.bounds), cone.w, a.phi + b.phi,
+                       cone.cosTheta, std::min(a.cosTheta_e, b.cosTheta_e),
+                       a.twoSided || b.twoSided);
+}
+
+// Estimates the cost of a node with bounds _b_ when splitting a node
+// with _bounds_ along _dim_: its power times the solid angle its
+// emission covers times its surface area, penalizing thin slabs
+static Float EvaluateCost(const LightBounds &b, const Bounds3f &bounds,
+                          int dim) {
+    Float theta_o = SafeACos(b.cosTheta_o), theta_e = SafeACos(b.cosTheta_e);
+    Float theta_w = std::min(theta_o + theta_e, Pi);
+    Float sinTheta_o = std::sin(theta_o);
+    Float M_omega =
+        2 * Pi * (1 - b.cosTheta_o) +
+        Pi / 2 * (2 * theta_w * sinTheta_o - std::cos(theta_o - 2 * theta_w) -
+                  2 * theta_o * sinTheta_o + b.cosTheta_o);
+    Vector3f d = bounds.Diagonal();
+    Float Kr = MaxComponent(d) / d[dim];
+    return b.phi * M_omega * Kr * b.bounds.SurfaceArea();
+}
+
+LightBVHDistribution::LightBVHDistribution(const Scene &scene)
+    : lightBitTrails(scene.lights.size(), UnsampledTrail),
+      powerDistrib(ComputeLightPowerDistribution(scene)) {
+    ProfilePhase _(Prof::LightDistribLookup);
+    // Sort lights into bounded and unbounded ones
+    std::vector<std::pair<int, LightBounds>> bvhLights;
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        LightBounds lb;
+        if (!scene.lights[i]->Bounds(&lb)) {
+            unboundedLights.push_back(int(i));
+            lightBitTrails[i] = UnboundedTrail;
+        } else if (lb.phi > 0)
+            bvhLights.push_back(std::make_pair(int(i), lb));
+    }
+    nBVHLights += bvhLights.size();
+    if (!bvhLights.empty()) {
+        nodes.reserve(2 * bvhLights.size() - 1);
+        build(bvhLights, 0, int(bvhLights.size()), 0, 0);
+    }
+    lightBVHBytes += nodes.size() * sizeof(LightBVHNode) +
+                     lightBitTrails.size() * sizeof(uint64_t);
+}
+
+int LightBVHDistribution::build(std::vector<std::pair<int, LightBounds>> &lights,
+                                int start, int end, uint64_t bitTrail,
+                                int depth) {
+    int nodeIndex = int(nodes.size());
+    if (end - start == 1) {
+        nodes.push_back({lights[start].second, lights[start].first, true});
+        lightBitTrails[lights[start].first] = bitTrail;
+        return nodeIndex;
+    }
+
+    // Compute bounds of the lights and of their centroids
+    Bounds3f bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        const Bounds3f &b = lights[i].second.bounds;
+        bounds = Union(bounds, b);
+        centroidBounds = Union(centroidBounds, (b.pMin + b.pMax) / 2);
+    }
+    auto centroid = [](const LightBounds &lb, int dim) {
+        return (lb.bounds.pMin[dim] + lb.bounds.pMax[dim]) / 2;
+    };
+
+    // Find the cheapest split between buckets of centroids; below depth 32
+    // lights are split evenly so that the bit trails fit in 63 bits
+    const int nBuckets = 12;
+    Float minCost = Infinity;
+    int minBucket = -1, minDim = -1;
+    auto bucket = [&](const LightBounds &lb, int dim) {
+        Float offset = (centroid(lb, dim) - centroidBounds.pMin[dim]) /
+                       (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]);
+        return std::min(int(nBuckets * offset), nBuckets - 1);
+    };
+    for (int dim = 0; dim < 3 && depth < 32; ++dim) {
+        if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) continue;
+        LightBounds bucketBounds[nBuckets];
+        for (int i = start; i < end; ++i) {
+            int b = bucket(lights[i].second, dim);
+            bucketBounds[b] = Union(bucketBounds[b], lights[i].second);
+        }
+        for (int split = 0; split < nBuckets - 1; ++split) {
+            LightBounds b0, b1;
+            for (int i = 0; i <= split; ++i) b0 = Union(b0, bucketBounds[i]);
+            for (int i = split + 1; i < nBuckets; ++i)
+                b1 = Union(b1, bucketBounds[i]);
+            Float cost = EvaluateCost(b0, bounds, dim) +
+                         EvaluateCost(b1, bounds, dim);
+            if (cost > 0 && cost < minCost) {
+                minCost = cost;
+                minBucket = split;
+                minDim = dim;
+            }
+        }
+    }
+
+    // Partition the lights; fall back to the median of the widest
+    // centroid extent, as for lights without area
+    int mid = start;
+    if (minDim != -1) {
+        auto pmid = std::partition(
+            &lights[start], &lights[end - 1] + 1,
+            [&](const std::pair<int, LightBounds> &l) {
+                return bucket(l.second, minDim) <= minBucket;
+            });
+        mid = int(pmid - &lights[0]);
+    }
+    if (mid == start || mid == end) {
+        int dim = centroidBounds.MaximumExtent();
+        mid = (start + end) / 2;
+        std::nth_element(&lights[start], &lights[mid], &lights[end - 1] + 1,
+                         [&](const std::pair<int, LightBounds> &a,
+                             const std::pair<int, LightBounds> &b) {
+                             return centroid(a.second, dim) <
+                                    centroid(b.second, dim);
+                         });
+    }
+
+    // Build the children; the first one directly follows this node
+    nodes.push_back({LightBounds(), 0, false});
+    build(lights, start, mid, bitTrail, depth + 1);
+    int second = build(lights, mid, end, bitTrail | (1ull << depth), depth + 1);
+    nodes[nodeIndex].bounds =
+        Union(nodes[nodeIndex + 1].bounds, nodes[second].bounds);
+    nodes[nodeIndex].index = second;
+    return nodeIndex;
+}
+
+const Distribution1D *LightBVHDistribution::Lookup(const Point3f &p) const {
+    return powerDistrib.get();
+}
+
+int LightBVHDistribution::Sample(const Point3f &p, const Normal3f &n, Float u,
+                                 Float *pmf) const {
+    ProfilePhase _(Prof::LightDistribLookup);
+    // Choose an unbounded light or the BVH
+    Float pu = pUnbounded();
+    if (u < pu) {
+        int count = int(unboundedLights.size());
+        *pmf = pu / count;
+        return unboundedLights[std::min(int(u / pu * count), count - 1)];
+    }
+    *pmf = 0;
+    if (nodes.empty()) return 0;
+    u = std::min((u - pu) / (1 - pu), OneMinusEpsilon);
+
+    // Descend the BVH, choosing children by their importance at _p_
+    Float prob = 1 - pu;
+    int nodeIndex = 0;
+    while (!nodes[nodeIndex].isLeaf) {
+        const LightBVHNode &node = nodes[nodeIndex];
+        Float c0 = nodes[nodeIndex + 1].bounds.Importance(p, n);
+        Float c1 = nodes[node.index].bounds.Importance(p, n);
+        if (c0 == 0 && c1 == 0) return 0;
+        Float p0 = c0 / (c0 + c1);
+        if (u < p0) {
+            u = std::min(u / p0, OneMinusEpsilon);
+            prob *= p0;
+            ++nodeIndex;
+        } else {
+            u = std::min((u - p0) / (1 - p0), OneMinusEpsilon);
+            prob *= 1 - p0;
+            nodeIndex = node.index;
+        }
+    }
+    // A single light in the BVH is only chosen where it may contribute
+    if (nodeIndex == 0 && nodes[0].bounds.Importance(p, n) == 0) return 0;
+    *pmf = prob;
+    return nodes[nodeIndex].index;
+}
+
+Float LightBVHDistribution::PMF(const Point3f &p, const Normal3f &n,
+                                int lightIndex) const {
+    uint64_t bitTrail = lightBitTrails[lightIndex];
+    if (bitTrail == UnboundedTrail) return pUnbounded() / unboundedLights.size();
+    if (bitTrail == UnsampledTrail) return 0;
+
+    // Follow the light's bit trail down the BVH
+    Float prob = 1 - pUnbounded();
+    int nodeIndex = 0;
+    while (!nodes[nodeIndex].isLeaf) {
+        const LightBVHNode &node = nodes[nodeIndex];
+        Float c0 = nodes[nodeIndex + 1].bounds.Importance(p, n);
+        Float c1 = nodes[node.index].bounds.Importance(p, n);
+        if (c0 == 0 && c1 == 0) return 0;
+        if (bitTrail & 1) {
+            prob *= c1 / (c0 + c1);
+            nodeIndex = node.index;
+        } else {
+            prob *= c0 / (c0 + c1);
+            ++nodeIndex;
+        }
+        bitTrail >>= 1;
+    }
+    if (nodeIndex == 0 && nodes[0].bounds.Importance(p, n) == 0) return 0;
+    return prob;
+}
+
 }  // namespace pbrt
@@ -35,6 +35,7 @@
 
 #include "pbrt.h"
 #include "geometry.h"
+#include "light.h"
 #include "sampling.h"
 #include <atomic>
 #include <functional>
@@ -54,6 +55,17 @@ class LightDistribution {
     // Given a point |p| in space, this method returns a (hopefully
     // effective) sampling distribution for light sources at that point.
     virtual const Distribution1D *Lookup(const Point3f &p) const = 0;
+
+    // Chooses a light to sample at the point |p| with surface normal |n|
+    // (zero for points in media) and returns its index, setting |pmf| to
+    // the probability of choosing it. A |pmf| of zero means that no light
+    // needs to be sampled. By default, this samples Lookup(p).
+    virtual int Sample(const Point3f &p, const Normal3f &n, Float u,
+                       Float *pmf) const;
+    // Returns the probability that Sample() chooses the light with index
+    // |lightIndex| at |p|.
+    virtual Float PMF(const Point3f &p, const Normal3f &n,
+                      int lightIndex) const;
 };
 
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
@@ -124,6 +136,49 @@ class SpatialLightDistribution : public LightDistribution {
     size_t hashTableSize;
 };
 
+// LightBVHDistribution chooses lights by descending a bounding volume
+// hierarchy built over the lights' LightBounds, choosing between the two
+// children at each node in proportion to an estimate of their lights'
+// contribution at the point. This takes O(log n) time and O(n) memory for
+// n lights, and it accounts for the orientation of area lights, so it
+// suits scenes with many lights, such as large emissive meshes. Lights
+// without bounds, such as infinite lights, are chosen uniformly, together
+// taking the same probability as one BVH child of the root. Lookup()
+// returns a distribution proportional to power for integrators that need
+// one.
+class LightBVHDistribution : public LightDistribution {
+  public:
+    LightBVHDistribution(const Scene &scene);
+    const Distribution1D *Lookup(const Point3f &p) const;
+    int Sample(const Point3f &p, const Normal3f &n, Float u, Float *pmf) const;
+    Float PMF(const Point3f &p, const Normal3f &n, int lightIndex) const;
+
+  private:
+    struct LightBVHNode {
+        LightBounds bounds;
+        // Interior nodes are followed by their first child and store the
+        // index of the second; leaves store their light's index
+        int index;
+        bool isLeaf;
+    };
+    int build(std::vector<std::pair<int, LightBounds>> &lights, int start,
+              int end, uint64_t bitTrail, int depth);
+    Float pUnbounded() const {
+        return Float(unboundedLights.size()) /
+               Float(unboundedLights.size() + (nodes.empty() ? 0 : 1));
+    }
+
+    std::vector<LightBVHNode> nodes;
+    std::vector<int> unboundedLights;
+    // For each light in the BVH, which child leads to it at each level of
+    // the tree, starting from the lowest bit; other lights are marked
+    // with one of the two values below, which no path can have
+    std::vector<uint64_t> lightBitTrails;
+    static const uint64_t UnboundedTrail = 1ull << 63;
+    static const uint64_t UnsampledTrail = UnboundedTrail | 1;
+    std::unique_ptr<Distribution1D> powerDistrib;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_LIGHTDISTRIB_H
@@ -44,6 +44,8 @@
 #include "texture.h"
 #include "stats.h"
 #include "parallel.h"
+#include "bfptexels.h"
+#include "texcache.h"
 
 namespace pbrt {
 
@@ -64,11 +66,21 @@ class MIPMap {
   public:
     // MIPMap Public Methods
     MIPMap(const Point2i &resolution, const T *data, bool doTri = false,
-           Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat);
+           Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat,
+           int bfpMantissaBits = 0);
+    // Creates a MIP map whose levels are read a tile at a time into
+    // _textureCache_ as lookups need them; _readTexels_ fills in the given
+    // region of a level in scanline order. The finest level has a
+    // power-of-two resolution, and each level is half the size of the one
+    // before it, rounded down.
+    using TexelReader = std::function<void(int, const Bounds2i &, T *)>;
+    MIPMap(const Point2i &resolution, TexelReader readTexels,
+           bool doTri = false, Float maxAniso = 8.f,
+           ImageWrap wrapMode = ImageWrap::Repeat);
     int Width() const { return resolution[0]; }
     int Height() const { return resolution[1]; }
     int Levels() const { return pyramid.size(); }
-    const T &Texel(int level, int s, int t) const;
+    T Texel(int level, int s, int t) const;
     T Lookup(const Point2f &st, Float width = 0.f) const;
     T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy) const;
 
@@ -99,6 +111,18 @@ class MIPMap {
     SampledSpectrum clamp(const SampledSpectrum &v) {
         return v.Clamp(0.f, Infinity);
     }
+    int LevelWidth(int level) const {
+        if (readTexels) return std::max(1, resolution[0] >> level);
+        return bfpPyramid.empty() ? pyramid[level]->uSize()
+                                  : bfpPyramid[level]->uSize();
+    }
+    int LevelHeight(int level) const {
+        if (readTexels) return std::max(1, resolution[1] >> level);
+        return bfpPyramid.empty() ? pyramid[level]->vSize()
+                                  : bfpPyramid[level]->vSize();
+    }
+    std::shared_ptr<const void> loadTile(int level, int tx, int ty,
+                                         size_t *bytes) const;
     T triangle(int level, const Point2f &st) const;
     T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
 
@@ -108,6 +132,14 @@ class MIPMap {
     const ImageWrap wrapMode;
     Point2i resolution;
     std::vector<std::unique_ptr<BlockedArray<T>>> pyramid;
+    // with BFP texel storage, the levels live here and _pyramid_ only keeps
+    // the level count
+    std::vector<std::unique_ptr<BfpBlockedArray<T>>> bfpPyramid;
+    // For MIP maps read into the texture cache, the levels' source and the
+    // upper bits of the keys of their tiles; _pyramid_ again only keeps
+    // the level count
+    TexelReader readTexels;
+    uint64_t cacheKey = 0;
     static PBRT_CONSTEXPR int WeightLUTSize = 128;
     static Float weightLut[WeightLUTSize];
 };
@@ -115,7 +147,7 @@ class MIPMap {
 // MIPMap Method Definitions
 template <typename T>
 MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
-                  Float maxAnisotropy, ImageWrap wrapMode)
+                  Float maxAnisotropy, ImageWrap wrapMode, int bfpMantissaBits)
     : doTrilinear(doTrilinear),
       maxAnisotropy(maxAnisotropy),
       wrapMode(wrapMode),
@@ -214,31 +246,96 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
             weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
         }
     }
-    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+
+    if (bfpMantissaBits > 0) {
+        // Convert the finished levels to BFP blocks and free the float ones
+        bfpPyramid.resize(nLevels);
+        ParallelFor([&](int64_t i) {
+            bfpPyramid[i].reset(
+                new BfpBlockedArray<T>(*pyramid[i], bfpMantissaBits));
+        }, nLevels);
+        for (int i = 0; i < nLevels; ++i) {
+            pyramid[i].reset();
+            mipMapMemory += bfpPyramid[i]->BytesUsed();
+        }
+    } else
+        mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
 }
 
 template <typename T>
-const T &MIPMap<T>::Texel(int level, int s, int t) const {
+MIPMap<T>::MIPMap(const Point2i &res, TexelReader readTexels, bool doTrilinear,
+                  Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      resolution(res),
+      readTexels(std::move(readTexels)),
+      cacheKey(TextureCache::NewOwnerKey()) {
+    CHECK(IsPowerOf2(resolution[0]) && IsPowerOf2(resolution[1]));
+    pyramid.resize(1 + Log2Int(std::max(resolution[0], resolution[1])));
+    if (weightLut[0] == 0.) {
+        for (int i = 0; i < WeightLUTSize; ++i) {
+            Float alpha = 2;
+            Float r2 = Float(i) / Float(WeightLUTSize - 1);
+            weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
+        }
+    }
+}
+
+template <typename T>
+std::shared_ptr<const void> MIPMap<T>::loadTile(int level, int tx, int ty,
+                                                size_t *bytes) const {
+    ProfilePhase _(Prof::TextureLoading);
+    const int tileSize = TextureCache::TileSize;
+    Bounds2i bounds(Point2i(tx * tileSize, ty * tileSize),
+                    Point2i(std::min((tx + 1) * tileSize, LevelWidth(level)),
+                            std::min((ty + 1) * tileSize, LevelHeight(level))));
+    int width = bounds.pMax.x - bounds.pMin.x;
+    int height = bounds.pMax.y - bounds.pMin.y;
+    auto tile = std::make_shared<std::vector<T>>(width * height);
+    *bytes = tile->size() * sizeof(T);
+    readTexels(level, bounds, tile->data());
+    return tile;
+}
+
+template <typename T>
+T MIPMap<T>::Texel(int level, int s, int t) const {
     CHECK_LT(level, pyramid.size());
-    const BlockedArray<T> &l = *pyramid[level];
+    int uSize = LevelWidth(level), vSize = LevelHeight(level);
     // Compute texel $(s,t)$ accounting for boundary conditions
     switch (wrapMode) {
     case ImageWrap::Repeat:
-        s = Mod(s, l.uSize());
-        t = Mod(t, l.vSize());
+        s = Mod(s, uSize);
+        t = Mod(t, vSize);
         break;
     case ImageWrap::Clamp:
-        s = Clamp(s, 0, l.uSize() - 1);
-        t = Clamp(t, 0, l.vSize() - 1);
+        s = Clamp(s, 0, uSize - 1);
+        t = Clamp(t, 0, vSize - 1);
         break;
     case ImageWrap::Black: {
         static const T black = 0.f;
-        if (s < 0 || s >= (int)l.uSize() || t < 0 || t >= (int)l.vSize())
-            return black;
+        if (s < 0 || s >= uSize || t < 0 || t >= vSize) return black;
         break;
     }
     }
-    return l(s, t);
+    if (readTexels) {
+        // Find the texel in its tile of the texture cache
+        const int tileLog2 = TextureCache::TileLog2;
+        int tx = s >> tileLog2, ty = t >> tileLog2;
+        int nxTiles = (uSize + TextureCache::TileSize - 1) >> tileLog2;
+        int tileWidth = std::min(uSize, TextureCache::TileSize);
+        uint64_t key = cacheKey | (uint64_t(level) << 34) |
+                       (uint64_t(ty) * nxTiles + tx);
+        const std::vector<T> *tile =
+            (const std::vector<T> *)textureCache.Lookup(
+                key, [&](size_t *bytes) {
+                    return loadTile(level, tx, ty, bytes);
+                });
+        return (*tile)[(t - (ty << tileLog2)) * tileWidth +
+                       (s - (tx << tileLog2))];
+    }
+    if (!bfpPyramid.empty()) return (*bfpPyramid[level])(s, t);
+    return (*pyramid[level])(s, t);
 }
 
 template <typename T>
@@ -263,8 +360,8 @@ T MIPMap<T>::Lookup(const Point2f &st, Float width) const {
 template <typename T>
 T MIPMap<T>::triangle(int level, const Point2f &st) const {
     level = Clamp(level, 0, Levels() - 1);
-    Float s = st[0] * pyramid[level]->uSize() - 0.5f;
-    Float t = st[1] * pyramid[level]->vSize() - 0.5f;
+    Float s = st[0] * LevelWidth(level) - 0.5f;
+    Float t = st[1] * LevelHeight(level) - 0.5f;
     int s0 = std::floor(s), t0 = std::floor(t);
     Float ds = s - s0, dt = t - t0;
     return (1 - ds) * (1 - dt) * Texel(level, s0, t0) +
@@ -306,12 +403,12 @@ template <typename T>
 T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     if (level >= Levels()) return Texel(Levels() - 1, 0, 0);
     // Convert EWA coordinates to appropriate scale for level
-    st[0] = st[0] * pyramid[level]->uSize() - 0.5f;
-    st[1] = st[1] * pyramid[level]->vSize() - 0.5f;
-    dst0[0] *= pyramid[level]->uSize();
-    dst0[1] *= pyramid[level]->vSize();
-    dst1[0] *= pyramid[level]->uSize();
-    dst1[1] *= pyramid[level]->vSize();
+    st[0] = st[0] * LevelWidth(level) - 0.5f;
+    st[1] = st[1] * LevelHeight(level) - 0.5f;
+    dst0[0] *= LevelWidth(level);
+    dst0[1] *= LevelHeight(level);
+    dst1[0] *= LevelWidth(level);
+    dst1[1] *= LevelHeight(level);
 
     // Compute ellipse coefficients to bound EWA filter region
     Float A = dst0[1] * dst0[1] + dst1[1] * dst1[1] + 1;
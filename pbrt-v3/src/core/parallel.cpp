@@ -35,22 +35,43 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
+#include <deque>
 #include <thread>
 #include <condition_variable>
 
 namespace pbrt {
 
+STAT_COUNTER("Parallel/Loop tasks run", nTasksRun);
+STAT_COUNTER("Parallel/Loop tasks stolen", nTasksStolen);
+
 // Parallel Local Definitions
 static std::vector<std::thread> threads;
-static bool shutdownThreads = false;
+static std::atomic<bool> shutdownThreads{false};
 class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+
+// Each thread owns a queue of loop tasks: it pushes and pops at the back
+// and other threads steal from the front, where the largest ranges are.
+struct ParallelTask {
+    ParallelForLoop *loop;
+    int64_t start, end;
+};
+
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<ParallelTask> tasks;
+};
+static std::vector<std::unique_ptr<WorkQueue>> workQueues;
+// Total number of queued tasks, so that idle workers know whether to sleep.
+static std::atomic<int64_t> nQueuedTasks{0};
+static std::atomic<int> nSleepingWorkers{0};
+// Idle workers sleep on _workerCondition_; threads waiting for their own
+// loop to finish sleep on _loopCondition_.
+static std::mutex sleepMutex;
+static std::condition_variable workerCondition, loopCondition;
 
 // Bookkeeping variables to help with the implementation of
 // MergeWorkerThreadStats().
-static std::atomic<bool> reportWorkerStats{false};
+static std::atomic<int> reportGeneration{0};
 // Number of workers that still need to report their stats.
 static std::atomic<int> reporterCount;
 // After kicking the workers to report their stats, the main thread waits
@@ -83,15 +104,11 @@ class ParallelForLoop {
     const int64_t maxIndex;
     const int chunkSize;
     uint64_t profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
+    // Iterations not yet run and tasks of this loop sitting in queues
+    std::atomic<int64_t> remaining{0};
+    std::atomic<int> nQueued{0};
+    std::atomic<bool> ownerSleeping{false};
     int nX = -1;
-
-    // ParallelForLoop Private Methods
-    bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
-    }
 };
 
 void Barrier::Wait() {
@@ -107,7 +124,135 @@ void Barrier::Wait() {
         cv.wait(lock, [this] { return count == 0; });
 }
 
-static std::condition_variable workListCondition;
+static WorkQueue &ThreadQueue() {
+    // Threads pbrt didn't start share the main thread's queue
+    return *workQueues[ThreadIndex < (int)workQueues.size() ? ThreadIndex : 0];
+}
+
+static void PushTask(const ParallelTask &task) {
+    WorkQueue &queue = ThreadQueue();
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    ++task.loop->nQueued;
+    ++nQueuedTasks;
+
+    // Wake up a worker to steal it, and the loop's owner if it's asleep
+    if (nSleepingWorkers > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        workerCondition.notify_one();
+    }
+    if (task.loop->ownerSleeping) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        loopCondition.notify_all();
+    }
+}
+
+// Takes a task from the back of the thread's own queue or, failing that,
+// from the front of another thread's. With _only_ set, just tasks of that
+// loop qualify: a thread waiting inside an iteration of some loop must not
+// start other iterations of enclosing loops, which may share per-thread
+// state indexed by _ThreadIndex_ with the suspended one.
+static bool FindTask(ParallelForLoop *only, ParallelTask *task) {
+    auto take = [&](std::deque<ParallelTask> &tasks, bool back) {
+        if (tasks.empty()) return false;
+        if (!only) {
+            *task = back ? tasks.back() : tasks.front();
+            if (back)
+                tasks.pop_back();
+            else
+                tasks.pop_front();
+            return true;
+        }
+        for (auto iter = tasks.begin(); iter != tasks.end(); ++iter)
+            if (iter->loop == only) {
+                *task = *iter;
+                tasks.erase(iter);
+                return true;
+            }
+        return false;
+    };
+
+    bool found = false;
+    const int nQueues = workQueues.size();
+    int self = ThreadIndex < nQueues ? ThreadIndex : 0;
+    {
+        std::lock_guard<std::mutex> lock(workQueues[self]->mutex);
+        found = take(workQueues[self]->tasks, true);
+    }
+    for (int i = 1; i < nQueues && !found; ++i) {
+        WorkQueue &victim = *workQueues[(self + i) % nQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (take(victim.tasks, false)) {
+            found = true;
+            ++nTasksStolen;
+        }
+    }
+    if (found) {
+        --task->loop->nQueued;
+        --nQueuedTasks;
+    }
+    return found;
+}
+
+// Splits off the upper half of _task_'s range onto the queue until a single
+// chunk is left, then runs it.
+static void RunTask(ParallelTask task) {
+    ParallelForLoop &loop = *task.loop;
+    while (task.end - task.start > loop.chunkSize) {
+        int64_t nChunks = (task.end - task.start + loop.chunkSize - 1) /
+                          loop.chunkSize;
+        int64_t mid = task.start + (nChunks / 2) * loop.chunkSize;
+        PushTask({&loop, mid, task.end});
+        task.end = mid;
+    }
+
+    // Run loop indices in _[task.start, task.end)_
+    ++nTasksRun;
+    for (int64_t index = task.start; index < task.end; ++index) {
+        uint64_t oldState = ProfilerState;
+        ProfilerState = loop.profilerState;
+        if (loop.func1D) {
+            loop.func1D(index);
+        }
+        // Handle other types of loops
+        else {
+            CHECK(loop.func2D);
+            loop.func2D(Point2i(index % loop.nX, index / loop.nX));
+        }
+        ProfilerState = oldState;
+    }
+
+    // _loop_ may be gone as soon as the last iterations are accounted for
+    int64_t n = task.end - task.start;
+    if (loop.remaining.fetch_sub(n) == n) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        loopCondition.notify_all();
+    }
+}
+
+// Runs _loop_ from the calling thread, which keeps working on the loop's
+// tasks until all of its iterations are done.
+static void RunLoop(ParallelForLoop &loop) {
+    loop.remaining = loop.maxIndex;
+    RunTask({&loop, 0, loop.maxIndex});
+    while (loop.remaining > 0) {
+        ParallelTask task;
+        if (FindTask(&loop, &task)) {
+            RunTask(task);
+            continue;
+        }
+        // The remaining iterations are running elsewhere; sleep until they
+        // are done or one of them splits off more work
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        loop.ownerSleeping = true;
+        loopCondition.wait(lock, [&loop]() {
+            return loop.remaining == 0 || loop.nQueued > 0;
+        });
+        loop.ownerSleeping = false;
+    }
+}
 
 static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     LOG(INFO) << "Started execution in worker thread " << tIndex;
@@ -117,6 +262,11 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the worker thread before the profiling system actually stops running.
     ProfilerWorkerThreadInit();
 
+    // Requests for stats must be noticed from here on. This has to happen
+    // before the barrier: once all workers are past it, the main thread
+    // may call MergeWorkerThreadStats() at any time.
+    int reported = reportGeneration;
+
     // The main thread sets up a barrier so that it can be sure that all
     // workers have called ProfilerWorkerThreadInit() before it continues
     // (and actually starts the profiling system).
@@ -126,56 +276,39 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
     while (!shutdownThreads) {
-        if (reportWorkerStats) {
+        if (reportGeneration != reported) {
+            reported = reportGeneration;
             ReportThreadStats();
-            if (--reporterCount == 0)
+            if (--reporterCount == 0) {
                 // Once all worker threads have merged their stats, wake up
                 // the main thread.
+                std::lock_guard<std::mutex> lock(reportDoneMutex);
                 reportDoneCondition.notify_one();
-            // Now sleep again.
-            workListCondition.wait(lock);
-        } else if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                uint64_t oldState = ProfilerState;
-                ProfilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    CHECK(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                ProfilerState = oldState;
             }
-            lock.lock();
+            continue;
+        }
 
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+        // Run tasks from any loop, stealing as needed
+        ParallelTask task;
+        bool found = false;
+        for (int spin = 0; spin < 16 && !found; ++spin) {
+            found = FindTask(nullptr, &task);
+            if (!found) std::this_thread::yield();
+        }
+        if (found) {
+            RunTask(task);
+            continue;
         }
+
+        // Sleep until there are more tasks to run
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        ++nSleepingWorkers;
+        workerCondition.wait(lock, [reported]() {
+            return shutdownThreads || nQueuedTasks > 0 ||
+                   reportGeneration != reported;
+        });
+        --nSleepingWorkers;
     }
     LOG(INFO) << "Exiting worker thread " << tIndex;
 }
@@ -186,56 +319,14 @@ void ParallelFor(std::function<void(int64_t)> func, int64_t count,
     CHECK(threads.size() > 0 || MaxThreadIndex() == 1);
 
     // Run iterations immediately if not using threads or if _count_ is small
-    if (threads.empty() || count < chunkSize) {
+    if (threads.empty() || count <= chunkSize) {
         for (int64_t i = 0; i < count; ++i) func(i);
         return;
     }
 
-    // Create and enqueue _ParallelForLoop_ for this loop
     ParallelForLoop loop(std::move(func), count, chunkSize,
                          CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    RunLoop(loop);
 }
 
 PBRT_THREAD_LOCAL int ThreadIndex;
@@ -254,48 +345,7 @@ void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
     }
 
     ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
-
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    RunLoop(loop);
 }
 
 int NumSystemCores() {
@@ -306,6 +356,8 @@ void ParallelInit() {
     CHECK_EQ(threads.size(), 0);
     int nThreads = MaxThreadIndex();
     ThreadIndex = 0;
+    for (int i = 0; i < nThreads; ++i)
+        workQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
 
     // Create a barrier so that we can be sure all worker threads get past
     // their call to ProfilerWorkerThreadInit() before we return from this
@@ -322,34 +374,37 @@ void ParallelInit() {
 }
 
 void ParallelCleanup() {
-    if (threads.empty()) return;
+    if (threads.empty()) {
+        workQueues.clear();
+        return;
+    }
 
     {
-        std::lock_guard<std::mutex> lock(workListMutex);
+        std::lock_guard<std::mutex> lock(sleepMutex);
         shutdownThreads = true;
-        workListCondition.notify_all();
+        workerCondition.notify_all();
     }
 
     for (std::thread &thread : threads) thread.join();
     threads.erase(threads.begin(), threads.end());
+    workQueues.clear();
     shutdownThreads = false;
 }
 
 void MergeWorkerThreadStats() {
-    std::unique_lock<std::mutex> lock(workListMutex);
     std::unique_lock<std::mutex> doneLock(reportDoneMutex);
-    // Set up state so that the worker threads will know that we would like
-    // them to report their thread-specific stats when they wake up.
-    reportWorkerStats = true;
-    reporterCount = threads.size();
-
-    // Wake up the worker threads.
-    workListCondition.notify_all();
+    {
+        // Set up state so that the worker threads will know that we would
+        // like them to report their thread-specific stats, and wake them
+        // up.
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        reporterCount = threads.size();
+        ++reportGeneration;
+        workerCondition.notify_all();
+    }
 
     // Wait for all of them to merge their stats.
-    reportDoneCondition.wait(lock, []() { return reporterCount == 0; });
-
-    reportWorkerStats = false;
+    reportDoneCondition.wait(doneLock, []() { return reporterCount == 0; });
 }
 
 }  // namespace pbrt
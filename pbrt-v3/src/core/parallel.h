@@ -58,15 +58,19 @@ class AtomicFloat {
         bits = FloatToBits(v);
         return v;
     }
-    void Add(Float v) {
+    // Returns the number of compare-and-swap attempts that failed
+    int Add(Float v) {
 #ifdef PBRT_FLOAT_AS_DOUBLE
         uint64_t oldBits = bits, newBits;
 #else
         uint32_t oldBits = bits, newBits;
 #endif
+        int retries = -1;
         do {
             newBits = FloatToBits(BitsToFloat(oldBits) + v);
+            ++retries;
         } while (!bits.compare_exchange_weak(oldBits, newBits));
+        return retries;
     }
 
   private:
@@ -35,6 +35,7 @@
 #include "api.h"
 #include "fileutil.h"
 #include "memory.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "stats.h"
 
@@ -50,8 +51,10 @@
 #elif defined(PBRT_IS_WINDOWS)
 #include <windows.h>  // Windows file mapping API
 #endif
+#include <algorithm>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -250,6 +253,33 @@ Tokenizer::~Tokenizer() {
 }
 
 string_view Tokenizer::Next() {
+    if (!lexedAll) return lex();
+    // The last stored token is an empty one for EOF
+    const LexedToken &t = lexedTokens[nextLexedToken];
+    if (nextLexedToken + 1 < lexedTokens.size()) ++nextLexedToken;
+    loc.line = t.line;
+    loc.column = t.column;
+    return t.token;
+}
+
+void Tokenizer::LexAll() {
+    CHECK(!lexedAll);
+    string_view tok;
+    while (!(tok = lex()).empty()) {
+        if (tok.data() == sEscaped.data()) {
+            // Keep a copy of the token, since _sEscaped_ is reused
+            lexedEscaped.push_back(sEscaped);
+            tok = string_view(lexedEscaped.back().data(),
+                              lexedEscaped.back().size());
+        }
+        lexedTokens.push_back({tok, loc.line, loc.column});
+    }
+    lexedTokens.push_back({tok, loc.line, loc.column});
+    lexedAll = true;
+    tokenizerMemory += lexedTokens.capacity() * sizeof(LexedToken);
+}
+
+string_view Tokenizer::lex() {
     while (true) {
         const char *tokenStart = pos;
         int ch = getChar();
@@ -382,6 +412,16 @@ static string_view dequoteString(string_view str) {
     return str;
 }
 
+std::vector<std::string> Tokenizer::IncludedFiles() const {
+    std::vector<std::string> filenames;
+    for (size_t i = 0; i + 1 < lexedTokens.size(); ++i)
+        if (lexedTokens[i].token == "Include" &&
+            isQuotedString(lexedTokens[i + 1].token))
+            filenames.push_back(
+                toString(dequoteString(lexedTokens[i + 1].token)));
+    return filenames;
+}
+
 struct ParamListItem {
     std::string name;
     double *doubleValues = nullptr;
@@ -782,8 +822,43 @@ ParamSet parseParams(Next nextToken, Unget ungetToken, MemoryArena &arena,
 
 extern int catIndentCount;
 
+// Included files that were lexed ahead of parsing, by absolute filename
+using LexedFileMap = std::map<std::string, std::unique_ptr<Tokenizer>>;
+
+// Lexes _t_ and then, level by level, the files it includes on worker
+// threads, adding them to _lexedFiles_
+static void lexIncludes(Tokenizer *t, LexedFileMap *lexedFiles) {
+    t->LexAll();
+    std::vector<Tokenizer *> level = {t};
+    while (!level.empty()) {
+        std::vector<std::string> filenames;
+        for (Tokenizer *file : level)
+            for (const std::string &name : file->IncludedFiles()) {
+                std::string filename = AbsolutePath(ResolveFilename(name));
+                if (lexedFiles->find(filename) == lexedFiles->end() &&
+                    std::find(filenames.begin(), filenames.end(),
+                              filename) == filenames.end())
+                    filenames.push_back(filename);
+            }
+        std::vector<std::unique_ptr<Tokenizer>> lexed(filenames.size());
+        ParallelFor([&](int64_t i) {
+            auto tokError = [](const char *msg) { Error("%s", msg); };
+            lexed[i] = Tokenizer::CreateFromFile(filenames[i], tokError);
+            if (lexed[i]) lexed[i]->LexAll();
+        }, filenames.size(), 1);
+
+        level.clear();
+        for (size_t i = 0; i < filenames.size(); ++i)
+            if (lexed[i]) {
+                level.push_back(lexed[i].get());
+                (*lexedFiles)[filenames[i]] = std::move(lexed[i]);
+            }
+    }
+}
+
 // Parsing Global Interface
-static void parse(std::unique_ptr<Tokenizer> t) {
+static void parse(std::unique_ptr<Tokenizer> t,
+                  LexedFileMap lexedFiles = LexedFileMap()) {
     std::vector<std::unique_ptr<Tokenizer>> fileStack;
     fileStack.push_back(std::move(t));
     parserLoc = &fileStack.back()->loc;
@@ -924,8 +999,13 @@ static void parse(std::unique_ptr<Tokenizer> t) {
                 else {
                     filename = AbsolutePath(ResolveFilename(filename));
                     auto tokError = [](const char *msg) { Error("%s", msg); };
-                    std::unique_ptr<Tokenizer> tinc =
-                        Tokenizer::CreateFromFile(filename, tokError);
+                    std::unique_ptr<Tokenizer> tinc;
+                    auto lexed = lexedFiles.find(filename);
+                    if (lexed != lexedFiles.end()) {
+                        tinc = std::move(lexed->second);
+                        lexedFiles.erase(lexed);
+                    } else
+                        tinc = Tokenizer::CreateFromFile(filename, tokError);
                     if (tinc) {
                         fileStack.push_back(std::move(tinc));
                         parserLoc = &fileStack.back()->loc;
@@ -1098,7 +1178,10 @@ void pbrtParseFile(std::string filename) {
     std::unique_ptr<Tokenizer> t =
         Tokenizer::CreateFromFile(filename, tokError);
     if (!t) return;
-    parse(std::move(t));
+    LexedFileMap lexedFiles;
+    if (PbrtOptions.parallelParse && !PbrtOptions.cat && !PbrtOptions.toPly)
+        lexIncludes(t.get(), &lexedFiles);
+    parse(std::move(t), std::move(lexedFiles));
 }
 
 void pbrtParseString(std::string str) {
@@ -41,6 +41,7 @@
 // core/parser.h*
 #include "pbrt.h"
 
+#include <deque>
 #include <functional>
 #include <memory>
 #include <string>
@@ -114,6 +115,13 @@ class Tokenizer {
     // string_view is not guaranteed to be valid after next call to Next().
     string_view Next();
 
+    // Lexes all of the remaining input up front, so that it can be done on
+    // a worker thread; Next() then returns the stored tokens in order.
+    void LexAll();
+    // Returns the filenames given to Include directives in the tokens
+    // stored by LexAll().
+    std::vector<std::string> IncludedFiles() const;
+
     Loc loc;
 
   private:
@@ -123,6 +131,8 @@ class Tokenizer {
               std::function<void(const char *)> errorCallback);
 #endif
 
+    string_view lex();
+
     int getChar() {
         if (pos == end) return EOF;
         int ch = *pos++;
@@ -168,6 +178,18 @@ class Tokenizer {
     // thence, string_views from previous calls to Next() must be invalid
     // after a subsequent call, since we may reuse sEscaped.)
     std::string sEscaped;
+
+    // Tokens stored by LexAll(), with the location following each one and
+    // an empty token at the end. Tokens with escaped characters are stored
+    // in _lexedEscaped_.
+    struct LexedToken {
+        string_view token;
+        int line, column;
+    };
+    bool lexedAll = false;
+    std::vector<LexedToken> lexedTokens;
+    size_t nextLexedToken = 0;
+    std::deque<std::string> lexedEscaped;
 };
 
 }  // namespace pbrt
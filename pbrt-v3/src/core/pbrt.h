@@ -152,6 +152,7 @@ struct BSSRDFTable;
 class Light;
 class VisibilityTester;
 class AreaLight;
+class LightDistribution;
 struct Distribution1D;
 class Distribution2D;
 #ifdef PBRT_FLOAT_AS_DOUBLE
@@ -179,6 +180,17 @@ struct Options {
     bool quickRender = false;
     bool quiet = false;
     bool cat = false, toPly = false;
+    // Transform triangle meshes with block floating point and, optionally,
+    // report the error against the float path
+    bool bfpTransform = false, bfpTransformError = false;
+    // Seconds between render checkpoints (0: none) and whether to resume
+    // from the checkpoint of a previous run
+    Float checkpointInterval = 0;
+    bool resume = false;
+    // Tokenize included files and create shapes on worker threads
+    bool parallelParse = false;
+    // Memory budget of the cache of tiled image textures, in MiB
+    int textureCacheMB = 512;
     std::string imageFile;
     // x0, x1, y0, y1
     Float cropWindow[2][2];
@@ -43,6 +43,14 @@ STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
 // Primitive Method Definitions
 Primitive::~Primitive() {}
+void Aggregate::Intersect(RayBatch &batch) const {
+    batch.ResetResults();
+    for (size_t i = 0; i < batch.Size(); ++i)
+        batch.hit[i] = batch.occlusion
+                           ? IntersectP(batch.rays[i])
+                           : Intersect(batch.rays[i], &batch.isects[i]);
+}
+
 const AreaLight *Aggregate::GetAreaLight() const {
     LOG(FATAL) <<
         "Aggregate::GetAreaLight() method"
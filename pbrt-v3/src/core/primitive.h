@@ -76,6 +76,7 @@ class GeometricPrimitive : public Primitive {
                        const MediumInterface &mediumInterface);
     const AreaLight *GetAreaLight() const;
     const Material *GetMaterial() const;
+    const Shape *GetShape() const { return shape.get(); }
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const;
@@ -115,10 +116,41 @@ class TransformedPrimitive : public Primitive {
     const AnimatedTransform PrimitiveToWorld;
 };
 
+// RayBatch Declarations
+// Rays traced together by Aggregate::Intersect(RayBatch &). Closest-hit
+// batches shorten each hit ray's _tMax_ and fill in its interaction, like
+// Primitive::Intersect(); occlusion batches only record which rays hit.
+struct RayBatch {
+    explicit RayBatch(bool occlusion = false) : occlusion(occlusion) {}
+    void Clear() {
+        rays.clear();
+        isects.clear();
+        hit.clear();
+    }
+    int Add(const Ray &ray) {
+        rays.push_back(ray);
+        return rays.size() - 1;
+    }
+    size_t Size() const { return rays.size(); }
+    // Sizes the results for _rays_ and marks every ray as unoccluded
+    void ResetResults() {
+        hit.assign(rays.size(), 0);
+        if (!occlusion) isects.resize(rays.size());
+    }
+
+    const bool occlusion;
+    std::vector<Ray> rays;
+    std::vector<SurfaceInteraction> isects;
+    std::vector<uint8_t> hit;
+};
+
 // Aggregate Declarations
 class Aggregate : public Primitive {
   public:
     // Aggregate Public Methods
+    using Primitive::Intersect;
+    // Traces all rays of _batch_; the default traces them one at a time
+    virtual void Intersect(RayBatch &batch) const;
     const AreaLight *GetAreaLight() const;
     const Material *GetMaterial() const;
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
@@ -112,6 +112,7 @@ bool PixelSampler::StartNextSample() {
 
 bool PixelSampler::SetSampleNumber(int64_t sampleNum) {
     current1DDimension = current2DDimension = 0;
+    if (sampleNum > 0) SeedPixelRNG(rng, seed, currentPixel, sampleNum);
     return Sampler::SetSampleNumber(sampleNum);
 }
 
@@ -194,4 +195,19 @@ Point2f GlobalSampler::Get2D() {
     return p;
 }
 
+static uint64_t MixBits(uint64_t v) {
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44d;
+    v ^= (v >> 33);
+    return v;
+}
+
+void SeedPixelRNG(RNG &rng, int seed, const Point2i &p, int64_t sampleNum) {
+    uint64_t pixel = ((uint64_t)(uint32_t)p.y << 32) | (uint32_t)p.x;
+    rng.SetSequence(MixBits(pixel ^ MixBits((uint32_t)seed)));
+    if (sampleNum > 0) rng.Advance(sampleNum << 32);
+}
+
 }  // namespace pbrt
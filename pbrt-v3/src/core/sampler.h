@@ -101,6 +101,7 @@ class PixelSampler : public Sampler {
     std::vector<std::vector<Point2f>> samples2D;
     int current1DDimension = 0, current2DDimension = 0;
     RNG rng;
+    int seed = 0;
 };
 
 class GlobalSampler : public Sampler {
@@ -123,6 +124,13 @@ class GlobalSampler : public Sampler {
     int arrayEndDim;
 };
 
+// Restarts _rng_ on a stream that depends only on the _Clone()_ seed and the
+// pixel, so that restarting a pixel reproduces its samples regardless of the
+// pixels sampled before it. A nonzero _sampleNum_ moves $2^{32}$ values
+// along the stream per sample, so that samples resumed with
+// _SetSampleNumber()_ do not replay the random values of earlier ones.
+void SeedPixelRNG(RNG &rng, int seed, const Point2i &p, int64_t sampleNum = 0);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_SAMPLER_H
@@ -35,6 +35,7 @@
 #include "sampling.h"
 #include "geometry.h"
 #include "shape.h"
+#include "parallel.h"
 
 namespace pbrt {
 
@@ -170,4 +171,78 @@ Distribution2D::Distribution2D(const Float *func, int nu, int nv) {
     pMarginal.reset(new Distribution1D(&marginalFunc[0], nv));
 }
 
+HierarchicalDistribution2D::HierarchicalDistribution2D(const Float *func,
+                                                       int nu, int nv)
+    : nu(nu), nv(nv) {
+    CHECK(IsPowerOf2(nu) && IsPowerOf2(nv));
+    // Sum each level's texels' children in the next finer one
+    int nLevels = 1 + Log2Int(std::max(nu, nv));
+    levels.resize(nLevels);
+    levels[0].assign(func, func + nu * nv);
+    for (int level = 1; level < nLevels; ++level) {
+        int width = levelWidth(level), height = levelHeight(level);
+        int fineWidth = levelWidth(level - 1);
+        int fineHeight = levelHeight(level - 1);
+        const std::vector<Float> &fine = levels[level - 1];
+        levels[level].resize(width * height);
+        ParallelFor([&](int64_t y) {
+            for (int x = 0; x < width; ++x) {
+                Float sum = 0;
+                for (int fy = 2 * y; fy < std::min<int>(2 * y + 2, fineHeight);
+                     ++fy)
+                    for (int fx = 2 * x; fx < std::min(2 * x + 2, fineWidth);
+                         ++fx)
+                        sum += fine[fy * fineWidth + fx];
+                levels[level][y * width + x] = sum;
+            }
+        }, height, std::max(1, 16384 / width));
+    }
+    funcInt = levels.back()[0] / (nu * nv);
+}
+
+Point2f HierarchicalDistribution2D::SampleContinuous(const Point2f &uSample,
+                                                     Float *pdf) const {
+    if (funcInt == 0) {
+        *pdf = 0;
+        return uSample;
+    }
+    // Choose between the halves of the current cell at each finer level,
+    // first along $u$ and then along $v$
+    Point2f u = uSample;
+    int x = 0, y = 0;
+    for (int level = int(levels.size()) - 1; level > 0; --level) {
+        const std::vector<Float> &fine = levels[level - 1];
+        int fineWidth = levelWidth(level - 1);
+        bool splitU = 2 * x + 1 < fineWidth;
+        bool splitV = 2 * y + 1 < levelHeight(level - 1);
+        x *= 2;
+        y *= 2;
+        auto f = [&](int fx, int fy) { return fine[fy * fineWidth + fx]; };
+        if (splitU) {
+            Float f0 = f(x, y) + (splitV ? f(x, y + 1) : 0);
+            Float f1 = f(x + 1, y) + (splitV ? f(x + 1, y + 1) : 0);
+            Float p0 = f0 / (f0 + f1);
+            if (u[0] < p0)
+                u[0] = std::min(u[0] / p0, OneMinusEpsilon);
+            else {
+                u[0] = std::min((u[0] - p0) / (1 - p0), OneMinusEpsilon);
+                ++x;
+            }
+        }
+        if (splitV) {
+            Float p0 = f(x, y) / (f(x, y) + f(x, y + 1));
+            if (u[1] < p0)
+                u[1] = std::min(u[1] / p0, OneMinusEpsilon);
+            else {
+                u[1] = std::min((u[1] - p0) / (1 - p0), OneMinusEpsilon);
+                ++y;
+            }
+        }
+    }
+
+    // Return a uniformly distributed point within the chosen texel
+    *pdf = levels[0][y * nu + x] / funcInt;
+    return Point2f((x + u[0]) / nu, (y + u[1]) / nv);
+}
+
 }  // namespace pbrt
@@ -146,6 +146,37 @@ class Distribution2D {
     std::unique_ptr<Distribution1D> pMarginal;
 };
 
+// HierarchicalDistribution2D samples the same piecewise-constant function
+// as Distribution2D, for power-of-two resolutions, by descending a
+// pyramid of sums of its values: at each level, the sample's coordinates
+// choose between the halves of the current cell and are rescaled to the
+// chosen half. Sampling thus costs a few nearby lookups per level rather
+// than two binary searches over large CDFs, and nearby samples stay
+// nearby, which preserves their stratification.
+class HierarchicalDistribution2D {
+  public:
+    // HierarchicalDistribution2D Public Methods
+    HierarchicalDistribution2D(const Float *func, int nu, int nv);
+    Point2f SampleContinuous(const Point2f &u, Float *pdf) const;
+    Float Pdf(const Point2f &p) const {
+        int iu = Clamp(int(p[0] * nu), 0, nu - 1);
+        int iv = Clamp(int(p[1] * nv), 0, nv - 1);
+        return funcInt > 0 ? levels[0][iv * nu + iu] / funcInt : 0;
+    }
+
+  private:
+    // HierarchicalDistribution2D Private Methods
+    int levelWidth(int level) const { return std::max(1, nu >> level); }
+    int levelHeight(int level) const { return std::max(1, nv >> level); }
+
+    // HierarchicalDistribution2D Private Data
+    const int nu, nv;
+    // _levels[0]_ holds the function's values; each following level halves
+    // the resolution, down to a single sum
+    std::vector<std::vector<Float>> levels;
+    Float funcInt;
+};
+
 // Sampling Inline Functions
 template <typename T>
 void Shuffle(T *samp, int count, int nDimensions, RNG &rng) {
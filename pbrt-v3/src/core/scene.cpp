@@ -54,6 +54,23 @@ bool Scene::IntersectP(const Ray &ray) const {
     return aggregate->IntersectP(ray);
 }
 
+void Scene::Intersect(RayBatch &batch) const {
+    if (batch.occlusion)
+        nShadowTests += batch.Size();
+    else
+        nIntersectionTests += batch.Size();
+    if (batchAggregate) {
+        batchAggregate->Intersect(batch);
+        return;
+    }
+    batch.ResetResults();
+    for (size_t i = 0; i < batch.Size(); ++i)
+        batch.hit[i] = batch.occlusion
+                           ? aggregate->IntersectP(batch.rays[i])
+                           : aggregate->Intersect(batch.rays[i],
+                                                  &batch.isects[i]);
+}
+
 bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                         Spectrum *Tr) const {
     *Tr = Spectrum(1.f);
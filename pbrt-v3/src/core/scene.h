@@ -55,6 +55,7 @@ class Scene {
         : lights(lights), aggregate(aggregate) {
         // Scene Constructor Implementation
         worldBound = aggregate->WorldBound();
+        batchAggregate = dynamic_cast<const Aggregate *>(aggregate.get());
         for (const auto &light : lights) {
             light->Preprocess(*this);
             if (light->flags & (int)LightFlags::Infinite)
@@ -64,6 +65,7 @@ class Scene {
     const Bounds3f &WorldBound() const { return worldBound; }
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void Intersect(RayBatch &batch) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
 
@@ -76,6 +78,8 @@ class Scene {
   private:
     // Scene Private Data
     std::shared_ptr<Primitive> aggregate;
+    // _aggregate_ if it's an _Aggregate_, for batched intersection
+    const Aggregate *batchAggregate;
     Bounds3f worldBound;
 };
 
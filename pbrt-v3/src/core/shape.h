@@ -82,6 +82,12 @@ class Shape {
     // used in this case.
     virtual Float SolidAngle(const Point3f &p, int nSamples = 512) const;
 
+    // Returns a cone that holds the geometric normals of all points on the
+    // shape, as oriented for emission by area lights
+    virtual DirectionCone NormalBounds() const {
+        return DirectionCone::EntireSphere();
+    }
+
     // Shape Public Data
     const Transform *ObjectToWorld, *WorldToObject;
     const bool reverseOrientation;
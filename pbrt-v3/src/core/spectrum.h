@@ -41,6 +41,10 @@
 // core/spectrum.h*
 #include "pbrt.h"
 #include "stringprint.h"
+#if defined(__SSE2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <emmintrin.h>
+#define PBRT_SPECTRUM_SSE
+#endif
 
 namespace pbrt {
 
@@ -96,13 +100,86 @@ extern const Float RGBIllum2SpectRed[nRGB2SpectSamples];
 extern const Float RGBIllum2SpectGreen[nRGB2SpectSamples];
 extern const Float RGBIllum2SpectBlue[nRGB2SpectSamples];
 
+// SpectrumVec Declarations
+// A group of adjacent spectral samples that CoefficientSpectrum operates
+// on at once; it holds four samples with SSE and a single one otherwise.
+#ifdef PBRT_SPECTRUM_SSE
+struct SpectrumVec {
+    static const int Width = 4;
+    static SpectrumVec Load(const Float *p) { return {_mm_loadu_ps(p)}; }
+    static SpectrumVec Set(Float v) { return {_mm_set1_ps(v)}; }
+    void Store(Float *p) const { _mm_storeu_ps(p, v); }
+    SpectrumVec operator+(SpectrumVec b) const { return {_mm_add_ps(v, b.v)}; }
+    SpectrumVec operator-(SpectrumVec b) const { return {_mm_sub_ps(v, b.v)}; }
+    SpectrumVec operator*(SpectrumVec b) const { return {_mm_mul_ps(v, b.v)}; }
+    SpectrumVec operator/(SpectrumVec b) const { return {_mm_div_ps(v, b.v)}; }
+    SpectrumVec Clamp(SpectrumVec low, SpectrumVec high) const {
+        // Ordered as in pbrt::Clamp(), so that NaNs are kept
+        __m128 r = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(v, low.v), low.v),
+                             _mm_andnot_ps(_mm_cmplt_ps(v, low.v), v));
+        __m128 isHigh = _mm_cmpgt_ps(v, high.v);
+        return {_mm_or_ps(_mm_and_ps(isHigh, high.v),
+                          _mm_andnot_ps(isHigh, r))};
+    }
+    SpectrumVec Max(SpectrumVec b) const { return {_mm_max_ps(v, b.v)}; }
+    bool AnyEqual(SpectrumVec b) const {
+        return _mm_movemask_ps(_mm_cmpeq_ps(v, b.v)) != 0;
+    }
+    bool AnyNotEqual(SpectrumVec b) const {
+        return _mm_movemask_ps(_mm_cmpneq_ps(v, b.v)) != 0;
+    }
+    bool AnyNaN() const {
+        return _mm_movemask_ps(_mm_cmpunord_ps(v, v)) != 0;
+    }
+    Float Sum() const {
+        __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+    Float MaxComponent() const {
+        __m128 m = _mm_max_ps(v, _mm_movehl_ps(v, v));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+    __m128 v;
+};
+#else
+struct SpectrumVec {
+    static const int Width = 1;
+    static SpectrumVec Load(const Float *p) { return {*p}; }
+    static SpectrumVec Set(Float v) { return {v}; }
+    void Store(Float *p) const { *p = v; }
+    SpectrumVec operator+(SpectrumVec b) const { return {v + b.v}; }
+    SpectrumVec operator-(SpectrumVec b) const { return {v - b.v}; }
+    SpectrumVec operator*(SpectrumVec b) const { return {v * b.v}; }
+    SpectrumVec operator/(SpectrumVec b) const { return {v / b.v}; }
+    SpectrumVec Clamp(SpectrumVec low, SpectrumVec high) const {
+        return {pbrt::Clamp(v, low.v, high.v)};
+    }
+    SpectrumVec Max(SpectrumVec b) const { return {std::max(v, b.v)}; }
+    bool AnyEqual(SpectrumVec b) const { return v == b.v; }
+    bool AnyNotEqual(SpectrumVec b) const { return v != b.v; }
+    bool AnyNaN() const { return std::isnan(v); }
+    Float Sum() const { return v; }
+    Float MaxComponent() const { return v; }
+    Float v;
+};
+#endif  // PBRT_SPECTRUM_SSE
+
 // Spectrum Declarations
 template <int nSpectrumSamples>
 class CoefficientSpectrum {
+    // Samples before _nVec_ are processed a _SpectrumVec_ at a time and the
+    // rest one by one
+    static const int nVec =
+        nSpectrumSamples - nSpectrumSamples % SpectrumVec::Width;
+
   public:
     // CoefficientSpectrum Public Methods
     CoefficientSpectrum(Float v = 0.f) {
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] = v;
+        SpectrumVec vv = SpectrumVec::Set(v);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width) vv.Store(&c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i) c[i] = v;
         DCHECK(!HasNaNs());
     }
 #ifdef DEBUG
@@ -127,49 +204,67 @@ class CoefficientSpectrum {
     }
     CoefficientSpectrum &operator+=(const CoefficientSpectrum &s2) {
         DCHECK(!s2.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] += s2.c[i];
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            (SpectrumVec::Load(&c[i]) + SpectrumVec::Load(&s2.c[i]))
+                .Store(&c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i) c[i] += s2.c[i];
         return *this;
     }
     CoefficientSpectrum operator+(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] += s2.c[i];
+        ret += s2;
         return ret;
     }
     CoefficientSpectrum operator-(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] -= s2.c[i];
+        CoefficientSpectrum ret;
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            (SpectrumVec::Load(&c[i]) - SpectrumVec::Load(&s2.c[i]))
+                .Store(&ret.c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i)
+            ret.c[i] = c[i] - s2.c[i];
         return ret;
     }
     CoefficientSpectrum operator/(const CoefficientSpectrum &s2) const {
         DCHECK(!s2.HasNaNs());
-        CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) {
+        CoefficientSpectrum ret;
+        const SpectrumVec zero = SpectrumVec::Set(0);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width) {
+            SpectrumVec d = SpectrumVec::Load(&s2.c[i]);
+            CHECK(!d.AnyEqual(zero));
+            (SpectrumVec::Load(&c[i]) / d).Store(&ret.c[i]);
+        }
+        for (int i = nVec; i < nSpectrumSamples; ++i) {
           CHECK_NE(s2.c[i], 0);
-          ret.c[i] /= s2.c[i];
+          ret.c[i] = c[i] / s2.c[i];
         }
         return ret;
     }
     CoefficientSpectrum operator*(const CoefficientSpectrum &sp) const {
         DCHECK(!sp.HasNaNs());
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] *= sp.c[i];
+        ret *= sp;
         return ret;
     }
     CoefficientSpectrum &operator*=(const CoefficientSpectrum &sp) {
         DCHECK(!sp.HasNaNs());
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= sp.c[i];
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            (SpectrumVec::Load(&c[i]) * SpectrumVec::Load(&sp.c[i]))
+                .Store(&c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i) c[i] *= sp.c[i];
         return *this;
     }
     CoefficientSpectrum operator*(Float a) const {
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] *= a;
-        DCHECK(!ret.HasNaNs());
+        ret *= a;
         return ret;
     }
     CoefficientSpectrum &operator*=(Float a) {
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] *= a;
+        SpectrumVec av = SpectrumVec::Set(a);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            (SpectrumVec::Load(&c[i]) * av).Store(&c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i) c[i] *= a;
         DCHECK(!HasNaNs());
         return *this;
     }
@@ -179,21 +274,26 @@ class CoefficientSpectrum {
         return s * a;
     }
     CoefficientSpectrum operator/(Float a) const {
-        CHECK_NE(a, 0);
-        DCHECK(!std::isnan(a));
         CoefficientSpectrum ret = *this;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] /= a;
+        ret /= a;
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     CoefficientSpectrum &operator/=(Float a) {
         CHECK_NE(a, 0);
         DCHECK(!std::isnan(a));
-        for (int i = 0; i < nSpectrumSamples; ++i) c[i] /= a;
+        SpectrumVec av = SpectrumVec::Set(a);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            (SpectrumVec::Load(&c[i]) / av).Store(&c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i) c[i] /= a;
         return *this;
     }
     bool operator==(const CoefficientSpectrum &sp) const {
-        for (int i = 0; i < nSpectrumSamples; ++i)
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            if (SpectrumVec::Load(&c[i]).AnyNotEqual(
+                    SpectrumVec::Load(&sp.c[i])))
+                return false;
+        for (int i = nVec; i < nSpectrumSamples; ++i)
             if (c[i] != sp.c[i]) return false;
         return true;
     }
@@ -201,7 +301,10 @@ class CoefficientSpectrum {
         return !(*this == sp);
     }
     bool IsBlack() const {
-        for (int i = 0; i < nSpectrumSamples; ++i)
+        const SpectrumVec zero = SpectrumVec::Set(0);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            if (SpectrumVec::Load(&c[i]).AnyNotEqual(zero)) return false;
+        for (int i = nVec; i < nSpectrumSamples; ++i)
             if (c[i] != 0.) return false;
         return true;
     }
@@ -214,11 +317,7 @@ class CoefficientSpectrum {
     template <int n>
     friend inline CoefficientSpectrum<n> Pow(const CoefficientSpectrum<n> &s,
                                              Float e);
-    CoefficientSpectrum operator-() const {
-        CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = -c[i];
-        return ret;
-    }
+    CoefficientSpectrum operator-() const { return *this * Float(-1); }
     friend CoefficientSpectrum Exp(const CoefficientSpectrum &s) {
         CoefficientSpectrum ret;
         for (int i = 0; i < nSpectrumSamples; ++i) ret.c[i] = std::exp(s.c[i]);
@@ -240,19 +339,30 @@ class CoefficientSpectrum {
     }
     CoefficientSpectrum Clamp(Float low = 0, Float high = Infinity) const {
         CoefficientSpectrum ret;
-        for (int i = 0; i < nSpectrumSamples; ++i)
+        SpectrumVec lowv = SpectrumVec::Set(low), highv = SpectrumVec::Set(high);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            SpectrumVec::Load(&c[i]).Clamp(lowv, highv).Store(&ret.c[i]);
+        for (int i = nVec; i < nSpectrumSamples; ++i)
             ret.c[i] = pbrt::Clamp(c[i], low, high);
         DCHECK(!ret.HasNaNs());
         return ret;
     }
     Float MaxComponentValue() const {
         Float m = c[0];
-        for (int i = 1; i < nSpectrumSamples; ++i)
+        if (nVec > 0) {
+            SpectrumVec mv = SpectrumVec::Load(&c[0]);
+            for (int i = SpectrumVec::Width; i < nVec; i += SpectrumVec::Width)
+                mv = mv.Max(SpectrumVec::Load(&c[i]));
+            m = mv.MaxComponent();
+        }
+        for (int i = nVec > 0 ? nVec : 1; i < nSpectrumSamples; ++i)
             m = std::max(m, c[i]);
         return m;
     }
     bool HasNaNs() const {
-        for (int i = 0; i < nSpectrumSamples; ++i)
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            if (SpectrumVec::Load(&c[i]).AnyNaN()) return true;
+        for (int i = nVec; i < nSpectrumSamples; ++i)
             if (std::isnan(c[i])) return true;
         return false;
     }
@@ -378,12 +488,9 @@ class SampledSpectrum : public CoefficientSpectrum<nSpectralSamples> {
         }
     }
     void ToXYZ(Float xyz[3]) const {
-        xyz[0] = xyz[1] = xyz[2] = 0.f;
-        for (int i = 0; i < nSpectralSamples; ++i) {
-            xyz[0] += X.c[i] * c[i];
-            xyz[1] += Y.c[i] * c[i];
-            xyz[2] += Z.c[i] * c[i];
-        }
+        xyz[0] = Dot(X);
+        xyz[1] = Dot(Y);
+        xyz[2] = Dot(Z);
         Float scale = Float(sampledLambdaEnd - sampledLambdaStart) /
                       Float(CIE_Y_integral * nSpectralSamples);
         xyz[0] *= scale;
@@ -391,9 +498,7 @@ class SampledSpectrum : public CoefficientSpectrum<nSpectralSamples> {
         xyz[2] *= scale;
     }
     Float y() const {
-        Float yy = 0.f;
-        for (int i = 0; i < nSpectralSamples; ++i) yy += Y.c[i] * c[i];
-        return yy * Float(sampledLambdaEnd - sampledLambdaStart) /
+        return Dot(Y) * Float(sampledLambdaEnd - sampledLambdaStart) /
                Float(CIE_Y_integral * nSpectralSamples);
     }
     void ToRGB(Float rgb[3]) const {
@@ -414,6 +519,19 @@ class SampledSpectrum : public CoefficientSpectrum<nSpectralSamples> {
                     SpectrumType type = SpectrumType::Reflectance);
 
   private:
+    // SampledSpectrum Private Methods
+    Float Dot(const SampledSpectrum &s) const {
+        // Accumulate a _SpectrumVec_ of partial sums
+        const int nVec =
+            nSpectralSamples - nSpectralSamples % SpectrumVec::Width;
+        SpectrumVec sum = SpectrumVec::Set(0);
+        for (int i = 0; i < nVec; i += SpectrumVec::Width)
+            sum = sum + SpectrumVec::Load(&c[i]) * SpectrumVec::Load(&s.c[i]);
+        Float r = sum.Sum();
+        for (int i = nVec; i < nSpectralSamples; ++i) r += c[i] * s.c[i];
+        return r;
+    }
+
     // SampledSpectrum Private Data
     static SampledSpectrum X, Y, Z;
     static SampledSpectrum rgbRefl2SpectWhite, rgbRefl2SpectCyan;
@@ -180,6 +180,7 @@ enum class Prof {
     GenerateCameraRay,
     MergeFilmTile,
     SplatFilm,
+    WriteCheckpoint,
     AddFilmSample,
     StartPixel,
     GetSample,
@@ -235,6 +236,7 @@ static const char *ProfNames[] = {
     "Camera::GenerateRay[Differential]()",
     "Film::MergeTile()",
     "Film::AddSplat()",
+    "RenderCheckpoint::Write()",
     "Film::AddSample()",
     "Sampler::StartPixelSample()",
     "Sampler::GetSample[12]D()",
@@ -0,0 +1,141 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/texcache.cpp*
+#include "texcache.h"
+#include "stats.h"
+#include <atomic>
+
+namespace pbrt {
+
+STAT_PERCENT("Texture/Tile cache misses", nTileMisses, nTileLookups);
+STAT_COUNTER("Texture/Tiles evicted", nTilesEvicted);
+STAT_MEMORY_COUNTER("Memory/Texture tiles loaded", tileMemory);
+
+TextureCache textureCache;
+
+// TextureCache Method Definitions
+uint64_t TextureCache::NewOwnerKey() {
+    // Owners get the upper 24 bits; keys are never reused
+    static std::atomic<uint64_t> nextOwner(1);
+    return nextOwner++ << 40;
+}
+
+TextureCache::RecentTile *TextureCache::RecentTiles() {
+    static thread_local RecentTile recentTiles[NumRecentTiles];
+    return recentTiles;
+}
+
+const std::shared_ptr<const void> &TextureCache::lookup(
+    uint64_t key, uint64_t hash, RecentTile &recent,
+    const std::function<std::shared_ptr<const void>(size_t *)> &load) {
+    ++nTileLookups;
+    Shard &shard = shards[(hash >> 32) % nShards];
+    std::promise<std::shared_ptr<const void>> loaded;
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto iter = shard.entries.find(key);
+        if (iter != shard.entries.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+            recent.key = key;
+            recent.tile = iter->second->tile;
+            return recent.tile;
+        }
+        auto loadingIter = shard.loading.find(key);
+        if (loadingIter != shard.loading.end()) {
+            // Wait for the thread that is creating the tile
+            std::shared_future<std::shared_ptr<const void>> pending =
+                loadingIter->second;
+            lock.unlock();
+            recent.key = key;
+            recent.tile = pending.get();
+            return recent.tile;
+        }
+        shard.loading[key] = loaded.get_future().share();
+    }
+
+    // Create the tile without holding the lock, so that lookups of other
+    // tiles in the shard can go on meanwhile
+    ++nTileMisses;
+    size_t bytes = 0;
+    std::shared_ptr<const void> tile = load(&bytes);
+    tileMemory += bytes;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.loading.erase(key);
+        shard.lru.push_front({key, tile, bytes});
+        shard.entries[key] = shard.lru.begin();
+        shard.bytes += bytes;
+        // Evict least recently used tiles; if that includes the new one,
+        // the caller still holds it through _recent_
+        size_t shardBudget = budget / nShards;
+        while (shard.bytes > shardBudget) {
+            const Entry &lru = shard.lru.back();
+            shard.bytes -= lru.bytes;
+            shard.entries.erase(lru.key);
+            shard.lru.pop_back();
+            ++nTilesEvicted;
+        }
+    }
+    loaded.set_value(tile);
+    recent.key = key;
+    recent.tile = std::move(tile);
+    return recent.tile;
+}
+
+size_t TextureCache::BytesUsed() {
+    size_t bytes = 0;
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
+
+void TextureCache::SetBudget(size_t bytes) {
+    Clear();
+    budget = bytes;
+    nShards = int(Clamp(bytes / MinShardBytes, 1, NumShards));
+}
+
+void TextureCache::Clear() {
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.entries.clear();
+        shard.bytes = 0;
+    }
+    // Tiles that threads used last stay alive until they look up others
+}
+
+}  // namespace pbrt
@@ -0,0 +1,135 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_TEXCACHE_H
+#define PBRT_CORE_TEXCACHE_H
+
+// core/texcache.h*
+#include "pbrt.h"
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace pbrt {
+
+// TextureCache Declarations
+// Holds the tiles of lazily loaded MIP maps within a fixed memory budget,
+// evicting the least recently used ones. Tiles are found by 64-bit keys
+// and are created by a caller-supplied function on a miss; threads that
+// miss on a tile that is already being created wait for it. The cache is
+// split into independently locked shards, and each thread remembers the
+// tiles it used last, so most lookups take no lock at all.
+class TextureCache {
+  public:
+    // TextureCache Public Methods
+    // Returns a unique value for the upper bits of an owner's tile keys
+    static uint64_t NewOwnerKey();
+    // Returns the tile for _key_, calling _load_ to create it on a miss;
+    // _load_ returns the tile and sets its size in bytes. The pointer is
+    // valid until the calling thread's next Lookup().
+    template <typename F>
+    const void *Lookup(uint64_t key, F load) {
+        uint64_t hash = MixKey(key);
+        RecentTile &recent = RecentTiles()[hash % NumRecentTiles];
+        if (recent.key == key) return recent.tile.get();
+        return lookup(key, hash, recent, load).get();
+    }
+    // Empties the cache and sets its size limit; not thread safe
+    void SetBudget(size_t bytes);
+    size_t Budget() const { return budget; }
+    // Bytes of the tiles currently in the cache
+    size_t BytesUsed();
+    void Clear();
+
+    static PBRT_CONSTEXPR int TileLog2 = 6;
+    static PBRT_CONSTEXPR int TileSize = 1 << TileLog2;
+
+  private:
+    // TextureCache Private Declarations
+    // Each thread's most recently used tiles, by hashed key; key 0 is unused
+    struct RecentTile {
+        uint64_t key = 0;
+        std::shared_ptr<const void> tile;
+    };
+    static PBRT_CONSTEXPR int NumRecentTiles = 16;
+
+    // TextureCache Private Methods
+    static uint64_t MixKey(uint64_t v) {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185ull;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44dull;
+        return v ^ (v >> 33);
+    }
+    static RecentTile *RecentTiles();
+    const std::shared_ptr<const void> &lookup(
+        uint64_t key, uint64_t hash, RecentTile &recent,
+        const std::function<std::shared_ptr<const void>(size_t *)> &load);
+
+    // TextureCache Private Data
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const void> tile;
+        size_t bytes;
+    };
+    struct Shard {
+        std::mutex mutex;
+        // Most recently used entries first
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+        // Tiles that some thread is creating
+        std::unordered_map<uint64_t,
+                           std::shared_future<std::shared_ptr<const void>>>
+            loading;
+        size_t bytes = 0;
+    };
+    // Small budgets use fewer shards, so that each still fits a few tiles
+    static PBRT_CONSTEXPR int NumShards = 64;
+    static PBRT_CONSTEXPR size_t MinShardBytes = 256 * 1024;
+    Shard shards[NumShards];
+    size_t budget = size_t(512) << 20;
+    int nShards = NumShards;
+};
+
+extern TextureCache textureCache;
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_TEXCACHE_H
@@ -32,6 +32,7 @@
 
 // integrators/bdpt.cpp*
 #include "integrators/bdpt.h"
+#include "checkpoint.h"
 #include "film.h"
 #include "filters/box.h"
 #include "integrator.h"
@@ -319,6 +320,12 @@ void BDPTIntegrator::Render(const Scene &scene) {
     const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
     const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
     ProgressReporter reporter(nXTiles * nYTiles, "Rendering");
+    RenderCheckpoint checkpoint(
+        film,
+        StringPrintf("BDPTIntegrator spp %d maxdepth %d",
+                     (int)sampler->samplesPerPixel, maxDepth),
+        nXTiles * nYTiles);
+    checkpoint.Restore();
 
     // Allocate buffers for debug visualization
     const int bufferCount = (1 + maxDepth) * (6 + maxDepth) / 2;
@@ -345,8 +352,13 @@ void BDPTIntegrator::Render(const Scene &scene) {
     if (scene.lights.size() > 0) {
         ParallelFor2D([&](const Point2i tile) {
             // Render a single tile using BDPT
-            MemoryArena arena;
             int seed = tile.y * nXTiles + tile.x;
+            if (checkpoint.TileSamples(seed) > 0) {
+                // Rendered before the checkpoint we resumed from
+                reporter.Update();
+                return;
+            }
+            MemoryArena arena;
             std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
             int x0 = sampleBounds.pMin.x + tile.x * tileSize;
             int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
@@ -357,6 +369,9 @@ void BDPTIntegrator::Render(const Scene &scene) {
 
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
+            // When checkpointing, the tile's splats are held back until it
+            // is committed so that checkpoints only hold complete tiles
+            std::vector<std::pair<Point2f, Spectrum>> tileSplats;
             for (Point2i pPixel : tileBounds) {
                 tileSampler->StartPixel(pPixel);
                 if (!InsideExclusive(pPixel, pixelBounds))
@@ -415,6 +430,8 @@ void BDPTIntegrator::Render(const Scene &scene) {
                             }
                             if (t != 1)
                                 L += Lpath;
+                            else if (checkpoint.Enabled())
+                                tileSplats.push_back({pFilmNew, Lpath});
                             else
                                 film->AddSplat(pFilmNew, Lpath);
                         }
@@ -425,13 +442,18 @@ void BDPTIntegrator::Render(const Scene &scene) {
                     arena.Reset();
                 } while (tileSampler->StartNextSample());
             }
-            film->MergeFilmTile(std::move(filmTile));
+            checkpoint.CommitTile(seed, sampler->samplesPerPixel, [&]() {
+                for (const auto &splat : tileSplats)
+                    film->AddSplat(splat.first, splat.second);
+                film->MergeFilmTile(std::move(filmTile));
+            });
             reporter.Update();
             LOG(INFO) << "Finished image tile " << tileBounds;
         }, Point2i(nXTiles, nYTiles));
         reporter.Done();
     }
     film->WriteImage(1.0f / sampler->samplesPerPixel);
+    checkpoint.Finish();
 
     // Write buffers for debug visualization
     if (visualizeStrategies || visualizeWeights) {
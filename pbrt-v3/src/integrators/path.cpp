@@ -50,8 +50,9 @@ PathIntegrator::PathIntegrator(int maxDepth,
                                std::shared_ptr<const Camera> camera,
                                std::shared_ptr<Sampler> sampler,
                                const Bounds2i &pixelBounds, Float rrThreshold,
-                               const std::string &lightSampleStrategy)
-    : SamplerIntegrator(camera, sampler, pixelBounds),
+                               const std::string &lightSampleStrategy,
+                               bool batchCameraRays)
+    : SamplerIntegrator(camera, sampler, pixelBounds, batchCameraRays),
       maxDepth(maxDepth),
       rrThreshold(rrThreshold),
       lightSampleStrategy(lightSampleStrategy) {}
@@ -61,9 +62,23 @@ void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
         CreateLightSampleDistribution(lightSampleStrategy, scene);
 }
 
-Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
+Spectrum PathIntegrator::Li(const RayDifferential &ray, const Scene &scene,
                             Sampler &sampler, MemoryArena &arena,
                             int depth) const {
+    return TracePath(ray, scene, sampler, arena, false, nullptr);
+}
+
+Spectrum PathIntegrator::LiFromHit(const RayDifferential &ray,
+                                   const SurfaceInteraction *isect,
+                                   const Scene &scene, Sampler &sampler,
+                                   MemoryArena &arena) const {
+    return TracePath(ray, scene, sampler, arena, true, isect);
+}
+
+Spectrum PathIntegrator::TracePath(const RayDifferential &r,
+                                   const Scene &scene, Sampler &sampler,
+                                   MemoryArena &arena, bool firstHitKnown,
+                                   const SurfaceInteraction *firstHit) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
     Spectrum L(0.f), beta(1.f);
     RayDifferential ray(r);
@@ -85,7 +100,13 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
         // Intersect _ray_ with scene and store intersection in _isect_
         SurfaceInteraction isect;
-        bool foundIntersection = scene.Intersect(ray, &isect);
+        bool foundIntersection;
+        if (firstHitKnown) {
+            foundIntersection = firstHit != nullptr;
+            if (firstHit) isect = *firstHit;
+            firstHitKnown = false;
+        } else
+            foundIntersection = scene.Intersect(ray, &isect);
 
         // Possibly add emitted light at intersection
         if (bounces == 0 || specularBounce) {
@@ -112,15 +133,14 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             continue;
         }
 
-        const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
-
         // Sample illumination from lights to find path contribution.
         // (But skip this for perfectly specular BSDFs.)
         if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
             0) {
             ++totalPaths;
-            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
-                                                       sampler, false, distrib);
+            Spectrum Ld =
+                beta * UniformSampleOneLight(isect, scene, arena, sampler,
+                                             false, *lightDistribution);
             VLOG(2) << "Sampled direct lighting Ld = " << Ld;
             if (Ld.IsBlack()) ++zeroRadiancePaths;
             CHECK_GE(Ld.y(), 0.f);
@@ -161,7 +181,7 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
             // Account for the direct subsurface scattering component
             L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
-                                              lightDistribution->Lookup(pi.p));
+                                              *lightDistribution);
 
             // Account for the indirect subsurface scattering component
             Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
@@ -208,8 +228,9 @@ PathIntegrator *CreatePathIntegrator(const ParamSet &params,
     Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
     std::string lightStrategy =
         params.FindOneString("lightsamplestrategy", "spatial");
+    bool batchCameraRays = params.FindOneBool("batchcamerarays", false);
     return new PathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                              rrThreshold, lightStrategy);
+                              rrThreshold, lightStrategy, batchCameraRays);
 }
 
 }  // namespace pbrt
@@ -52,13 +52,25 @@ class PathIntegrator : public SamplerIntegrator {
     PathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                    std::shared_ptr<Sampler> sampler,
                    const Bounds2i &pixelBounds, Float rrThreshold = 1,
-                   const std::string &lightSampleStrategy = "spatial");
+                   const std::string &lightSampleStrategy = "spatial",
+                   bool batchCameraRays = false);
 
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
+    Spectrum LiFromHit(const RayDifferential &ray,
+                       const SurfaceInteraction *isect, const Scene &scene,
+                       Sampler &sampler, MemoryArena &arena) const;
 
   private:
+    // PathIntegrator Private Methods
+    // If _firstHitKnown_, _firstHit_ is the intersection of _ray_ (nullptr
+    // if it escaped) and the scene is not traced for the first vertex.
+    Spectrum TracePath(const RayDifferential &ray, const Scene &scene,
+                       Sampler &sampler, MemoryArena &arena,
+                       bool firstHitKnown,
+                       const SurfaceInteraction *firstHit) const;
+
     // PathIntegrator Private Data
     const int maxDepth;
     const Float rrThreshold;
@@ -0,0 +1,379 @@
+// integrators/wavefront.cpp*
+#include "integrators/wavefront.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "paramset.h"
+#include "parallel.h"
+#include "progressreporter.h"
+#include "sampler.h"
+#include "scene.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_INT_DISTRIBUTION("Integrator/Wavefront paths in flight", pathsInFlight);
+STAT_PERCENT("Integrator/Unoccluded light samples", unoccludedLightSamples,
+             lightSamples);
+
+// Path states of one tile, as structure of arrays. Path _i_ renders all
+// samples of the _i_th pixel one after the other with its own sampler.
+struct WavefrontQueue {
+    enum State : uint8_t { NewSample, Tracing, Done };
+    void Add(std::unique_ptr<Sampler> s, const Point2i &pixel) {
+        samplers.push_back(std::move(s));
+        pixels.push_back(pixel);
+        state.push_back(NewSample);
+        rays.push_back(RayDifferential());
+        pFilm.push_back(Point2f());
+        rayWeight.push_back(0);
+        L.push_back(Spectrum(0.f));
+        beta.push_back(Spectrum(1.f));
+        etaScale.push_back(1);
+        bsdfPdf.push_back(0);
+        bounces.push_back(0);
+        specularBounce.push_back(0);
+        misEmission.push_back(0);
+        prevVertex.push_back(Interaction());
+    }
+    int Size() const { return pixels.size(); }
+
+    std::vector<std::unique_ptr<Sampler>> samplers;
+    std::vector<Point2i> pixels;
+    std::vector<State> state;
+    std::vector<RayDifferential> rays;
+    std::vector<Point2f> pFilm;
+    std::vector<Float> rayWeight;
+    std::vector<Spectrum> L, beta;
+    std::vector<Float> etaScale;
+    // pdf of the BSDF sample that produced _rays_
+    std::vector<Float> bsdfPdf;
+    std::vector<int> bounces;
+    std::vector<uint8_t> specularBounce;
+    // Emission found by _rays_ is MIS-weighted against the light sample
+    // taken at _prevVertex_
+    std::vector<uint8_t> misEmission;
+    std::vector<Interaction> prevVertex;
+
+    // Light samples waiting for their shadow rays
+    RayBatch shadowRays = RayBatch(true);
+    std::vector<int> shadowPaths;
+    std::vector<Spectrum> shadowLd;
+};
+
+// WavefrontIntegrator Method Definitions
+WavefrontIntegrator::WavefrontIntegrator(int maxDepth,
+                                         std::shared_ptr<const Camera> camera,
+                                         std::shared_ptr<Sampler> sampler,
+                                         const Bounds2i &pixelBounds,
+                                         Float rrThreshold,
+                                         const std::string &lightSampleStrategy)
+    : camera(camera),
+      sampler(sampler),
+      pixelBounds(pixelBounds),
+      maxDepth(maxDepth),
+      rrThreshold(rrThreshold),
+      lightSampleStrategy(lightSampleStrategy) {}
+
+void WavefrontIntegrator::Render(const Scene &scene) {
+    lightDistribution =
+        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lightToIndex[scene.lights[i].get()] = i;
+
+    // Tiles are larger than SamplerIntegrator's so that more paths are in
+    // flight at once
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    Vector2i sampleExtent = sampleBounds.Diagonal();
+    const int tileSize = 32;
+    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
+                   (sampleExtent.y + tileSize - 1) / tileSize);
+    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
+    ParallelFor2D([&](Point2i tile) {
+        MemoryArena arena;
+        int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+        int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+        int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+        int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+        Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+        LOG(INFO) << "Starting image tile " << tileBounds;
+        std::unique_ptr<FilmTile> filmTile =
+            camera->film->GetFilmTile(tileBounds);
+        RenderTile(scene, tileBounds, filmTile.get(), arena);
+        LOG(INFO) << "Finished image tile " << tileBounds;
+        camera->film->MergeFilmTile(std::move(filmTile));
+        reporter.Update();
+    }, nTiles);
+    reporter.Done();
+    LOG(INFO) << "Rendering finished";
+    camera->film->WriteImage();
+}
+
+void WavefrontIntegrator::RenderTile(const Scene &scene,
+                                     const Bounds2i &tileBounds,
+                                     FilmTile *filmTile,
+                                     MemoryArena &arena) const {
+    // One path per pixel, with samplers seeded by pixel so that images do
+    // not depend on the tiling
+    WavefrontQueue q;
+    for (Point2i pixel : tileBounds) {
+        if (!InsideExclusive(pixel, pixelBounds)) continue;
+        int seed = pixel.y * camera->film->fullResolution.x + pixel.x;
+        q.Add(sampler->Clone(seed), pixel);
+        q.samplers.back()->StartPixel(pixel);
+    }
+
+    RayBatch rays;
+    std::vector<int> rayPaths, shadeOrder, finished;
+    while (true) {
+        // Generate camera rays for paths starting a new sample
+        rays.Clear();
+        rayPaths.clear();
+        for (int i = 0; i < q.Size(); ++i) {
+            if (q.state[i] == WavefrontQueue::NewSample)
+                StartPath(q, i, filmTile);
+            if (q.state[i] == WavefrontQueue::Tracing) {
+                rays.Add(q.rays[i]);
+                rayPaths.push_back(i);
+            }
+        }
+        if (rayPaths.empty()) break;
+        ReportValue(pathsInFlight, rayPaths.size());
+
+        // Find the next vertices of all paths
+        scene.Intersect(rays);
+
+        // Add emission; terminate escaped paths and those at _maxDepth_
+        shadeOrder.clear();
+        finished.clear();
+        for (size_t k = 0; k < rayPaths.size(); ++k) {
+            int i = rayPaths[k];
+            q.rays[i].tMax = rays.rays[k].tMax;
+            const SurfaceInteraction *isect =
+                rays.hit[k] ? &rays.isects[k] : nullptr;
+            AddEmission(q, i, scene, isect);
+            if (!isect || q.bounces[i] >= maxDepth)
+                finished.push_back(i);
+            else
+                shadeOrder.push_back(k);
+        }
+
+        // Shade the vertices grouped by material
+        std::stable_sort(shadeOrder.begin(), shadeOrder.end(),
+                         [&](int a, int b) {
+                             return rays.isects[a].primitive->GetMaterial() <
+                                    rays.isects[b].primitive->GetMaterial();
+                         });
+        q.shadowRays.Clear();
+        q.shadowPaths.clear();
+        q.shadowLd.clear();
+        for (int k : shadeOrder)
+            if (!Shade(q, rayPaths[k], rays.isects[k], scene, arena))
+                finished.push_back(rayPaths[k]);
+
+        // Trace shadow rays of the light samples
+        scene.Intersect(q.shadowRays);
+        lightSamples += q.shadowRays.Size();
+        for (size_t j = 0; j < q.shadowRays.Size(); ++j)
+            if (!q.shadowRays.hit[j]) {
+                q.L[q.shadowPaths[j]] += q.shadowLd[j];
+                ++unoccludedLightSamples;
+            }
+
+        for (int i : finished) FinishPath(q, i, filmTile);
+        arena.Reset();
+    }
+}
+
+void WavefrontIntegrator::StartPath(WavefrontQueue &q, int i,
+                                    FilmTile *filmTile) const {
+    Sampler &sampler = *q.samplers[i];
+    while (q.state[i] == WavefrontQueue::NewSample) {
+        CameraSample cameraSample = sampler.GetCameraSample(q.pixels[i]);
+        RayDifferential ray;
+        Float rayWeight = camera->GenerateRayDifferential(cameraSample, &ray);
+        ray.ScaleDifferentials(1 / std::sqrt((Float)sampler.samplesPerPixel));
+        if (rayWeight == 0) {
+            filmTile->AddSample(cameraSample.pFilm, Spectrum(0.f), 0);
+            if (!sampler.StartNextSample()) q.state[i] = WavefrontQueue::Done;
+            continue;
+        }
+        q.state[i] = WavefrontQueue::Tracing;
+        q.rays[i] = ray;
+        q.pFilm[i] = cameraSample.pFilm;
+        q.rayWeight[i] = rayWeight;
+        q.L[i] = Spectrum(0.f);
+        q.beta[i] = Spectrum(1.f);
+        q.etaScale[i] = 1;
+        q.bounces[i] = 0;
+        q.specularBounce[i] = false;
+        q.misEmission[i] = false;
+    }
+}
+
+void WavefrontIntegrator::FinishPath(WavefrontQueue &q, int i,
+                                     FilmTile *filmTile) const {
+    Sampler &sampler = *q.samplers[i];
+    ReportValue(pathLength, q.bounces[i]);
+    Spectrum L =
+        CheckRadiance(q.L[i], q.pixels[i], sampler.CurrentSampleNumber());
+    filmTile->AddSample(q.pFilm[i], L, q.rayWeight[i]);
+    q.state[i] = sampler.StartNextSample() ? WavefrontQueue::NewSample
+                                           : WavefrontQueue::Done;
+}
+
+void WavefrontIntegrator::AddEmission(WavefrontQueue &q, int i,
+                                      const Scene &scene,
+                                      const SurfaceInteraction *isect) const {
+    // Emission is counted fully when the light sample at the previous
+    // vertex could not have found it
+    bool unweighted = q.bounces[i] == 0 || q.specularBounce[i];
+    if (!unweighted && !q.misEmission[i]) return;
+    const RayDifferential &ray = q.rays[i];
+    auto add = [&](const Light *light, const Spectrum &Le) {
+        if (Le.IsBlack()) return;
+        Float weight = 1;
+        auto index = lightToIndex.find(light);
+        if (!unweighted && index != lightToIndex.end()) {
+            const Interaction &prev = q.prevVertex[i];
+            Float lightPdf =
+                lightDistribution->PMF(prev.p, prev.n, index->second) *
+                light->Pdf_Li(prev, ray.d);
+            weight = PowerHeuristic(1, q.bsdfPdf[i], 1, lightPdf);
+        }
+        q.L[i] += q.beta[i] * Le * weight;
+    };
+    if (isect)
+        add(isect->primitive->GetAreaLight(), isect->Le(-ray.d));
+    else
+        for (const auto &light : scene.infiniteLights)
+            add(light.get(), light->Le(ray));
+}
+
+bool WavefrontIntegrator::Shade(WavefrontQueue &q, int i,
+                                SurfaceInteraction &isect, const Scene &scene,
+                                MemoryArena &arena) const {
+    Sampler &sampler = *q.samplers[i];
+    RayDifferential &ray = q.rays[i];
+    Spectrum &beta = q.beta[i];
+
+    // Compute scattering functions and skip over medium boundaries
+    isect.ComputeScatteringFunctions(ray, arena, true);
+    if (!isect.bsdf) {
+        ray = isect.SpawnRay(ray.d);
+        return true;
+    }
+
+    // Sample one light; its visibility is resolved by the shadow ray stage
+    const BxDFType nonSpecular = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    if (isect.bsdf->NumComponents(nonSpecular) > 0 && !scene.lights.empty()) {
+        Float lightPdf;
+        int lightIndex = lightDistribution->Sample(isect.p, isect.n,
+                                                   sampler.Get1D(), &lightPdf);
+        const Light &light = *scene.lights[lightIndex];
+        Point2f uLight = sampler.Get2D();
+        Vector3f wi;
+        Float pdf;
+        VisibilityTester visibility;
+        Spectrum Li = light.Sample_Li(isect, uLight, &wi, &pdf, &visibility);
+        if (lightPdf > 0 && pdf > 0 && !Li.IsBlack()) {
+            Spectrum f = isect.bsdf->f(isect.wo, wi, nonSpecular) *
+                         AbsDot(wi, isect.shading.n);
+            if (!f.IsBlack()) {
+                Float weight =
+                    IsDeltaLight(light.flags)
+                        ? 1
+                        : PowerHeuristic(1, lightPdf * pdf, 1,
+                                         isect.bsdf->Pdf(isect.wo, wi,
+                                                         nonSpecular));
+                q.shadowRays.Add(
+                    visibility.P0().SpawnRayTo(visibility.P1()));
+                q.shadowPaths.push_back(i);
+                q.shadowLd.push_back(beta * f * Li * weight /
+                                     (lightPdf * pdf));
+            }
+        }
+    }
+
+    // Sample BSDF to get new path direction
+    Vector3f wo = -ray.d, wi;
+    Float pdf;
+    BxDFType flags;
+    Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
+                                      BSDF_ALL, &flags);
+    if (f.IsBlack() || pdf == 0.f) return false;
+    beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+    DCHECK(!std::isinf(beta.y()));
+    q.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+    q.misEmission[i] = true;
+    q.bsdfPdf[i] = pdf;
+    q.prevVertex[i] = isect;
+    if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+        Float eta = isect.bsdf->eta;
+        q.etaScale[i] *=
+            (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+    }
+    ray = isect.SpawnRay(wi);
+
+    // Account for subsurface scattering, if applicable; the exit point's
+    // direct lighting is estimated right away, so emission found by the
+    // next ray is not MIS-weighted against it
+    if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+        SurfaceInteraction pi;
+        Spectrum S = isect.bssrdf->Sample_S(
+            scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
+        DCHECK(!std::isinf(beta.y()));
+        if (S.IsBlack() || pdf == 0) return false;
+        beta *= S / pdf;
+        q.L[i] += beta * UniformSampleOneLight(pi, scene, arena, sampler,
+                                               false, *lightDistribution);
+        Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
+                                       BSDF_ALL, &flags);
+        if (f.IsBlack() || pdf == 0) return false;
+        beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+        DCHECK(!std::isinf(beta.y()));
+        q.specularBounce[i] = (flags & BSDF_SPECULAR) != 0;
+        q.misEmission[i] = false;
+        ray = pi.SpawnRay(wi);
+    }
+
+    // Possibly terminate the path with Russian roulette
+    Spectrum rrBeta = beta * q.etaScale[i];
+    if (rrBeta.MaxComponentValue() < rrThreshold && q.bounces[i] > 3) {
+        Float p = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+        if (sampler.Get1D() < p) return false;
+        beta /= 1 - p;
+        DCHECK(!std::isinf(beta.y()));
+    }
+    ++q.bounces[i];
+    return true;
+}
+
+WavefrontIntegrator *CreateWavefrontIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "spatial");
+    return new WavefrontIntegrator(maxDepth, camera, sampler, pixelBounds,
+                                   rrThreshold, lightStrategy);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,61 @@
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_WAVEFRONT_H
+#define PBRT_INTEGRATORS_WAVEFRONT_H
+
+// integrators/wavefront.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "lightdistrib.h"
+#include <unordered_map>
+
+namespace pbrt {
+struct WavefrontQueue;
+
+// WavefrontIntegrator Declarations
+// Unidirectional path tracer that keeps the paths of all pixels of a tile
+// in flight at once and advances them together stage by stage: camera ray
+// generation, a batched intersection, shading sorted by material and a
+// batched shadow ray trace. Direct lighting uses one light sample per
+// vertex, MIS-weighted against the continuation ray of the path.
+class WavefrontIntegrator : public Integrator {
+  public:
+    // WavefrontIntegrator Public Methods
+    WavefrontIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
+                        std::shared_ptr<Sampler> sampler,
+                        const Bounds2i &pixelBounds, Float rrThreshold = 1,
+                        const std::string &lightSampleStrategy = "spatial");
+    void Render(const Scene &scene);
+
+  private:
+    // WavefrontIntegrator Private Methods
+    void RenderTile(const Scene &scene, const Bounds2i &tileBounds,
+                    FilmTile *filmTile, MemoryArena &arena) const;
+    void StartPath(WavefrontQueue &q, int i, FilmTile *filmTile) const;
+    void FinishPath(WavefrontQueue &q, int i, FilmTile *filmTile) const;
+    void AddEmission(WavefrontQueue &q, int i, const Scene &scene,
+                     const SurfaceInteraction *isect) const;
+    bool Shade(WavefrontQueue &q, int i, SurfaceInteraction &isect,
+               const Scene &scene, MemoryArena &arena) const;
+
+    // WavefrontIntegrator Private Data
+    std::shared_ptr<const Camera> camera;
+    std::shared_ptr<Sampler> sampler;
+    const Bounds2i pixelBounds;
+    const int maxDepth;
+    const Float rrThreshold;
+    const std::string lightSampleStrategy;
+    std::unique_ptr<LightDistribution> lightDistribution;
+    std::unordered_map<const Light *, size_t> lightToIndex;
+};
+
+WavefrontIntegrator *CreateWavefrontIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_WAVEFRONT_H
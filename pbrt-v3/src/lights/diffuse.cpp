@@ -65,6 +65,14 @@ Spectrum DiffuseAreaLight::Power() const {
     return (twoSided ? 2 : 1) * Lemit * area * Pi;
 }
 
+bool DiffuseAreaLight::Bounds(LightBounds *lb) const {
+    // Emission is cosine-weighted about each point's normal
+    DirectionCone nb = shape->NormalBounds();
+    *lb = LightBounds(shape->WorldBound(), nb.w, Power().y(), nb.cosTheta, 0,
+                      twoSided);
+    return true;
+}
+
 Spectrum DiffuseAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
                                      Vector3f *wi, Float *pdf,
                                      VisibilityTester *vis) const {
@@ -58,6 +58,12 @@ Spectrum GonioPhotometricLight::Power() const {
                                  SpectrumType::Illuminant);
 }
 
+bool GonioPhotometricLight::Bounds(LightBounds *lb) const {
+    *lb = LightBounds(Bounds3f(pLight), Vector3f(0, 0, 1), Power().y(), -1, 0,
+                      false);
+    return true;
+}
+
 Float GonioPhotometricLight::Pdf_Li(const Interaction &,
                                     const Vector3f &) const {
     return 0.f;
@@ -33,6 +33,7 @@
 // lights/infinite.cpp*
 #include "lights/infinite.h"
 #include "imageio.h"
+#include "mipmap.h"
 #include "paramset.h"
 #include "sampling.h"
 #include "stats.h"
@@ -45,54 +46,82 @@ InfiniteAreaLight::InfiniteAreaLight(const Transform &LightToWorld,
                                      const std::string &texmap)
     : Light((int)LightFlags::Infinite, LightToWorld, MediumInterface(),
             nSamples) {
-    // Read texel data from _texmap_ and initialize _Lmap_
-    Point2i resolution;
-    std::unique_ptr<RGBSpectrum[]> texels(nullptr);
+    // Read texel data from _texmap_
+    Point2i mapResolution;
+    std::unique_ptr<RGBSpectrum[]> mapTexels(nullptr);
     if (texmap != "") {
-        texels = ReadImage(texmap, &resolution);
-        if (texels)
-            for (int i = 0; i < resolution.x * resolution.y; ++i)
-                texels[i] *= L.ToRGBSpectrum();
+        mapTexels = ReadImage(texmap, &mapResolution);
+        if (mapTexels)
+            for (int i = 0; i < mapResolution.x * mapResolution.y; ++i)
+                mapTexels[i] *= L.ToRGBSpectrum();
     }
-    if (!texels) {
-        resolution.x = resolution.y = 1;
-        texels = std::unique_ptr<RGBSpectrum[]>(new RGBSpectrum[1]);
-        texels[0] = L.ToRGBSpectrum();
+    if (!mapTexels) {
+        mapResolution.x = mapResolution.y = 1;
+        mapTexels = std::unique_ptr<RGBSpectrum[]>(new RGBSpectrum[1]);
+        mapTexels[0] = L.ToRGBSpectrum();
+    }
+
+    // Keep the finest level of the map's MIP map, which has been resampled
+    // to a power-of-two resolution, and its filtered average
+    {
+        MIPMap<RGBSpectrum> Lmap(mapResolution, mapTexels.get());
+        Lavg = Lmap.Lookup(Point2f(.5f, .5f), .5f);
+        resolution = Point2i(Lmap.Width(), Lmap.Height());
+        texels.resize(resolution.x * resolution.y);
+        ParallelFor([&](int64_t t) {
+            for (int s = 0; s < resolution.x; ++s)
+                texels[t * resolution.x + s] = Lmap.Texel(0, s, t);
+        }, resolution.y, 32);
     }
-    Lmap.reset(new MIPMap<RGBSpectrum>(resolution, texels.get()));
 
     // Initialize sampling PDFs for infinite area light
 
     // Compute scalar-valued image _img_ from environment map
-    int width = 2 * Lmap->Width(), height = 2 * Lmap->Height();
+    int width = 2 * resolution.x, height = 2 * resolution.y;
     std::unique_ptr<Float[]> img(new Float[width * height]);
-    float fwidth = 0.5f / std::min(width, height);
     ParallelFor(
         [&](int64_t v) {
             Float vp = (v + .5f) / (Float)height;
             Float sinTheta = std::sin(Pi * (v + .5f) / height);
             for (int u = 0; u < width; ++u) {
                 Float up = (u + .5f) / (Float)width;
-                img[u + v * width] = Lmap->Lookup(Point2f(up, vp), fwidth).y();
+                img[u + v * width] = lookup(Point2f(up, vp)).y();
                 img[u + v * width] *= sinTheta;
             }
         },
         height, 32);
 
-    // Compute sampling distributions for rows and columns of image
-    distribution.reset(new Distribution2D(img.get(), width, height));
+    // Compute sampling distribution for the image
+    distribution.reset(new HierarchicalDistribution2D(img.get(), width, height));
+}
+
+RGBSpectrum InfiniteAreaLight::lookup(const Point2f &st) const {
+    // Bilinearly interpolate the four texels around _st_, as
+    // _MIPMap::Lookup()_ does at the finest level, wrapping around the edges
+    Float s = st[0] * resolution.x - 0.5f;
+    Float t = st[1] * resolution.y - 0.5f;
+    int s0 = std::floor(s), t0 = std::floor(t);
+    Float ds = s - s0, dt = t - t0;
+    auto texel = [&](int x, int y) -> const RGBSpectrum & {
+        if (x < 0 || x >= resolution.x) x = Mod(x, resolution.x);
+        if (y < 0 || y >= resolution.y) y = Mod(y, resolution.y);
+        return texels[y * resolution.x + x];
+    };
+    return (1 - ds) * (1 - dt) * texel(s0, t0) +
+           (1 - ds) * dt * texel(s0, t0 + 1) +
+           ds * (1 - dt) * texel(s0 + 1, t0) +
+           ds * dt * texel(s0 + 1, t0 + 1);
 }
 
 Spectrum InfiniteAreaLight::Power() const {
     return Pi * worldRadius * worldRadius *
-           Spectrum(Lmap->Lookup(Point2f(.5f, .5f), .5f),
-                    SpectrumType::Illuminant);
+           Spectrum(Lavg, SpectrumType::Illuminant);
 }
 
 Spectrum InfiniteAreaLight::Le(const RayDifferential &ray) const {
     Vector3f w = Normalize(WorldToLight(ray.d));
     Point2f st(SphericalPhi(w) * Inv2Pi, SphericalTheta(w) * InvPi);
-    return Spectrum(Lmap->Lookup(st), SpectrumType::Illuminant);
+    return Spectrum(lookup(st), SpectrumType::Illuminant);
 }
 
 Spectrum InfiniteAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
@@ -118,7 +147,7 @@ Spectrum InfiniteAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
     // Return radiance value for infinite light direction
     *vis = VisibilityTester(ref, Interaction(ref.p + *wi * (2 * worldRadius),
                                              ref.time, mediumInterface));
-    return Spectrum(Lmap->Lookup(uv), SpectrumType::Illuminant);
+    return Spectrum(lookup(uv), SpectrumType::Illuminant);
 }
 
 Float InfiniteAreaLight::Pdf_Li(const Interaction &, const Vector3f &w) const {
@@ -159,7 +188,7 @@ Spectrum InfiniteAreaLight::Sample_Le(const Point2f &u1, const Point2f &u2,
     // Compute _InfiniteAreaLight_ ray PDFs
     *pdfDir = sinTheta == 0 ? 0 : mapPdf / (2 * Pi * Pi * sinTheta);
     *pdfPos = 1 / (Pi * worldRadius * worldRadius);
-    return Spectrum(Lmap->Lookup(uv), SpectrumType::Illuminant);
+    return Spectrum(lookup(uv), SpectrumType::Illuminant);
 }
 
 void InfiniteAreaLight::Pdf_Le(const Ray &ray, const Normal3f &, Float *pdfPos,
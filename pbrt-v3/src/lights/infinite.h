@@ -44,7 +44,7 @@
 #include "texture.h"
 #include "shape.h"
 #include "scene.h"
-#include "mipmap.h"
+#include "sampling.h"
 
 namespace pbrt {
 
@@ -69,11 +69,18 @@ class InfiniteAreaLight : public Light {
                 Float *pdfDir) const;
 
   private:
+    // InfiniteAreaLight Private Methods
+    RGBSpectrum lookup(const Point2f &st) const;
+
     // InfiniteAreaLight Private Data
-    std::unique_ptr<MIPMap<RGBSpectrum>> Lmap;
+    // Lookups only use the finest level of the environment map's MIP map,
+    // so only it is kept, with the map's filtered average for Power()
+    Point2i resolution;
+    std::vector<RGBSpectrum> texels;
+    RGBSpectrum Lavg;
     Point3f worldCenter;
     Float worldRadius;
-    std::unique_ptr<Distribution2D> distribution;
+    std::unique_ptr<HierarchicalDistribution2D> distribution;
 };
 
 std::shared_ptr<InfiniteAreaLight> CreateInfiniteLight(
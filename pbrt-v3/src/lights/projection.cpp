@@ -105,6 +105,14 @@ Spectrum ProjectionLight::Power() const {
            I * 2 * Pi * (1.f - cosTotalWidth);
 }
 
+bool ProjectionLight::Bounds(LightBounds *lb) const {
+    // Intensity as for a point light emitting in all directions
+    Float phi = Power().y() * 2 / (1 - cosTotalWidth);
+    *lb = LightBounds(Bounds3f(pLight), LightToWorld(Vector3f(0, 0, 1)), phi,
+                      cosTotalWidth, 0, false);
+    return true;
+}
+
 Float ProjectionLight::Pdf_Li(const Interaction &, const Vector3f &) const {
     return 0.f;
 }
@@ -76,6 +76,15 @@ Spectrum SpotLight::Power() const {
     return I * 2 * Pi * (1 - .5f * (cosFalloffStart + cosTotalWidth));
 }
 
+bool SpotLight::Bounds(LightBounds *lb) const {
+    // Full intensity within the falloff start, fading out to the total width
+    Float cosTheta_e =
+        std::cos(std::acos(cosTotalWidth) - std::acos(cosFalloffStart));
+    *lb = LightBounds(Bounds3f(pLight), LightToWorld(Vector3f(0, 0, 1)),
+                      4 * Pi * I.y(), cosFalloffStart, cosTheta_e, false);
+    return true;
+}
+
 Float SpotLight::Pdf_Li(const Interaction &, const Vector3f &) const {
     return 0.f;
 }
@@ -55,6 +55,7 @@ class SpotLight : public Light {
                        Float *pdf, VisibilityTester *vis) const;
     Float Falloff(const Vector3f &w) const;
     Spectrum Power() const;
+    bool Bounds(LightBounds *lb) const;
     Float Pdf_Li(const Interaction &, const Vector3f &) const;
     Spectrum Sample_Le(const Point2f &u1, const Point2f &u2, Float time,
                        Ray *ray, Normal3f *nLight, Float *pdfPos,
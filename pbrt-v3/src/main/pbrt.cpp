@@ -47,13 +47,21 @@ static void usage(const char *msg = nullptr) {
 
     fprintf(stderr, R"(usage: pbrt [<options>] <filename.pbrt...>
 Rendering options:
+  --checkpoint <secs>  Save the render progress to <image file>.ckpt every
+                       given number of seconds.
   --cropwindow <x0,x1,y0,y1> Specify an image crop window.
   --help               Print this help text.
   --nthreads <num>     Use specified number of threads for rendering.
   --outfile <filename> Write the final image to the given filename.
+  --parallelparse      Tokenize included files and create shapes using
+                       multiple threads.
   --quick              Automatically reduce a number of quality settings to
                        render more quickly.
   --quiet              Suppress all text output other than error messages.
+  --resume             Continue from the checkpoint of an interrupted render
+                       with the same scene and settings.
+  --texcachemb <num>   Memory budget for the texels of tiled EXR textures, in
+                       MiB. Default: 512
 
 Logging options:
   --logdir <dir>       Specify directory that log files should be written to.
@@ -63,6 +71,13 @@ Logging options:
                        1 -> WARNING, 2 -> ERROR, 3-> FATAL). Default: 0.
   --v <verbosity>      Set VLOG verbosity.
 
+BFP options:
+  --bfptransform       Transform triangle mesh vertices with block floating
+                       point matrices.
+  --bfptransformerror  With --bfptransform, also transform them with the
+                       float path and report the difference in the
+                       statistics.
+
 Reformatting options:
   --cat                Print a reformatted version of the input file(s) to
                        standard output. Does not render an image.
@@ -91,6 +106,23 @@ int main(int argc, char *argv[]) {
                    !strcmp(argv[i], "-outfile")) {
             if (i + 1 == argc) usage("missing value after --outfile argument");
             options.imageFile = argv[++i];
+        } else if (!strcmp(argv[i], "--checkpoint") ||
+                   !strcmp(argv[i], "-checkpoint")) {
+            if (i + 1 == argc)
+                usage("missing value after --checkpoint argument");
+            options.checkpointInterval = atof(argv[++i]);
+        } else if (!strncmp(argv[i], "--checkpoint=", 13)) {
+            options.checkpointInterval = atof(&argv[i][13]);
+        } else if (!strcmp(argv[i], "--resume") ||
+                   !strcmp(argv[i], "-resume")) {
+            options.resume = true;
+        } else if (!strcmp(argv[i], "--texcachemb") ||
+                   !strcmp(argv[i], "-texcachemb")) {
+            if (i + 1 == argc)
+                usage("missing value after --texcachemb argument");
+            options.textureCacheMB = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--texcachemb=", 13)) {
+            options.textureCacheMB = atoi(&argv[i][13]);
         } else if (!strcmp(argv[i], "--cropwindow") ||
                    !strcmp(argv[i], "-cropwindow")) {
             if (i + 4 >= argc)
@@ -114,6 +146,9 @@ int main(int argc, char *argv[]) {
             FLAGS_minloglevel = atoi(argv[++i]);
         } else if (!strncmp(argv[i], "--minloglevel=", 14)) {
             FLAGS_minloglevel = atoi(&argv[i][14]);
+        } else if (!strcmp(argv[i], "--parallelparse") ||
+                   !strcmp(argv[i], "-parallelparse")) {
+            options.parallelParse = true;
         } else if (!strcmp(argv[i], "--quick") || !strcmp(argv[i], "-quick")) {
             options.quickRender = true;
         } else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-quiet")) {
@@ -122,6 +157,12 @@ int main(int argc, char *argv[]) {
             options.cat = true;
         } else if (!strcmp(argv[i], "--toply") || !strcmp(argv[i], "-toply")) {
             options.toPly = true;
+        } else if (!strcmp(argv[i], "--bfptransform") ||
+                   !strcmp(argv[i], "-bfptransform")) {
+            options.bfpTransform = true;
+        } else if (!strcmp(argv[i], "--bfptransformerror") ||
+                   !strcmp(argv[i], "-bfptransformerror")) {
+            options.bfpTransformError = true;
         } else if (!strcmp(argv[i], "--v") || !strcmp(argv[i], "-v")) {
             if (i + 1 == argc) usage("missing value after --v argument");
             FLAGS_v = atoi(argv[++i]);
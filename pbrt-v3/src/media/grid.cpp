@@ -37,12 +37,324 @@
 #include "sampler.h"
 #include "stats.h"
 #include "interaction.h"
+#include "parallel.h"
+#include <fstream>
 
 namespace pbrt {
 
 STAT_RATIO("Media/Grid steps per Tr() call", nTrSteps, nTrCalls);
+STAT_RATIO("Media/Majorant cells per grid ray", nMajorantCells, nMajorantRays);
+STAT_PERCENT("Media/Occupied density bricks", nOccupiedBricks, nDensityBricks);
+
+// MajorantIterator Declarations
+// Steps a ray through the cells of a medium's majorant grid in order,
+// returning the parametric range it spends in each and the cell's majorant
+class MajorantIterator {
+  public:
+    MajorantIterator(const Ray &ray, Float tMin, Float tMax, const int res[3],
+                     const Float *majorants)
+        : tMin(tMin), tMax(tMax), majorants(majorants) {
+        ++nMajorantRays;
+        Point3f pGrid = ray(tMin);
+        for (int axis = 0; axis < 3; ++axis) {
+            // Compute DDA state for _axis_ in majorant grid coordinates
+            this->res[axis] = res[axis];
+            Float p = pGrid[axis] * res[axis];
+            voxel[axis] = Clamp(int(p), 0, res[axis] - 1);
+            Float d = ray.d[axis] * res[axis];
+            if (d == 0) {
+                nextCrossingT[axis] = Infinity;
+                deltaT[axis] = Infinity;
+                step[axis] = 1;
+                voxelLimit[axis] = res[axis];
+            } else if (d > 0) {
+                nextCrossingT[axis] = tMin + (voxel[axis] + 1 - p) / d;
+                deltaT[axis] = 1 / d;
+                step[axis] = 1;
+                voxelLimit[axis] = res[axis];
+            } else {
+                nextCrossingT[axis] = tMin + (voxel[axis] - p) / d;
+                deltaT[axis] = -1 / d;
+                step[axis] = -1;
+                voxelLimit[axis] = -1;
+            }
+        }
+    }
+    bool Next(Float *t0, Float *t1, Float *majorant) {
+        if (tMin >= tMax) return false;
+        ++nMajorantCells;
+        // Find _stepAxis_ for stepping to next cell and its exit point
+        int stepAxis = 0;
+        if (nextCrossingT[1] < nextCrossingT[stepAxis]) stepAxis = 1;
+        if (nextCrossingT[2] < nextCrossingT[stepAxis]) stepAxis = 2;
+        *t0 = tMin;
+        *t1 = std::min(tMax, nextCrossingT[stepAxis]);
+        *majorant =
+            majorants[(voxel[2] * res[1] + voxel[1]) * res[0] + voxel[0]];
+
+        // Advance to the next cell, unless the ray ends first
+        tMin = *t1;
+        voxel[stepAxis] += step[stepAxis];
+        nextCrossingT[stepAxis] += deltaT[stepAxis];
+        if (voxel[stepAxis] == voxelLimit[stepAxis]) tMin = tMax;
+        return true;
+    }
+
+  private:
+    // MajorantIterator Private Data
+    Float tMin, tMax;
+    const Float *majorants;
+    int res[3], voxel[3], step[3], voxelLimit[3];
+    Float nextCrossingT[3], deltaT[3];
+};
+
+// BrickedDensity Method Definitions
+BrickedDensity::BrickedDensity(int nx, int ny, int nz, Encoding encoding,
+                               int bfpMantissaBits)
+    : encoding(encoding), mantissaBits(bfpMantissaBits), res{nx, ny, nz} {
+    for (int axis = 0; axis < 3; ++axis)
+        nBricks[axis] = (res[axis] + BrickSize - 1) >> Log2BrickSize;
+    bricks.resize(TotalBricks(), -1);
+    switch (encoding) {
+    case Encoding::Float:
+        storage = Storage::Float;
+        break;
+    case Encoding::Fixed16:
+        storage = Storage::Word16;
+        break;
+    case Encoding::Fixed8:
+        storage = Storage::Word8;
+        break;
+    case Encoding::Bfp:
+        CHECK(mantissaBits >= 1 && mantissaBits <= 16);
+        storage = mantissaBits <= 8 ? Storage::Word8 : Storage::Word16;
+        break;
+    }
+}
+
+void BrickedDensity::AddSlab(int slab, const Float *d) {
+    const int brickVoxels = 1 << (3 * Log2BrickSize);
+    int nx = res[0], ny = res[1];
+    int nz = std::min(BrickSize, res[2] - slab * BrickSize);
+    int nSlabBricks = nBricks[0] * nBricks[1];
+    int *slabBricks = &bricks[slab * nSlabBricks];
+    auto brickBounds = [&](int b, int *x0, int *x1, int *y0, int *y1) {
+        *x0 = (b % nBricks[0]) * BrickSize;
+        *x1 = std::min(*x0 + BrickSize, nx);
+        *y0 = (b / nBricks[0]) * BrickSize;
+        *y1 = std::min(*y0 + BrickSize, ny);
+    };
+
+    // Find the bricks that have nonzero samples and number them
+    ParallelFor([&](int b) {
+        int x0, x1, y0, y1;
+        brickBounds(b, &x0, &x1, &y0, &y1);
+        slabBricks[b] = -1;
+        for (int z = 0; z < nz; ++z)
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                    if (d[(size_t(z) * ny + y) * nx + x] != 0) {
+                        slabBricks[b] = 0;
+                        return;
+                    }
+    }, nSlabBricks, 16);
+    int first = nOccupied;
+    for (int b = 0; b < nSlabBricks; ++b)
+        if (slabBricks[b] == 0) slabBricks[b] = nOccupied++;
+    size_t nSamples = size_t(nOccupied) * brickVoxels;
+    switch (storage) {
+    case Storage::Float:
+        floats.resize(nSamples);
+        break;
+    case Storage::Word16:
+        words16.resize(nSamples);
+        break;
+    case Storage::Word8:
+        words8.resize(nSamples);
+        break;
+    }
+    if (encoding != Encoding::Float) ranges.resize(nOccupied);
+
+    // Encode the samples of the occupied bricks
+    ParallelFor([&](int b) {
+        int brick = slabBricks[b];
+        if (brick < first) return;
+        int x0, x1, y0, y1;
+        brickBounds(b, &x0, &x1, &y0, &y1);
+        Float minDensity = Infinity, maxDensity = -Infinity;
+        for (int z = 0; z < nz; ++z)
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x) {
+                    Float v = d[(size_t(z) * ny + y) * nx + x];
+                    minDensity = std::min(minDensity, v);
+                    maxDensity = std::max(maxDensity, v);
+                }
+
+        // Choose the brick's mapping from stored words to densities
+        uint32_t maxWord = 0;
+        if (encoding == Encoding::Fixed16 || encoding == Encoding::Fixed8) {
+            maxWord = encoding == Encoding::Fixed16 ? 0xffff : 0xff;
+            ranges[brick].offset = minDensity;
+            ranges[brick].scale = (maxDensity - minDensity) / maxWord;
+        } else if (encoding == Encoding::Bfp) {
+            // Densities are nonnegative, so the words need no sign bit
+            maxWord = (1u << mantissaBits) - 1;
+            int maxExp;
+            std::frexp(std::max(maxDensity, (Float)0), &maxExp);
+            ranges[brick].offset = 0;
+            ranges[brick].scale =
+                std::ldexp((Float)1, Clamp(maxExp - mantissaBits, -126, 127));
+        }
+
+        size_t base = size_t(brick) * brickVoxels;
+        for (int z = 0; z < nz; ++z)
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x) {
+                    Float v = d[(size_t(z) * ny + y) * nx + x];
+                    size_t i = base +
+                               ((((z << Log2BrickSize) + (y - y0))
+                                 << Log2BrickSize) + (x - x0));
+                    if (storage == Storage::Float) {
+                        floats[i] = v;
+                        continue;
+                    }
+                    const BrickRange &r = ranges[brick];
+                    uint32_t w = 0;
+                    if (r.scale > 0)
+                        w = (uint32_t)Clamp(
+                            std::lround((v - r.offset) / r.scale), 0, maxWord);
+                    if (storage == Storage::Word16)
+                        words16[i] = (uint16_t)w;
+                    else
+                        words8[i] = (uint8_t)w;
+                }
+    }, nSlabBricks, 16);
+}
+
+void BrickedDensity::AddSlabs(const Float *d) {
+    for (int s = 0; s < nBricks[2]; ++s)
+        AddSlab(s, d + size_t(s) * BrickSize * res[0] * res[1]);
+}
+
+size_t BrickedDensity::BytesUsed() const {
+    return bricks.size() * sizeof(int) + floats.size() * sizeof(float) +
+           words16.size() * sizeof(uint16_t) + words8.size() +
+           ranges.size() * sizeof(BrickRange);
+}
+
+bool ReadDensityFile(const std::string &filename, BrickedDensity *density) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        Error("Unable to open density file \"%s\"", filename.c_str());
+        return false;
+    }
+    size_t sliceSamples = size_t(density->XSize()) * density->YSize();
+    size_t expectedBytes = sliceSamples * density->ZSize() * sizeof(float);
+    in.seekg(0, std::ios::end);
+    if (size_t(in.tellg()) != expectedBytes) {
+        Error("Density file \"%s\" has %lld bytes; expected %lld for a "
+              "%dx%dx%d grid", filename.c_str(), (long long)in.tellg(),
+              (long long)expectedBytes, density->XSize(), density->YSize(),
+              density->ZSize());
+        return false;
+    }
+    in.seekg(0, std::ios::beg);
+
+    // Read one slab of bricks at a time, so the full grid is never in memory
+    const int brickSize = BrickedDensity::BrickSize;
+    std::vector<float> samples(sliceSamples * brickSize);
+    std::vector<Float> slab(samples.size());
+    for (int z0 = 0, s = 0; z0 < density->ZSize(); z0 += brickSize, ++s) {
+        size_t n = sliceSamples * std::min(brickSize, density->ZSize() - z0);
+        if (!in.read((char *)samples.data(), n * sizeof(float))) {
+            Error("%s: premature end of density file", filename.c_str());
+            return false;
+        }
+        std::copy(samples.begin(), samples.begin() + n, slab.begin());
+        density->AddSlab(s, slab.data());
+    }
+    return true;
+}
 
 // GridDensityMedium Method Definitions
+static BrickedDensity MakeDensity(int nx, int ny, int nz, const Float *d) {
+    BrickedDensity density(nx, ny, nz);
+    density.AddSlabs(d);
+    return density;
+}
+
+GridDensityMedium::GridDensityMedium(const Spectrum &sigma_a,
+                                     const Spectrum &sigma_s, Float g, int nx,
+                                     int ny, int nz,
+                                     const Transform &mediumToWorld,
+                                     const Float *d)
+    : GridDensityMedium(sigma_a, sigma_s, g, mediumToWorld,
+                        MakeDensity(nx, ny, nz, d)) {}
+
+GridDensityMedium::GridDensityMedium(const Spectrum &sigma_a,
+                                     const Spectrum &sigma_s, Float g,
+                                     const Transform &mediumToWorld,
+                                     BrickedDensity density)
+    : sigma_a(sigma_a),
+      sigma_s(sigma_s),
+      g(g),
+      nx(density.XSize()),
+      ny(density.YSize()),
+      nz(density.ZSize()),
+      WorldToMedium(Inverse(mediumToWorld)),
+      density(std::move(density)) {
+    densityBytes += this->density.BytesUsed();
+    nOccupiedBricks += this->density.OccupiedBricks();
+    nDensityBricks += this->density.TotalBricks();
+    // Precompute values for Monte Carlo sampling of _GridDensityMedium_
+    sigma_t = (sigma_a + sigma_s)[0];
+    if (Spectrum(sigma_t) != sigma_a + sigma_s)
+        Error(
+            "GridDensityMedium requires a spectrally uniform attenuation "
+            "coefficient!");
+    initMajorants();
+}
+
+void GridDensityMedium::initMajorants() {
+    int n[3] = {nx, ny, nz};
+    for (int axis = 0; axis < 3; ++axis)
+        majorantRes[axis] =
+            (n[axis] + MajorantCellVoxels - 1) / MajorantCellVoxels;
+    int nCells = majorantRes[0] * majorantRes[1] * majorantRes[2];
+    majorants.reset(new Float[nCells]);
+    densityBytes += nCells * sizeof(Float);
+
+    // Find the density samples that _Density()_ may interpolate within each
+    // cell along each axis, padded by one for round-off in the traversal
+    std::vector<int> sampleRange[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int c = 0; c < majorantRes[axis]; ++c) {
+            Float p0 = Float(c) / majorantRes[axis] * n[axis] - .5f;
+            Float p1 = Float(c + 1) / majorantRes[axis] * n[axis] - .5f;
+            sampleRange[axis].push_back(
+                std::max(0, int(std::floor(p0)) - 1));
+            sampleRange[axis].push_back(
+                std::min(n[axis] - 1, int(std::floor(p1)) + 2));
+        }
+    }
+    ParallelFor([&](int z) {
+        for (int y = 0; y < majorantRes[1]; ++y)
+            for (int x = 0; x < majorantRes[0]; ++x) {
+                Float maxDensity = 0;
+                for (int sz = sampleRange[2][2 * z];
+                     sz <= sampleRange[2][2 * z + 1]; ++sz)
+                    for (int sy = sampleRange[1][2 * y];
+                         sy <= sampleRange[1][2 * y + 1]; ++sy)
+                        for (int sx = sampleRange[0][2 * x];
+                             sx <= sampleRange[0][2 * x + 1]; ++sx)
+                            maxDensity =
+                                std::max(maxDensity, D(Point3i(sx, sy, sz)));
+                majorants[(z * majorantRes[1] + y) * majorantRes[0] + x] =
+                    maxDensity;
+            }
+    }, majorantRes[2]);
+}
+
 Float GridDensityMedium::Density(const Point3f &p) const {
     // Compute voxel coordinates and offsets for _p_
     Point3f pSamples(p.x * nx - .5f, p.y * ny - .5f, p.z * nz - .5f);
@@ -70,17 +382,23 @@ Spectrum GridDensityMedium::Sample(const Ray &rWorld, Sampler &sampler,
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Run delta-tracking iterations to sample a medium interaction
-    Float t = tMin;
-    while (true) {
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
-        if (t >= tMax) break;
-        if (Density(ray(t)) * invMaxDensity > sampler.Get1D()) {
-            // Populate _mi_ with medium interaction information and return
-            PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
-            *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time, this,
-                                    phase);
-            return sigma_s / sigma_t;
+    // Run delta-tracking iterations in each majorant cell the ray crosses
+    MajorantIterator iter(ray, tMin, tMax, majorantRes, majorants.get());
+    Float t0, t1, maxDensity;
+    while (iter.Next(&t0, &t1, &maxDensity)) {
+        if (maxDensity == 0) continue;
+        Float invMaxDensity = 1 / maxDensity;
+        Float t = t0;
+        while (true) {
+            t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
+            if (t >= t1) break;
+            if (Density(ray(t)) * invMaxDensity > sampler.Get1D()) {
+                // Populate _mi_ with medium interaction information and return
+                PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
+                *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time, this,
+                                        phase);
+                return sigma_s / sigma_t;
+            }
         }
     }
     return Spectrum(1.f);
@@ -97,21 +415,27 @@ Spectrum GridDensityMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Perform ratio tracking to estimate the transmittance value
-    Float Tr = 1, t = tMin;
-    while (true) {
-        ++nTrSteps;
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
-        if (t >= tMax) break;
-        Float density = Density(ray(t));
-        Tr *= 1 - std::max((Float)0, density * invMaxDensity);
-        // Added after book publication: when transmittance gets low,
-        // start applying Russian roulette to terminate sampling.
-        const Float rrThreshold = .1;
-        if (Tr < rrThreshold) {
-            Float q = std::max((Float).05, 1 - Tr);
-            if (sampler.Get1D() < q) return 0;
-            Tr /= 1 - q;
+    // Perform ratio tracking in each majorant cell the ray crosses
+    MajorantIterator iter(ray, tMin, tMax, majorantRes, majorants.get());
+    Float Tr = 1, t0, t1, maxDensity;
+    while (iter.Next(&t0, &t1, &maxDensity)) {
+        if (maxDensity == 0) continue;
+        Float invMaxDensity = 1 / maxDensity;
+        Float t = t0;
+        while (true) {
+            ++nTrSteps;
+            t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
+            if (t >= t1) break;
+            Float density = Density(ray(t));
+            Tr *= Clamp(1 - density * invMaxDensity, 0, 1);
+            // Added after book publication: when transmittance gets low,
+            // start applying Russian roulette to terminate sampling.
+            const Float rrThreshold = .1;
+            if (Tr < rrThreshold) {
+                Float q = std::max((Float).05, 1 - Tr);
+                if (sampler.Get1D() < q) return 0;
+                Tr /= 1 - q;
+            }
         }
     }
     return Spectrum(Tr);
@@ -47,54 +47,110 @@ namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Volume density grid", densityBytes);
 
+// BrickedDensity Declarations
+// Stores a grid of density samples in bricks of 8^3 samples. Bricks that
+// are all zero aren't stored, and the others may be quantized: "fixed16"
+// and "fixed8" store each sample relative to the range of its brick, and
+// "bfp" stores mantissas that share a power-of-two scale per brick.
+class BrickedDensity {
+  public:
+    // BrickedDensity Public Types
+    enum class Encoding { Float, Fixed16, Fixed8, Bfp };
+    static PBRT_CONSTEXPR int Log2BrickSize = 3;
+    static PBRT_CONSTEXPR int BrickSize = 1 << Log2BrickSize;
+
+    // BrickedDensity Public Methods
+    BrickedDensity(int nx, int ny, int nz, Encoding encoding = Encoding::Float,
+                   int bfpMantissaBits = 8);
+    // Stores the samples of the _BrickSize_ slices starting at _slab_ *
+    // _BrickSize_ (fewer for the last one), given with x varying fastest
+    void AddSlab(int slab, const Float *d);
+    // Stores all nx*ny*nz samples at once
+    void AddSlabs(const Float *d);
+    Float operator()(const Point3i &p) const {
+        const int mask = BrickSize - 1;
+        int brick = bricks[((p.z >> Log2BrickSize) * nBricks[1] +
+                            (p.y >> Log2BrickSize)) * nBricks[0] +
+                           (p.x >> Log2BrickSize)];
+        if (brick < 0) return 0;
+        size_t i = (size_t(brick) << (3 * Log2BrickSize)) +
+                   ((((p.z & mask) << Log2BrickSize) + (p.y & mask))
+                    << Log2BrickSize) + (p.x & mask);
+        switch (storage) {
+        case Storage::Float:
+            return floats[i];
+        case Storage::Word16:
+            return ranges[brick].offset + ranges[brick].scale * words16[i];
+        default:
+            return ranges[brick].offset + ranges[brick].scale * words8[i];
+        }
+    }
+    int XSize() const { return res[0]; }
+    int YSize() const { return res[1]; }
+    int ZSize() const { return res[2]; }
+    int OccupiedBricks() const { return nOccupied; }
+    int TotalBricks() const { return nBricks[0] * nBricks[1] * nBricks[2]; }
+    size_t BytesUsed() const;
+
+  private:
+    // BrickedDensity Private Data
+    enum class Storage { Float, Word16, Word8 };
+    struct BrickRange {
+        Float offset, scale;
+    };
+    Encoding encoding;
+    Storage storage;
+    int mantissaBits;
+    int res[3], nBricks[3];
+    // Index of each brick's samples, or -1 if they are all zero
+    std::vector<int> bricks;
+    int nOccupied = 0;
+    std::vector<float> floats;
+    std::vector<uint16_t> words16;
+    std::vector<uint8_t> words8;
+    std::vector<BrickRange> ranges;
+};
+
+// Reads _density_'s samples from a file of nx*ny*nz native-endian 32-bit
+// floats, with x varying fastest, one slab of bricks at a time
+bool ReadDensityFile(const std::string &filename, BrickedDensity *density);
+
 // GridDensityMedium Declarations
 class GridDensityMedium : public Medium {
   public:
     // GridDensityMedium Public Methods
     GridDensityMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
                       int nx, int ny, int nz, const Transform &mediumToWorld,
-                      const Float *d)
-        : sigma_a(sigma_a),
-          sigma_s(sigma_s),
-          g(g),
-          nx(nx),
-          ny(ny),
-          nz(nz),
-          WorldToMedium(Inverse(mediumToWorld)),
-          density(new Float[nx * ny * nz]) {
-        densityBytes += nx * ny * nz * sizeof(Float);
-        memcpy((Float *)density.get(), d, sizeof(Float) * nx * ny * nz);
-        // Precompute values for Monte Carlo sampling of _GridDensityMedium_
-        sigma_t = (sigma_a + sigma_s)[0];
-        if (Spectrum(sigma_t) != sigma_a + sigma_s)
-            Error(
-                "GridDensityMedium requires a spectrally uniform attenuation "
-                "coefficient!");
-        Float maxDensity = 0;
-        for (int i = 0; i < nx * ny * nz; ++i)
-            maxDensity = std::max(maxDensity, density[i]);
-        invMaxDensity = 1 / maxDensity;
-    }
+                      const Float *d);
+    GridDensityMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
+                      const Transform &mediumToWorld, BrickedDensity density);
 
     Float Density(const Point3f &p) const;
     Float D(const Point3i &p) const {
         Bounds3i sampleBounds(Point3i(0, 0, 0), Point3i(nx, ny, nz));
         if (!InsideExclusive(p, sampleBounds)) return 0;
-        return density[(p.z * ny + p.y) * nx + p.x];
+        return density(p);
     }
     Spectrum Sample(const Ray &ray, Sampler &sampler, MemoryArena &arena,
                     MediumInteraction *mi) const;
     Spectrum Tr(const Ray &ray, Sampler &sampler) const;
 
   private:
+    // GridDensityMedium Private Methods
+    void initMajorants();
+
     // GridDensityMedium Private Data
     const Spectrum sigma_a, sigma_s;
     const Float g;
     const int nx, ny, nz;
     const Transform WorldToMedium;
-    std::unique_ptr<Float[]> density;
+    BrickedDensity density;
     Float sigma_t;
-    Float invMaxDensity;
+    // Upper bounds on the density within each cell of a coarse grid over
+    // the medium, so that tracking can take long steps through thin regions
+    static PBRT_CONSTEXPR int MajorantCellVoxels = BrickedDensity::BrickSize;
+    int majorantRes[3];
+    std::unique_ptr<Float[]> majorants;
 };
 
 }  // namespace pbrt
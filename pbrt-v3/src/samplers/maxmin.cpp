@@ -41,6 +41,7 @@ namespace pbrt {
 // MaxMinDistSampler Method Definitions
 void MaxMinDistSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    SeedPixelRNG(rng, seed, p);
     Float invSPP = (Float)1 / samplesPerPixel;
     for (int i = 0; i < samplesPerPixel; ++i)
         samples2D[0][i] = Point2f(i * invSPP, SampleGeneratorMatrix(CPixel, i));
@@ -66,7 +67,7 @@ void MaxMinDistSampler::StartPixel(const Point2i &p) {
 
 std::unique_ptr<Sampler> MaxMinDistSampler::Clone(int seed) {
     MaxMinDistSampler *mmds = new MaxMinDistSampler(*this);
-    mmds->rng.SetSequence(seed);
+    mmds->seed = seed;
     return std::unique_ptr<Sampler>(mmds);
 }
 
@@ -39,7 +39,7 @@
 
 namespace pbrt {
 
-RandomSampler::RandomSampler(int ns, int seed) : Sampler(ns), rng(seed) {}
+RandomSampler::RandomSampler(int ns, int seed) : Sampler(ns), seed(seed) {}
 
 Float RandomSampler::Get1D() {
     ProfilePhase _(Prof::GetSample);
@@ -55,12 +55,13 @@ Point2f RandomSampler::Get2D() {
 
 std::unique_ptr<Sampler> RandomSampler::Clone(int seed) {
     RandomSampler *rs = new RandomSampler(*this);
-    rs->rng.SetSequence(seed);
+    rs->seed = seed;
     return std::unique_ptr<Sampler>(rs);
 }
 
 void RandomSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    SeedPixelRNG(rng, seed, p);
     for (size_t i = 0; i < sampleArray1D.size(); ++i)
         for (size_t j = 0; j < sampleArray1D[i].size(); ++j)
             sampleArray1D[i][j] = rng.UniformFloat();
@@ -71,6 +72,11 @@ void RandomSampler::StartPixel(const Point2i &p) {
     Sampler::StartPixel(p);
 }
 
+bool RandomSampler::SetSampleNumber(int64_t sampleNum) {
+    if (sampleNum > 0) SeedPixelRNG(rng, seed, currentPixel, sampleNum);
+    return Sampler::SetSampleNumber(sampleNum);
+}
+
 Sampler *CreateRandomSampler(const ParamSet &params) {
     int ns = params.FindOneInt("pixelsamples", 4);
     return new RandomSampler(ns);
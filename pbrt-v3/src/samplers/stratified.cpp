@@ -42,6 +42,7 @@ namespace pbrt {
 // StratifiedSampler Method Definitions
 void StratifiedSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    SeedPixelRNG(rng, seed, p);
     // Generate single stratified samples for the pixel
     for (size_t i = 0; i < samples1D.size(); ++i) {
         StratifiedSample1D(&samples1D[i][0], xPixelSamples * yPixelSamples, rng,
@@ -72,7 +73,7 @@ void StratifiedSampler::StartPixel(const Point2i &p) {
 
 std::unique_ptr<Sampler> StratifiedSampler::Clone(int seed) {
     StratifiedSampler *ss = new StratifiedSampler(*this);
-    ss->rng.SetSequence(seed);
+    ss->seed = seed;
     return std::unique_ptr<Sampler>(ss);
 }
 
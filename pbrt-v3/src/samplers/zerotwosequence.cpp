@@ -52,6 +52,7 @@ ZeroTwoSequenceSampler::ZeroTwoSequenceSampler(int64_t samplesPerPixel,
 
 void ZeroTwoSequenceSampler::StartPixel(const Point2i &p) {
     ProfilePhase _(Prof::StartPixel);
+    SeedPixelRNG(rng, seed, p);
     // Generate 1D and 2D pixel sample components using $(0,2)$-sequence
     for (size_t i = 0; i < samples1D.size(); ++i)
         VanDerCorput(1, samplesPerPixel, &samples1D[i][0], rng);
@@ -70,7 +71,7 @@ void ZeroTwoSequenceSampler::StartPixel(const Point2i &p) {
 
 std::unique_ptr<Sampler> ZeroTwoSequenceSampler::Clone(int seed) {
     ZeroTwoSequenceSampler *lds = new ZeroTwoSequenceSampler(*this);
-    lds->rng.SetSequence(seed);
+    lds->seed = seed;
     return std::unique_ptr<Sampler>(lds);
 }
 
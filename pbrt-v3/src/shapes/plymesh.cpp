@@ -35,13 +35,32 @@
 #include "shapes/triangle.h"
 #include "textures/constant.h"
 #include "paramset.h"
+#include "fileutil.h"
+#include "parallel.h"
+#include "stats.h"
 #include "ext/rply.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace pbrt {
 using namespace std;
 
+STAT_PERCENT("Scene/PLY meshes read from memory mappings", nMappedPlyMeshes,
+             nPlyMeshes);
+
+// A PLY mesh's object space data, in the form _TriangleMesh_ takes over
+struct PLYMeshData {
+    int nVertices = 0;
+    std::unique_ptr<Point3f[]> p;
+    std::unique_ptr<Normal3f[]> n;
+    std::unique_ptr<Point2f[]> uv;
+    std::vector<int> indices, faceIndices;
+};
+
 struct CallbackContext {
     Point3f *p;
     Normal3f *n;
@@ -154,20 +173,340 @@ int rply_face_callback(p_ply_argument argument) {
     return 1;
 }
 
-std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
-    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
-    const ParamSet &params,
-    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
-    const std::string filename = params.FindOneFilename("filename", "");
+// Binary PLY Loading
+// Binary little-endian files are read straight from a memory mapping of the
+// file into the arrays the _TriangleMesh_ takes over, with the vertices
+// decoded in parallel; rply handles everything else.
+enum class PLYType {
+    Invalid, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64
+};
+
+static PLYType ParsePLYType(const std::string &name) {
+    if (name == "char" || name == "int8") return PLYType::Int8;
+    if (name == "uchar" || name == "uint8") return PLYType::UInt8;
+    if (name == "short" || name == "int16") return PLYType::Int16;
+    if (name == "ushort" || name == "uint16") return PLYType::UInt16;
+    if (name == "int" || name == "int32") return PLYType::Int32;
+    if (name == "uint" || name == "uint32") return PLYType::UInt32;
+    if (name == "float" || name == "float32") return PLYType::Float32;
+    if (name == "double" || name == "float64") return PLYType::Float64;
+    return PLYType::Invalid;
+}
+
+static int PLYTypeSize(PLYType type) {
+    switch (type) {
+    case PLYType::Int8:
+    case PLYType::UInt8: return 1;
+    case PLYType::Int16:
+    case PLYType::UInt16: return 2;
+    case PLYType::Int32:
+    case PLYType::UInt32:
+    case PLYType::Float32: return 4;
+    case PLYType::Float64: return 8;
+    default: return 0;
+    }
+}
+
+template <typename T>
+static T LoadUnaligned(const char *ptr) {
+    T v;
+    memcpy(&v, ptr, sizeof(T));
+    return v;
+}
+
+static double PLYValue(const char *ptr, PLYType type) {
+    switch (type) {
+    case PLYType::Int8: return LoadUnaligned<int8_t>(ptr);
+    case PLYType::UInt8: return LoadUnaligned<uint8_t>(ptr);
+    case PLYType::Int16: return LoadUnaligned<int16_t>(ptr);
+    case PLYType::UInt16: return LoadUnaligned<uint16_t>(ptr);
+    case PLYType::Int32: return LoadUnaligned<int32_t>(ptr);
+    case PLYType::UInt32: return LoadUnaligned<uint32_t>(ptr);
+    case PLYType::Float32: return LoadUnaligned<float>(ptr);
+    case PLYType::Float64: return LoadUnaligned<double>(ptr);
+    default: return 0;
+    }
+}
+
+struct PLYProperty {
+    std::string name;
+    // _countType_ is _Invalid_ for scalar properties
+    PLYType type, countType;
+    // Offset in the element's records if all of its properties are scalars
+    int offset;
+};
+
+struct PLYElement {
+    std::string name;
+    int64_t count;
+    std::vector<PLYProperty> properties;
+    // Record size; 0 if the element has list properties
+    int stride;
+    int Find(const char *name) const {
+        for (size_t i = 0; i < properties.size(); ++i)
+            if (properties[i].name == name) return i;
+        return -1;
+    }
+};
+
+// Reads _file_'s header; returns false if it is not a binary PLY file in
+// the host's byte order (little-endian) or is malformed
+static bool ReadPLYHeader(const MappedFile &file,
+                          std::vector<PLYElement> *elements,
+                          size_t *dataOffset) {
+    const uint16_t one = 1;
+    if (*(const uint8_t *)&one != 1) return false;
+    const char *data = file.Data(), *end = data + file.Size();
+    const char endHeader[] = "end_header";
+    const char *headerEnd =
+        std::search(data, end, endHeader, endHeader + sizeof(endHeader) - 1);
+    if (headerEnd == end) return false;
+    headerEnd = std::find(headerEnd, end, '\n');
+    if (headerEnd == end) return false;
+    *dataOffset = headerEnd + 1 - data;
+
+    std::istringstream header(std::string(data, headerEnd));
+    std::string line;
+    bool binary = false;
+    if (!std::getline(header, line) || line.compare(0, 3, "ply") != 0)
+        return false;
+    while (std::getline(header, line)) {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            words >> format;
+            binary = format == "binary_little_endian";
+        } else if (keyword == "element") {
+            PLYElement element;
+            words >> element.name >> element.count;
+            if (!words || element.count < 0) return false;
+            element.stride = 0;
+            elements->push_back(element);
+        } else if (keyword == "property") {
+            if (elements->empty()) return false;
+            PLYProperty property;
+            std::string type;
+            words >> type;
+            property.countType = PLYType::Invalid;
+            if (type == "list") {
+                std::string countType;
+                words >> countType >> type;
+                property.countType = ParsePLYType(countType);
+                if (property.countType == PLYType::Invalid) return false;
+            }
+            property.type = ParsePLYType(type);
+            words >> property.name;
+            if (!words || property.type == PLYType::Invalid) return false;
+            elements->back().properties.push_back(property);
+        }
+    }
+    if (!binary) return false;
+
+    for (PLYElement &element : *elements) {
+        int offset = 0;
+        for (PLYProperty &property : element.properties) {
+            property.offset = offset;
+            if (property.countType != PLYType::Invalid) {
+                offset = 0;
+                break;
+            }
+            offset += PLYTypeSize(property.type);
+        }
+        element.stride = offset;
+    }
+    return true;
+}
+
+// Walks the records of an element with list properties starting at
+// _*ptr_, calling _func(property, value pointer, count)_ for each property
+// and _endRecord()_ after each record; returns false if the data ends early
+template <typename F, typename G>
+static bool ForEachPLYRecord(const PLYElement &element, const char **ptr,
+                             const char *end, F func, G endRecord) {
+    for (int64_t r = 0; r < element.count; ++r) {
+        for (size_t i = 0; i < element.properties.size(); ++i) {
+            const PLYProperty &property = element.properties[i];
+            int64_t count = 1;
+            if (property.countType != PLYType::Invalid) {
+                int countSize = PLYTypeSize(property.countType);
+                if (end - *ptr < countSize) return false;
+                count = (int64_t)PLYValue(*ptr, property.countType);
+                *ptr += countSize;
+                if (count < 0) return false;
+            }
+            int64_t size = count * PLYTypeSize(property.type);
+            if (end - *ptr < size) return false;
+            func(i, *ptr, count);
+            *ptr += size;
+        }
+        endRecord();
+    }
+    return true;
+}
+
+// Returns false if the file is not a binary PLY file with vertex
+// positions; sets _*error_ if it is one but its contents are invalid
+static bool ReadBinaryPLY(const std::string &filename, PLYMeshData *mesh,
+                          bool *error) {
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    std::vector<PLYElement> elements;
+    size_t dataOffset;
+    if (!file || !ReadPLYHeader(*file, &elements, &dataOffset)) return false;
+
+    // Check for the properties this reader handles
+    const PLYElement *vertices = nullptr, *faces = nullptr;
+    for (const PLYElement &element : elements) {
+        if (element.name == "vertex") vertices = &element;
+        if (element.name == "face") faces = &element;
+    }
+    if (!vertices || !faces || vertices->stride == 0 ||
+        vertices->count > std::numeric_limits<int>::max())
+        return false;
+    int x = vertices->Find("x"), y = vertices->Find("y"),
+        z = vertices->Find("z");
+    int nx = vertices->Find("nx"), ny = vertices->Find("ny"),
+        nz = vertices->Find("nz");
+    int u = -1, v = -1;
+    const char *uvNames[][2] = {
+        {"u", "v"}, {"s", "t"}, {"texture_u", "texture_v"},
+        {"texture_s", "texture_t"}};
+    for (const auto &names : uvNames)
+        if (u == -1 || v == -1) {
+            u = vertices->Find(names[0]);
+            v = vertices->Find(names[1]);
+        }
+    int vertexIndices = faces->Find("vertex_indices");
+    int faceIndices = faces->Find("face_indices");
+    if (x == -1 || y == -1 || z == -1 || vertexIndices == -1 ||
+        faces->properties[vertexIndices].countType == PLYType::Invalid ||
+        (faceIndices != -1 &&
+         faces->properties[faceIndices].countType != PLYType::Invalid))
+        return false;
+    bool hasNormals = nx != -1 && ny != -1 && nz != -1;
+    bool hasUV = u != -1 && v != -1;
+
+    const char *ptr = file->Data() + dataOffset;
+    const char *end = file->Data() + file->Size();
+    const int nVertices = vertices->count;
+    int nIgnoredFaces = 0;
+    for (const PLYElement &element : elements) {
+        if (&element == vertices) {
+            // Decode fixed-size vertex records in parallel
+            if ((end - ptr) / vertices->stride < vertices->count) {
+                Error("%s: PLY file is truncated", filename.c_str());
+                *error = true;
+                return true;
+            }
+            mesh->nVertices = nVertices;
+            mesh->p.reset(new Point3f[nVertices]);
+            if (hasNormals) mesh->n.reset(new Normal3f[nVertices]);
+            if (hasUV) mesh->uv.reset(new Point2f[nVertices]);
+            const std::vector<PLYProperty> &props = vertices->properties;
+            auto value = [&](const char *record, int prop) {
+                return (Float)PLYValue(record + props[prop].offset,
+                                       props[prop].type);
+            };
+            const int chunkSize = 16384;
+            const char *base = ptr;
+            auto decodeChunk = [&](int64_t chunk) {
+                int start = chunk * chunkSize;
+                int last = std::min(nVertices, start + chunkSize);
+                for (int i = start; i < last; ++i) {
+                    const char *record = base + (size_t)i * vertices->stride;
+                    mesh->p[i] = Point3f(value(record, x), value(record, y),
+                                         value(record, z));
+                    if (hasNormals)
+                        mesh->n[i] =
+                            Normal3f(value(record, nx), value(record, ny),
+                                     value(record, nz));
+                    if (hasUV)
+                        mesh->uv[i] =
+                            Point2f(value(record, u), value(record, v));
+                }
+            };
+            int64_t nChunks = (nVertices + chunkSize - 1) / chunkSize;
+            if (nChunks > 1)
+                ParallelFor(decodeChunk, nChunks, 1);
+            else if (nChunks == 1)
+                decodeChunk(0);
+            ptr += (size_t)nVertices * vertices->stride;
+        } else if (&element == faces) {
+            // Triangulate faces into the final index array
+            mesh->indices.reserve(3 * faces->count);
+            if (faceIndices != -1) mesh->faceIndices.reserve(faces->count);
+            int face[4], faceLength = 0, faceIndex = 0;
+            bool ok = ForEachPLYRecord(
+                *faces, &ptr, end,
+                [&](int prop, const char *values, int64_t count) {
+                    if (prop == faceIndices)
+                        faceIndex = (int)PLYValue(
+                            values, faces->properties[prop].type);
+                    if (prop != vertexIndices) return;
+                    faceLength = (count == 3 || count == 4) ? count : 0;
+                    PLYType type = faces->properties[prop].type;
+                    for (int i = 0; i < faceLength; ++i) {
+                        face[i] = (int)PLYValue(
+                            values + i * PLYTypeSize(type), type);
+                        if (face[i] < 0 || face[i] >= vertices->count) {
+                            if (!*error)
+                                Error("plymesh: Vertex reference %i is out "
+                                      "of bounds! Valid range is [0..%i)",
+                                      face[i], nVertices);
+                            *error = true;
+                        }
+                    }
+                    if (!faceLength) ++nIgnoredFaces;
+                },
+                [&]() {
+                    if (faceLength == 0) return;
+                    mesh->indices.insert(mesh->indices.end(), face, face + 3);
+                    if (faceLength == 4) {
+                        mesh->indices.push_back(face[3]);
+                        mesh->indices.push_back(face[0]);
+                        mesh->indices.push_back(face[2]);
+                    }
+                    if (faceIndices != -1)
+                        mesh->faceIndices.insert(mesh->faceIndices.end(),
+                                                 faceLength - 2, faceIndex);
+                });
+            if (!ok) {
+                Error("%s: PLY file is truncated", filename.c_str());
+                *error = true;
+                return true;
+            }
+        } else if (element.stride > 0) {
+            if ((end - ptr) / element.stride < element.count) break;
+            ptr += (size_t)element.count * element.stride;
+        } else if (!ForEachPLYRecord(element, &ptr, end,
+                                     [](int, const char *, int64_t) {},
+                                     []() {}))
+            break;
+    }
+    if (nIgnoredFaces > 0)
+        Warning("plymesh: Ignoring %d faces with other than 3 or 4 vertices "
+                "(only triangles and quads are supported!)",
+                nIgnoredFaces);
+    if (mesh->indices.empty()) {
+        Error("%s: PLY file is invalid! No face/vertex elements found!",
+              filename.c_str());
+        *error = true;
+    }
+    return true;
+}
+
+// Reads any PLY file through rply's callbacks; returns false on errors
+static bool ReadPLYWithRply(const std::string &filename, PLYMeshData *mesh) {
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
     if (!ply) {
         Error("Couldn't open PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     if (!ply_read_header(ply)) {
         Error("Unable to read the header of PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     p_ply_element element = nullptr;
@@ -188,7 +527,7 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     if (vertexCount == 0 || faceCount == 0) {
         Error("%s: PLY file is invalid! No face/vertex elements found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     CallbackContext context;
@@ -203,7 +542,7 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     } else {
         Error("%s: Vertex coordinate property not found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback, &context,
@@ -249,12 +588,40 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
         Error("%s: unable to read the contents of PLY file",
               filename.c_str());
         ply_close(ply);
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     ply_close(ply);
 
-    if (context.error) return std::vector<std::shared_ptr<Shape>>();
+    if (context.error) return false;
+
+    mesh->nVertices = vertexCount;
+    mesh->p.reset(context.p);
+    mesh->n.reset(context.n);
+    mesh->uv.reset(context.uv);
+    context.p = nullptr;
+    context.n = nullptr;
+    context.uv = nullptr;
+    mesh->indices.assign(context.indices, context.indices + context.indexCtr);
+    if (context.faceIndices)
+        mesh->faceIndices.assign(context.faceIndices,
+                                 context.faceIndices + context.faceIndexCtr);
+    return true;
+}
+
+std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    const std::string filename = params.FindOneFilename("filename", "");
+    PLYMeshData mesh;
+    bool error = false;
+    ++nPlyMeshes;
+    if (ReadBinaryPLY(filename, &mesh, &error)) {
+        if (error) return std::vector<std::shared_ptr<Shape>>();
+        ++nMappedPlyMeshes;
+    } else if (!ReadPLYWithRply(filename, &mesh))
+        return std::vector<std::shared_ptr<Shape>>();
 
     // Look up an alpha texture, if applicable
     std::shared_ptr<Texture<Float>> alphaTex;
@@ -283,10 +650,10 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
     return CreateTriangleMesh(o2w, w2o, reverseOrientation,
-                              context.indexCtr / 3, context.indices,
-                              vertexCount, context.p, nullptr, context.n,
-                              context.uv, alphaTex, shadowAlphaTex,
-                              context.faceIndices);
+                              std::move(mesh.indices), mesh.nVertices,
+                              std::move(mesh.p), nullptr, std::move(mesh.n),
+                              std::move(mesh.uv), alphaTex, shadowAlphaTex,
+                              std::move(mesh.faceIndices));
 }
 
 }  // namespace pbrt
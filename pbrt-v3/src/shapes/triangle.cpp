@@ -37,6 +37,8 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "efloat.h"
+#include "bfptransform.h"
+#include "parallel.h"
 #include "ext/rply.h"
 #include <array>
 
@@ -51,44 +53,94 @@ static void PlyErrorCallback(p_ply, const char *message) {
 
 // Triangle Method Definitions
 STAT_RATIO("Scene/Triangles per triangle mesh", nTris, nMeshes);
+// Copies _data_'s first _n_ elements, or returns nullptr if it is nullptr
+template <typename T>
+static std::unique_ptr<T[]> CopyVertexData(const T *data, int n) {
+    if (!data) return nullptr;
+    std::unique_ptr<T[]> copy(new T[n]);
+    memcpy(copy.get(), data, n * sizeof(T));
+    return copy;
+}
+
+// Transforms _v_'s _n_ elements in place, in parallel for large meshes
+template <typename T>
+static void TransformInPlace(const Transform &t, T *v, int n) {
+    const int chunkSize = 16384;
+    if (n < 4 * chunkSize) {
+        for (int i = 0; i < n; ++i) v[i] = t(v[i]);
+        return;
+    }
+    ParallelFor([&](int64_t chunk) {
+        int end = std::min<int64_t>(n, (chunk + 1) * chunkSize);
+        for (int i = chunk * chunkSize; i < end; ++i) v[i] = t(v[i]);
+    }, (n + chunkSize - 1) / chunkSize);
+}
+
+// Transforms _v_ to world space; a BFP transform that reports its error
+// compares its results against the input, so it is not applied in place
+template <typename T>
+static void TransformVertexData(const Transform &ObjectToWorld,
+                                const BfpTransform *bfpObjectToWorld,
+                                std::unique_ptr<T[]> &v, int n) {
+    if (!v) return;
+    if (bfpObjectToWorld && PbrtOptions.bfpTransformError) {
+        std::unique_ptr<T[]> out(new T[n]);
+        (*bfpObjectToWorld)(v.get(), n, out.get());
+        v = std::move(out);
+    } else if (bfpObjectToWorld)
+        (*bfpObjectToWorld)(v.get(), n, v.get());
+    else
+        TransformInPlace(ObjectToWorld, v.get(), n);
+}
+
 TriangleMesh::TriangleMesh(
     const Transform &ObjectToWorld, int nTriangles, const int *vertexIndices,
     int nVertices, const Point3f *P, const Vector3f *S, const Normal3f *N,
     const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
     const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
     const int *fIndices)
-    : nTriangles(nTriangles),
+    : TriangleMesh(ObjectToWorld,
+                   std::vector<int>(vertexIndices,
+                                    vertexIndices + 3 * nTriangles),
+                   nVertices, CopyVertexData(P, nVertices),
+                   CopyVertexData(S, nVertices), CopyVertexData(N, nVertices),
+                   CopyVertexData(UV, nVertices), alphaMask, shadowAlphaMask,
+                   fIndices ? std::vector<int>(fIndices, fIndices + nTriangles)
+                            : std::vector<int>()) {}
+
+TriangleMesh::TriangleMesh(
+    const Transform &ObjectToWorld, std::vector<int> vertexIndices,
+    int nVertices, std::unique_ptr<Point3f[]> P, std::unique_ptr<Vector3f[]> S,
+    std::unique_ptr<Normal3f[]> N, std::unique_ptr<Point2f[]> UV,
+    const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    std::vector<int> fIndices)
+    : nTriangles(vertexIndices.size() / 3),
       nVertices(nVertices),
-      vertexIndices(vertexIndices, vertexIndices + 3 * nTriangles),
+      vertexIndices(std::move(vertexIndices)),
+      p(std::move(P)),
+      n(std::move(N)),
+      s(std::move(S)),
+      uv(std::move(UV)),
       alphaMask(alphaMask),
-      shadowAlphaMask(shadowAlphaMask) {
+      shadowAlphaMask(shadowAlphaMask),
+      faceIndices(std::move(fIndices)) {
     ++nMeshes;
     nTris += nTriangles;
     triMeshBytes += sizeof(*this) + this->vertexIndices.size() * sizeof(int) +
-                    nVertices * (sizeof(*P) + (N ? sizeof(*N) : 0) +
-                                 (S ? sizeof(*S) : 0) + (UV ? sizeof(*UV) : 0) +
-                                 (fIndices ? sizeof(*fIndices) : 0));
+                    nVertices * (sizeof(Point3f) + (n ? sizeof(Normal3f) : 0) +
+                                 (s ? sizeof(Vector3f) : 0) +
+                                 (uv ? sizeof(Point2f) : 0)) +
+                    faceIndices.size() * sizeof(int);
 
     // Transform mesh vertices to world space
-    p.reset(new Point3f[nVertices]);
-    for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
-
-    // Copy _UV_, _N_, and _S_ vertex data, if present
-    if (UV) {
-        uv.reset(new Point2f[nVertices]);
-        memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
-    }
-    if (N) {
-        n.reset(new Normal3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
-    }
-    if (S) {
-        s.reset(new Vector3f[nVertices]);
-        for (int i = 0; i < nVertices; ++i) s[i] = ObjectToWorld(S[i]);
-    }
-
-    if (fIndices)
-        faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
+    std::unique_ptr<BfpTransform> bfpObjectToWorld;
+    if (PbrtOptions.bfpTransform)
+        bfpObjectToWorld.reset(
+            new BfpTransform(ObjectToWorld, PbrtOptions.bfpTransformError));
+    TransformVertexData(ObjectToWorld, bfpObjectToWorld.get(), p, nVertices);
+    TransformVertexData(ObjectToWorld, bfpObjectToWorld.get(), n, nVertices);
+    TransformVertexData(ObjectToWorld, bfpObjectToWorld.get(), s, nVertices);
 }
 
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
@@ -98,14 +150,43 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Point2f *uv, const std::shared_ptr<Texture<Float>> &alphaMask,
     const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
     const int *faceIndices) {
+    return CreateTriangleMesh(
+        ObjectToWorld, WorldToObject, reverseOrientation,
+        std::vector<int>(vertexIndices, vertexIndices + 3 * nTriangles),
+        nVertices, CopyVertexData(p, nVertices), CopyVertexData(s, nVertices),
+        CopyVertexData(n, nVertices), CopyVertexData(uv, nVertices), alphaMask,
+        shadowAlphaMask,
+        faceIndices ? std::vector<int>(faceIndices, faceIndices + nTriangles)
+                    : std::vector<int>());
+}
+
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, std::vector<int> vertexIndices, int nVertices,
+    std::unique_ptr<Point3f[]> p, std::unique_ptr<Vector3f[]> s,
+    std::unique_ptr<Normal3f[]> n, std::unique_ptr<Point2f[]> uv,
+    const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    std::vector<int> faceIndices) {
     std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
-        *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
-        alphaMask, shadowAlphaMask, faceIndices);
-    std::vector<std::shared_ptr<Shape>> tris;
-    tris.reserve(nTriangles);
-    for (int i = 0; i < nTriangles; ++i)
-        tris.push_back(std::make_shared<Triangle>(ObjectToWorld, WorldToObject,
-                                                  reverseOrientation, mesh, i));
+        *ObjectToWorld, std::move(vertexIndices), nVertices, std::move(p),
+        std::move(s), std::move(n), std::move(uv), alphaMask, shadowAlphaMask,
+        std::move(faceIndices));
+    std::vector<std::shared_ptr<Shape>> tris(mesh->nTriangles);
+    auto createTriangles = [&](int start, int end) {
+        for (int i = start; i < end; ++i)
+            tris[i] = std::make_shared<Triangle>(
+                ObjectToWorld, WorldToObject, reverseOrientation, mesh, i);
+    };
+    const int chunkSize = 16384;
+    if (mesh->nTriangles < 4 * chunkSize)
+        createTriangles(0, mesh->nTriangles);
+    else
+        ParallelFor([&](int64_t chunk) {
+            createTriangles(chunk * chunkSize,
+                            std::min<int64_t>(mesh->nTriangles,
+                                              (chunk + 1) * chunkSize));
+        }, (mesh->nTriangles + chunkSize - 1) / chunkSize);
     return tris;
 }
 
@@ -606,6 +687,27 @@ Interaction Triangle::Sample(const Point2f &u, Float *pdf) const {
     return it;
 }
 
+DirectionCone Triangle::NormalBounds() const {
+    // Orient the normal as Sample() does; with shading normals that point
+    // to both sides of the triangle, it may face either way
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+    Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
+    if (mesh->n) {
+        int nFront = 0, nBack = 0;
+        for (int i = 0; i < 3; ++i) {
+            Float d = Dot(n, mesh->n[v[i]]);
+            if (d > 0) ++nFront;
+            if (d < 0) ++nBack;
+        }
+        if (nFront > 0 && nBack > 0) return DirectionCone::EntireSphere();
+        if (nBack > 0) n = -n;
+    } else if (reverseOrientation ^ transformSwapsHandedness)
+        n *= -1;
+    return DirectionCone(Vector3f(n), 1);
+}
+
 Float Triangle::SolidAngle(const Point3f &p, int nSamples) const {
     // Project the vertices into the unit sphere around p.
     std::array<Vector3f, 3> pSphere = {
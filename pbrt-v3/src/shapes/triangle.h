@@ -56,6 +56,15 @@ struct TriangleMesh {
                  const std::shared_ptr<Texture<Float>> &alphaMask,
                  const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
                  const int *faceIndices);
+    // Takes over the object space vertex data, which is transformed to
+    // world space in place
+    TriangleMesh(const Transform &ObjectToWorld, std::vector<int> vertexIndices,
+                 int nVertices, std::unique_ptr<Point3f[]> P,
+                 std::unique_ptr<Vector3f[]> S, std::unique_ptr<Normal3f[]> N,
+                 std::unique_ptr<Point2f[]> uv,
+                 const std::shared_ptr<Texture<Float>> &alphaMask,
+                 const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+                 std::vector<int> faceIndices);
 
     // TriangleMesh Data
     const int nTriangles, nVertices;
@@ -92,6 +101,12 @@ class Triangle : public Shape {
     // Returns the solid angle subtended by the triangle w.r.t. the given
     // reference point p.
     Float SolidAngle(const Point3f &p, int nSamples = 0) const;
+    DirectionCone NormalBounds() const;
+
+    // World-space vertex positions
+    void GetVertices(Point3f p[3]) const {
+        for (int i = 0; i < 3; ++i) p[i] = mesh->p[v[i]];
+    }
 
   private:
     // Triangle Private Methods
@@ -120,6 +135,15 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const std::shared_ptr<Texture<Float>> &alphaTexture,
     const std::shared_ptr<Texture<Float>> &shadowAlphaTexture,
     const int *faceIndices = nullptr);
+// Without copies of the vertex data; see the _TriangleMesh_ constructor
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    std::vector<int> vertexIndices, int nVertices, std::unique_ptr<Point3f[]> p,
+    std::unique_ptr<Vector3f[]> s, std::unique_ptr<Normal3f[]> n,
+    std::unique_ptr<Point2f[]> uv,
+    const std::shared_ptr<Texture<Float>> &alphaTexture,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaTexture,
+    std::vector<int> faceIndices = std::vector<int>());
 std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
@@ -0,0 +1,532 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "bfpblock.h"
+#include "bfperror.h"
+#include "bfpkernels.h"
+#include "bfptransform.h"
+#include "bfptriangle.h"
+#include "bfptexels.h"
+#include "mipmap.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+// Error bound for a single rounding of a block value against the largest
+// magnitude in the block.
+static double BlockError(const std::vector<double> &ref, int mantBits) {
+    double maxAbs = 0;
+    for (double v : ref) maxAbs = std::max(maxAbs, std::abs(v));
+    return 4 * maxAbs * std::ldexp(1., -mantBits);
+}
+
+static std::vector<double> RandomValues(RNG &rng, int n, double range) {
+    std::vector<double> v(n);
+    for (int i = 0; i < n; ++i)
+        v[i] = (2 * rng.UniformFloat() - 1) * range;
+    return v;
+}
+
+template <typename T>
+class BfpBlockFormat : public testing::Test {};
+
+typedef testing::Types<BfpBlock8, BfpBlock12, BfpBlock16, BfpBlock23,
+                       BfpBlock<10, 6, 16>, BfpBlock<30, 11, 64>>
+    BfpBlockFormats;
+TYPED_TEST_CASE(BfpBlockFormat, BfpBlockFormats);
+
+TEST(BfpBlock, RoundTrip) {
+    std::vector<double> x = {1., -2., 0.5, 0., -0.75, 3.25, 1024., -1e-3};
+    BfpBlock23 b(x);
+    EXPECT_EQ(x.size(), b.blockSize);
+
+    // Exactly representable relative to the common exponent.
+    std::vector<double> y = b.ToFloatingPoint();
+    for (int i = 0; i < 7; ++i) EXPECT_EQ(x[i], y[i]);
+    EXPECT_LT(std::abs(x[7] - y[7]), BlockError(x, 23));
+
+    // Elements past the block size stay zero.
+    for (int i = x.size(); i < BfpBlock23::Capacity; ++i)
+        EXPECT_EQ(0, b.mant[i]);
+}
+
+TEST(BfpBlock, Rounding) {
+    // Formatting rounds to nearest even, as arithmetic results do, rather
+    // than truncating small elements toward zero
+    const double ulp = std::ldexp(1., -8);
+    std::vector<double> x = {1 + .75 * ulp, 1 + .5 * ulp, 1 + 1.5 * ulp,
+                             255.5, .99, 1.999};
+    std::vector<double> y = BfpBlock8(std::vector<double>(x.begin(),
+                                                          x.begin() + 3))
+                                .ToFloatingPoint();
+    EXPECT_EQ(1 + ulp, y[0]);
+    EXPECT_EQ(1, y[1]);
+    EXPECT_EQ(1 + 2 * ulp, y[2]);
+
+    // A dim element sharing a block with a bright one
+    y = BfpBlock8(std::vector<double>(x.begin() + 3, x.begin() + 5))
+            .ToFloatingPoint();
+    EXPECT_EQ(255.5, y[0]);
+    EXPECT_EQ(1, y[1]);
+
+    // Rounding up into the next exponent
+    y = BfpBlock8(std::vector<double>{1.999, -.5}).ToFloatingPoint();
+    EXPECT_EQ(2, y[0]);
+    EXPECT_EQ(-.5, y[1]);
+}
+
+TEST(BfpBlock, Saturation) {
+    // Values past the largest exponent saturate to the largest magnitude
+    // instead of keeping their mantissas at a clamped exponent
+    typedef BfpBlock<10, 6, 16> Block;
+    const double maxValue = std::ldexp(2047., Block::MaxExp - Block::Bias - 10);
+    std::vector<double> y = Block(std::vector<double>{1e12, -1e13, 1.})
+                                .ToFloatingPoint();
+    EXPECT_EQ(maxValue, y[0]);
+    EXPECT_EQ(-maxValue, y[1]);
+    EXPECT_EQ(0, y[2]);
+
+    // and so do arithmetic results
+    Block a(std::vector<double>{std::ldexp(3., 30), 2.});
+    y = a.Mult1D(a).ToFloatingPoint();
+    EXPECT_EQ(maxValue, y[0]);
+    y = a.Add1D(a).ToFloatingPoint();
+    EXPECT_EQ(std::ldexp(3., 31), y[0]);
+    y = a.Add1D(a).Add1D(a).ToFloatingPoint();
+    EXPECT_EQ(maxValue, y[0]);
+}
+
+TYPED_TEST(BfpBlockFormat, Zeros) {
+    RNG rng;
+    std::vector<double> z(16, 0.);
+    TypeParam a(z), b(RandomValues(rng, 16, 10.));
+    for (double v : a.Add1D(a).ToFloatingPoint()) EXPECT_EQ(0, v);
+    for (double v : a.Mult1D(b).ToFloatingPoint()) EXPECT_EQ(0, v);
+    for (double v : b.Sub1D(b).ToFloatingPoint()) EXPECT_EQ(0, v);
+}
+
+TYPED_TEST(BfpBlockFormat, Arithmetic) {
+    RNG rng;
+    const int m = TypeParam::MantLength;
+    for (int n : {1, 3, 4, 7, 16, 33, 64}) {
+        if (n > TypeParam::Capacity) continue;
+        for (double range : {1e-3, 1., 1e4}) {
+            // Keep quotients within short exponent ranges.
+            if (TypeParam::ExpLength < 8 && range != 1.) continue;
+            std::vector<double> x = RandomValues(rng, n, range);
+            std::vector<double> y = RandomValues(rng, n, range);
+            TypeParam a(x), b(y);
+
+            std::vector<double> sum(n), diff(n), prod(n), quot(n);
+            for (int i = 0; i < n; ++i) {
+                sum[i] = x[i] + y[i];
+                diff[i] = x[i] - y[i];
+                prod[i] = x[i] * y[i];
+                quot[i] = x[i] / y[i];
+            }
+
+            std::vector<double> r = a.Add1D(b).ToFloatingPoint();
+            for (int i = 0; i < n; ++i)
+                EXPECT_NEAR(sum[i], r[i], BlockError(sum, m) + BlockError(x, m));
+            r = a.Sub1D(b).ToFloatingPoint();
+            for (int i = 0; i < n; ++i)
+                EXPECT_NEAR(diff[i], r[i], BlockError(diff, m) + BlockError(x, m));
+
+            // Products and quotients inherit the alignment error of both
+            // operands.
+            double maxX = BlockError(x, m) / 4, maxY = BlockError(y, m) / 4;
+            double maxAbsX = maxX * std::ldexp(1., m);
+            double maxAbsY = maxY * std::ldexp(1., m);
+            r = a.Mult1D(b).ToFloatingPoint();
+            for (int i = 0; i < n; ++i)
+                EXPECT_NEAR(prod[i], r[i],
+                            BlockError(prod, m) + 2 * maxX * maxAbsY +
+                                2 * maxY * maxAbsX);
+
+            // Divisors must not flush to zero in short formats.
+            for (int i = 0; i < n; ++i) {
+                y[i] = std::copysign(range * (.5 + .5 * rng.UniformFloat()),
+                                     y[i]);
+                quot[i] = x[i] / y[i];
+            }
+            b = TypeParam(y);
+            maxY = BlockError(y, m) / 4;
+            r = a.Div1D(b).ToFloatingPoint();
+            for (int i = 0; i < n; ++i) {
+                // Dividing by a value much smaller than the block maximum
+                // loses precision in the divisor.
+                double relY = 2 * maxY / std::abs(y[i]);
+                EXPECT_NEAR(quot[i], r[i],
+                            BlockError(quot, m) + 2 * std::abs(quot[i]) * relY +
+                                2 * maxX / std::abs(y[i]));
+            }
+        }
+    }
+}
+
+TYPED_TEST(BfpBlockFormat, Carry) {
+    // Sums overflow the implicit 1 and must bump the common exponent.
+    std::vector<double> x = {1.5, 1.75, -1.5, 0.25};
+    TypeParam a(x);
+    std::vector<double> r = a.Add1D(a).ToFloatingPoint();
+    for (int i = 0; i < 4; ++i) EXPECT_EQ(2 * x[i], r[i]);
+    r = a.Mult1D(a).ToFloatingPoint();
+    for (int i = 0; i < 4; ++i) EXPECT_EQ(x[i] * x[i], r[i]);
+
+    // Cancellation renormalizes back to full precision.
+    std::vector<double> y = {1.5, 1.75 - 1. / 64, -1.5, 0.25};
+    r = TypeParam(y).Sub1D(a).ToFloatingPoint();
+    EXPECT_EQ(0, r[0]);
+    EXPECT_EQ(-1. / 64, r[1]);
+}
+
+TEST(BfpBlock, Scalar) {
+    RNG rng;
+    std::vector<double> x = RandomValues(rng, 32, 100.);
+    BfpBlock23 a(x);
+    const double s = 3.25;
+
+    std::vector<double> r = a.AddScalar1D(s).ToFloatingPoint();
+    for (int i = 0; i < 32; ++i) EXPECT_NEAR(x[i] + s, r[i], 2 * BlockError(x, 23));
+    r = a.SubScalar1D(s, false).ToFloatingPoint();
+    for (int i = 0; i < 32; ++i) EXPECT_NEAR(x[i] - s, r[i], 2 * BlockError(x, 23));
+    r = a.SubScalar1D(s, true).ToFloatingPoint();
+    for (int i = 0; i < 32; ++i) EXPECT_NEAR(s - x[i], r[i], 2 * BlockError(x, 23));
+    r = a.MultScalar1D(s).ToFloatingPoint();
+    for (int i = 0; i < 32; ++i)
+        EXPECT_NEAR(x[i] * s, r[i], 2 * s * BlockError(x, 23));
+    r = a.DivScalar1D(s, false).ToFloatingPoint();
+    for (int i = 0; i < 32; ++i)
+        EXPECT_NEAR(x[i] / s, r[i], 2 * BlockError(x, 23) / s);
+
+    // The block itself is left untouched.
+    std::vector<double> y = a.ToFloatingPoint();
+    for (int i = 0; i < 32; ++i) EXPECT_NEAR(x[i], y[i], BlockError(x, 23));
+}
+
+TEST(BfpBlock, MatrixMult) {
+    // 2x3 times 3x2
+    std::vector<double> x = {1, 2, 3, 4, 5, 6};
+    std::vector<double> y = {7, 8, 9, 10, 11, -12};
+    std::vector<double> r =
+        BfpBlock23(x).MatrixMult(BfpBlock23(y), 3).ToFloatingPoint();
+    ASSERT_EQ(4, r.size());
+    EXPECT_EQ(1 * 7 + 2 * 9 + 3 * 11, r[0]);
+    EXPECT_EQ(1 * 8 + 2 * 10 + 3 * -12, r[1]);
+    EXPECT_EQ(4 * 7 + 5 * 9 + 6 * 11, r[2]);
+    EXPECT_EQ(4 * 8 + 5 * 10 + 6 * -12, r[3]);
+}
+
+TEST(BfpBlock, Compare) {
+    std::vector<double> x = {1, -2, 0.5, 4};
+    std::vector<double> y = {-1, 3, 0.25, -8};
+    BfpBlock23 a(x), b(y);
+    EXPECT_EQ(4, a.Max().ToFloatingPoint());
+    EXPECT_EQ(-2, a.Min().ToFloatingPoint());
+
+    a.Swap(&b);
+    std::vector<double> hi = a.ToFloatingPoint(), lo = b.ToFloatingPoint();
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(std::max(x[i], y[i]), hi[i]);
+        EXPECT_EQ(std::min(x[i], y[i]), lo[i]);
+    }
+}
+
+TEST(BfpBlock, SizeMismatch) {
+    BfpBlock23 a(std::vector<double>(4, 1.)), b(std::vector<double>(5, 1.));
+    EXPECT_THROW(a.Add1D(b), std::invalid_argument);
+    EXPECT_THROW(a.Mult1D(b), std::invalid_argument);
+    EXPECT_THROW(BfpBlock23(std::vector<double>(65, 1.)),
+                 std::invalid_argument);
+    EXPECT_THROW((BfpBlock<10, 6, 16>(std::vector<double>(17, 1.))),
+                 std::invalid_argument);
+}
+
+// Largest error of _op_ in ulps of the result block over random inputs of
+// several sizes and dynamic ranges, against exact arithmetic on the
+// quantized inputs.
+template <typename Block>
+static double MaxBlockUlps(BfpOp op) {
+    BfpErrorStats stats;
+    for (int n : {4, 16, 64})
+        for (int decades : {0, 2, 4, 8}) {
+            RNG rng(n * 131 + decades);
+            for (int i = 0; i < 64; ++i) {
+                std::vector<double> x = BfpRandomValues(rng, n, decades);
+                std::vector<double> y = BfpRandomValues(rng, n, decades);
+                double s = BfpRandomValues(rng, 1, decades)[0];
+                Block a(x), b(y);
+                std::vector<double> xq = a.ToFloatingPoint();
+                std::vector<double> yq = b.ToFloatingPoint();
+                int nOut = BfpResultSize(op, n);
+                std::vector<double> r(nOut), ref(nOut);
+                double ulp;
+                try {
+                    BfpApply(op, a, b, s, r.data(), &ulp);
+                } catch (const std::invalid_argument &) {
+                    // a divisor flushed to zero by the shared exponent
+                    continue;
+                }
+                BfpReference(op, op == BfpOp::Convert ? x.data() : xq.data(),
+                             yq.data(), s, n, ref.data());
+                for (int j = 0; j < nOut; ++j)
+                    stats.Add(std::abs(r[j] - ref[j]) / ulp);
+            }
+        }
+    EXPECT_GT(stats.Count(), 0) << BfpOpString(op);
+    return stats.Max();
+}
+
+template <typename Block>
+static void CheckErrorBounds() {
+    for (const BfpOpName &o : bfpOpNames) {
+        // Conversion truncates, and so does Swap when it realigns the
+        // smaller block; the scalar operations quantize the scalar first.
+        double bound;
+        switch (o.op) {
+        case BfpOp::Convert:
+        case BfpOp::Swap: bound = 1; break;
+        case BfpOp::Max:
+        case BfpOp::Min: bound = 0; break;
+        case BfpOp::AddScalar:
+        case BfpOp::SubScalar:
+        case BfpOp::ScalarSub:
+        case BfpOp::MultScalar:
+        case BfpOp::DivScalar:
+        case BfpOp::ScalarDiv: bound = 5; break;
+        default: bound = .5; break;
+        }
+        EXPECT_LE(MaxBlockUlps<Block>(o.op), bound) << o.name;
+    }
+}
+
+TEST(BfpBlock, KernelSetsAgree) {
+    // Every kernel set this CPU can run computes exactly what the scalar
+    // one does
+    const BfpKernelSet *sets[3];
+    int nSets = BfpSupportedKernels(sets);
+    EXPECT_EQ(&BfpKernels(), sets[nSets - 1]);
+
+    RNG rng;
+    const int n = 64;
+    uint16_t a16[n], b16[n];
+    uint32_t a32[n], b32[n];
+    for (int i = 0; i < n; ++i) {
+        a16[i] = rng.UniformUInt32() & 0xffff;
+        b16[i] = rng.UniformUInt32() & 0xffff;
+        a32[i] = rng.UniformUInt32() & 0x3fffffff;
+        b32[i] = rng.UniformUInt32() & 0x3fffffff;
+    }
+    uint64_t signA = (uint64_t)rng.UniformUInt32() << 32 | rng.UniformUInt32();
+    uint64_t signB = (uint64_t)rng.UniformUInt32() << 32 | rng.UniformUInt32();
+
+    for (int s = 1; s < nSets; ++s) {
+        const BfpKernelSet &ref = *sets[0], &k = *sets[s];
+        uint64_t wideRef[n], wide[n];
+        for (int shift : {0, 3, 20, 70}) {
+            EXPECT_EQ(ref.alignedSum16(a16, signA, 0, b16, signB, shift, 45,
+                                       n, wideRef),
+                      k.alignedSum16(a16, signA, 0, b16, signB, shift, 45, n,
+                                     wide));
+            for (int i = 0; i < n; ++i) EXPECT_EQ(wideRef[i], wide[i]);
+            EXPECT_EQ(ref.alignedSum32(a32, signA, shift, b32, signB, 1, 31,
+                                       n, wideRef),
+                      k.alignedSum32(a32, signA, shift, b32, signB, 1, 31, n,
+                                     wide));
+            for (int i = 0; i < n; ++i) EXPECT_EQ(wideRef[i], wide[i]);
+        }
+
+        ref.multiply32(a32, b32, n, wideRef);
+        k.multiply32(a32, b32, n, wide);
+        for (int i = 0; i < n; ++i) EXPECT_EQ(wideRef[i], wide[i]);
+        EXPECT_EQ(ref.orReduce(wideRef, n), k.orReduce(wideRef, n));
+        for (int point : {-2, 1, 13, 31}) {
+            uint32_t mRef[n], m[n];
+            EXPECT_EQ(ref.roundToMant32(wideRef, n, point, mRef),
+                      k.roundToMant32(wideRef, n, point, m));
+            for (int i = 0; i < n; ++i) EXPECT_EQ(mRef[i], m[i]);
+        }
+
+        ref.multiply16(a16, b16, n, wideRef);
+        k.multiply16(a16, b16, n, wide);
+        for (int i = 0; i < n; ++i) EXPECT_EQ(wideRef[i], wide[i]);
+        uint16_t mRef[n], m[n];
+        EXPECT_EQ(ref.roundToMant16(wideRef, n, 17, mRef),
+                  k.roundToMant16(wideRef, n, 17, m));
+        for (int i = 0; i < n; ++i) EXPECT_EQ(mRef[i], m[i]);
+
+        // Rays from inside and around a block of random triangles
+        int16_t v[3][24];
+        for (int a = 0; a < 3; ++a)
+            for (int i = 0; i < 24; ++i)
+                v[a][i] = int16_t(rng.UniformUInt32(1 << 15)) - (1 << 14);
+        for (int r = 0; r < 1000; ++r) {
+            BfpTriangleRay ray;
+            for (int a = 0; a < 3; ++a) {
+                ray.v[a] = v[(a + r) % 3];
+                ray.o[a] = int64_t(rng.UniformUInt32(1 << 13)) - (1 << 12);
+            }
+            ray.sx = int64_t(rng.UniformUInt32(1u << 31)) - (1 << 30);
+            ray.sy = int64_t(rng.UniformUInt32(1u << 31)) - (1 << 30);
+            ray.tz = rng.UniformUInt32(1 << 17);
+            ray.flipZ = r & 1;
+            int nTris = 1 + r % 8;
+            EXPECT_EQ(ref.triangleMisses(ray, nTris),
+                      k.triangleMisses(ray, nTris));
+        }
+    }
+}
+
+TEST(BfpBlock, ErrorBounds) {
+    CheckErrorBounds<BfpBlock8>();
+    CheckErrorBounds<BfpBlock12>();
+    CheckErrorBounds<BfpBlock16>();
+    CheckErrorBounds<BfpBlock23>();
+}
+
+TEST(BfpTransform, Points) {
+    RNG rng;
+    Transform t = Translate(Vector3f(10, -4, 2.5)) * RotateY(30) *
+                  Scale(2, 3, .5);
+    BfpTransform bt(t);
+
+    // Uneven batch count on purpose.
+    const int n = 3 * BfpTransform::BatchSize + 5;
+    std::vector<Point3f> p(n), pb(n);
+    std::vector<Vector3f> v(n), vb(n);
+    std::vector<Normal3f> nrm(n), nb(n);
+    for (int i = 0; i < n; ++i) {
+        p[i] = Point3f(rng.UniformFloat(), rng.UniformFloat(),
+                       rng.UniformFloat()) * 20.f - Vector3f(10, 10, 10);
+        v[i] = Vector3f(p[i]);
+        nrm[i] = Normal3f(v[i]);
+    }
+    bt(p.data(), n, pb.data());
+    bt(v.data(), n, vb.data());
+    bt(nrm.data(), n, nb.data());
+
+    // The shared exponents of the matrix and the batch cost a few bits
+    // relative to the largest magnitudes involved.
+    const Float tol = 1e-3f;
+    for (int i = 0; i < n; ++i) {
+        EXPECT_LT(Distance(t(p[i]), pb[i]), tol) << i;
+        EXPECT_LT((t(v[i]) - vb[i]).Length(), tol) << i;
+        EXPECT_LT((t(nrm[i]) - nb[i]).Length(), tol) << i;
+    }
+
+    // Transforming in place gives the same results
+    std::vector<Point3f> pInPlace = p;
+    bt(pInPlace.data(), n, pInPlace.data());
+    EXPECT_EQ(pb, pInPlace);
+    EXPECT_EQ(BfpTransform(Transform()).GetMatrix(), Matrix4x4());
+}
+
+TEST(BfpTriangleBlock, ConservativeMisses) {
+    RNG rng;
+    Transform identity;
+    const int nTris = BfpTriangleBlock::MaxTriangles;
+    int64_t nCulled = 0, nFloatMisses = 0;
+    for (int trial = 0; trial < 200; ++trial) {
+        // A leaf's worth of triangles somewhere in a large scene
+        Float scale = std::pow(10.f, 4 * rng.UniformFloat() - 2);
+        Point3f offset(1000 * (rng.UniformFloat() - .5f),
+                       1000 * (rng.UniformFloat() - .5f),
+                       1000 * (rng.UniformFloat() - .5f));
+        std::vector<Point3f> p(3 * nTris);
+        std::vector<int> indices(3 * nTris);
+        for (int i = 0; i < 3 * nTris; ++i) {
+            p[i] = offset + scale * Vector3f(rng.UniformFloat(),
+                                             rng.UniformFloat(),
+                                             rng.UniformFloat());
+            indices[i] = i;
+        }
+        std::vector<std::shared_ptr<Shape>> tris =
+            CreateTriangleMesh(&identity, &identity, false, nTris,
+                               indices.data(), p.size(), p.data(), nullptr,
+                               nullptr, nullptr, nullptr, nullptr);
+        BfpTriangleBlock block(p.data(), nTris);
+
+        for (int r = 0; r < 200; ++r) {
+            // Aim at points on the triangles' edges and at random points
+            // around them, from near and far.
+            int t = rng.UniformUInt32(nTris);
+            Float b = rng.UniformFloat();
+            Point3f target =
+                (r & 1) ? Lerp(b, p[3 * t], p[3 * t + 1])
+                        : offset + 2 * scale * Vector3f(rng.UniformFloat(),
+                                                        rng.UniformFloat(),
+                                                        rng.UniformFloat());
+            Vector3f w(rng.UniformFloat() - .5f, rng.UniformFloat() - .5f,
+                       rng.UniformFloat() - .5f);
+            Float dist = scale * std::pow(10.f, 4 * rng.UniformFloat() - 1);
+            Point3f o = target - dist * Normalize(w);
+            Ray ray(o, target - o,
+                    (r % 3 == 0) ? 0.5f + rng.UniformFloat() : Infinity);
+
+            uint32_t misses = block.Misses(ray, BfpRay(ray));
+            for (int i = 0; i < nTris; ++i) {
+                bool floatHit = tris[i]->IntersectP(ray);
+                if (!floatHit) ++nFloatMisses;
+                if (misses & (1u << i)) {
+                    EXPECT_FALSE(floatHit) << trial << " " << r << " " << i;
+                    ++nCulled;
+                }
+            }
+        }
+    }
+    // Most misses are caught without the float test
+    EXPECT_GT(nCulled, nFloatMisses / 2);
+}
+
+TEST(BfpBlockedArray, RoundTrip) {
+    RNG rng;
+    // Odd resolution on purpose: partial blocks at the edges
+    const int w = 13, h = 7;
+    std::vector<RGBSpectrum> texels(w * h);
+    for (int i = 0; i < w * h; ++i) {
+        // Wide dynamic range between blocks
+        Float s = std::pow(10.f, 6 * rng.UniformFloat() - 3);
+        Float rgb[3] = {s * rng.UniformFloat(), s * rng.UniformFloat(),
+                        -s * rng.UniformFloat()};
+        texels[i] = RGBSpectrum::FromRGB(rgb);
+    }
+    BlockedArray<RGBSpectrum, 2> a(w, h, texels.data());
+    for (int bits : {4, 7, 8, 12, 15}) {
+        BfpBlockedArray<RGBSpectrum> b(a, bits);
+        EXPECT_EQ(w, b.uSize());
+        EXPECT_EQ(h, b.vSize());
+        for (int v = 0; v < h; ++v)
+            for (int u = 0; u < w; ++u) {
+                // Half an ulp of the block maximum of the channel
+                RGBSpectrum x = a(u, v), y = b(u, v);
+                for (int c = 0; c < 3; ++c) {
+                    Float maxAbs = 0;
+                    for (int vv = v & ~3; vv < std::min(h, (v & ~3) + 4); ++vv)
+                        for (int uu = u & ~3; uu < std::min(w, (u & ~3) + 4);
+                             ++uu)
+                            maxAbs = std::max(maxAbs, std::abs(a(uu, vv)[c]));
+                    EXPECT_LE(std::abs(x[c] - y[c]),
+                              maxAbs * std::ldexp(1.f, -bits))
+                        << bits << " " << u << " " << v << " " << c;
+                }
+            }
+    }
+}
+
+TEST(BfpBlockedArray, MIPMap) {
+    RNG rng;
+    const Point2i res(37, 16);
+    std::vector<Float> texels(res.x * res.y);
+    for (Float &t : texels) t = rng.UniformFloat();
+    MIPMap<Float> ref(res, texels.data());
+    MIPMap<Float> bfp(res, texels.data(), false, 8.f, ImageWrap::Repeat, 12);
+    ASSERT_EQ(ref.Levels(), bfp.Levels());
+    for (int i = 0; i < 100; ++i) {
+        Point2f st(rng.UniformFloat(), rng.UniformFloat());
+        Vector2f dst0(.1f * rng.UniformFloat(), 0),
+            dst1(0, .1f * rng.UniformFloat());
+        EXPECT_NEAR(ref.Lookup(st, 0), bfp.Lookup(st, 0), 1e-3f);
+        EXPECT_NEAR(ref.Lookup(st, dst0, dst1), bfp.Lookup(st, dst0, dst1),
+                    1e-3f);
+    }
+}
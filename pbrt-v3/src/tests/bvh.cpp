@@ -0,0 +1,285 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "sampling.h"
+#include "accelerators/bvh.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+// Many small random triangles, enough to take the parallel paths of the
+// SAH build.
+static std::vector<std::shared_ptr<Primitive>> RandomTriangles(int nTris) {
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTris; ++i) {
+        Point3f c(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat());
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(c + .01f * Vector3f(rng.UniformFloat(),
+                                            rng.UniformFloat(),
+                                            rng.UniformFloat()));
+        }
+    }
+    static Transform identity;
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTris, &indices[0], p.size(), &p[0],
+        nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const auto &t : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            t, nullptr, nullptr, MediumInterface()));
+    return prims;
+}
+
+TEST(BVH, ParallelBuild) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(40000);
+    for (auto method : {BVHAccel::SplitMethod::SAH,
+                        BVHAccel::SplitMethod::Middle,
+                        BVHAccel::SplitMethod::EqualCounts}) {
+        BVHAccel bvh(prims, 4, method);
+        EXPECT_TRUE(Inside(prims[0]->WorldBound().pMin, bvh.WorldBound()));
+
+        // Closest hits must match a test against every triangle
+        RNG rng(1);
+        for (int i = 0; i < 200; ++i) {
+            Point3f o = Point3f(.5f, .5f, .5f) +
+                        UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                                    rng.UniformFloat()));
+            Point3f target(rng.UniformFloat(), rng.UniformFloat(),
+                           rng.UniformFloat());
+            Ray ray(o, target - o);
+            Float tHit = Infinity;
+            for (const auto &p : prims) {
+                Ray r = ray;
+                SurfaceInteraction isect;
+                if (p->Intersect(r, &isect)) tHit = std::min(tHit, r.tMax);
+            }
+
+            Ray r = ray;
+            SurfaceInteraction isect;
+            EXPECT_EQ(tHit < Infinity, bvh.Intersect(r, &isect));
+            if (tHit < Infinity) EXPECT_EQ(tHit, r.tMax);
+            EXPECT_EQ(tHit < Infinity, bvh.IntersectP(ray));
+        }
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
+
+TEST(BVH, Wide) {
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000);
+    BVHAccel binary(prims, 4);
+    for (int width : {4, 8}) {
+        BVHAccel wide(prims, 4, BVHAccel::SplitMethod::SAH, false, width);
+        EXPECT_EQ(binary.WorldBound(), wide.WorldBound());
+
+        // Same closest hits as the binary tree, for rays from outside and
+        // inside the triangle cloud
+        RNG rng(2);
+        for (int i = 0; i < 2000; ++i) {
+            Point3f o(rng.UniformFloat(), rng.UniformFloat(),
+                      rng.UniformFloat());
+            if (i & 1)
+                o = Point3f(.5f, .5f, .5f) +
+                    UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                                rng.UniformFloat()));
+            Vector3f d = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Ray ray(o, d, i % 3 == 0 ? Float(.2) : Infinity);
+
+            Ray rb = ray, rw = ray;
+            SurfaceInteraction ib, iw;
+            bool hitBinary = binary.Intersect(rb, &ib);
+            EXPECT_EQ(hitBinary, wide.Intersect(rw, &iw));
+            EXPECT_EQ(rb.tMax, rw.tMax);
+            EXPECT_EQ(hitBinary, wide.IntersectP(ray));
+        }
+    }
+}
+
+TEST(BVH, BfpLeaves) {
+    // The BFP leaf blocks only cull triangles the float test misses too, so
+    // the hits are those of the plain tree, also with leaves of up to eight
+    // triangles
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000);
+    for (int maxPrims : {4, 8}) {
+        BVHAccel plain(prims, maxPrims);
+        for (int width : {2, 4}) {
+            BVHAccel bfp(prims, maxPrims, BVHAccel::SplitMethod::SAH, true,
+                         width);
+            RNG rng(3);
+            for (int i = 0; i < 2000; ++i) {
+                Point3f o(rng.UniformFloat(), rng.UniformFloat(),
+                          rng.UniformFloat());
+                if (i & 1)
+                    o = Point3f(.5f, .5f, .5f) +
+                        UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                                    rng.UniformFloat()));
+                Vector3f d = UniformSampleSphere(
+                    Point2f(rng.UniformFloat(), rng.UniformFloat()));
+                Ray ray(o, d, i % 3 == 0 ? Float(.2) : Infinity);
+
+                Ray rp = ray, rb = ray;
+                SurfaceInteraction ip, ib;
+                bool hitPlain = plain.Intersect(rp, &ip);
+                EXPECT_EQ(hitPlain, bfp.Intersect(rb, &ib));
+                EXPECT_EQ(rp.tMax, rb.tMax);
+                EXPECT_EQ(hitPlain, bfp.IntersectP(ray));
+            }
+        }
+    }
+}
+
+TEST(BVH, RayBatch) {
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000);
+    BVHAccel bvh(prims, 4);
+    RNG rng(3);
+    for (bool coherent : {true, false}) {
+        // A fan of rays with the same direction signs, or random origins and
+        // directions
+        RayBatch batch, shadow(true);
+        std::vector<Ray> rays;
+        Point3f eye(-1, -1, -1);
+        for (int i = 0; i < 1000; ++i) {
+            Ray ray;
+            if (coherent) {
+                Point3f target(rng.UniformFloat(), rng.UniformFloat(), .5f);
+                ray = Ray(eye, target - eye);
+            } else
+                ray = Ray(Point3f(rng.UniformFloat(), rng.UniformFloat(),
+                                  rng.UniformFloat()),
+                          UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                                      rng.UniformFloat())));
+            if (i % 3 == 0) ray.tMax = .8f;
+            rays.push_back(ray);
+            batch.Add(ray);
+            shadow.Add(ray);
+        }
+
+        bvh.Intersect(batch);
+        bvh.Intersect(shadow);
+        for (size_t i = 0; i < batch.Size(); ++i) {
+            Ray r = rays[i];
+            SurfaceInteraction isect;
+            bool hit = bvh.Intersect(r, &isect);
+            EXPECT_EQ(hit, (bool)batch.hit[i]);
+            EXPECT_EQ(hit, (bool)shadow.hit[i]);
+            EXPECT_EQ(r.tMax, batch.rays[i].tMax);
+            if (hit) {
+                EXPECT_EQ(isect.p, batch.isects[i].p);
+            }
+        }
+    }
+}
+
+TEST(BVH, Quantized) {
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000);
+    BVHAccel exact(prims, 4);
+    for (int bits : {8, 16}) {
+        BVHAccel quantized(prims, 4, BVHAccel::SplitMethod::SAH, false, 2,
+                           bits);
+        EXPECT_EQ(exact.WorldBound(), quantized.WorldBound());
+
+        // Conservative bounds: the same closest hits as the float nodes
+        RNG rng(4);
+        for (int i = 0; i < 2000; ++i) {
+            Point3f o(rng.UniformFloat(), rng.UniformFloat(),
+                      rng.UniformFloat());
+            if (i & 1)
+                o = Point3f(.5f, .5f, .5f) +
+                    UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                                rng.UniformFloat()));
+            Vector3f d = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Ray ray(o, d, i % 3 == 0 ? Float(.2) : Infinity);
+
+            Ray re = ray, rq = ray;
+            SurfaceInteraction ie, iq;
+            bool hitExact = exact.Intersect(re, &ie);
+            EXPECT_EQ(hitExact, quantized.Intersect(rq, &iq));
+            EXPECT_EQ(re.tMax, rq.tMax);
+            EXPECT_EQ(hitExact, quantized.IntersectP(ray));
+        }
+    }
+}
+
+TEST(BVH, Cache) {
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000);
+    BVHAccel exact(prims, 4);
+    const std::string cacheDir = ".";
+    // The first BVH writes the cache file, the second loads it
+    for (bool loaded : {false, true}) {
+        BVHAccel cached(prims, 4, BVHAccel::SplitMethod::SAH, loaded, 2, 0,
+                        cacheDir);
+        EXPECT_EQ(loaded, cached.LoadedFromCache());
+        EXPECT_EQ(exact.WorldBound(), cached.WorldBound());
+        RNG rng(5);
+        for (int i = 0; i < 500; ++i) {
+            Point3f o = Point3f(.5f, .5f, .5f) +
+                        UniformSampleSphere(Point2f(rng.UniformFloat(),
+                                                    rng.UniformFloat()));
+            Ray ray(o, Point3f(rng.UniformFloat(), rng.UniformFloat(),
+                               rng.UniformFloat()) - o);
+            Ray re = ray, rc = ray;
+            SurfaceInteraction ie, ic;
+            EXPECT_EQ(exact.Intersect(re, &ie), cached.Intersect(rc, &ic));
+            EXPECT_EQ(re.tMax, rc.tMax);
+            EXPECT_EQ(ie.shape, ic.shape);
+        }
+    }
+
+    // Other primitives, or the same primitives in another order, are not
+    // loaded from it
+    std::vector<std::shared_ptr<Primitive>> reordered(prims.rbegin(),
+                                                      prims.rend());
+    BVHAccel other(reordered, 4, BVHAccel::SplitMethod::SAH, false, 2, 0,
+                   cacheDir);
+    EXPECT_FALSE(other.LoadedFromCache());
+    BVHAccel otherSettings(prims, 2, BVHAccel::SplitMethod::SAH, false, 2, 0,
+                           cacheDir);
+    EXPECT_FALSE(otherSettings.LoadedFromCache());
+    BVHAccel cached(prims, 4, BVHAccel::SplitMethod::SAH, false, 2, 0,
+                    cacheDir);
+
+    // Corrupt files of the right size are rebuilt: the file ends with the
+    // nodes, 32 bytes each, followed by the primitive indices
+    const std::string &cacheFile = cached.CacheFile();
+    auto corrupt = [&](long offset, const std::vector<char> &bytes) {
+        FILE *f = fopen(cacheFile.c_str(), "r+b");
+        ASSERT_TRUE(f != nullptr);
+        fseek(f, offset, SEEK_END);
+        fwrite(bytes.data(), 1, bytes.size(), f);
+        fclose(f);
+    };
+    long indicesOffset = -long(prims.size() * sizeof(int32_t));
+    // A leaf past the last primitive
+    corrupt(indicesOffset - 32, std::vector<char>(32, 0x7f));
+    BVHAccel badNodes(prims, 4, BVHAccel::SplitMethod::SAH, false, 2, 0,
+                      cacheDir);
+    EXPECT_FALSE(badNodes.LoadedFromCache());
+    // A primitive index repeated in place of another
+    std::vector<char> index(sizeof(int32_t));
+    FILE *f = fopen(cacheFile.c_str(), "rb");
+    ASSERT_TRUE(f != nullptr);
+    fseek(f, indicesOffset, SEEK_END);
+    EXPECT_EQ(index.size(), fread(index.data(), 1, index.size(), f));
+    fclose(f);
+    corrupt(indicesOffset + sizeof(int32_t), index);
+    BVHAccel badIndices(prims, 4, BVHAccel::SplitMethod::SAH, false, 2, 0,
+                        cacheDir);
+    EXPECT_FALSE(badIndices.LoadedFromCache());
+    EXPECT_EQ(exact.WorldBound(), badIndices.WorldBound());
+
+    for (const BVHAccel *bvh : {&cached, &other, &otherSettings})
+        EXPECT_EQ(0, remove(bvh->CacheFile().c_str()));
+}
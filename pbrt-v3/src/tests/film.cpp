@@ -0,0 +1,122 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "film.h"
+#include "filters/box.h"
+#include "imageio.h"
+#include "parallel.h"
+#include "rng.h"
+#include <sstream>
+
+using namespace pbrt;
+
+// Adds random samples and splats to _film_ from parallel tiles.
+static void AccumulateRandom(Film &film) {
+    Bounds2i sampleBounds = film.GetSampleBounds();
+    Vector2i extent = sampleBounds.Diagonal();
+    const int tileSize = 8;
+    Point2i nTiles((extent.x + tileSize - 1) / tileSize,
+                   (extent.y + tileSize - 1) / tileSize);
+    ParallelFor2D([&](Point2i tile) {
+        RNG rng(tile.y * nTiles.x + tile.x);
+        Point2i p0 = sampleBounds.pMin + tileSize * Vector2i(tile.x, tile.y);
+        Bounds2i tileBounds(p0, Min(p0 + Vector2i(tileSize, tileSize),
+                                    sampleBounds.pMax));
+        std::unique_ptr<FilmTile> filmTile = film.GetFilmTile(tileBounds);
+        for (Point2i pixel : tileBounds)
+            for (int i = 0; i < 4; ++i)
+                filmTile->AddSample(
+                    Point2f(pixel) + Vector2f(rng.UniformFloat(),
+                                              rng.UniformFloat()),
+                    Spectrum(rng.UniformFloat()));
+        film.MergeFilmTile(std::move(filmTile));
+        for (int i = 0; i < 100; ++i)
+            film.AddSplat(Point2f(rng.UniformFloat() * film.fullResolution.x,
+                                  rng.UniformFloat() * film.fullResolution.y),
+                          Spectrum(rng.UniformFloat()));
+    }, nTiles);
+}
+
+// Returns the image _film_ writes.
+static std::unique_ptr<RGBSpectrum[]> WriteAndRead(Film &film) {
+    film.WriteImage(.25f);
+
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(film.filename, &res);
+    EXPECT_EQ(res, film.fullResolution);
+    remove(film.filename.c_str());
+    return image;
+}
+
+static std::unique_ptr<RGBSpectrum[]> RenderRandom(Film &film) {
+    AccumulateRandom(film);
+    return WriteAndRead(film);
+}
+
+TEST(Film, LockFree) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+
+    Point2i res(61, 40);
+    Bounds2f crop(Point2f(0, 0), Point2f(1, 1));
+    Film locked(res, crop,
+                std::unique_ptr<Filter>(new BoxFilter(Vector2f(1.5, 1.5))), 35,
+                "film_locked.pfm", 1);
+    Film lockFree(res, crop,
+                  std::unique_ptr<Filter>(new BoxFilter(Vector2f(1.5, 1.5))),
+                  35, "film_lockfree.pfm", 1, Infinity, false, true);
+    std::unique_ptr<RGBSpectrum[]> a = RenderRandom(locked);
+    std::unique_ptr<RGBSpectrum[]> b = RenderRandom(lockFree);
+    ASSERT_TRUE(a && b);
+    // Same sums, possibly added in a different order
+    Float sum = 0;
+    for (int i = 0; i < res.x * res.y; ++i)
+        for (int c = 0; c < 3; ++c) {
+            EXPECT_NEAR(a[i][c], b[i][c], 1e-4f * (1 + a[i][c]));
+            sum += a[i][c];
+        }
+    EXPECT_GT(sum, 0);
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
+
+TEST(Film, PixelState) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+
+    Point2i res(61, 40);
+    Bounds2f crop(Point2f(0, 0), Point2f(1, 1));
+    for (bool bfp : {false, true}) {
+        auto filter = [] {
+            return std::unique_ptr<Filter>(new BoxFilter(Vector2f(1.5, 1.5)));
+        };
+        Film saved(res, crop, filter(), 35, "film_saved.pfm", 1, Infinity,
+                   bfp, !bfp);
+        Film restored(res, crop, filter(), 35, "film_restored.pfm", 1,
+                      Infinity, bfp, !bfp);
+        AccumulateRandom(saved);
+        std::stringstream state;
+        saved.WritePixelState(state);
+        ASSERT_TRUE(restored.ReadPixelState(state));
+
+        // Restored films write the same image
+        std::unique_ptr<RGBSpectrum[]> a = WriteAndRead(saved);
+        std::unique_ptr<RGBSpectrum[]> b = WriteAndRead(restored);
+        ASSERT_TRUE(a && b);
+        for (int i = 0; i < res.x * res.y; ++i)
+            for (int c = 0; c < 3; ++c) EXPECT_EQ(a[i][c], b[i][c]);
+
+        // State is only read into films with the same pixel bounds
+        Film other(Point2i(60, 40), crop, filter(), 35, "film_other.pfm", 1,
+                   Infinity, bfp);
+        state.clear();
+        state.seekg(0);
+        EXPECT_FALSE(other.ReadPixelState(state));
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
@@ -87,3 +87,56 @@ TEST(ImageIO, RoundTripPFM) { TestRoundTrip("out.pfm", false); }
 TEST(ImageIO, RoundTripTGA) { TestRoundTrip("out.tga", true); }
 
 TEST(ImageIO, RoundTripPNG) { TestRoundTrip("out.png", true); }
+
+TEST(ImageIO, TiledEXR) {
+    Point2i res(100, 70);
+    std::vector<Float> pixels(3 * res.x * res.y);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = Float(i % 97) / 8;
+    std::string filename = inTestDir("tiled.exr");
+    ASSERT_TRUE(WriteTiledImageEXR(filename, &pixels[0], res, 16));
+
+    // Regions read tile by tile match the image read in full
+    Point2i readRes;
+    auto full = ReadImage(filename, &readRes);
+    ASSERT_TRUE(full.get() != nullptr);
+    EXPECT_EQ(readRes, res);
+    {
+        auto reader = TiledImageReader::Open(filename);
+        ASSERT_TRUE(reader.get() != nullptr);
+        EXPECT_EQ(res, reader->Resolution());
+        for (Bounds2i b : {Bounds2i({0, 0}, res), Bounds2i({15, 3}, {17, 69}),
+                           Bounds2i({40, 20}, {100, 70})}) {
+            std::vector<RGBSpectrum> rgb(b.Area());
+            ASSERT_TRUE(reader->Read(b, &rgb[0]));
+            int i = 0;
+            for (int y = b.pMin.y; y < b.pMax.y; ++y)
+                for (int x = b.pMin.x; x < b.pMax.x; ++x)
+                    EXPECT_EQ(full[y * res.x + x], rgb[i++]);
+        }
+
+        // Each MIP level averages 2x2 texels of the one before it, up to
+        // the precision of the file
+        ASSERT_EQ(7, reader->Levels());
+        Point2i res1(res.x / 2, res.y / 2);
+        std::vector<RGBSpectrum> level1(res1.x * res1.y);
+        ASSERT_TRUE(reader->Read(Bounds2i({0, 0}, res1), &level1[0], 1));
+        for (int y = 0; y < res1.y; ++y)
+            for (int x = 0; x < res1.x; ++x) {
+                RGBSpectrum avg =
+                    .25f * (full[2 * y * res.x + 2 * x] +
+                            full[2 * y * res.x + 2 * x + 1] +
+                            full[(2 * y + 1) * res.x + 2 * x] +
+                            full[(2 * y + 1) * res.x + 2 * x + 1]);
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_NEAR(avg[c], level1[y * res1.x + x][c], .02f);
+            }
+        RGBSpectrum coarsest;
+        ASSERT_TRUE(reader->Read(Bounds2i({0, 0}, {1, 1}), &coarsest, 6));
+    }
+    EXPECT_EQ(0, remove(filename.c_str()));
+
+    // Scanline images aren't read by tiles
+    WriteImage(filename, &pixels[0], Bounds2i({0, 0}, res), res);
+    EXPECT_TRUE(TiledImageReader::Open(filename).get() == nullptr);
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
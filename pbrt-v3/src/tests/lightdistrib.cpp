@@ -0,0 +1,95 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "sampling.h"
+#include "lightdistrib.h"
+#include "primitive.h"
+#include "scene.h"
+#include "accelerators/bvh.h"
+#include "lights/diffuse.h"
+#include "lights/distant.h"
+#include "lights/point.h"
+#include "lights/spot.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+TEST(LightBVH, SampleMatchesPMF) {
+    // Randomly placed and oriented emissive triangles of varying power,
+    // some point and spot lights, and a distant light, which can't be
+    // bounded
+    RNG rng;
+    static Transform id;
+    std::vector<std::shared_ptr<Light>> lights;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (int i = 0; i < 100; ++i) {
+        Point3f p[3];
+        Point3f c(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat());
+        for (int j = 0; j < 3; ++j)
+            p[j] = 10 * c + Vector3f(rng.UniformFloat(), rng.UniformFloat(),
+                                     rng.UniformFloat());
+        int indices[3] = {0, 1, 2};
+        std::shared_ptr<Shape> tri =
+            CreateTriangleMesh(&id, &id, false, 1, indices, 3, p, nullptr,
+                               nullptr, nullptr, nullptr, nullptr)[0];
+        std::shared_ptr<AreaLight> area = std::make_shared<DiffuseAreaLight>(
+            Transform(), MediumInterface(), Spectrum(1 + 9 * rng.UniformFloat()),
+            1, tri, i % 7 == 0);
+        lights.push_back(area);
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, area, MediumInterface()));
+    }
+    for (int i = 0; i < 5; ++i) {
+        Transform t = Translate(Vector3f(10 * rng.UniformFloat(),
+                                         10 * rng.UniformFloat(),
+                                         10 * rng.UniformFloat()));
+        lights.push_back(std::make_shared<PointLight>(t, MediumInterface(),
+                                                      Spectrum(1.f)));
+        lights.push_back(std::make_shared<SpotLight>(
+            t * RotateX(90 * i), MediumInterface(), Spectrum(1.f), 30, 20));
+    }
+    lights.push_back(std::make_shared<DistantLight>(
+        Transform(), Spectrum(1.f), Vector3f(0, 0, 1)));
+    Scene scene(std::make_shared<BVHAccel>(prims), lights);
+    LightBVHDistribution distrib(scene);
+
+    for (int i = 0; i < 20; ++i) {
+        Point3f p(-2 + 14 * rng.UniformFloat(), -2 + 14 * rng.UniformFloat(),
+                  -2 + 14 * rng.UniformFloat());
+        Normal3f n(0, 0, 0);
+        if (i & 1)
+            n = Normal3f(UniformSampleSphere(
+                {rng.UniformFloat(), rng.UniformFloat()}));
+
+        // The probabilities of choosing each light sum to at most one;
+        // the rest is the probability of descending into a subtree none of
+        // whose lights can reach _p_
+        std::vector<Float> pmf(lights.size());
+        Float sum = 0;
+        for (size_t j = 0; j < lights.size(); ++j)
+            sum += pmf[j] = distrib.PMF(p, n, int(j));
+        EXPECT_LE(sum, 1 + 1e-4) << p << " " << n;
+        EXPECT_GT(sum, .5);
+        EXPECT_GT(pmf.back(), 0);
+
+        // Sampled lights are chosen with the probability PMF() returns,
+        // and about as often as it says
+        const int nSamples = 10000;
+        std::vector<int> counts(lights.size());
+        int nNone = 0;
+        for (int j = 0; j < nSamples; ++j) {
+            Float samplePMF;
+            int light = distrib.Sample(p, n, (j + .5f) / nSamples, &samplePMF);
+            if (samplePMF == 0) {
+                ++nNone;
+                continue;
+            }
+            EXPECT_NEAR(pmf[light], samplePMF, 1e-5 * pmf[light]);
+            ++counts[light];
+        }
+        EXPECT_NEAR(1 - sum, Float(nNone) / nSamples, 2e-3);
+        for (size_t j = 0; j < lights.size(); ++j)
+            EXPECT_NEAR(pmf[j], Float(counts[j]) / nSamples, 2e-3)
+                << "light " << j << ", " << p << " " << n;
+    }
+}
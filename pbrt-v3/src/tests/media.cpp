@@ -0,0 +1,132 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "sampling.h"
+#include "memory.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "media/grid.h"
+#include "samplers/random.h"
+
+using namespace pbrt;
+
+TEST(GridDensityMedium, MajorantTracking) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // Thin background density with a few dense voxels; the resolution
+    // isn't a multiple of the majorant cell size
+    const int n = 20;
+    RNG rng;
+    std::vector<Float> density(n * n * n);
+    for (Float &d : density) d = .02f * rng.UniformFloat();
+    Point3i dense[] = {Point3i(13, 6, 10), Point3i(0, 19, 4), Point3i(7, 7, 7)};
+    for (Point3i p : dense) density[(p.z * n + p.y) * n + p.x] = 8;
+    GridDensityMedium medium(Spectrum(1.f), Spectrum(1.f), 0.f, n, n, n,
+                             Transform(), &density[0]);
+    PbrtOptions.nThreads = nThreads;
+    ParallelCleanup();
+
+    RandomSampler sampler(1);
+    sampler.StartPixel(Point2i(0, 0));
+    MemoryArena arena;
+    for (int i = 0; i < 12; ++i) {
+        // Aim a ray near one of the dense voxels
+        Point3i pd = dense[i % 3];
+        Point3f target((pd.x + .5f) / n, (pd.y + .5f) / n, (pd.z + .5f) / n);
+        target += Vector3f(rng.UniformFloat() - .5f, rng.UniformFloat() - .5f,
+                           rng.UniformFloat() - .5f) / Float(n);
+        Vector3f w = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        // Some rays start inside the medium and some end inside it
+        Point3f o = target + (i & 1 ? .2f : 2.f) * w;
+        Float tMax = i & 2 ? 4.f : (target - o).Length() + .1f;
+        Ray ray(o, -w, tMax);
+
+        // Integrate the density along the ray for the expected transmittance
+        const int nSteps = 100000;
+        Float opticalDepth = 0;
+        for (int j = 0; j < nSteps; ++j) {
+            Point3f p = ray((j + .5f) / nSteps * tMax);
+            if (Inside(p, Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1))))
+                opticalDepth += 2 * medium.Density(p) * tMax / nSteps;
+        }
+        Float expected = std::exp(-opticalDepth);
+
+        // Compare ratio tracking and delta tracking estimates
+        const int nTrials = 20000;
+        double trSum = 0;
+        int nEscaped = 0;
+        for (int j = 0; j < nTrials; ++j) {
+            trSum += medium.Tr(ray, sampler)[0];
+            MediumInteraction mi;
+            medium.Sample(ray, sampler, arena, &mi);
+            if (!mi.IsValid()) ++nEscaped;
+            arena.Reset();
+        }
+        EXPECT_NEAR(expected, trSum / nTrials, .02) << "ray " << i;
+        EXPECT_NEAR(expected, Float(nEscaped) / nTrials, .02) << "ray " << i;
+    }
+}
+
+TEST(GridDensityMedium, BrickedStorage) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // Sparse samples in a grid that isn't a whole number of bricks
+    const int nx = 21, ny = 13, nz = 17;
+    RNG rng;
+    std::vector<Float> d(nx * ny * nz, 0.f);
+    for (int z = 0; z < nz; ++z)
+        for (int y = 0; y < ny; ++y)
+            for (int x = 0; x < nx; ++x)
+                if (x >= 16 || (y < 8 && z < 8 && x < 8))
+                    d[(z * ny + y) * nx + x] = 10 * rng.UniformFloat();
+
+    using Encoding = BrickedDensity::Encoding;
+    for (Encoding encoding : {Encoding::Float, Encoding::Fixed16,
+                              Encoding::Fixed8, Encoding::Bfp}) {
+        BrickedDensity density(nx, ny, nz, encoding, 8);
+        density.AddSlabs(&d[0]);
+        // One brick at the origin and the six along +x hold samples
+        EXPECT_EQ(7, density.OccupiedBricks());
+        EXPECT_EQ(18, density.TotalBricks());
+
+        // Samples round to within half a step of their brick's encoding
+        Float tolerance = 0;
+        if (encoding == Encoding::Fixed16) tolerance = 10.f / 65535;
+        if (encoding == Encoding::Fixed8) tolerance = 10.f / 255;
+        if (encoding == Encoding::Bfp) tolerance = 16.f / 256;
+        for (int z = 0; z < nz; ++z)
+            for (int y = 0; y < ny; ++y)
+                for (int x = 0; x < nx; ++x) {
+                    Float expected = d[(z * ny + y) * nx + x];
+                    Float v = density(Point3i(x, y, z));
+                    if (encoding == Encoding::Float || expected == 0)
+                        EXPECT_EQ(expected, v) << x << ' ' << y << ' ' << z;
+                    else
+                        EXPECT_LE(std::abs(expected - v), .5f * tolerance)
+                            << x << ' ' << y << ' ' << z;
+                }
+    }
+
+    // Streaming from a file gives the same samples
+    std::string filename = "density.raw";
+    std::vector<float> raw(d.begin(), d.end());
+    FILE *f = fopen(filename.c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    ASSERT_EQ(raw.size(), fwrite(&raw[0], sizeof(float), raw.size(), f));
+    fclose(f);
+    BrickedDensity density(nx, ny, nz);
+    EXPECT_TRUE(ReadDensityFile(filename, &density));
+    for (int z = 0; z < nz; ++z)
+        for (int y = 0; y < ny; ++y)
+            for (int x = 0; x < nx; ++x)
+                EXPECT_EQ(d[(z * ny + y) * nx + x], density(Point3i(x, y, z)));
+    EXPECT_EQ(0, remove(filename.c_str()));
+
+    PbrtOptions.nThreads = nThreads;
+    ParallelCleanup();
+}
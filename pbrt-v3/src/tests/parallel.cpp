@@ -37,3 +37,43 @@ TEST(Parallel, DoNothing) {
 
     ParallelCleanup();
 }
+
+TEST(Parallel, EachIndexOnce) {
+    // Use several threads even on single-core machines
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+
+    for (int chunkSize : {1, 7, 64, 10000}) {
+        std::vector<std::atomic<int>> visits(10007);
+        for (auto &v : visits) v = 0;
+        ParallelFor([&](int64_t i) { ++visits[i]; }, visits.size(), chunkSize);
+        for (size_t i = 0; i < visits.size(); ++i) EXPECT_EQ(1, visits[i]) << i;
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
+
+TEST(Parallel, Nested) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 8;
+    ParallelInit();
+
+    // Inner loops run while their callers' iterations are suspended; the
+    // per-thread slots must never be used by two iterations at once.
+    std::vector<std::atomic<int>> busy(MaxThreadIndex());
+    for (auto &b : busy) b = 0;
+    std::atomic<int> counter{0}, overlaps{0};
+    ParallelFor([&](int64_t) {
+        if (busy[ThreadIndex]++ != 0) ++overlaps;
+        ParallelFor([&](int64_t) { ++counter; }, 1000, 8);
+        ParallelFor2D([&](Point2i) { ++counter; }, Point2i(5, 6));
+        --busy[ThreadIndex];
+    }, 64);
+    EXPECT_EQ(64 * (1000 + 30), counter);
+    EXPECT_EQ(0, overlaps);
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
@@ -2,6 +2,9 @@
 #include "tests/gtest/gtest.h"
 #include "pbrt.h"
 #include "parser.h"
+#include "api.h"
+#include "light.h"
+#include "primitive.h"
 
 #include <fstream>
 #include <initializer_list>
@@ -130,3 +133,114 @@ Integrator "deep" "float density" [ 2 2.66612 -5e-51]
     EXPECT_EQ(0, remove(filename.c_str()));
 }
 
+
+TEST(Parser, LexAll) {
+    auto err = [](const char *err) {
+        EXPECT_TRUE(false) << "Unexpected error: " << err;
+    };
+    const char *scene = R"(Include "a.pbrt" # "b.pbrt"
+Shape "sphere" "string name" "esc\"aped" "float radius" [1]
+Include "geometry/c.pbrt" Include "d e.pbrt"
+)";
+    auto lazy = Tokenizer::CreateFromString(scene, err);
+    auto lexed = Tokenizer::CreateFromString(scene, err);
+    lexed->LexAll();
+    EXPECT_EQ(lexed->IncludedFiles(),
+              std::vector<std::string>({"a.pbrt", "geometry/c.pbrt",
+                                        "d e.pbrt"}));
+
+    // The stored tokens, including ones with escaped characters, and
+    // their locations match the ones from lexing as they are parsed
+    while (true) {
+        string_view a = lazy->Next(), b = lexed->Next();
+        ASSERT_EQ(std::string(a.data(), a.size()),
+                  std::string(b.data(), b.size()));
+        EXPECT_EQ(lazy->loc.line, lexed->loc.line);
+        EXPECT_EQ(lazy->loc.column, lexed->loc.column);
+        if (a.empty()) break;
+    }
+}
+
+// What pbrtWorldEnd() receives for _scene_: each primitive's bounds and the
+// index of its area light, if any, followed by each light's power
+static std::vector<Float> ParseSceneSummary(const std::string &scene,
+                                            bool parallelParse) {
+    // pbrtInit() replaces the options, which other tests rely on
+    Options savedOptions = PbrtOptions;
+    Options opt;
+    opt.nThreads = 4;
+    opt.quiet = true;
+    opt.parallelParse = parallelParse;
+    pbrtInit(opt);
+    std::vector<Float> summary;
+    pbrtSetWorldEndCallback(
+        [&](const std::vector<std::shared_ptr<Primitive>> &prims,
+            const std::vector<std::shared_ptr<Light>> &lights) {
+            for (const auto &prim : prims) {
+                Bounds3f b = prim->WorldBound();
+                for (int c = 0; c < 3; ++c) {
+                    summary.push_back(b.pMin[c]);
+                    summary.push_back(b.pMax[c]);
+                }
+                int lightIndex = -1;
+                for (size_t i = 0; i < lights.size(); ++i)
+                    if (lights[i].get() == prim->GetAreaLight())
+                        lightIndex = int(i);
+                summary.push_back(lightIndex);
+            }
+            for (const auto &light : lights)
+                summary.push_back(light->Power().y());
+        });
+    pbrtParseString(scene);
+    pbrtSetWorldEndCallback(nullptr);
+    pbrtCleanup();
+    PbrtOptions = savedOptions;
+    return summary;
+}
+
+TEST(Parser, ParallelParseOrder) {
+    // Deferred shapes, some with area lights, interleaved with lights and
+    // animated shapes that are queued behind them, and an object instance
+    // whose shapes must be created when it is used
+    const char *scene = R"(WorldBegin
+LightSource "point" "rgb I" [1 1 1]
+Shape "sphere" "float radius" [1]
+AttributeBegin
+  AreaLightSource "diffuse" "rgb L" [2 2 2]
+  Translate 3 0 0
+  Shape "sphere" "float radius" [.5]
+  Shape "trianglemesh" "integer indices" [0 1 2 0 2 3]
+      "point P" [0 0 0 1 0 0 1 1 0 0 1 0]
+AttributeEnd
+LightSource "point" "rgb I" [3 3 3]
+ObjectBegin "pair"
+  Shape "sphere" "float radius" [.25]
+  Translate 0 2 0
+  Shape "sphere" "float radius" [.75]
+ObjectEnd
+AttributeBegin
+  Translate 0 0 5
+  ObjectInstance "pair"
+AttributeEnd
+AttributeBegin
+  ActiveTransform EndTime
+  Translate 0 0 1
+  ActiveTransform All
+  Shape "sphere" "float radius" [2]
+AttributeEnd
+AttributeBegin
+  AreaLightSource "diffuse" "rgb L" [4 4 4]
+  Translate -3 0 0
+  Shape "trianglemesh" "integer indices" [0 1 2 0 2 3]
+      "point P" [0 0 0 2 0 0 2 2 0 0 2 0]
+AttributeEnd
+LightSource "point" "rgb I" [5 5 5]
+Shape "disk" "float radius" [3]
+WorldEnd
+)";
+    std::vector<Float> serial = ParseSceneSummary(scene, false);
+    std::vector<Float> parallel = ParseSceneSummary(scene, true);
+    // 9 primitives and 8 lights
+    EXPECT_EQ(9 * 7 + 8, serial.size());
+    EXPECT_EQ(serial, parallel);
+}
@@ -6,8 +6,11 @@
 #include "rng.h"
 #include "sampling.h"
 #include "lowdiscrepancy.h"
+#include "parallel.h"
 #include "samplers/maxmin.h"
+#include "samplers/random.h"
 #include "samplers/sobol.h"
+#include "samplers/stratified.h"
 #include "samplers/zerotwosequence.h"
 
 using namespace pbrt;
@@ -133,6 +136,59 @@ TEST(LowDiscrepancy, Sobol) {
     }
 }
 
+// Resuming a pixel with SetSampleNumber(), as adaptive sampling passes do,
+// must continue its sample sequence: the sampled dimensions match those of a
+// single pass and the RNG dimensions do not repeat earlier samples' values.
+TEST(Sampler, ResumePixel) {
+    auto checkSampler = [](const char *name, Sampler &prototype,
+                           bool sampledDimensions) {
+        const int64_t spp = prototype.samplesPerPixel, split = spp / 2;
+        const Point2i pixel(5, 7);
+        // Returns a sampled dimension and an RNG dimension of each sample
+        auto getSamples = [&](Sampler &sampler, int64_t first, int64_t end) {
+            std::vector<std::pair<Point2f, Float>> samples;
+            sampler.StartPixel(pixel);
+            if (first > 0) EXPECT_TRUE(sampler.SetSampleNumber(first));
+            do {
+                Point2f u = sampler.Get2D();
+                for (int i = 0; i < 4; ++i) sampler.Get1D();
+                samples.push_back({u, sampler.Get1D()});
+            } while (sampler.CurrentSampleNumber() + 1 < end &&
+                     sampler.StartNextSample());
+            return samples;
+        };
+
+        auto all = getSamples(*prototype.Clone(3), 0, spp);
+        std::unique_ptr<Sampler> sampler = prototype.Clone(3);
+        auto first = getSamples(*sampler, 0, split);
+        // Sample another pixel in between so the RNG state has moved on
+        sampler->StartPixel(Point2i(6, 7));
+        sampler->Get1D();
+        auto second = getSamples(*sampler, split, spp);
+        ASSERT_EQ(split, first.size()) << name;
+        ASSERT_EQ(spp - split, second.size()) << name;
+        for (int64_t i = 0; i < spp; ++i) {
+            const auto &s = i < split ? first[i] : second[i - split];
+            if (sampledDimensions)
+                EXPECT_EQ(all[i].first, s.first) << name << " sample " << i;
+            for (int64_t j = 0; j < split; ++j)
+                if (i >= split)
+                    EXPECT_NE(first[j].second, s.second)
+                        << name << " sample " << i;
+        }
+    };
+
+    StratifiedSampler stratified(4, 4, true, 2);
+    checkSampler("StratifiedSampler", stratified, true);
+    ZeroTwoSequenceSampler zeroTwo(16, 2);
+    checkSampler("ZeroTwoSequenceSampler", zeroTwo, true);
+    MaxMinDistSampler maxMin(16, 2);
+    checkSampler("MaxMinDistSampler", maxMin, true);
+    // All of the random sampler's dimensions come from its RNG
+    RandomSampler random(16);
+    checkSampler("RandomSampler", random, false);
+}
+
 // Make sure samplers that are supposed to generate a single sample in
 // each of the elementary intervals actually do so.
 // TODO: check Halton (where the elementary intervals are (2^i, 3^j)).
@@ -301,3 +357,40 @@ TEST(Distribution1D, Continuous) {
     EXPECT_FLOAT_EQ(0., dist.SampleContinuous(0., &pdf));
     EXPECT_FLOAT_EQ(1., dist.SampleContinuous(1., &pdf));
 }
+
+TEST(HierarchicalDistribution2D, MatchesFunction) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // A non-square function with zero-valued regions
+    const int nu = 16, nv = 4;
+    RNG rng;
+    Float func[nu * nv], sum = 0;
+    for (int i = 0; i < nu * nv; ++i) {
+        func[i] = (i % 5 == 0 || i / nu == 2) ? 0 : rng.UniformFloat();
+        sum += func[i];
+    }
+    HierarchicalDistribution2D distrib(func, nu, nv);
+    PbrtOptions.nThreads = nThreads;
+    ParallelCleanup();
+
+    // Samples land in texels as often as their share of the function,
+    // with pdfs that match Pdf()
+    const int n = 256;
+    std::vector<int> counts(nu * nv);
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            Float pdf;
+            Point2f u((x + rng.UniformFloat()) / n, (y + rng.UniformFloat()) / n);
+            Point2f p = distrib.SampleContinuous(u, &pdf);
+            ASSERT_TRUE(p.x >= 0 && p.x < 1 && p.y >= 0 && p.y < 1) << p;
+            int i = int(p.y * nv) * nu + int(p.x * nu);
+            EXPECT_GT(func[i], 0);
+            EXPECT_FLOAT_EQ(func[i] * nu * nv / sum, pdf);
+            EXPECT_EQ(pdf, distrib.Pdf(p));
+            ++counts[i];
+        }
+    for (int i = 0; i < nu * nv; ++i)
+        EXPECT_NEAR(func[i] / sum, Float(counts[i]) / (n * n), 2e-3) << i;
+}
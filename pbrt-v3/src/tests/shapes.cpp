@@ -1,16 +1,20 @@
 
 #include "tests/gtest/gtest.h"
 #include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <functional>
 #include "pbrt.h"
 #include "rng.h"
 #include "shape.h"
 #include "lowdiscrepancy.h"
 #include "sampling.h"
+#include "paramset.h"
 #include "shapes/cone.h"
 #include "shapes/cylinder.h"
 #include "shapes/disk.h"
 #include "shapes/paraboloid.h"
+#include "shapes/plymesh.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
 
@@ -557,3 +561,75 @@ TEST(Triangle, BadCases) {
     SurfaceInteraction isect;
     EXPECT_FALSE(mesh[0]->Intersect(ray, &thit, &isect));
 }
+
+TEST(PLYMesh, BinaryAndAscii) {
+    // Write a random mesh as a binary PLY file, which is read from a
+    // memory mapping, and as an ASCII one, which goes through rply.
+    RNG rng(7);
+    const int nVertices = 50, nTriangles = 80;
+    std::vector<Point3f> p;
+    std::vector<Normal3f> n;
+    std::vector<Point2f> uv;
+    std::vector<int> indices, faceIndices;
+    for (int i = 0; i < nVertices; ++i) {
+        p.push_back(Point3f(pUnif(rng), pUnif(rng), pUnif(rng)));
+        n.push_back(Normal3f(pUnif(rng), pUnif(rng), pUnif(rng)));
+        uv.push_back(Point2f(rng.UniformFloat(), rng.UniformFloat()));
+    }
+    for (int i = 0; i < nTriangles; ++i) {
+        int v0 = rng.UniformUInt32(nVertices);
+        int v1 = (v0 + 1 + rng.UniformUInt32(nVertices - 2)) % nVertices;
+        int v2 = (v1 + 1 + rng.UniformUInt32(nVertices - 2)) % nVertices;
+        if (v2 == v0) v2 = (v2 + 1) % nVertices;
+        indices.insert(indices.end(), {v0, v1, v2});
+        faceIndices.push_back(i);
+    }
+    const std::string binaryName = "test_binary.ply";
+    const std::string asciiName = "test_ascii.ply";
+    ASSERT_TRUE(WritePlyFile(binaryName, nTriangles, indices.data(), nVertices,
+                             p.data(), nullptr, n.data(), uv.data(),
+                             faceIndices.data()));
+    {
+        std::ofstream out(asciiName);
+        out.precision(9);
+        out << "ply\nformat ascii 1.0\nelement vertex " << nVertices
+            << "\nproperty float x\nproperty float y\nproperty float z\n"
+            << "property float nx\nproperty float ny\nproperty float nz\n"
+            << "property float u\nproperty float v\nelement face "
+            << nTriangles << "\nproperty list uint8 int vertex_indices\n"
+            << "property int face_indices\nend_header\n";
+        for (int i = 0; i < nVertices; ++i)
+            out << p[i].x << " " << p[i].y << " " << p[i].z << " " << n[i].x
+                << " " << n[i].y << " " << n[i].z << " " << uv[i].x << " "
+                << uv[i].y << "\n";
+        for (int i = 0; i < nTriangles; ++i)
+            out << "3 " << indices[3 * i] << " " << indices[3 * i + 1] << " "
+                << indices[3 * i + 2] << " " << faceIndices[i] << "\n";
+    }
+
+    Transform identity;
+    std::map<std::string, std::shared_ptr<Texture<Float>>> floatTextures;
+    auto load = [&](const std::string &filename) {
+        ParamSet params;
+        std::unique_ptr<std::string[]> name(new std::string[1]);
+        name[0] = filename;
+        params.AddString("filename", std::move(name), 1);
+        return CreatePLYMesh(&identity, &identity, false, params,
+                             &floatTextures);
+    };
+    std::vector<std::shared_ptr<Shape>> binary = load(binaryName);
+    std::vector<std::shared_ptr<Shape>> ascii = load(asciiName);
+    ASSERT_EQ(nTriangles, binary.size());
+    ASSERT_EQ(nTriangles, ascii.size());
+    for (int i = 0; i < nTriangles; ++i) {
+        EXPECT_EQ(binary[i]->WorldBound(), ascii[i]->WorldBound());
+        EXPECT_EQ(binary[i]->Area(), ascii[i]->Area());
+        Float pdf;
+        Interaction ib = binary[i]->Sample(Point2f(.3, .6), &pdf);
+        Interaction ia = ascii[i]->Sample(Point2f(.3, .6), &pdf);
+        EXPECT_EQ(ib.p, ia.p);
+        EXPECT_EQ(ib.n, ia.n);
+    }
+    EXPECT_EQ(0, remove(binaryName.c_str()));
+    EXPECT_EQ(0, remove(asciiName.c_str()));
+}
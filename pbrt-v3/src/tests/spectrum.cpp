@@ -230,3 +230,45 @@ TEST(Spectrum, LinearDownsampleIrreg) {
         EXPECT_LT(std::abs(lambda * lambda - newVal[i]), .8);
     }
 }
+
+TEST(Spectrum, SampledArithmetic) {
+    // The vectorized operators match per-sample scalar arithmetic exactly
+    RNG rng;
+    for (int trial = 0; trial < 100; ++trial) {
+        SampledSpectrum a, b;
+        for (int i = 0; i < nSpectralSamples; ++i) {
+            a[i] = 4 * rng.UniformFloat() - 2;
+            b[i] = trial & 1 ? 1 + rng.UniformFloat() : -1 - rng.UniformFloat();
+        }
+        Float f = 1 + rng.UniformFloat();
+        SampledSpectrum sum = a + b, diff = a - b, prod = a * b, quot = a / b;
+        SampledSpectrum scaled = a * f, divided = a / f, neg = -a;
+        SampledSpectrum clamped = a.Clamp(-.5f, 1.f);
+        Float maxValue = a[0];
+        for (int i = 0; i < nSpectralSamples; ++i) {
+            EXPECT_EQ(a[i] + b[i], sum[i]);
+            EXPECT_EQ(a[i] - b[i], diff[i]);
+            EXPECT_EQ(a[i] * b[i], prod[i]);
+            EXPECT_EQ(a[i] / b[i], quot[i]);
+            EXPECT_EQ(a[i] * f, scaled[i]);
+            EXPECT_EQ(a[i] / f, divided[i]);
+            EXPECT_EQ(-a[i], neg[i]);
+            EXPECT_EQ(Clamp(a[i], -.5f, 1.f), clamped[i]);
+            maxValue = std::max(maxValue, a[i]);
+        }
+        EXPECT_EQ(maxValue, a.MaxComponentValue());
+        EXPECT_TRUE(a == a);
+        EXPECT_FALSE(a == b);
+        EXPECT_FALSE(a.HasNaNs());
+
+        // A single differing sample is noticed anywhere in the spectrum
+        int i = rng.UniformUInt32(nSpectralSamples);
+        SampledSpectrum black(0.f), one(0.f);
+        EXPECT_TRUE(black.IsBlack());
+        one[i] = 1;
+        EXPECT_FALSE(one.IsBlack());
+        EXPECT_TRUE(black != one);
+        one[i] = std::numeric_limits<Float>::quiet_NaN();
+        EXPECT_TRUE(one.HasNaNs());
+    }
+}
@@ -0,0 +1,80 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "rng.h"
+#include "texcache.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace pbrt;
+
+TEST(TextureCache, MIPMapLookups) {
+    // A MIP map read tile by tile into the cache returns the same values
+    // as one built up front, even when its tiles are evicted all the time
+    Point2i res(256, 128);
+    std::vector<Float> texels(res.x * res.y);
+    RNG rng;
+    for (Float &t : texels) t = rng.UniformFloat();
+    size_t budget = textureCache.Budget();
+    textureCache.SetBudget(64 * 1024);
+
+    for (ImageWrap wrap : {ImageWrap::Repeat, ImageWrap::Black,
+                           ImageWrap::Clamp}) {
+        MIPMap<Float> eager(res, &texels[0], false, 8.f, wrap);
+        MIPMap<Float> cached(res, [&](int level, const Bounds2i &b,
+                                      Float *out) {
+            for (int y = b.pMin.y; y < b.pMax.y; ++y)
+                for (int x = b.pMin.x; x < b.pMax.x; ++x)
+                    *out++ = eager.Texel(level, x, y);
+        }, false, 8.f, wrap);
+        ASSERT_EQ(eager.Levels(), cached.Levels());
+
+        PbrtOptions.nThreads = 4;
+        ParallelInit();
+        ParallelFor([&](int64_t i) {
+            RNG rng(i);
+            for (int j = 0; j < 100; ++j) {
+                Point2f st(rng.UniformFloat() * 1.2f - .1f,
+                           rng.UniformFloat() * 1.2f - .1f);
+                Float width = std::pow(2.f, -10.f * rng.UniformFloat());
+                Vector2f dst0(width, width * rng.UniformFloat());
+                Vector2f dst1(-width * rng.UniformFloat(), width / 3);
+                EXPECT_EQ(eager.Lookup(st, width), cached.Lookup(st, width));
+                EXPECT_EQ(eager.Lookup(st, dst0, dst1),
+                          cached.Lookup(st, dst0, dst1));
+            }
+        }, 64);
+        ParallelCleanup();
+        PbrtOptions.nThreads = 0;
+    }
+    EXPECT_LE(textureCache.BytesUsed(), 64 * 1024);
+
+    textureCache.Clear();
+    textureCache.SetBudget(budget);
+}
+
+TEST(TextureCache, ConcurrentMisses) {
+    // Threads that miss on a tile while another one is creating it wait
+    // for that one rather than creating it again
+    uint64_t owner = TextureCache::NewOwnerKey();
+    std::atomic<int> nLoads{0};
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+    ParallelFor([&](int64_t i) {
+        uint64_t key = owner | (i % 4);
+        const int *tile = (const int *)textureCache.Lookup(
+            key, [&](size_t *bytes) {
+                ++nLoads;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                *bytes = sizeof(int);
+                return std::make_shared<int>(int(i % 4));
+            });
+        EXPECT_EQ(i % 4, *tile);
+    }, 64);
+    ParallelCleanup();
+    PbrtOptions.nThreads = 0;
+    EXPECT_EQ(4, nLoads);
+    textureCache.Clear();
+}
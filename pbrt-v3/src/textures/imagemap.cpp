@@ -38,28 +38,63 @@
 
 namespace pbrt {
 
+STAT_PERCENT("Texture/Image textures read into the tile cache",
+             nTexturesInCache, nImageTextures);
+
 // ImageTexture Method Definitions
 template <typename Tmemory, typename Treturn>
 ImageTexture<Tmemory, Treturn>::ImageTexture(
     std::unique_ptr<TextureMapping2D> mapping, const std::string &filename,
     bool doTrilinear, Float maxAniso, ImageWrap wrapMode, Float scale,
-    bool gamma)
+    bool gamma, int bfpMantissaBits)
     : mapping(std::move(mapping)) {
-    mipmap =
-        GetTexture(filename, doTrilinear, maxAniso, wrapMode, scale, gamma);
+    mipmap = GetTexture(filename, doTrilinear, maxAniso, wrapMode, scale,
+                        gamma, bfpMantissaBits);
 }
 
 template <typename Tmemory, typename Treturn>
 MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
     const std::string &filename, bool doTrilinear, Float maxAniso,
-    ImageWrap wrap, Float scale, bool gamma) {
+    ImageWrap wrap, Float scale, bool gamma, int bfpMantissaBits) {
     // Return _MIPMap_ from texture cache if present
-    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma);
+    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma,
+                    bfpMantissaBits);
     if (textures.find(texInfo) != textures.end())
         return textures[texInfo].get();
+    ++nImageTextures;
 
     // Create _MIPMap_ for _filename_
     ProfilePhase _(Prof::TextureLoading);
+    std::shared_ptr<TiledImageReader> reader = TiledImageReader::Open(filename);
+    Point2i res = reader ? reader->Resolution() : Point2i();
+    // The file's MIP levels were filtered before gamma correction, so
+    // images that need it are read in full
+    if (reader && bfpMantissaBits == 0 && !gamma && IsPowerOf2(res.x) &&
+        IsPowerOf2(res.y) &&
+        reader->Levels() == 1 + Log2Int(std::max(res.x, res.y))) {
+        // Read texels of tiled images as lookups need them
+        ++nTexturesInCache;
+        auto readTexels = [reader, res, scale](int level, const Bounds2i &b,
+                                               Tmemory *texels) {
+            // Read the rows of _b_ flipped in y, as below
+            int levelHeight = std::max(1, res.y >> level);
+            Bounds2i flipped(Point2i(b.pMin.x, levelHeight - b.pMax.y),
+                             Point2i(b.pMax.x, levelHeight - b.pMin.y));
+            int width = b.pMax.x - b.pMin.x, height = b.pMax.y - b.pMin.y;
+            std::unique_ptr<RGBSpectrum[]> rgb(new RGBSpectrum[width * height]);
+            if (!reader->Read(flipped, rgb.get(), level))
+                for (int i = 0; i < width * height; ++i)
+                    rgb[i] = RGBSpectrum(0.5f);
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < width; ++x)
+                    convertIn(rgb[(height - 1 - y) * width + x],
+                              &texels[y * width + x], scale, false);
+        };
+        MIPMap<Tmemory> *mipmap = new MIPMap<Tmemory>(
+            res, readTexels, doTrilinear, maxAniso, wrap);
+        textures[texInfo].reset(mipmap);
+        return mipmap;
+    }
     Point2i resolution;
     std::unique_ptr<RGBSpectrum[]> texels = ReadImage(filename, &resolution);
     if (!texels) {
@@ -88,7 +123,8 @@ MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
         for (int i = 0; i < resolution.x * resolution.y; ++i)
             convertIn(texels[i], &convertedTexels[i], scale, gamma);
         mipmap = new MIPMap<Tmemory>(resolution, convertedTexels.get(),
-                                     doTrilinear, maxAniso, wrap);
+                                     doTrilinear, maxAniso, wrap,
+                                     bfpMantissaBits);
     } else {
         // Create one-valued _MIPMap_
         Tmemory oneVal = scale;
@@ -101,6 +137,16 @@ MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
 template <typename Tmemory, typename Treturn>
 std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>>
     ImageTexture<Tmemory, Treturn>::textures;
+
+// "bfpmantissa": mantissa bits of the BFP texel storage, 0 keeps floats
+static int BfpMantissaBits(const TextureParams &tp) {
+    int bits = tp.FindInt("bfpmantissa", 0);
+    if (bits < 0 || bits > 15) {
+        Warning("\"bfpmantissa\" %d out of range [0, 15]. Clamping.", bits);
+        bits = Clamp(bits, 0, 15);
+    }
+    return bits;
+}
 ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
                                                     const TextureParams &tp) {
     // Initialize 2D texture mapping _map_ from _tp_
@@ -139,8 +185,10 @@ ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
     std::string filename = tp.FindFilename("filename");
     bool gamma = tp.FindBool("gamma", HasExtension(filename, ".tga") ||
                                           HasExtension(filename, ".png"));
+    int bfpMantissaBits = BfpMantissaBits(tp);
     return new ImageTexture<Float, Float>(std::move(map), filename, trilerp,
-                                          maxAniso, wrapMode, scale, gamma);
+                                          maxAniso, wrapMode, scale, gamma,
+                                          bfpMantissaBits);
 }
 
 ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
@@ -181,8 +229,10 @@ ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
     std::string filename = tp.FindFilename("filename");
     bool gamma = tp.FindBool("gamma", HasExtension(filename, ".tga") ||
                                           HasExtension(filename, ".png"));
+    int bfpMantissaBits = BfpMantissaBits(tp);
     return new ImageTexture<RGBSpectrum, Spectrum>(
-        std::move(map), filename, trilerp, maxAniso, wrapMode, scale, gamma);
+        std::move(map), filename, trilerp, maxAniso, wrapMode, scale, gamma,
+        bfpMantissaBits);
 }
 
 template class ImageTexture<Float, Float>;
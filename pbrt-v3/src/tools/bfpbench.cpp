@@ -0,0 +1,235 @@
+// tools/bfpbench.cpp*
+#include <stdarg.h>
+#include <chrono>
+#include <stdexcept>
+#include "pbrt.h"
+#include "rng.h"
+#include "bfpblock.h"
+#include "bfperror.h"
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "bfpbench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: bfpbench [options]
+
+Measures every BfpBlock operation: error distributions against double
+arithmetic on the same (block-quantized) inputs, and throughput in million
+elements per second against plain float and double loops.
+
+options:
+    --blocks <n>       Number of random input block pairs. Default: 256
+    --decades <list>   Comma-separated dynamic ranges of the inputs, in orders
+                       of magnitude. Default: 0,2,4,8
+    --formats <list>   Comma-separated mantissa lengths out of 8, 12, 16, 23.
+                       Default: 8,12,16,23
+    --ops <list>       Comma-separated operation names (see below).
+                       Default: all
+    --repeat <n>       Passes over the input blocks when timing. Default: 50
+    --sizes <list>     Comma-separated block sizes, at most 64. Default: 4,16,64
+
+operations: convert add sub mult div addscalar subscalar scalarsub
+            multscalar divscalar scalardiv matrixmult max min swap
+
+Errors are reported as mean, median, 99th percentile and maximum, in ulps of
+the result block's shared exponent ("block ulps") and in ulps of a float
+holding the exact result ("float ulps"). Operations that threw (e.g. a
+divisor element flushed to zero by the shared exponent) are counted as
+failures.
+)");
+    exit(1);
+}
+
+struct BenchOptions {
+    int nBlocks = 256, repeat = 50;
+    std::vector<int> decades = {0, 2, 4, 8};
+    std::vector<int> formats = {8, 12, 16, 23};
+    std::vector<int> sizes = {4, 16, 64};
+    std::vector<BfpOp> ops;
+};
+
+static std::vector<int> ParseList(const char *arg) {
+    std::vector<int> r;
+    for (const char *p = arg; *p;) {
+        char *end;
+        r.push_back((int)strtol(p, &end, 10));
+        if (end == p) usage("bad list \"%s\"", arg);
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return r;
+}
+
+static volatile uint64_t sink;
+
+template <typename F>
+static double ElementsPerSecond(F f, int64_t nElements) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return nElements / std::max(d.count(), 1e-9);
+}
+
+template <typename Block>
+static void BenchFormat(const BenchOptions &opt) {
+    printf("\nBfpBlock<%d, %d, %d>\n", Block::MantLength, Block::ExpLength,
+           (int)Block::Capacity);
+    printf("%-10s %4s %3s | %-31s | %-23s | %8s %8s %8s\n", "op", "n", "dec",
+           "block ulps mean/p50/p99/max", "float ulps mean/p99/max",
+           "bfp M/s", "float", "double");
+    for (BfpOp op : opt.ops)
+        for (int n : opt.sizes) {
+            if (n > (int)Block::Capacity) continue;
+            if (op == BfpOp::MatrixMult && !BfpMatrixSide(n)) continue;
+            for (int decades : opt.decades) {
+                RNG rng(n * 131 + decades);
+                // Inputs: blocks and the doubles they hold exactly
+                std::vector<Block> a, b;
+                std::vector<double> xs, ys, ss, xOrig;
+                for (int i = 0; i < opt.nBlocks; ++i) {
+                    std::vector<double> x = BfpRandomValues(rng, n, decades);
+                    std::vector<double> y = BfpRandomValues(rng, n, decades);
+                    a.push_back(Block(x));
+                    b.push_back(Block(y));
+                    xOrig.insert(xOrig.end(), x.begin(), x.end());
+                    x = a.back().ToFloatingPoint();
+                    y = b.back().ToFloatingPoint();
+                    xs.insert(xs.end(), x.begin(), x.end());
+                    ys.insert(ys.end(), y.begin(), y.end());
+                    ss.push_back(BfpRandomValues(rng, 1, decades)[0]);
+                }
+
+                // Errors
+                BfpErrorStats blockUlps, floatUlps;
+                int nFailed = 0;
+                int nOut = BfpResultSize(op, n);
+                std::vector<double> r(nOut), ref(nOut);
+                for (int i = 0; i < opt.nBlocks; ++i) {
+                    try {
+                        double ulp;
+                        BfpApply(op, a[i], b[i], ss[i], r.data(), &ulp);
+                        // conversion is measured against the original
+                        // values, everything else against exact arithmetic
+                        // on the block contents
+                        const double *x = (op == BfpOp::Convert ? &xOrig[0]
+                                                             : &xs[0]) + i * n;
+                        BfpReference(op, x, &ys[i * n], ss[i], n, ref.data());
+                        for (int j = 0; j < nOut; ++j) {
+                            double err = std::abs(r[j] - ref[j]);
+                            blockUlps.Add(err / ulp);
+                            floatUlps.Add(err / FloatUlp(ref[j]));
+                        }
+                    } catch (const std::invalid_argument &) {
+                        ++nFailed;
+                    }
+                }
+
+                // Throughput
+                const int64_t nElements = (int64_t)opt.repeat * opt.nBlocks * n;
+                uint64_t check = 0;
+                double bfpRate = ElementsPerSecond([&]() {
+                    for (int k = 0; k < opt.repeat; ++k)
+                        for (int i = 0; i < opt.nBlocks; ++i) {
+                            try {
+                                check += BfpApply(op, a[i], b[i], ss[i], nullptr,
+                                               nullptr);
+                            } catch (const std::invalid_argument &) {
+                            }
+                        }
+                }, nElements);
+                std::vector<float> xf(xs.begin(), xs.end()),
+                    yf(ys.begin(), ys.end()), outf(nOut);
+                double floatRate = ElementsPerSecond([&]() {
+                    for (int k = 0; k < opt.repeat; ++k)
+                        for (int i = 0; i < opt.nBlocks; ++i) {
+                            BfpReference(op, &xf[i * n], &yf[i * n], (float)ss[i],
+                                      n, outf.data());
+                            check += (uint64_t)FloatToBits(outf[0]);
+                        }
+                }, nElements);
+                std::vector<double> outd(nOut);
+                double doubleRate = ElementsPerSecond([&]() {
+                    for (int k = 0; k < opt.repeat; ++k)
+                        for (int i = 0; i < opt.nBlocks; ++i) {
+                            BfpReference(op, &xs[i * n], &ys[i * n], ss[i], n,
+                                      outd.data());
+                            check += FloatToBits(outd[0]);
+                        }
+                }, nElements);
+
+                printf("%-10s %4d %3d | %7.3f %7.3f %7.3f %7.3f | %7.2g %7.2g "
+                       "%7.2g | %8.1f %8.1f %8.1f",
+                       BfpOpString(op), n, decades, blockUlps.Mean(),
+                       blockUlps.Percentile(.5), blockUlps.Percentile(.99),
+                       blockUlps.Max(), floatUlps.Mean(),
+                       floatUlps.Percentile(.99), floatUlps.Max(),
+                       bfpRate * 1e-6, floatRate * 1e-6, doubleRate * 1e-6);
+                if (nFailed) printf("  (%d/%d failed)", nFailed, opt.nBlocks);
+                printf("\n");
+                sink = check;
+            }
+        }
+}
+
+int main(int argc, char *argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1;  // Warning and above.
+
+    BenchOptions opt;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc) usage("missing value after %s", argv[i]);
+        if (!strcmp(argv[i], "--blocks"))
+            opt.nBlocks = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--decades"))
+            opt.decades = ParseList(argv[++i]);
+        else if (!strcmp(argv[i], "--formats"))
+            opt.formats = ParseList(argv[++i]);
+        else if (!strcmp(argv[i], "--repeat"))
+            opt.repeat = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--sizes"))
+            opt.sizes = ParseList(argv[++i]);
+        else if (!strcmp(argv[i], "--ops")) {
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                std::string name = list.substr(start, end - start);
+                bool found = false;
+                for (const auto &o : bfpOpNames)
+                    if (name == o.name) {
+                        opt.ops.push_back(o.op);
+                        found = true;
+                    }
+                if (!found) usage("unknown operation \"%s\"", name.c_str());
+                start = end + 1;
+            }
+        } else
+            usage("unknown option \"%s\"", argv[i]);
+    }
+    if (opt.ops.empty())
+        for (const auto &o : bfpOpNames) opt.ops.push_back(o.op);
+    for (int n : opt.sizes)
+        if (n < 1 || n > 64) usage("block size %d out of range [1, 64]", n);
+    if (opt.nBlocks < 1 || opt.repeat < 1)
+        usage("--blocks and --repeat must be positive");
+
+    for (int f : opt.formats) {
+        if (f == 8)
+            BenchFormat<BfpBlock8>(opt);
+        else if (f == 12)
+            BenchFormat<BfpBlock12>(opt);
+        else if (f == 16)
+            BenchFormat<BfpBlock16>(opt);
+        else if (f == 23)
+            BenchFormat<BfpBlock23>(opt);
+        else
+            usage("unsupported format %d (8, 12, 16 or 23)", f);
+    }
+    return 0;
+}
@@ -61,6 +61,9 @@ convert options:
                        between RGB components.
     --repeatpix <n>    Repeat each pixel value n times in both directions
     --scale <scale>    Scale pixel values by given amount
+    --tiled            Write an EXR image and its MIP levels in 64x64 tiles,
+                       which pbrt reads into its texture cache as they are
+                       needed.
     --tonemap          Apply tonemapping to the image (Reinhard et al.'s
                        photographic tone mapping operator)
 
@@ -594,6 +597,7 @@ int convert(int argc, char *argv[]) {
     Float maxY = 1.;
     Float despikeLimit = Infinity;
     bool preserveColors = false;
+    bool tiled = false;
 
     int i;
     auto parseArg = [&]() -> std::pair<std::string, double> {
@@ -622,6 +626,8 @@ int convert(int argc, char *argv[]) {
             tonemap = !tonemap;
         else if (!strcmp(argv[i], "--preservecolors") || !strcmp(argv[i], "-preservecolors"))
             preserveColors = !preserveColors;
+        else if (!strcmp(argv[i], "--tiled") || !strcmp(argv[i], "-tiled"))
+            tiled = !tiled;
         else {
             std::pair<std::string, double> arg = parseArg();
             if (std::get<0>(arg) == "maxluminance") {
@@ -755,8 +761,14 @@ int convert(int argc, char *argv[]) {
     }
 
     // FIXME: another bad RGBSpectrum -> Float cast.
-    WriteImage(outFilename, (Float *)image.get(), Bounds2i(Point2i(0, 0), res),
-               res);
+    if (tiled) {
+        if (!HasExtension(outFilename, ".exr"))
+            usage("--tiled is only supported for EXR images");
+        if (!WriteTiledImageEXR(outFilename, (Float *)image.get(), res))
+            return 1;
+    } else
+        WriteImage(outFilename, (Float *)image.get(),
+                   Bounds2i(Point2i(0, 0), res), res);
 
     return 0;
 }